@@ -0,0 +1,51 @@
+#ifndef _MI_ADV_H_
+#define _MI_ADV_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_bt_defs.h"
+
+#define MI_ADV_UUID_ENV_SENSING     0x181A      /*!< ATC1441 and pvvx custom firmware */
+#define MI_ADV_UUID_MIBEACON        0xFE95      /*!< Xiaomi MiBeacon */
+
+#define MI_ADV_PRODUCT_LYWSD03MMC   0x055B      /*!< MiBeacon product id, sent by the stock firmware without a scan request */
+
+// Fields present in mi_adv_data_t.flags
+#define MI_ADV_HAS_TEMP             0x01
+#define MI_ADV_HAS_HUM              0x02
+#define MI_ADV_HAS_BATTERY          0x04
+#define MI_ADV_HAS_BATTERY_MV       0x08
+#define MI_ADV_HAS_COUNTER          0x10
+
+typedef enum {
+    MI_ADV_FORMAT_NONE,
+    MI_ADV_FORMAT_ATC,
+    MI_ADV_FORMAT_PVVX,
+    MI_ADV_FORMAT_MIBEACON,
+} mi_adv_format_t;
+
+typedef struct {
+    mi_adv_format_t     format;
+    uint8_t             flags;
+    int16_t             temp;               /*!< 0.01 degrees Celsius */
+    uint16_t            hum;                /*!< 0.01 % */
+    uint16_t            battery_mv;
+    uint8_t             battery;            /*!< % */
+    uint8_t             counter;            /*!< frame counter of the sender */
+} mi_adv_data_t;
+
+/**
+ * Walk the raw AD structures of an advertising report (adv data followed by
+ * scan response) and decode the first service data block of a known format.
+ * Encrypted MiBeacon frames are decrypted with the bind key of bda, see
+ * mi_beacon_decrypt for the errors. Returns ESP_ERR_NOT_FOUND when the
+ * report carries no sensor data.
+ */
+esp_err_t mi_adv_decode(const esp_bd_addr_t bda, const uint8_t *adv, uint8_t len, mi_adv_data_t *out);
+
+/**
+ * Product id of the first MiBeacon frame in a report, nothing is decrypted.
+ * Returns ESP_ERR_NOT_FOUND when the report carries no MiBeacon frame.
+ */
+esp_err_t mi_adv_product(const uint8_t *adv, uint8_t len, uint16_t *product);
+#endif
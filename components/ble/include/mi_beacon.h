@@ -0,0 +1,46 @@
+#ifndef _MI_BEACON_H_
+#define _MI_BEACON_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_bt_defs.h"
+
+#define MI_BEACON_NAMESPACE         "mi_keys"
+#define MI_BEACON_KEYS_MAX          16          /*!< bind keys kept in RAM, looked up on every encrypted frame */
+#define MI_BEACON_KEY_LEN           16
+#define MI_BEACON_PAYLOAD_MAX       24          /*!< decrypted objects of one frame */
+
+typedef struct {
+    uint32_t            frames;             /*!< encrypted frames seen */
+    uint32_t            decrypted;
+    uint32_t            duplicates;         /*!< repeats of the last frame, dropped before decrypting */
+    uint32_t            no_key;
+    uint32_t            auth_failed;        /*!< wrong bind key, corrupted frame or no memory for the key context */
+} mi_beacon_stats_t;
+
+/**
+ * Read every bind key from NVS into RAM and set up its AES context, called
+ * once by mi_init before scanning. The scan callback never touches NVS, and
+ * allocates only for a key set while scanning, on its first frame.
+ */
+esp_err_t mi_beacon_load_keys(void);
+
+/**
+ * Store the 16 byte bind key of a sensor, in NVS and in RAM.
+ */
+esp_err_t mi_beacon_set_key(const esp_bd_addr_t bda, const uint8_t *key);
+esp_err_t mi_beacon_erase_key(const esp_bd_addr_t bda);
+
+/**
+ * Decrypt the objects of a MiBeacon v4/v5 frame. frame is the service data
+ * after the UUID and pos the offset of the encrypted objects, followed by
+ * the 3 byte extended counter and the 4 byte MIC. out_len holds the size of
+ * out and receives the object bytes. A frame with the same counter as the
+ * last one accepted from bda is ESP_ERR_INVALID_STATE, a sensor without a
+ * key ESP_ERR_NOT_SUPPORTED and a failed MIC ESP_ERR_INVALID_CRC.
+ * Called from the BT task only.
+ */
+esp_err_t mi_beacon_decrypt(const esp_bd_addr_t bda, const uint8_t *frame, uint8_t len, uint8_t pos, uint8_t *out, uint8_t *out_len);
+
+void mi_beacon_get_stats(mi_beacon_stats_t *stats);
+#endif
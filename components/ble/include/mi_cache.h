@@ -0,0 +1,53 @@
+#ifndef _MI_CACHE_H_
+#define _MI_CACHE_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_bt_defs.h"
+
+#define MI_CACHE_NAMESPACE          "mi_cache"
+#define MI_CACHE_VERSION            3           /*!< bump when mi_cache_t changes */
+#define MI_CACHE_STR_LEN            24
+
+typedef struct {
+    uint16_t            handle;
+    uint8_t             len;
+    char                data[MI_CACHE_STR_LEN];
+} mi_cache_char_t;
+
+/**
+ * Everything a session learns on its first connection to a sensor, so a
+ * reconnect can go straight to enabling notifications.
+ */
+typedef struct {
+    uint8_t             version;
+    mi_cache_char_t     model_char;
+    mi_cache_char_t     serial_char;
+    mi_cache_char_t     fw_char;
+    mi_cache_char_t     hw_char;
+    mi_cache_char_t     sw_char;
+    mi_cache_char_t     battery_char;
+    uint16_t            temp_hum_handle;
+    uint16_t            handle_write;
+    uint16_t            history_handle;     /*!< 0 if the sensor has no history service */
+    uint16_t            history_ccc;
+    uint16_t            history_index_handle;
+    uint16_t            history_clock_handle;
+} mi_cache_t;
+
+esp_err_t mi_cache_load(const esp_bd_addr_t bda, mi_cache_t *cache);
+esp_err_t mi_cache_save(const esp_bd_addr_t bda, mi_cache_t *cache);
+esp_err_t mi_cache_erase(const esp_bd_addr_t bda);
+
+/**
+ * Addresses of every sensor with cached handles, up to *count of them.
+ */
+esp_err_t mi_cache_list(esp_bd_addr_t *bdas, uint8_t *count);
+
+/**
+ * Next history record to download from a sensor, kept apart from the
+ * handles so a rediscovery does not restart the download.
+ */
+esp_err_t mi_cache_load_index(const esp_bd_addr_t bda, uint32_t *index);
+esp_err_t mi_cache_save_index(const esp_bd_addr_t bda, uint32_t index);
+#endif
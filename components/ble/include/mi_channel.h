@@ -0,0 +1,52 @@
+#ifndef _MI_CHANNEL_H_
+#define _MI_CHANNEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_bt_defs.h"
+
+#define MI_CHANNELS_MAX             4
+#define MI_CHANNEL_LEN              32          /*!< samples buffered per channel, power of two */
+#define MI_CHANNEL_WAKE             (MI_CHANNEL_LEN / 2)    /*!< fill that notifies the reader */
+
+/**
+ * One reading as published by the BLE callbacks.
+ */
+typedef struct __attribute__((packed)) {
+    esp_bd_addr_t       bda;
+    int16_t             temp;               /*!< 0.01 degrees Celsius */
+    uint8_t             hum;                /*!< relative humidity in % */
+    uint16_t            battery_mv;
+    uint32_t            time;               /*!< seconds since boot */
+} mi_sample_t;
+
+typedef uint8_t mi_channel_t;
+
+typedef struct {
+    uint32_t            published;
+    uint32_t            overflows;          /*!< samples dropped because the consumer fell behind */
+} mi_channel_stats_t;
+
+/**
+ * Open a channel that receives every sample published from now on. Each
+ * channel is a single producer, single consumer ring: the BLE callbacks
+ * write, only the calling task may read. Readers never block the BT task,
+ * a full ring drops the new sample and counts an overflow. The calling
+ * task gets a notification (xTaskNotifyGive) each time the ring fills to
+ * MI_CHANNEL_WAKE, a reader waiting in ulTaskNotifyTake drains it however
+ * fast sensors advertise.
+ */
+esp_err_t mi_subscribe(mi_channel_t *channel);
+
+/**
+ * Take the oldest sample, ESP_ERR_NOT_FOUND if the channel is empty.
+ */
+esp_err_t mi_channel_read(mi_channel_t channel, mi_sample_t *sample);
+esp_err_t mi_channel_get_stats(mi_channel_t channel, mi_channel_stats_t *stats);
+
+/**
+ * Hand a sample to every open channel, called from the BT task only.
+ */
+void mi_channel_publish(const mi_sample_t *sample);
+#endif
@@ -0,0 +1,45 @@
+#ifndef _MI_DECODER_H_
+#define _MI_DECODER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define MI_DATA_LEN                 5           /*!< temp int16 LE, hum u8, battery mV u16 LE */
+#define MI_HISTORY_RECORD_LEN       14          /*!< index u32, time u32, max temp int16 0.1 C, max hum, min temp, min hum */
+
+/**
+ * One reading of the LYWSD03MMC data characteristic in fixed point.
+ */
+typedef struct __attribute__((packed)) {
+    int16_t             temp;               /*!< 0.01 degrees Celsius */
+    uint8_t             hum;                /*!< relative humidity in % */
+    uint16_t            battery_mv;
+} mi_reading_t;
+
+/**
+ * Decode a notification or read of the data characteristic. No heap is
+ * used, out is only written when ESP_OK is returned. Short payloads give
+ * ESP_ERR_INVALID_SIZE, out of range values ESP_ERR_INVALID_RESPONSE.
+ */
+esp_err_t mi_decode_data(const uint8_t *data, uint16_t len, mi_reading_t *out);
+
+/**
+ * One hour of the sensor's own log, temperatures scaled to 0.01 C like
+ * the live readings.
+ */
+typedef struct {
+    uint32_t            index;              /*!< record number on the sensor */
+    uint32_t            time;               /*!< sensor clock in seconds */
+    int16_t             temp_max;
+    int16_t             temp_min;
+    uint8_t             hum_max;
+    uint8_t             hum_min;
+} mi_history_record_t;
+
+/**
+ * Decode count back to back MI_HISTORY_RECORD_LEN byte records. Records
+ * out of range are skipped, returns how many were written to out.
+ */
+size_t mi_decode_history(const uint8_t *data, size_t count, mi_history_record_t *out);
+#endif
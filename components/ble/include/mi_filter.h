@@ -0,0 +1,41 @@
+#ifndef _MI_FILTER_H_
+#define _MI_FILTER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_bt_defs.h"
+
+#define MI_FILTER_BDA_MAX           16          /*!< allowlisted addresses, the hash table has twice the slots */
+#define MI_FILTER_OUI_MAX           4
+#define MI_FILTER_UUID_MAX          4
+
+#define MI_FILTER_OUI_LYWSD03MMC    0xA4C138    /*!< vendor prefix of the stock sensors */
+
+// Rules, a report passes when it matches any enabled rule
+#define MI_FILTER_BDA               0x01        /*!< address is in the allowlist */
+#define MI_FILTER_OUI               0x02        /*!< address starts with an allowed vendor prefix */
+#define MI_FILTER_UUID              0x04        /*!< adv data lists or carries data for an allowed 16-bit service */
+#define MI_FILTER_DEFAULT           (MI_FILTER_OUI | MI_FILTER_UUID)
+
+typedef struct {
+    uint32_t            seen;
+    uint32_t            rejected;
+} mi_filter_stats_t;
+
+/**
+ * Cheap check run on every advertising report before any name resolution.
+ * adv is the raw adv data followed by the scan response. Only fixed tables
+ * are touched, nothing is allocated and no lock is taken. With no rule
+ * enabled everything passes.
+ */
+bool mi_filter_match(const esp_bd_addr_t bda, const uint8_t *adv, uint8_t len);
+
+void mi_filter_set_rules(uint8_t rules);
+uint8_t mi_filter_get_rules(void);
+esp_err_t mi_filter_add_bda(const esp_bd_addr_t bda);
+esp_err_t mi_filter_remove_bda(const esp_bd_addr_t bda);
+esp_err_t mi_filter_add_oui(uint32_t oui);
+esp_err_t mi_filter_add_uuid(uint16_t uuid);
+void mi_filter_get_stats(mi_filter_stats_t *stats);
+#endif
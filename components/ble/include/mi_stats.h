@@ -0,0 +1,54 @@
+#ifndef _MI_STATS_H_
+#define _MI_STATS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "mithermometer.h"
+
+#define MI_STATS_BUCKETS            16          /*!< bucket n counts latencies below 2^n ms, the last one the rest */
+
+/**
+ * Counters of one state. The latency runs from entering the state to the
+ * event that completes it, so for the reads it is the GATT round-trip and
+ * for MI_IDLE the time between two notifications.
+ */
+typedef struct {
+    uint32_t            entered;
+    uint32_t            completed;
+    uint32_t            timeouts;
+    uint32_t            retries;            /*!< re-entered after a timeout or failure */
+    uint32_t            max_ms;
+    uint32_t            hist[MI_STATS_BUCKETS];
+} mi_stats_state_t;
+
+typedef struct {
+    mi_stats_state_t    state[MI_IDLE + 1];
+    uint32_t            reconnects;         /*!< links opened again to a sensor that was connected before */
+    uint32_t            disconnects;
+    uint32_t            scan_fallbacks;     /*!< reconnects given up, sensor searched for again */
+    uint32_t            recovered;
+    uint32_t            recover_max_ms;
+    uint32_t            recover_hist[MI_STATS_BUCKETS];     /*!< link lost until notifications flow again */
+} mi_stats_t;
+
+// Called by mi_task only
+void mi_stats_enter(mi_state_t state, bool retry);
+void mi_stats_done(mi_state_t state, int64_t elapsed_us);
+void mi_stats_timeout(mi_state_t state);
+void mi_stats_reconnect(void);
+void mi_stats_disconnect(void);
+void mi_stats_scan_fallback(void);
+void mi_stats_recovered(int64_t elapsed_us);
+
+/**
+ * Snapshot of every counter, this is also the binary dump format.
+ */
+void mi_stats_get(mi_stats_t *stats);
+void mi_stats_reset(void);
+
+/**
+ * Print one line per state that was ever entered.
+ */
+void mi_stats_dump(void);
+#endif
@@ -0,0 +1,63 @@
+#ifndef _MI_TRACE_H_
+#define _MI_TRACE_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gattc_api.h"
+
+// SELECT TRACE
+// #define MI_TRACE                 /*!< record every GAP/GATTC callback into a RAM ring */
+
+#define MI_TRACE_BUF_SIZE           8192        /*!< oldest records are overwritten when full */
+#define MI_TRACE_VALUE_MAX          64          /*!< GATT values are cut to this length */
+
+#define MI_TRACE_GAP                0
+#define MI_TRACE_GATTC              1
+
+/**
+ * Records are stored back to back as a header followed by `len` payload
+ * bytes, all little endian. mi_trace_dump() prints one record per line as
+ * "MI_TRACE <hex>" so a host tool can pick them out of the console log and
+ * feed them back into the callbacks.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t            time;               /*!< esp_timer_get_time() in us, wraps after 71 min */
+    uint8_t             source;             /*!< MI_TRACE_GAP or MI_TRACE_GATTC */
+    uint8_t             event;              /*!< esp_gap_ble_cb_event_t or esp_gattc_cb_event_t */
+    uint8_t             len;
+} mi_trace_hdr_t;
+
+// Payload of ESP_GAP_BLE_SCAN_RESULT_EVT, followed by adv_len + rsp_len raw AD bytes
+typedef struct __attribute__((packed)) {
+    uint8_t             search_evt;
+    uint8_t             bda[6];
+    uint8_t             addr_type;
+    int8_t              rssi;
+    uint8_t             adv_len;
+    uint8_t             rsp_len;
+} mi_trace_scan_t;
+
+// Payload of every GATTC event, followed by the read or notified value if any
+typedef struct __attribute__((packed)) {
+    uint8_t             gattc_if;
+    uint8_t             status;
+    uint16_t            conn_id;
+    uint16_t            handle;
+    uint8_t             bda[6];
+} mi_trace_gattc_t;
+
+typedef struct {
+    uint32_t            recorded;
+    uint32_t            dropped;            /*!< overwritten before they were dumped */
+} mi_trace_stats_t;
+
+void mi_trace_gap(esp_gap_ble_cb_event_t event, const esp_ble_gap_cb_param_t *param);
+void mi_trace_gattc(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, const esp_ble_gattc_cb_param_t *param);
+
+/**
+ * Print and remove every buffered record, oldest first.
+ */
+void mi_trace_dump(void);
+void mi_trace_get_stats(mi_trace_stats_t *stats);
+#endif
@@ -1,15 +1,67 @@
 #ifndef _MI_THERMOMETER_H_
 #define _MI_THERMOMETER_H_
 
+#include <stdbool.h>
+#include "sdkconfig.h"
 #include "esp_err.h"
+#include "esp_bt_defs.h"
 #include "esp_gatt_defs.h"
+#include "mi_decoder.h"
+
+// SELECT MODE
+// #define MI_PASSIVE_MODE          /*!< decode advertisements only, never open a GATT connection */
+// #define MI_POLL_MODE             /*!< connect, take one reading and disconnect, in turn for every sensor of mi_poll_add */
+
+// SELECT ALLOCATION
+// #define MI_STATIC_ALLOC          /*!< event queue and task in static memory, nothing here touches the heap after mi_init but a bind key set later */
+
+// SELECT DEVICE INFORMATION READS
+#define MI_DIS_PIPELINE             /*!< queue all reads at once, comment out for one read per state */
+
+// SELECT STATE PACING
+// #define MI_STATE_DWELL_MS        1000        /*!< sleep before every state as mi_task did before the event queue, a baseline for one sensor, all sessions share the task */
+
+#define MI_MAX_SENSORS              CONFIG_BTDM_CTRL_BLE_MAX_CONN   /*!< one session per controller link */
+#define MI_MAX_ADV_SENSORS          64          /*!< sensors tracked from advertisements in passive mode */
+
+// Default state timeouts, see mi_set_timeout()
+#define MI_SCAN_TIMEOUT_MS          1000        /*!< restart scanning if the window ended without a match */
+#define MI_CONNECT_TIMEOUT_MS       30000       /*!< link up and service discovery */
+#define MI_GATT_TIMEOUT_MS          1000        /*!< each read, register or write round-trip */
+#define MI_NOTIFY_TIMEOUT_MS        60000       /*!< a link that stays silent this long is closed and reconnected */
+#define MI_HISTORY_IDLE_MS          3000        /*!< the history download ends once the sensor is quiet this long */
+
+// Reconnect policy, the delay doubles per failed attempt and is jittered down to half
+#define MI_RECONNECT_BASE_MS        500
+#define MI_RECONNECT_MAX_MS         30000
+#define MI_RECONNECT_ATTEMPTS       5           /*!< direct reconnects before the sensor is searched for again */
+
+// Scan scheduler, see mi_set_scan_config()
+#define MI_SCAN_BURST_MS            30000       /*!< full duty after boot, a lost sensor or a discovery */
+
+// Poll mode, the sessions visit the polled sensors in turn
+#define MI_POLL_MAX                 32          /*!< sensors polled, independent of the controller links */
+#define MI_POLL_PERIOD_MS           300000      /*!< period of the sensors found in mi_cache at start */
+#define MI_POLL_NOTIFY_TIMEOUT_MS   10000       /*!< the sensors notify every few seconds, a visit gives up after this */
+#define MI_POLL_RETRY_MS            30000       /*!< a missed sensor is visited again this soon, or after its period if shorter */
+
+// Sensors the mode reports at once, what a store kept per sensor needs room for
+#if defined(MI_PASSIVE_MODE)
+#define MI_SENSORS_LIMIT            MI_MAX_ADV_SENSORS
+#elif defined(MI_POLL_MODE)
+#define MI_SENSORS_LIMIT            MI_POLL_MAX
+#else
+#define MI_SENSORS_LIMIT            MI_MAX_SENSORS
+#endif
 
 typedef enum {
     MI_INIT,
     MI_SCAN,
+    MI_POLL,
     MI_CONNECT,
     MI_SEARCH_SERVICE,
     MI_DISCONNECT,
+    MI_RELEASE,
     MI_READ_DEVICE,
     MI_READ_MODEL,
     MI_READ_SERIAL,
@@ -18,8 +70,113 @@ typedef enum {
     MI_READ_SW_VER,
     MI_READ_BATTERY,
     MI_READ_TEMP_HUM,
+    MI_SYNC_HISTORY,
     MI_IDLE,
 } mi_state_t;
 
+typedef enum {
+    MI_SCAN_BURST,                          /*!< sensors missing, find them fast */
+    MI_SCAN_BACKOFF,                        /*!< nothing new for MI_SCAN_BURST_MS, save radio time */
+    MI_SCAN_PROFILES,
+} mi_scan_profile_t;
+
+typedef enum {
+    MI_CONN_FAST,                           /*!< discovery, reads and history download */
+    MI_CONN_SLOW,                           /*!< only notifications expected */
+    MI_CONN_PROFILES,
+} mi_conn_profile_t;
+
+typedef struct {
+    uint16_t            interval_min_ms;
+    uint16_t            interval_max_ms;
+    uint16_t            latency;            /*!< connection events the sensor may skip */
+    uint16_t            timeout_ms;         /*!< supervision timeout */
+} mi_conn_config_t;
+
+typedef struct {
+    uint16_t            interval_ms;
+    uint16_t            window_ms;          /*!< radio listens window_ms out of every interval_ms */
+    bool                active;             /*!< request scan responses */
+} mi_scan_config_t;
+
+typedef struct {
+    bool                scanning;
+    mi_scan_profile_t   profile;
+    uint16_t            duty;               /*!< radio-on fraction right now, per mille */
+    uint64_t            radio_on_ms;        /*!< listening time since boot */
+} mi_scan_stats_t;
+
+typedef struct {
+    uint8_t             sensors;
+    uint32_t            polls;              /*!< visits that brought a reading */
+    uint32_t            misses;
+    uint32_t            max_late_ms;        /*!< longest a due sensor waited for a free session */
+} mi_poll_stats_t;
+
+typedef struct {
+    esp_bd_addr_t       bda;
+    mi_state_t          state;
+    int16_t             temp;               /*!< 0.01 degrees Celsius */
+    uint8_t             hum;                /*!< relative humidity in % */
+    uint8_t             battery;            /*!< battery level in % */
+    uint16_t            battery_mv;
+    int64_t             updated;            /*!< esp_timer_get_time() of the last reading, 0 if none */
+} mi_sensor_t;
+
 esp_err_t mi_init(void);
-#endif
\ No newline at end of file
+
+/**
+ * Change how long a state waits for its GATT/GAP event before the request
+ * is retried. 0 waits forever.
+ */
+esp_err_t mi_set_timeout(mi_state_t state, uint32_t timeout_ms);
+
+/**
+ * Change the scan window, interval and type used for a profile. Windows
+ * and intervals go from 3 ms to 10240 ms with window <= interval. A running
+ * scan picks the change up immediately.
+ */
+esp_err_t mi_set_scan_config(mi_scan_profile_t profile, const mi_scan_config_t *config);
+esp_err_t mi_get_scan_stats(mi_scan_stats_t *stats);
+
+/**
+ * Change the connection parameters of a profile. Every link starts fast and
+ * turns slow once it only waits for notifications, each connection event
+ * saved is controller time for the scanner and the other links. Intervals
+ * go from 8 ms to 4000 ms, latency up to 499 and the timeout from 100 ms to
+ * 32000 ms, longer than (1 + latency) * interval_max_ms * 2. Links pick the
+ * change up at their next switch.
+ */
+esp_err_t mi_set_conn_config(mi_conn_profile_t profile, const mi_conn_config_t *config);
+
+/**
+ * Copy every sensor that has been assigned to a session.
+ * On entry *count is the capacity of sensors, on return the number written.
+ */
+esp_err_t mi_get_sensors(mi_sensor_t *sensors, uint8_t *count);
+
+/**
+ * Copy the session of a single sensor, ESP_ERR_NOT_FOUND if bda is unknown.
+ */
+esp_err_t mi_get_sensor(const esp_bd_addr_t bda, mi_sensor_t *sensor);
+
+/**
+ * Poll a sensor every period_ms in MI_POLL_MODE, or change its period. The
+ * sessions pick the most overdue sensor whenever they are free, so a
+ * reading is at most period_ms old plus the wait for a session, which
+ * max_late_ms reports. ESP_ERR_NOT_SUPPORTED in the other modes.
+ */
+esp_err_t mi_poll_add(const esp_bd_addr_t bda, uint32_t period_ms);
+esp_err_t mi_poll_remove(const esp_bd_addr_t bda);
+void mi_get_poll_stats(mi_poll_stats_t *stats);
+
+/**
+ * Records of the sensor's own hourly log, called from the BLE task in
+ * batches while a session downloads it. The download starts after the
+ * last record delivered before, and is skipped while no callback is set.
+ * Record times are on the sensor clock, sensor_now is that clock at the
+ * time of the call.
+ */
+typedef void (*mi_history_cb_t)(const uint8_t *bda, const mi_history_record_t *records, size_t count, uint32_t sensor_now, void *arg);
+void mi_set_history_cb(mi_history_cb_t cb, void *arg);
+#endif
@@ -0,0 +1,171 @@
+#include "mi_adv.h"
+#include <string.h>
+#include "mi_beacon.h"
+
+#define AD_TYPE_SERVICE_DATA        0x16
+
+#define ATC_DATA_LEN                13
+#define PVVX_DATA_LEN               15
+
+// MiBeacon frame control bits
+#define MIBEACON_ENCRYPTED          0x0008
+#define MIBEACON_HAS_MAC            0x0010
+#define MIBEACON_HAS_CAPABILITY     0x0020
+#define MIBEACON_HAS_OBJECT         0x0040
+#define MIBEACON_CAP_IO             0x20
+#define MIBEACON_VERSION_SHIFT      12
+#define MIBEACON_VERSION_CCM        4           /*!< first version with the AES-CCM layout of mi_beacon_decrypt */
+
+// MiBeacon object ids
+#define MIBEACON_OBJ_TEMP           0x1004
+#define MIBEACON_OBJ_HUM            0x1006
+#define MIBEACON_OBJ_BATTERY        0x100A
+#define MIBEACON_OBJ_TEMP_HUM       0x100D
+
+static inline uint16_t _le16(const uint8_t *p) {
+    return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+static inline uint16_t _be16(const uint8_t *p) {
+    return ((uint16_t)p[0] << 8) | (uint16_t)p[1];
+}
+
+static esp_err_t _mi_adv_atc(const uint8_t *data, uint8_t len, mi_adv_data_t *out) {
+    if (len == ATC_DATA_LEN) {
+        // mac[6] BE, temp int16 BE 0.1 C, hum %, battery %, battery mV BE, counter
+        out->format = MI_ADV_FORMAT_ATC;
+        out->temp = (int16_t)_be16(&data[6]) * 10;
+        out->hum = (uint16_t)data[8] * 100;
+        out->battery = data[9];
+        out->battery_mv = _be16(&data[10]);
+        out->counter = data[12];
+    }
+    else if (len == PVVX_DATA_LEN) {
+        // mac[6] LE, temp int16 LE 0.01 C, hum 0.01 %, battery mV, battery %, counter, flags
+        out->format = MI_ADV_FORMAT_PVVX;
+        out->temp = (int16_t)_le16(&data[6]);
+        out->hum = _le16(&data[8]);
+        out->battery_mv = _le16(&data[10]);
+        out->battery = data[12];
+        out->counter = data[13];
+    }
+    else {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    out->flags = MI_ADV_HAS_TEMP | MI_ADV_HAS_HUM | MI_ADV_HAS_BATTERY | MI_ADV_HAS_BATTERY_MV | MI_ADV_HAS_COUNTER;
+    return ESP_OK;
+}
+
+static esp_err_t _mi_adv_mibeacon(const esp_bd_addr_t bda, const uint8_t *data, uint8_t len, mi_adv_data_t *out) {
+    uint8_t plain[MI_BEACON_PAYLOAD_MAX];
+    // frame control, product id, frame counter
+    if (len < 5)
+        return ESP_ERR_INVALID_SIZE;
+    uint16_t frctrl = _le16(data);
+    uint8_t pos = 5;
+    if (frctrl & MIBEACON_HAS_MAC)
+        pos += 6;
+    if (frctrl & MIBEACON_HAS_CAPABILITY) {
+        if (pos >= len)
+            return ESP_ERR_INVALID_SIZE;
+        pos += (data[pos] & MIBEACON_CAP_IO) ? 3 : 1;
+    }
+    if (!(frctrl & MIBEACON_HAS_OBJECT))
+        return ESP_ERR_NOT_FOUND;
+    out->counter = data[4];
+    if (frctrl & MIBEACON_ENCRYPTED) {
+        // Continue on the plaintext objects
+        uint8_t plain_len = sizeof(plain);
+        if ((frctrl >> MIBEACON_VERSION_SHIFT) < MIBEACON_VERSION_CCM || bda == NULL)
+            return ESP_ERR_NOT_SUPPORTED;
+        esp_err_t ret = mi_beacon_decrypt(bda, data, len, pos, plain, &plain_len);
+        if (ret != ESP_OK)
+            return ret;
+        data = plain;
+        len = plain_len;
+        pos = 0;
+    }
+    if (pos + 3 > len || pos + 3 + data[pos + 2] > len)
+        return ESP_ERR_INVALID_SIZE;
+
+    uint16_t obj_id = _le16(&data[pos]);
+    uint8_t obj_len = data[pos + 2];
+    const uint8_t *obj = &data[pos + 3];
+    out->format = MI_ADV_FORMAT_MIBEACON;
+    out->flags = MI_ADV_HAS_COUNTER;
+    switch (obj_id) {
+        case MIBEACON_OBJ_TEMP:
+            if (obj_len < 2)
+                return ESP_ERR_INVALID_SIZE;
+            out->temp = (int16_t)_le16(obj) * 10;
+            out->flags |= MI_ADV_HAS_TEMP;
+            break;
+        case MIBEACON_OBJ_HUM:
+            if (obj_len < 2)
+                return ESP_ERR_INVALID_SIZE;
+            out->hum = _le16(obj) * 10;
+            out->flags |= MI_ADV_HAS_HUM;
+            break;
+        case MIBEACON_OBJ_BATTERY:
+            if (obj_len < 1)
+                return ESP_ERR_INVALID_SIZE;
+            out->battery = obj[0];
+            out->flags |= MI_ADV_HAS_BATTERY;
+            break;
+        case MIBEACON_OBJ_TEMP_HUM:
+            if (obj_len < 4)
+                return ESP_ERR_INVALID_SIZE;
+            out->temp = (int16_t)_le16(obj) * 10;
+            out->hum = _le16(&obj[2]) * 10;
+            out->flags |= MI_ADV_HAS_TEMP | MI_ADV_HAS_HUM;
+            break;
+        default:
+            return ESP_ERR_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+esp_err_t mi_adv_decode(const esp_bd_addr_t bda, const uint8_t *adv, uint8_t len, mi_adv_data_t *out) {
+    if (adv == NULL || out == NULL)
+        return ESP_ERR_INVALID_ARG;
+    memset(out, 0, sizeof(mi_adv_data_t));
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    uint8_t pos = 0;
+    // AD structure: length, type, data[length - 1]
+    while (pos + 1 < len) {
+        uint8_t ad_len = adv[pos];
+        if (ad_len == 0 || pos + 1 + ad_len > len)
+            break;
+        if (adv[pos + 1] == AD_TYPE_SERVICE_DATA && ad_len >= 3) {
+            const uint8_t *data = &adv[pos + 4];
+            uint8_t data_len = ad_len - 3;
+            uint16_t uuid = _le16(&adv[pos + 2]);
+            if (uuid == MI_ADV_UUID_ENV_SENSING)
+                ret = _mi_adv_atc(data, data_len, out);
+            else if (uuid == MI_ADV_UUID_MIBEACON)
+                ret = _mi_adv_mibeacon(bda, data, data_len, out);
+            if (ret == ESP_OK)
+                return ret;
+        }
+        pos += ad_len + 1;
+    }
+    return ret;
+}
+
+esp_err_t mi_adv_product(const uint8_t *adv, uint8_t len, uint16_t *product) {
+    if (adv == NULL || product == NULL)
+        return ESP_ERR_INVALID_ARG;
+    uint8_t pos = 0;
+    while (pos + 1 < len) {
+        uint8_t ad_len = adv[pos];
+        if (ad_len == 0 || pos + 1 + ad_len > len)
+            break;
+        // uuid, frame control, product id
+        if (adv[pos + 1] == AD_TYPE_SERVICE_DATA && ad_len >= 7 && _le16(&adv[pos + 2]) == MI_ADV_UUID_MIBEACON) {
+            *product = _le16(&adv[pos + 6]);
+            return ESP_OK;
+        }
+        pos += ad_len + 1;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
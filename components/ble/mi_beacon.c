@@ -0,0 +1,223 @@
+#include "mi_beacon.h"
+#include <stdio.h>
+#include <string.h>
+#include "nvs.h"
+#include "mbedtls/ccm.h"
+#include "freertos/FreeRTOS.h"
+
+#define MI_BEACON_EXT_COUNTER_LEN   3
+#define MI_BEACON_MIC_LEN           4
+#define MI_BEACON_NONCE_LEN         12
+#define MI_BEACON_AAD               0x11
+
+typedef struct {
+    esp_bd_addr_t       bda;
+    uint8_t             key[MI_BEACON_KEY_LEN];
+    uint32_t            last;               /*!< frame counter and extended counter of the last frame accepted */
+    bool                seen;
+    bool                used;
+    bool                rekey;              /*!< key changed since ccm was set up */
+    mbedtls_ccm_context ccm;                /*!< AES key schedule of key, BT task only once scanning */
+} mi_beacon_key_t;
+
+static mi_beacon_key_t mi_beacon_keys[MI_BEACON_KEYS_MAX];
+static mi_beacon_stats_t mi_beacon_stats;
+static portMUX_TYPE mi_beacon_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// NVS keys are limited to 15 characters, the BDA in hex takes 12
+static void _mi_beacon_nvs_key(const esp_bd_addr_t bda, char *key, size_t len) {
+    snprintf(key, len, "%02x%02x%02x%02x%02x%02x", bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+}
+
+static bool _mi_beacon_parse_bda(const char *key, esp_bd_addr_t bda) {
+    unsigned int b[6];
+    if (strlen(key) != 12 || sscanf(key, "%2x%2x%2x%2x%2x%2x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6)
+        return false;
+    for (uint8_t i = 0; i < 6; i++)
+        bda[i] = b[i];
+    return true;
+}
+
+static mi_beacon_key_t *_mi_beacon_find(const esp_bd_addr_t bda) {
+    for (uint8_t i = 0; i < MI_BEACON_KEYS_MAX; i++) {
+        if (mi_beacon_keys[i].used && memcmp(mi_beacon_keys[i].bda, bda, sizeof(esp_bd_addr_t)) == 0)
+            return &mi_beacon_keys[i];
+    }
+    return NULL;
+}
+
+static esp_err_t _mi_beacon_put(const esp_bd_addr_t bda, const uint8_t *key) {
+    esp_err_t ret = ESP_ERR_NO_MEM;
+    portENTER_CRITICAL(&mi_beacon_lock);
+    mi_beacon_key_t *k = _mi_beacon_find(bda);
+    for (uint8_t i = 0; i < MI_BEACON_KEYS_MAX && k == NULL; i++) {
+        if (!mi_beacon_keys[i].used)
+            k = &mi_beacon_keys[i];
+    }
+    if (k) {
+        memcpy(k->bda, bda, sizeof(esp_bd_addr_t));
+        memcpy(k->key, key, MI_BEACON_KEY_LEN);
+        k->seen = false;
+        k->used = true;
+        k->rekey = true;
+        ret = ESP_OK;
+    }
+    portEXIT_CRITICAL(&mi_beacon_lock);
+    return ret;
+}
+
+static esp_err_t _mi_beacon_load_nvs(nvs_handle_t nvs) {
+    esp_err_t ret = ESP_OK;
+    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, MI_BEACON_NAMESPACE, NVS_TYPE_BLOB);
+    while (it != NULL) {
+        nvs_entry_info_t info;
+        esp_bd_addr_t bda;
+        uint8_t key[MI_BEACON_KEY_LEN];
+        size_t len = sizeof(key);
+        nvs_entry_info(it, &info);
+        it = nvs_entry_next(it);
+        if (!_mi_beacon_parse_bda(info.key, bda))
+            continue;
+        if (nvs_get_blob(nvs, info.key, key, &len) != ESP_OK || len != sizeof(key))
+            continue;
+        ret = _mi_beacon_put(bda, key);
+        if (ret != ESP_OK) {
+            nvs_release_iterator(it);
+            break;
+        }
+    }
+    nvs_close(nvs);
+    return ret;
+}
+
+// The cipher context is allocated here, once per key, not per frame
+static int _mi_beacon_setkey(mi_beacon_key_t *k, const uint8_t *key) {
+    return mbedtls_ccm_setkey(&k->ccm, MBEDTLS_CIPHER_ID_AES, key, MI_BEACON_KEY_LEN * 8);
+}
+
+esp_err_t mi_beacon_load_keys(void) {
+    nvs_handle_t nvs;
+    for (uint8_t i = 0; i < MI_BEACON_KEYS_MAX; i++)
+        mbedtls_ccm_init(&mi_beacon_keys[i].ccm);
+    esp_err_t ret = nvs_open(MI_BEACON_NAMESPACE, NVS_READONLY, &nvs);
+    if (ret == ESP_OK)
+        ret = _mi_beacon_load_nvs(nvs);
+    // Scanning has not started, the BT task does not use the contexts yet
+    for (uint8_t i = 0; i < MI_BEACON_KEYS_MAX; i++) {
+        mi_beacon_key_t *k = &mi_beacon_keys[i];
+        if (k->used && _mi_beacon_setkey(k, k->key) == 0)
+            k->rekey = false;
+    }
+    return ret;
+}
+
+esp_err_t mi_beacon_set_key(const esp_bd_addr_t bda, const uint8_t *key) {
+    nvs_handle_t nvs;
+    char name[16];
+    if (bda == NULL || key == NULL)
+        return ESP_ERR_INVALID_ARG;
+    esp_err_t ret = nvs_open(MI_BEACON_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret != ESP_OK)
+        return ret;
+    _mi_beacon_nvs_key(bda, name, sizeof(name));
+    ret = nvs_set_blob(nvs, name, key, MI_BEACON_KEY_LEN);
+    if (ret == ESP_OK)
+        ret = nvs_commit(nvs);
+    nvs_close(nvs);
+    if (ret != ESP_OK)
+        return ret;
+    return _mi_beacon_put(bda, key);
+}
+
+esp_err_t mi_beacon_erase_key(const esp_bd_addr_t bda) {
+    nvs_handle_t nvs;
+    char name[16];
+    portENTER_CRITICAL(&mi_beacon_lock);
+    mi_beacon_key_t *k = _mi_beacon_find(bda);
+    if (k)
+        k->used = false;
+    portEXIT_CRITICAL(&mi_beacon_lock);
+    esp_err_t ret = nvs_open(MI_BEACON_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret != ESP_OK)
+        return ret;
+    _mi_beacon_nvs_key(bda, name, sizeof(name));
+    ret = nvs_erase_key(nvs, name);
+    if (ret == ESP_OK)
+        ret = nvs_commit(nvs);
+    nvs_close(nvs);
+    return ret;
+}
+
+esp_err_t mi_beacon_decrypt(const esp_bd_addr_t bda, const uint8_t *frame, uint8_t len, uint8_t pos, uint8_t *out, uint8_t *out_len) {
+    uint8_t key[MI_BEACON_KEY_LEN];
+    uint8_t nonce[MI_BEACON_NONCE_LEN];
+    const uint8_t aad = MI_BEACON_AAD;
+    // frame control, product id, frame counter ... objects, extended counter, MIC
+    if (pos < 5 || pos + MI_BEACON_EXT_COUNTER_LEN + MI_BEACON_MIC_LEN >= len)
+        return ESP_ERR_INVALID_SIZE;
+    uint8_t payload_len = len - pos - MI_BEACON_EXT_COUNTER_LEN - MI_BEACON_MIC_LEN;
+    if (payload_len > *out_len)
+        return ESP_ERR_INVALID_SIZE;
+    const uint8_t *ext = &frame[pos + payload_len];
+    uint32_t counter = frame[4] | ((uint32_t)ext[0] << 8) | ((uint32_t)ext[1] << 16) | ((uint32_t)ext[2] << 24);
+
+    // Sensors send each frame several times, only the first one is worth an AES run
+    bool duplicate = false, rekey = false;
+    portENTER_CRITICAL(&mi_beacon_lock);
+    mi_beacon_stats.frames++;
+    mi_beacon_key_t *k = _mi_beacon_find(bda);
+    if (k == NULL) {
+        mi_beacon_stats.no_key++;
+    } else if (k->seen && k->last == counter) {
+        mi_beacon_stats.duplicates++;
+        duplicate = true;
+    } else if (k->rekey) {
+        memcpy(key, k->key, sizeof(key));
+        k->rekey = false;
+        rekey = true;
+    }
+    portEXIT_CRITICAL(&mi_beacon_lock);
+    if (k == NULL)
+        return ESP_ERR_NOT_SUPPORTED;
+    if (duplicate)
+        return ESP_ERR_INVALID_STATE;
+
+    // Nonce: sensor MAC little endian, product id, frame counter, extended counter
+    for (uint8_t i = 0; i < sizeof(esp_bd_addr_t); i++)
+        nonce[i] = bda[sizeof(esp_bd_addr_t) - 1 - i];
+    memcpy(&nonce[6], &frame[2], 3);
+    memcpy(&nonce[9], ext, MI_BEACON_EXT_COUNTER_LEN);
+    // A key set while scanning is taken on its first frame, here in the BT task that owns k->ccm
+    int rc = (rekey) ? _mi_beacon_setkey(k, key) : 0;
+    bool keyed = (rc == 0);
+    if (keyed)
+        rc = mbedtls_ccm_auth_decrypt(&k->ccm, payload_len, nonce, sizeof(nonce), &aad, 1,
+                                      &frame[pos], out, &ext[MI_BEACON_EXT_COUNTER_LEN], MI_BEACON_MIC_LEN);
+
+    // Only an authenticated frame moves the counter, a forged one can not mute the sensor
+    portENTER_CRITICAL(&mi_beacon_lock);
+    if (!keyed) {
+        k->rekey = true;
+        mi_beacon_stats.auth_failed++;
+    } else if (rc != 0) {
+        mi_beacon_stats.auth_failed++;
+    } else {
+        mi_beacon_stats.decrypted++;
+        k = _mi_beacon_find(bda);
+        if (k) {
+            k->last = counter;
+            k->seen = true;
+        }
+    }
+    portEXIT_CRITICAL(&mi_beacon_lock);
+    if (rc != 0)
+        return ESP_ERR_INVALID_CRC;
+    *out_len = payload_len;
+    return ESP_OK;
+}
+
+void mi_beacon_get_stats(mi_beacon_stats_t *stats) {
+    portENTER_CRITICAL(&mi_beacon_lock);
+    *stats = mi_beacon_stats;
+    portEXIT_CRITICAL(&mi_beacon_lock);
+}
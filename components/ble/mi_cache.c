@@ -0,0 +1,105 @@
+#include "mi_cache.h"
+#include <stdio.h>
+#include <string.h>
+#include "nvs.h"
+
+// NVS keys are limited to 15 characters, the BDA in hex takes 12
+static void _mi_cache_key(const esp_bd_addr_t bda, char *key, size_t len) {
+    snprintf(key, len, "%02x%02x%02x%02x%02x%02x", bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+}
+
+static void _mi_cache_index_key(const esp_bd_addr_t bda, char *key, size_t len) {
+    snprintf(key, len, "i%02x%02x%02x%02x%02x%02x", bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+}
+
+esp_err_t mi_cache_load(const esp_bd_addr_t bda, mi_cache_t *cache) {
+    nvs_handle_t nvs;
+    char key[16];
+    size_t len = sizeof(mi_cache_t);
+    esp_err_t ret = nvs_open(MI_CACHE_NAMESPACE, NVS_READONLY, &nvs);
+    if (ret != ESP_OK)
+        return ret;
+    _mi_cache_key(bda, key, sizeof(key));
+    ret = nvs_get_blob(nvs, key, cache, &len);
+    nvs_close(nvs);
+    if (ret != ESP_OK)
+        return ret;
+    if (len != sizeof(mi_cache_t) || cache->version != MI_CACHE_VERSION || cache->temp_hum_handle == 0 || cache->handle_write == 0)
+        return ESP_ERR_INVALID_SIZE;
+    return ESP_OK;
+}
+
+esp_err_t mi_cache_save(const esp_bd_addr_t bda, mi_cache_t *cache) {
+    nvs_handle_t nvs;
+    char key[16];
+    esp_err_t ret = nvs_open(MI_CACHE_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret != ESP_OK)
+        return ret;
+    _mi_cache_key(bda, key, sizeof(key));
+    cache->version = MI_CACHE_VERSION;
+    ret = nvs_set_blob(nvs, key, cache, sizeof(mi_cache_t));
+    if (ret == ESP_OK)
+        ret = nvs_commit(nvs);
+    nvs_close(nvs);
+    return ret;
+}
+
+esp_err_t mi_cache_erase(const esp_bd_addr_t bda) {
+    nvs_handle_t nvs;
+    char key[16];
+    esp_err_t ret = nvs_open(MI_CACHE_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret != ESP_OK)
+        return ret;
+    _mi_cache_key(bda, key, sizeof(key));
+    ret = nvs_erase_key(nvs, key);
+    if (ret == ESP_OK)
+        ret = nvs_commit(nvs);
+    nvs_close(nvs);
+    return ret;
+}
+
+esp_err_t mi_cache_list(esp_bd_addr_t *bdas, uint8_t *count) {
+    uint8_t n = 0;
+    // Handles are blobs, the history indexes u32 and skipped here
+    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, MI_CACHE_NAMESPACE, NVS_TYPE_BLOB);
+    while (it != NULL && n < *count) {
+        nvs_entry_info_t info;
+        unsigned int b[6];
+        nvs_entry_info(it, &info);
+        it = nvs_entry_next(it);
+        if (strlen(info.key) != 12 || sscanf(info.key, "%2x%2x%2x%2x%2x%2x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6)
+            continue;
+        for (uint8_t i = 0; i < 6; i++)
+            bdas[n][i] = b[i];
+        n++;
+    }
+    nvs_release_iterator(it);
+    *count = n;
+    return ESP_OK;
+}
+
+esp_err_t mi_cache_load_index(const esp_bd_addr_t bda, uint32_t *index) {
+    nvs_handle_t nvs;
+    char key[16];
+    esp_err_t ret = nvs_open(MI_CACHE_NAMESPACE, NVS_READONLY, &nvs);
+    if (ret != ESP_OK)
+        return ret;
+    _mi_cache_index_key(bda, key, sizeof(key));
+    ret = nvs_get_u32(nvs, key, index);
+    nvs_close(nvs);
+    return ret;
+}
+
+esp_err_t mi_cache_save_index(const esp_bd_addr_t bda, uint32_t index) {
+    nvs_handle_t nvs;
+    char key[16];
+    esp_err_t ret = nvs_open(MI_CACHE_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret != ESP_OK)
+        return ret;
+    _mi_cache_index_key(bda, key, sizeof(key));
+    ret = nvs_set_u32(nvs, key, index);
+    if (ret == ESP_OK)
+        ret = nvs_commit(nvs);
+    nvs_close(nvs);
+    return ret;
+}
@@ -0,0 +1,76 @@
+#include "mi_channel.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// head is only written by the producer, tail only by the consumer
+typedef struct {
+    mi_sample_t         ring[MI_CHANNEL_LEN];
+    uint32_t            head;
+    uint32_t            tail;
+    mi_channel_stats_t  stats;
+    TaskHandle_t        reader;             /*!< notified at MI_CHANNEL_WAKE */
+    bool                open;
+} mi_channel_ring_t;
+
+static mi_channel_ring_t mi_channels[MI_CHANNELS_MAX];
+static portMUX_TYPE mi_channel_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t mi_subscribe(mi_channel_t *channel) {
+    esp_err_t ret = ESP_ERR_NO_MEM;
+    if (channel == NULL)
+        return ESP_ERR_INVALID_ARG;
+    // Only opening takes a lock, several tasks may subscribe at once
+    portENTER_CRITICAL(&mi_channel_lock);
+    for (uint8_t i = 0; i < MI_CHANNELS_MAX; i++) {
+        mi_channel_ring_t *ch = &mi_channels[i];
+        if (ch->open)
+            continue;
+        ch->tail = __atomic_load_n(&ch->head, __ATOMIC_ACQUIRE);
+        ch->reader = xTaskGetCurrentTaskHandle();
+        __atomic_store_n(&ch->open, true, __ATOMIC_RELEASE);
+        *channel = i;
+        ret = ESP_OK;
+        break;
+    }
+    portEXIT_CRITICAL(&mi_channel_lock);
+    return ret;
+}
+
+esp_err_t mi_channel_read(mi_channel_t channel, mi_sample_t *sample) {
+    if (channel >= MI_CHANNELS_MAX || sample == NULL)
+        return ESP_ERR_INVALID_ARG;
+    mi_channel_ring_t *ch = &mi_channels[channel];
+    uint32_t tail = ch->tail;
+    if (tail == __atomic_load_n(&ch->head, __ATOMIC_ACQUIRE))
+        return ESP_ERR_NOT_FOUND;
+    *sample = ch->ring[tail & (MI_CHANNEL_LEN - 1)];
+    __atomic_store_n(&ch->tail, tail + 1, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+esp_err_t mi_channel_get_stats(mi_channel_t channel, mi_channel_stats_t *stats) {
+    if (channel >= MI_CHANNELS_MAX || stats == NULL)
+        return ESP_ERR_INVALID_ARG;
+    stats->published = __atomic_load_n(&mi_channels[channel].stats.published, __ATOMIC_RELAXED);
+    stats->overflows = __atomic_load_n(&mi_channels[channel].stats.overflows, __ATOMIC_RELAXED);
+    return ESP_OK;
+}
+
+void mi_channel_publish(const mi_sample_t *sample) {
+    for (uint8_t i = 0; i < MI_CHANNELS_MAX; i++) {
+        mi_channel_ring_t *ch = &mi_channels[i];
+        if (!__atomic_load_n(&ch->open, __ATOMIC_ACQUIRE))
+            continue;
+        uint32_t head = ch->head;
+        ch->stats.published++;
+        if (head - __atomic_load_n(&ch->tail, __ATOMIC_ACQUIRE) >= MI_CHANNEL_LEN) {
+            ch->stats.overflows++;
+            continue;
+        }
+        ch->ring[head & (MI_CHANNEL_LEN - 1)] = *sample;
+        __atomic_store_n(&ch->head, head + 1, __ATOMIC_RELEASE);
+        // Once per fill, a reader still behind is not woken again
+        if (head + 1 - __atomic_load_n(&ch->tail, __ATOMIC_ACQUIRE) == MI_CHANNEL_WAKE && ch->reader)
+            xTaskNotifyGive(ch->reader);
+    }
+}
@@ -0,0 +1,45 @@
+#include "mi_decoder.h"
+
+#define MI_TEMP_MIN                 -4000       /*!< sensor range is -40..+85 C */
+#define MI_TEMP_MAX                 8500
+#define MI_HUM_MAX                  100
+
+esp_err_t mi_decode_data(const uint8_t *data, uint16_t len, mi_reading_t *out) {
+    if (data == NULL || out == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (len < MI_DATA_LEN)
+        return ESP_ERR_INVALID_SIZE;
+    // Temperature is signed, below zero it comes as two's complement
+    int16_t temp = (int16_t)((uint16_t)data[0] | ((uint16_t)data[1] << 8));
+    if (temp < MI_TEMP_MIN || temp > MI_TEMP_MAX || data[2] > MI_HUM_MAX)
+        return ESP_ERR_INVALID_RESPONSE;
+    out->temp = temp;
+    out->hum = data[2];
+    out->battery_mv = (uint16_t)data[3] | ((uint16_t)data[4] << 8);
+    return ESP_OK;
+}
+
+static inline uint32_t _le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+size_t mi_decode_history(const uint8_t *data, size_t count, mi_history_record_t *out) {
+    size_t n = 0;
+    if (data == NULL || out == NULL)
+        return 0;
+    for (size_t i = 0; i < count; i++, data += MI_HISTORY_RECORD_LEN) {
+        int32_t temp_max = (int16_t)((uint16_t)data[8] | ((uint16_t)data[9] << 8)) * 10;
+        int32_t temp_min = (int16_t)((uint16_t)data[11] | ((uint16_t)data[12] << 8)) * 10;
+        if (temp_max < MI_TEMP_MIN || temp_max > MI_TEMP_MAX || temp_min < MI_TEMP_MIN || temp_min > MI_TEMP_MAX
+            || data[10] > MI_HUM_MAX || data[13] > MI_HUM_MAX)
+            continue;
+        out[n].index = _le32(&data[0]);
+        out[n].time = _le32(&data[4]);
+        out[n].temp_max = temp_max;
+        out[n].hum_max = data[10];
+        out[n].temp_min = temp_min;
+        out[n].hum_min = data[13];
+        n++;
+    }
+    return n;
+}
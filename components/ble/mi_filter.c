@@ -0,0 +1,274 @@
+#include "mi_filter.h"
+#include <string.h>
+#include "mi_adv.h"
+#include "freertos/FreeRTOS.h"
+
+#define MI_FILTER_SLOTS             (2 * MI_FILTER_BDA_MAX)     /*!< power of two */
+
+#define AD_TYPE_UUID16_INCOMPLETE   0x02
+#define AD_TYPE_UUID16_COMPLETE     0x03
+#define AD_TYPE_SERVICE_DATA        0x16
+#define AD_TYPES_UUID               ((1U << AD_TYPE_UUID16_INCOMPLETE) | (1U << AD_TYPE_UUID16_COMPLETE) | (1U << AD_TYPE_SERVICE_DATA))
+
+#define MI_FILTER_KEY_USED          (1ULL << 48)
+
+typedef struct {
+    uint64_t            key;                /*!< address packed with MI_FILTER_KEY_USED, 0 when free */
+} mi_filter_slot_t;
+
+typedef struct {
+    uint8_t             bda_count;
+    uint8_t             oui_count;
+    uint8_t             uuid_count;
+    mi_filter_slot_t    slots[MI_FILTER_SLOTS];
+    uint32_t            hashed[8];          /*!< a bit per top byte of the hash of every slot used, most misses stop here */
+    uint32_t            oui[MI_FILTER_OUI_MAX];
+    uint16_t            uuid[MI_FILTER_UUID_MAX];
+} mi_filter_tables_t;
+
+// Readers take no lock: writers fill the copy not in use and publish it by
+// swapping active, the lock only keeps writers apart. The counters are only
+// written by the GAP callback.
+typedef struct {
+    uint8_t             rules;
+    uint8_t             active;
+    mi_filter_tables_t  tables[2];
+    uint32_t            seq[2];             /*!< odd while a writer fills that copy */
+    uint32_t            seen;
+    uint32_t            passed;             /*!< the few that pass, one store per rejected report */
+    portMUX_TYPE        lock;
+} mi_filter_t;
+
+static mi_filter_t mi_filter = {
+    .rules = MI_FILTER_DEFAULT,
+    .tables[0] = {
+        .oui_count = 1,
+        .oui = { MI_FILTER_OUI_LYWSD03MMC },
+        .uuid_count = 2,
+        .uuid = { MI_ADV_UUID_MIBEACON, MI_ADV_UUID_ENV_SENSING },
+    },
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+// One compare per probe instead of a memcmp of the address
+static inline uint64_t _mi_filter_key(const esp_bd_addr_t bda) {
+    uint32_t lo = bda[0] | (bda[1] << 8) | (bda[2] << 16) | ((uint32_t)bda[3] << 24);
+    return MI_FILTER_KEY_USED | ((uint64_t)(bda[4] | (bda[5] << 8)) << 32) | lo;
+}
+
+static inline uint32_t _mi_filter_mix(uint64_t key) {
+    return ((uint32_t)key ^ (uint32_t)(key >> 24)) * 0x9E3779B1;
+}
+
+static inline uint8_t _mi_filter_hash(uint64_t key) {
+    return (_mi_filter_mix(key) >> 16) & (MI_FILTER_SLOTS - 1);
+}
+
+// Linear probing, returns the slot holding key or the free slot ending its chain.
+// Bounded, a reader racing a writer may see every slot used, it retries anyway.
+static uint8_t _mi_filter_probe(const mi_filter_tables_t *t, uint64_t key) {
+    uint8_t i = _mi_filter_hash(key);
+    for (uint8_t n = 1; n < MI_FILTER_SLOTS && t->slots[i].key != 0 && t->slots[i].key != key; n++)
+        i = (i + 1) & (MI_FILTER_SLOTS - 1);
+    return i;
+}
+
+static bool _mi_filter_bda(const mi_filter_tables_t *t, const esp_bd_addr_t bda) {
+    uint64_t key = _mi_filter_key(bda);
+    uint8_t bit = _mi_filter_mix(key) >> 24;
+    if (!(t->hashed[bit / 32] & (1U << (bit % 32))))
+        return false;
+    return t->slots[_mi_filter_probe(t, key)].key == key;
+}
+
+static void _mi_filter_rehash(mi_filter_tables_t *t) {
+    memset(t->hashed, 0, sizeof(t->hashed));
+    for (uint8_t i = 0; i < MI_FILTER_SLOTS; i++) {
+        if (t->slots[i].key != 0) {
+            uint8_t bit = _mi_filter_mix(t->slots[i].key) >> 24;
+            t->hashed[bit / 32] |= 1U << (bit % 32);
+        }
+    }
+}
+
+static bool _mi_filter_oui(const mi_filter_tables_t *t, const esp_bd_addr_t bda) {
+    uint32_t oui = ((uint32_t)bda[0] << 16) | ((uint32_t)bda[1] << 8) | bda[2];
+    for (uint8_t i = 0; i < t->oui_count; i++) {
+        if (t->oui[i] == oui)
+            return true;
+    }
+    return false;
+}
+
+static bool _mi_filter_uuid_allowed(const mi_filter_tables_t *t, uint16_t uuid) {
+    for (uint8_t i = 0; i < t->uuid_count; i++) {
+        if (t->uuid[i] == uuid)
+            return true;
+    }
+    return false;
+}
+
+// Walk the AD structures for 16-bit service UUID lists and service data
+static bool _mi_filter_uuid(const mi_filter_tables_t *t, const uint8_t *adv, uint8_t len) {
+    uint8_t pos = 0;
+    while (pos + 1 < len) {
+        uint8_t ad_len = adv[pos];
+        if (ad_len == 0 || pos + 1 + ad_len > len)
+            break;
+        uint8_t type = adv[pos + 1];
+        pos += 1 + ad_len;
+        // Flags and manufacturer data, most of what phones send, in one test
+        if (type >= 32 || !(AD_TYPES_UUID & (1U << type)))
+            continue;
+        const uint8_t *data = &adv[pos + 1 - ad_len];
+        uint8_t data_len = ad_len - 1;
+        if (type != AD_TYPE_SERVICE_DATA) {
+            for (uint8_t i = 0; i + 1 < data_len; i += 2) {
+                if (_mi_filter_uuid_allowed(t, data[i] | (data[i + 1] << 8)))
+                    return true;
+            }
+        }
+        else if (data_len >= 2) {
+            if (_mi_filter_uuid_allowed(t, data[0] | (data[1] << 8)))
+                return true;
+        }
+    }
+    return false;
+}
+
+// Cheapest rule first, phones fail them all
+static inline bool _mi_filter_test(const mi_filter_tables_t *t, uint8_t rules, const esp_bd_addr_t bda, const uint8_t *adv, uint8_t len) {
+    return (rules == 0)
+        || ((rules & MI_FILTER_OUI) && _mi_filter_oui(t, bda))
+        || ((rules & MI_FILTER_BDA) && _mi_filter_bda(t, bda))
+        || ((rules & MI_FILTER_UUID) && adv && _mi_filter_uuid(t, adv, len));
+}
+
+bool mi_filter_match(const esp_bd_addr_t bda, const uint8_t *adv, uint8_t len) {
+    bool match;
+    uint8_t rules = __atomic_load_n(&mi_filter.rules, __ATOMIC_RELAXED);
+    const mi_filter_tables_t *t;
+    uint8_t active;
+    uint32_t seq;
+    // A second write may refill the copy just read, retried then
+    do {
+        active = __atomic_load_n(&mi_filter.active, __ATOMIC_ACQUIRE);
+        seq = __atomic_load_n(&mi_filter.seq[active], __ATOMIC_ACQUIRE);
+        t = &mi_filter.tables[active];
+        match = _mi_filter_test(t, rules, bda, adv, len);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&mi_filter.seq[active], __ATOMIC_RELAXED));
+    __atomic_store_n(&mi_filter.seen, mi_filter.seen + 1, __ATOMIC_RELAXED);
+    if (match)
+        __atomic_store_n(&mi_filter.passed, mi_filter.passed + 1, __ATOMIC_RELAXED);
+    return match;
+}
+
+void mi_filter_set_rules(uint8_t rules) {
+    __atomic_store_n(&mi_filter.rules, rules, __ATOMIC_RELAXED);
+}
+
+uint8_t mi_filter_get_rules(void) {
+    return __atomic_load_n(&mi_filter.rules, __ATOMIC_RELAXED);
+}
+
+// Under the lock: a copy of the tables in use to change, readers keep to the other one
+static mi_filter_tables_t *_mi_filter_edit(void) {
+    uint8_t next = !mi_filter.active;
+    __atomic_store_n(&mi_filter.seq[next], mi_filter.seq[next] + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    mi_filter.tables[next] = mi_filter.tables[mi_filter.active];
+    return &mi_filter.tables[next];
+}
+
+// Ends every edit, readers switch to the copy only when it changed
+static void _mi_filter_done(bool changed) {
+    uint8_t next = !mi_filter.active;
+    __atomic_store_n(&mi_filter.seq[next], mi_filter.seq[next] + 1, __ATOMIC_RELEASE);
+    if (changed)
+        __atomic_store_n(&mi_filter.active, next, __ATOMIC_RELEASE);
+}
+
+esp_err_t mi_filter_add_bda(const esp_bd_addr_t bda) {
+    esp_err_t ret = ESP_OK;
+    bool changed = false;
+    portENTER_CRITICAL(&mi_filter.lock);
+    mi_filter_tables_t *t = _mi_filter_edit();
+    uint64_t key = _mi_filter_key(bda);
+    uint8_t i = _mi_filter_probe(t, key);
+    if (t->slots[i].key == 0) {
+        if (t->bda_count < MI_FILTER_BDA_MAX) {
+            t->slots[i].key = key;
+            t->bda_count++;
+            _mi_filter_rehash(t);
+            changed = true;
+        } else {
+            ret = ESP_ERR_NO_MEM;
+        }
+    }
+    _mi_filter_done(changed);
+    portEXIT_CRITICAL(&mi_filter.lock);
+    return ret;
+}
+
+esp_err_t mi_filter_remove_bda(const esp_bd_addr_t bda) {
+    portENTER_CRITICAL(&mi_filter.lock);
+    mi_filter_tables_t *t = _mi_filter_edit();
+    uint8_t i = _mi_filter_probe(t, _mi_filter_key(bda));
+    if (t->slots[i].key == 0) {
+        _mi_filter_done(false);
+        portEXIT_CRITICAL(&mi_filter.lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+    t->slots[i].key = 0;
+    t->bda_count--;
+    // Shift the rest of the chain back so lookups never stop at the hole
+    uint8_t j = i;
+    while (1) {
+        j = (j + 1) & (MI_FILTER_SLOTS - 1);
+        if (t->slots[j].key == 0)
+            break;
+        uint8_t home = _mi_filter_hash(t->slots[j].key);
+        if (((j - home) & (MI_FILTER_SLOTS - 1)) >= ((j - i) & (MI_FILTER_SLOTS - 1))) {
+            t->slots[i] = t->slots[j];
+            t->slots[j].key = 0;
+            i = j;
+        }
+    }
+    _mi_filter_rehash(t);
+    _mi_filter_done(true);
+    portEXIT_CRITICAL(&mi_filter.lock);
+    return ESP_OK;
+}
+
+esp_err_t mi_filter_add_oui(uint32_t oui) {
+    esp_err_t ret = ESP_ERR_NO_MEM;
+    portENTER_CRITICAL(&mi_filter.lock);
+    mi_filter_tables_t *t = _mi_filter_edit();
+    if (t->oui_count < MI_FILTER_OUI_MAX) {
+        t->oui[t->oui_count++] = oui & 0xFFFFFF;
+        ret = ESP_OK;
+    }
+    _mi_filter_done(ret == ESP_OK);
+    portEXIT_CRITICAL(&mi_filter.lock);
+    return ret;
+}
+
+esp_err_t mi_filter_add_uuid(uint16_t uuid) {
+    esp_err_t ret = ESP_ERR_NO_MEM;
+    portENTER_CRITICAL(&mi_filter.lock);
+    mi_filter_tables_t *t = _mi_filter_edit();
+    if (t->uuid_count < MI_FILTER_UUID_MAX) {
+        t->uuid[t->uuid_count++] = uuid;
+        ret = ESP_OK;
+    }
+    _mi_filter_done(ret == ESP_OK);
+    portEXIT_CRITICAL(&mi_filter.lock);
+    return ret;
+}
+
+void mi_filter_get_stats(mi_filter_stats_t *stats) {
+    uint32_t passed = __atomic_load_n(&mi_filter.passed, __ATOMIC_RELAXED);
+    stats->seen = __atomic_load_n(&mi_filter.seen, __ATOMIC_RELAXED);
+    stats->rejected = stats->seen - passed;
+}
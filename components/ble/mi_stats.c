@@ -0,0 +1,108 @@
+#include "mi_stats.h"
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+
+static mi_stats_t mi_stats;
+static portMUX_TYPE mi_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static inline uint8_t _mi_stats_bucket(uint32_t ms) {
+    uint8_t bucket = 0;
+    while (ms != 0 && bucket < MI_STATS_BUCKETS - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void mi_stats_enter(mi_state_t state, bool retry) {
+    if (state > MI_IDLE)
+        return;
+    portENTER_CRITICAL(&mi_stats_lock);
+    mi_stats.state[state].entered++;
+    if (retry)
+        mi_stats.state[state].retries++;
+    portEXIT_CRITICAL(&mi_stats_lock);
+}
+
+void mi_stats_done(mi_state_t state, int64_t elapsed_us) {
+    if (state > MI_IDLE)
+        return;
+    uint32_t ms = (elapsed_us > 0) ? elapsed_us / 1000 : 0;
+    mi_stats_state_t *s = &mi_stats.state[state];
+    portENTER_CRITICAL(&mi_stats_lock);
+    s->completed++;
+    s->hist[_mi_stats_bucket(ms)]++;
+    if (ms > s->max_ms)
+        s->max_ms = ms;
+    portEXIT_CRITICAL(&mi_stats_lock);
+}
+
+void mi_stats_timeout(mi_state_t state) {
+    if (state > MI_IDLE)
+        return;
+    portENTER_CRITICAL(&mi_stats_lock);
+    mi_stats.state[state].timeouts++;
+    portEXIT_CRITICAL(&mi_stats_lock);
+}
+
+void mi_stats_reconnect(void) {
+    portENTER_CRITICAL(&mi_stats_lock);
+    mi_stats.reconnects++;
+    portEXIT_CRITICAL(&mi_stats_lock);
+}
+
+void mi_stats_disconnect(void) {
+    portENTER_CRITICAL(&mi_stats_lock);
+    mi_stats.disconnects++;
+    portEXIT_CRITICAL(&mi_stats_lock);
+}
+
+void mi_stats_scan_fallback(void) {
+    portENTER_CRITICAL(&mi_stats_lock);
+    mi_stats.scan_fallbacks++;
+    portEXIT_CRITICAL(&mi_stats_lock);
+}
+
+void mi_stats_recovered(int64_t elapsed_us) {
+    uint32_t ms = (elapsed_us > 0) ? elapsed_us / 1000 : 0;
+    portENTER_CRITICAL(&mi_stats_lock);
+    mi_stats.recovered++;
+    mi_stats.recover_hist[_mi_stats_bucket(ms)]++;
+    if (ms > mi_stats.recover_max_ms)
+        mi_stats.recover_max_ms = ms;
+    portEXIT_CRITICAL(&mi_stats_lock);
+}
+
+void mi_stats_get(mi_stats_t *stats) {
+    portENTER_CRITICAL(&mi_stats_lock);
+    *stats = mi_stats;
+    portEXIT_CRITICAL(&mi_stats_lock);
+}
+
+void mi_stats_reset(void) {
+    portENTER_CRITICAL(&mi_stats_lock);
+    memset(&mi_stats, 0, sizeof(mi_stats));
+    portEXIT_CRITICAL(&mi_stats_lock);
+}
+
+void mi_stats_dump(void) {
+    // Print from a snapshot, printing under the spinlock would stall the other core
+    static mi_stats_t stats;
+    mi_stats_get(&stats);
+    printf("MI_STATS disconnects %u reconnects %u fallbacks %u recovered %u max %u ms hist",
+           stats.disconnects, stats.reconnects, stats.scan_fallbacks, stats.recovered, stats.recover_max_ms);
+    for (uint8_t b = 0; b < MI_STATS_BUCKETS; b++)
+        printf(" %u", stats.recover_hist[b]);
+    printf("\n");
+    for (uint8_t i = 0; i <= MI_IDLE; i++) {
+        mi_stats_state_t *s = &stats.state[i];
+        if (s->entered == 0)
+            continue;
+        printf("MI_STATS state %u enter %u done %u timeout %u retry %u max %u ms hist",
+               i, s->entered, s->completed, s->timeouts, s->retries, s->max_ms);
+        for (uint8_t b = 0; b < MI_STATS_BUCKETS; b++)
+            printf(" %u", s->hist[b]);
+        printf("\n");
+    }
+}
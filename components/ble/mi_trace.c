@@ -0,0 +1,197 @@
+#include "mi_trace.h"
+
+#ifdef MI_TRACE
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#define MI_TRACE_RECORD_MAX         (sizeof(mi_trace_hdr_t) + 255)
+
+typedef struct {
+    uint8_t             buf[MI_TRACE_BUF_SIZE];
+    uint32_t            head;               /*!< next byte to write */
+    uint32_t            tail;               /*!< oldest record */
+    uint32_t            used;
+    mi_trace_stats_t    stats;
+    portMUX_TYPE        lock;
+} mi_trace_ring_t;
+
+static mi_trace_ring_t ring = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+static void _mi_trace_copy_in(const uint8_t *data, uint32_t len) {
+    if (len == 0)
+        return;
+    uint32_t n = MI_TRACE_BUF_SIZE - ring.head;
+    if (n > len)
+        n = len;
+    memcpy(&ring.buf[ring.head], data, n);
+    memcpy(ring.buf, data + n, len - n);
+    ring.head = (ring.head + len) % MI_TRACE_BUF_SIZE;
+    ring.used += len;
+}
+
+static void _mi_trace_copy_out(uint8_t *data, uint32_t len) {
+    uint32_t n = MI_TRACE_BUF_SIZE - ring.tail;
+    if (n > len)
+        n = len;
+    memcpy(data, &ring.buf[ring.tail], n);
+    memcpy(data + n, ring.buf, len - n);
+    ring.tail = (ring.tail + len) % MI_TRACE_BUF_SIZE;
+    ring.used -= len;
+}
+
+// Pop the oldest record into out, returns its total size or 0 if the ring is empty
+static uint32_t _mi_trace_pop(uint8_t *out) {
+    mi_trace_hdr_t hdr;
+    if (ring.used == 0)
+        return 0;
+    _mi_trace_copy_out((uint8_t *)&hdr, sizeof(hdr));
+    memcpy(out, &hdr, sizeof(hdr));
+    _mi_trace_copy_out(out + sizeof(hdr), hdr.len);
+    return sizeof(hdr) + hdr.len;
+}
+
+static void _mi_trace_push(uint8_t source, uint8_t event, const void *payload, uint8_t len,
+                           const uint8_t *data, uint8_t data_len) {
+    uint8_t scratch[MI_TRACE_RECORD_MAX];
+    mi_trace_hdr_t hdr = {
+        .time = (uint32_t)esp_timer_get_time(),
+        .source = source,
+        .event = event,
+        .len = len + data_len,
+    };
+    uint32_t size = sizeof(hdr) + hdr.len;
+    portENTER_CRITICAL(&ring.lock);
+    while (MI_TRACE_BUF_SIZE - ring.used < size) {
+        _mi_trace_pop(scratch);
+        ring.stats.dropped++;
+    }
+    _mi_trace_copy_in((const uint8_t *)&hdr, sizeof(hdr));
+    _mi_trace_copy_in(payload, len);
+    _mi_trace_copy_in(data, data_len);
+    ring.stats.recorded++;
+    portEXIT_CRITICAL(&ring.lock);
+}
+
+void mi_trace_gap(esp_gap_ble_cb_event_t event, const esp_ble_gap_cb_param_t *param) {
+    if (event != ESP_GAP_BLE_SCAN_RESULT_EVT) {
+        _mi_trace_push(MI_TRACE_GAP, event, NULL, 0, NULL, 0);
+        return;
+    }
+    mi_trace_scan_t scan = {
+        .search_evt = param->scan_rst.search_evt,
+        .addr_type = param->scan_rst.ble_addr_type,
+        .rssi = param->scan_rst.rssi,
+        .adv_len = param->scan_rst.adv_data_len,
+        .rsp_len = param->scan_rst.scan_rsp_len,
+    };
+    memcpy(scan.bda, param->scan_rst.bda, sizeof(scan.bda));
+    uint16_t data_len = scan.adv_len + scan.rsp_len;
+    if (data_len > 255 - sizeof(scan))
+        data_len = 255 - sizeof(scan);
+    _mi_trace_push(MI_TRACE_GAP, event, &scan, sizeof(scan), param->scan_rst.ble_adv, data_len);
+}
+
+void mi_trace_gattc(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, const esp_ble_gattc_cb_param_t *param) {
+    mi_trace_gattc_t rec = {
+        .gattc_if = gattc_if,
+    };
+    const uint8_t *value = NULL;
+    uint16_t value_len = 0;
+    switch ((int)event) {
+    case ESP_GATTC_REG_EVT:
+        rec.status = param->reg.status;
+        rec.handle = param->reg.app_id;
+        break;
+    case ESP_GATTC_OPEN_EVT:
+        rec.status = param->open.status;
+        rec.conn_id = param->open.conn_id;
+        memcpy(rec.bda, param->open.remote_bda, sizeof(rec.bda));
+        break;
+    case ESP_GATTC_CONNECT_EVT:
+        rec.conn_id = param->connect.conn_id;
+        memcpy(rec.bda, param->connect.remote_bda, sizeof(rec.bda));
+        break;
+    case ESP_GATTC_DISCONNECT_EVT:
+        rec.status = param->disconnect.reason;
+        rec.conn_id = param->disconnect.conn_id;
+        memcpy(rec.bda, param->disconnect.remote_bda, sizeof(rec.bda));
+        break;
+    case ESP_GATTC_CLOSE_EVT:
+        rec.status = param->close.status;
+        rec.conn_id = param->close.conn_id;
+        memcpy(rec.bda, param->close.remote_bda, sizeof(rec.bda));
+        break;
+    case ESP_GATTC_CFG_MTU_EVT:
+        rec.status = param->cfg_mtu.status;
+        rec.conn_id = param->cfg_mtu.conn_id;
+        rec.handle = param->cfg_mtu.mtu;
+        break;
+    case ESP_GATTC_SEARCH_CMPL_EVT:
+        rec.status = param->search_cmpl.status;
+        rec.conn_id = param->search_cmpl.conn_id;
+        break;
+    case ESP_GATTC_DIS_SRVC_CMPL_EVT:
+        rec.status = param->dis_srvc_cmpl.status;
+        rec.conn_id = param->dis_srvc_cmpl.conn_id;
+        break;
+    case ESP_GATTC_READ_CHAR_EVT:
+    case ESP_GATTC_READ_DESCR_EVT:
+        rec.status = param->read.status;
+        rec.conn_id = param->read.conn_id;
+        rec.handle = param->read.handle;
+        value = param->read.value;
+        value_len = param->read.value_len;
+        break;
+    case ESP_GATTC_WRITE_CHAR_EVT:
+    case ESP_GATTC_WRITE_DESCR_EVT:
+        rec.status = param->write.status;
+        rec.conn_id = param->write.conn_id;
+        rec.handle = param->write.handle;
+        break;
+    case ESP_GATTC_REG_FOR_NOTIFY_EVT:
+        rec.status = param->reg_for_notify.status;
+        rec.handle = param->reg_for_notify.handle;
+        break;
+    case ESP_GATTC_NOTIFY_EVT:
+        rec.conn_id = param->notify.conn_id;
+        rec.handle = param->notify.handle;
+        memcpy(rec.bda, param->notify.remote_bda, sizeof(rec.bda));
+        value = param->notify.value;
+        value_len = param->notify.value_len;
+        break;
+    default:
+        break;
+    }
+    if (value == NULL)
+        value_len = 0;
+    if (value_len > MI_TRACE_VALUE_MAX)
+        value_len = MI_TRACE_VALUE_MAX;
+    _mi_trace_push(MI_TRACE_GATTC, event, &rec, sizeof(rec), value, value_len);
+}
+
+void mi_trace_dump(void) {
+    uint8_t record[MI_TRACE_RECORD_MAX];
+    while (1) {
+        // Copy out under the lock, print outside it so the callbacks keep recording
+        portENTER_CRITICAL(&ring.lock);
+        uint32_t size = _mi_trace_pop(record);
+        portEXIT_CRITICAL(&ring.lock);
+        if (size == 0)
+            break;
+        printf("MI_TRACE ");
+        for (uint32_t i = 0; i < size; i++)
+            printf("%02x", record[i]);
+        printf("\n");
+    }
+}
+
+void mi_trace_get_stats(mi_trace_stats_t *stats) {
+    portENTER_CRITICAL(&ring.lock);
+    *stats = ring.stats;
+    portEXIT_CRITICAL(&ring.lock);
+}
+#endif
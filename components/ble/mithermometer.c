@@ -1,4 +1,13 @@
 #include "mithermometer.h"
+#include "mi_adv.h"
+#include "mi_beacon.h"
+#include "mi_cache.h"
+#include "mi_channel.h"
+#include "mi_decoder.h"
+#include "mi_filter.h"
+#include "mi_stats.h"
+#include "mi_trace.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "esp_bt.h"
@@ -9,7 +18,11 @@
 #include "esp_bt_main.h"
 #include "esp_gatt_common_api.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "freertos/event_groups.h"
 
 #define ERROR_CHECKE(con, str, action)   if (con) {                                                                 \
@@ -21,19 +34,78 @@
 static const char *TAG = "MI THERMOMETER";
 
 #define MI_APPID                    0
+#define MI_CONN_ID_INVALID          0xFFFF
+#define MI_INDEX_ALL                0xFF        /*!< event for every session */
+#define MI_QUEUE_LEN                32
+#define MI_DIS_CHARS                6           /*!< model, serial, fw, hw, sw and battery */
+#define MI_HISTORY_BATCH            32          /*!< records buffered between the GATTC callback and mi_task */
+#define MI_HISTORY_REGISTER_TRIES   5           /*!< the notification table is shared, a refused sync waits for another to end */
+#define MI_CLOCK_LEN                4           /*!< seconds, a time zone byte may follow */
+#define MI_POLL_NONE                0xFF
+#define MI_CHAR_LEN                 MI_CACHE_STR_LEN    /*!< longer DIS strings are cut, the cache keeps no more */
+#define MI_TASK_STACK               (4 * 1024)
+#define MI_SCAN_UNITS(ms)           ((ms) * 8 / 5)      /*!< scan timing is in 0.625 ms slots */
+#define MI_CONN_UNITS(ms)           ((ms) * 4 / 5)      /*!< connection intervals are in 1.25 ms units */
 const uint8_t MI_DATA_CHAR_UUID[] = {0xa6, 0xa3, 0x7d, 0x99, 0xf2, 0x6f, 0x1a, 0x8a, 0x0c, 0x4b, 0x0a, 0x7a, 0xc1, 0xcc, 0xe0, 0xeb};
+const uint8_t MI_HISTORY_CHAR_UUID[] = {0xa6, 0xa3, 0x7d, 0x99, 0xf2, 0x6f, 0x1a, 0x8a, 0x0c, 0x4b, 0x0a, 0x7a, 0xbc, 0xcc, 0xe0, 0xeb};
+const uint8_t MI_HISTORY_INDEX_CHAR_UUID[] = {0xa6, 0xa3, 0x7d, 0x99, 0xf2, 0x6f, 0x1a, 0x8a, 0x0c, 0x4b, 0x0a, 0x7a, 0xba, 0xcc, 0xe0, 0xeb};
+const uint8_t MI_CLOCK_CHAR_UUID[] = {0xa6, 0xa3, 0x7d, 0x99, 0xf2, 0x6f, 0x1a, 0x8a, 0x0c, 0x4b, 0x0a, 0x7a, 0xb7, 0xcc, 0xe0, 0xeb};
 
 typedef struct {
-    uint8_t             handle;
-    char                *data;
+    uint16_t            handle;
+    uint16_t            len;
+    char                data[MI_CHAR_LEN + 1];  /*!< inline, reconnects never touch the heap */
 } mi_char_t;
 
+typedef enum {
+    MI_HISTORY_CLOCK,
+    MI_HISTORY_REGISTER,
+    MI_HISTORY_INDEX,
+    MI_HISTORY_ENABLE,
+    MI_HISTORY_STREAM,
+} mi_history_step_t;
+
+typedef struct {
+    uint16_t            handle;             /*!< records are notified here */
+    uint16_t            ccc;
+    uint16_t            index_handle;       /*!< takes the first record to send */
+    uint16_t            clock_handle;       /*!< sensor clock, seconds little endian, the log is in this clock */
+    mi_history_step_t   step;
+    uint8_t             tries;              /*!< registrations refused in a row */
+    uint32_t            clock;              /*!< sensor clock read at the start of the download */
+    int64_t             clock_at;           /*!< esp_timer_get_time() of that read */
+    uint32_t            next;               /*!< first record not delivered yet */
+    uint32_t            received;
+    int64_t             start;
+    uint8_t             raw[MI_HISTORY_BATCH][MI_HISTORY_RECORD_LEN];   /*!< filled by the GATTC callback */
+    uint8_t             count;
+    bool                posted;             /*!< EVT_HISTORY queued and not handled yet */
+    bool                overflow;
+    uint32_t            dropped_from;       /*!< lowest record lost to overflow */
+} mi_history_sync_t;
+
 typedef struct mi_thermometer {
-    esp_gatt_if_t       gattcif;
+    uint8_t             index;
+    bool                assigned;
+    uint16_t            notify_pending;     /*!< handle to register or waiting for REG_FOR_NOTIFY_EVT, 0 if none */
+    bool                cached;             /*!< handles came from mi_cache, not discovery */
+    bool                linked;             /*!< connected at least once */
+    uint8_t             failures;           /*!< connection attempts failed in a row */
+    uint8_t             reads_pending;      /*!< pipelined reads not answered yet */
+    bool                sequential;         /*!< sensor did not answer pipelined reads, read one by one */
+    int64_t             lost;               /*!< esp_timer_get_time() when the link went down, 0 while up */
+    uint8_t             poll;               /*!< polled sensor being visited, MI_POLL_NONE if none */
+    mi_conn_profile_t   conn_profile;       /*!< last asked of the controller */
+    int64_t             poll_start;
     uint16_t            conn_id;
     esp_bd_addr_t       bda;
-    EventGroupHandle_t  event;
     mi_state_t          state;
+    EventBits_t         bits;               /*!< events received in the current state */
+    EventBits_t         wait;               /*!< events the current state needs, 0 if none */
+    EventBits_t         wait_any;           /*!< any one of these ends the wait as well */
+    TickType_t          start;
+    TickType_t          timeout;            /*!< 0 waits forever */
+    int64_t             entered;            /*!< esp_timer_get_time() when the state was entered */
     mi_char_t           model_char;
     mi_char_t           serial_char;
     mi_char_t           fw_char;
@@ -41,143 +113,544 @@ typedef struct mi_thermometer {
     mi_char_t           sw_char;
     mi_char_t           battery_char;
     mi_char_t           temp_hum_char;
-    uint8_t             handle_write;
-    float               temp;
-    uint8_t             hum;
+    uint16_t            handle_write;
+    mi_history_sync_t   history;
+    mi_reading_t        reading;
+    int64_t             updated;
 } mi_thermometer_t;
 
-mi_thermometer_t    mi_thermometer;
+typedef struct {
+    esp_bd_addr_t       bda;
+    bool                used;
+    int8_t              rssi;
+    int64_t             last_seen;
+    mi_adv_data_t       data;
+} mi_adv_sensor_t;
 
-static const int EVT_READY          = BIT0;
-static const int EVT_SEARCH_DEVICE  = BIT1;
-static const int EVT_OPEN           = BIT2;
-static const int EVT_CLOSE          = BIT3;
-static const int EVT_SEARCH_SERVICE = BIT4;
-static const int EVT_READ           = BIT5;
-static const int EVT_WRITE          = BIT6;
-static const int EVT_REGISTER       = BIT7;
+typedef struct {
+    esp_bd_addr_t       bda;
+    bool                used;
+    bool                busy;               /*!< a session is visiting it */
+    uint8_t             session;
+    uint32_t            period_ms;
+    int64_t             due;                /*!< esp_timer_get_time() of the next visit */
+    mi_reading_t        reading;
+    uint8_t             battery;
+    int64_t             updated;
+} mi_poll_entry_t;
 
-static esp_err_t _mi_write_char_descr(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle) {
-    xEventGroupClearBits(mi_thermometer.event, EVT_WRITE);
-    uint8_t notify_en = 1;
-    esp_ble_gattc_write_char_descr(gattc_if, conn_id, handle, sizeof(notify_en),(uint8_t *)&notify_en, ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
-    if ((xEventGroupWaitBits(mi_thermometer.event, EVT_WRITE, false, true, 1000/portTICK_RATE_MS) & EVT_WRITE) == 0) {
-        ESP_LOGE(TAG, "hid button write time out");
-        return ESP_FAIL;
+typedef struct {
+    uint8_t             index;
+    EventBits_t         evt;
+} mi_event_t;
+
+typedef struct {
+    esp_gatt_if_t       gattcif;
+    QueueHandle_t       queue;
+    bool                scanning;
+    bool                scan_switching;     /*!< stopped to apply a new profile */
+    mi_scan_profile_t   scan_profile;
+    TickType_t          scan_burst;         /*!< start of the current burst */
+    int64_t             scan_since;         /*!< radio time is accounted up to here */
+    uint64_t            radio_on_us;
+    struct mi_thermometer *registering;     /*!< session whose REG_FOR_NOTIFY_EVT is due, NULL if none */
+    portMUX_TYPE        lock;
+    mi_thermometer_t    sensors[MI_MAX_SENSORS];
+#ifdef MI_PASSIVE_MODE
+    mi_adv_sensor_t     adv_sensors[MI_MAX_ADV_SENSORS];
+#endif
+#ifdef MI_POLL_MODE
+    mi_poll_entry_t     polls[MI_POLL_MAX];
+    mi_poll_stats_t     poll_stats;
+#endif
+} mi_pool_t;
+
+static mi_pool_t mi_pool = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+#ifdef MI_STATIC_ALLOC
+#if !configSUPPORT_STATIC_ALLOCATION
+#error "MI_STATIC_ALLOC needs FreeRTOS static allocation"
+#endif
+static StaticQueue_t mi_queue;
+static uint8_t mi_queue_storage[MI_QUEUE_LEN * sizeof(mi_event_t)];
+static StaticTask_t mi_task_tcb;
+static StackType_t mi_task_stack[MI_TASK_STACK];
+#endif
+
+// Burst at full duty, then listen 10% of the time. A sensor is known by its name in the scan
+// response or by the product id of its MiBeacon frame, the burst asks for both and the backoff
+// saves the scan requests
+static mi_scan_config_t mi_scan_config[MI_SCAN_PROFILES] = {
+#ifdef MI_PASSIVE_MODE
+    [MI_SCAN_BURST]     = { .interval_ms = 50, .window_ms = 50, .active = false },
+#else
+    [MI_SCAN_BURST]     = { .interval_ms = 50, .window_ms = 50, .active = true },
+#endif
+    [MI_SCAN_BACKOFF]   = { .interval_ms = 500, .window_ms = 50, .active = false },
+};
+
+// Fast while talking, slow while listening: a 1 s interval with latency 4 still hears the 6 s notifications
+static mi_conn_config_t mi_conn_config[MI_CONN_PROFILES] = {
+    [MI_CONN_FAST]      = { .interval_min_ms = 10, .interval_max_ms = 20, .latency = 0, .timeout_ms = 2000 },
+    [MI_CONN_SLOW]      = { .interval_min_ms = 500, .interval_max_ms = 1000, .latency = 4, .timeout_ms = 12000 },
+};
+
+// Enumerators, not const ints, so the state table below is a constant expression
+enum {
+    EVT_READY           = BIT0,
+    EVT_SEARCH_DEVICE   = BIT1,
+    EVT_OPEN            = BIT2,
+    EVT_CLOSE           = BIT3,
+    EVT_SEARCH_SERVICE  = BIT4,
+    EVT_READ            = BIT5,
+    EVT_WRITE           = BIT6,
+    EVT_REGISTER        = BIT7,
+    EVT_NOTIFY          = BIT8,
+    EVT_ERROR           = BIT9,
+    EVT_BACKOFF         = BIT10,    /*!< never posted, waiting on it is a plain timer */
+    EVT_HISTORY         = BIT11,
+    EVT_POLL            = BIT12,    /*!< a polled sensor was added */
+};
+
+typedef enum {
+    MI_STEP_WAIT,                   /*!< request sent, wait for the events of the state */
+    MI_STEP_NEXT,                   /*!< nothing to do here, go on to next */
+    MI_STEP_FAIL,                   /*!< cannot run here, go on to fail */
+} mi_step_t;
+
+/**
+ * One row of the session state machine. Entering a state arms its wait and
+ * runs action. Once all events of wait arrived, done may start the next
+ * request of a multi-step state and return false, otherwise the session
+ * moves to next. On timeout failed may act and pick another state than
+ * fail. Rows with nothing to wait for must have an action that moves on.
+ */
+typedef struct {
+    mi_step_t           (*action)(mi_thermometer_t *mi, mi_state_t prev);
+    EventBits_t         wait;
+    bool                (*done)(mi_thermometer_t *mi);
+    mi_state_t          next;
+    mi_state_t          (*failed)(mi_thermometer_t *mi, mi_state_t fail);
+    mi_state_t          fail;
+    bool                quiet;      /*!< timing out is routine, not worth a log */
+} mi_step_def_t;
+
+// Where poll mode differs: sessions start polling, and every visit ends in MI_RELEASE after one reading
+#ifdef MI_POLL_MODE
+#define MI_START                    MI_POLL
+#define MI_LINK_LOST                MI_POLL
+#define MI_CONNECT_FAIL             MI_RELEASE
+#define MI_CONNECT_FAILED           NULL
+#define MI_GATT_FAIL(state)         MI_RELEASE
+#define MI_IDLE_TIMEOUT_MS          MI_POLL_NOTIFY_TIMEOUT_MS
+#define MI_IDLE_NEXT                MI_RELEASE
+#define MI_IDLE_FAILED              NULL
+#else
+#define MI_START                    MI_SCAN
+#define MI_LINK_LOST                MI_DISCONNECT
+#define MI_CONNECT_FAIL             MI_DISCONNECT
+#define MI_CONNECT_FAILED           _mi_connect_failed
+#define MI_GATT_FAIL(state)         state
+#define MI_IDLE_TIMEOUT_MS          MI_NOTIFY_TIMEOUT_MS
+#define MI_IDLE_NEXT                MI_IDLE
+#define MI_IDLE_FAILED              _mi_idle_failed
+#endif
+
+// state              action                    wait                            timeout_ms              done                    next                failed                  fail                            quiet
+#define MI_STEPS(X) \
+    X(MI_INIT,          NULL,                   EVT_READY,                      0,                      NULL,                   MI_START,           NULL,                   MI_INIT,                        false) \
+    X(MI_SCAN,          _mi_scan_action,        EVT_SEARCH_DEVICE,              MI_SCAN_TIMEOUT_MS,     NULL,                   MI_CONNECT,         NULL,                   MI_SCAN,                        true) \
+    X(MI_POLL,          _mi_poll_action,        EVT_POLL,                       0,                      _mi_poll_woken,         MI_CONNECT,         NULL,                   MI_POLL,                        true) \
+    X(MI_CONNECT,       _mi_connect,            EVT_OPEN | EVT_SEARCH_SERVICE,  MI_CONNECT_TIMEOUT_MS,  _mi_connected,          MI_SEARCH_SERVICE,  MI_CONNECT_FAILED,      MI_CONNECT_FAIL,                false) \
+    X(MI_SEARCH_SERVICE,_mi_search_service,     0,                              0,                      NULL,                   MI_READ_DEVICE,     NULL,                   MI_SEARCH_SERVICE,              false) \
+    X(MI_DISCONNECT,    _mi_backoff,            EVT_BACKOFF,                    0,                      NULL,                   MI_SCAN,            NULL,                   MI_CONNECT,                     true) \
+    X(MI_RELEASE,       _mi_release,            EVT_CLOSE,                      MI_GATT_TIMEOUT_MS,     NULL,                   MI_POLL,            NULL,                   MI_POLL,                        false) \
+    X(MI_READ_DEVICE,   _mi_read_device_action, EVT_READ,                       MI_GATT_TIMEOUT_MS,     _mi_read_device_done,   MI_READ_TEMP_HUM,   _mi_read_device_failed, MI_READ_MODEL,                  false) \
+    X(MI_READ_MODEL,    _mi_read_dis,           EVT_READ,                       MI_GATT_TIMEOUT_MS,     _mi_read_dis_done,      MI_READ_SERIAL,     NULL,                   MI_GATT_FAIL(MI_READ_MODEL),    false) \
+    X(MI_READ_SERIAL,   _mi_read_dis,           EVT_READ,                       MI_GATT_TIMEOUT_MS,     _mi_read_dis_done,      MI_READ_FW_VER,     NULL,                   MI_GATT_FAIL(MI_READ_SERIAL),   false) \
+    X(MI_READ_FW_VER,   _mi_read_dis,           EVT_READ,                       MI_GATT_TIMEOUT_MS,     _mi_read_dis_done,      MI_READ_HW_VER,     NULL,                   MI_GATT_FAIL(MI_READ_FW_VER),   false) \
+    X(MI_READ_HW_VER,   _mi_read_dis,           EVT_READ,                       MI_GATT_TIMEOUT_MS,     _mi_read_dis_done,      MI_READ_SW_VER,     NULL,                   MI_GATT_FAIL(MI_READ_HW_VER),   false) \
+    X(MI_READ_SW_VER,   _mi_read_dis,           EVT_READ,                       MI_GATT_TIMEOUT_MS,     _mi_read_dis_done,      MI_READ_BATTERY,    NULL,                   MI_GATT_FAIL(MI_READ_SW_VER),   false) \
+    X(MI_READ_BATTERY,  _mi_read_dis,           EVT_READ,                       MI_GATT_TIMEOUT_MS,     _mi_read_dis_done,      MI_READ_TEMP_HUM,   NULL,                   MI_GATT_FAIL(MI_READ_BATTERY),  false) \
+    X(MI_READ_TEMP_HUM, _mi_notify_action,      EVT_REGISTER,                   MI_GATT_TIMEOUT_MS,     _mi_notify_done,        MI_SYNC_HISTORY,    _mi_notify_failed,      MI_GATT_FAIL(MI_READ_TEMP_HUM), false) \
+    X(MI_SYNC_HISTORY,  _mi_history_action,     EVT_READ,                       MI_HISTORY_IDLE_MS,     _mi_history_done,       MI_IDLE,            _mi_history_end,        MI_IDLE,                        true) \
+    X(MI_IDLE,          _mi_idle_action,        EVT_NOTIFY,                     MI_IDLE_TIMEOUT_MS,     _mi_idle_done,          MI_IDLE_NEXT,       MI_IDLE_FAILED,         MI_IDLE_NEXT,                   false)
+
+#define MI_STEP_ROW(state, action, wait, timeout_ms, done, next, failed, fail, quiet)       MI_ROW_##state,
+#define MI_STEP_TIMEOUT(state, action, wait, timeout_ms, done, next, failed, fail, quiet)   [state] = timeout_ms,
+#define MI_STEP_DEF(state, action, wait, timeout_ms, done, next, failed, fail, quiet) \
+    [state] = { action, wait, done, next, failed, fail, quiet },
+
+enum { MI_STEPS(MI_STEP_ROW) };
+
+// Defaults from MI_STEPS, mi_set_timeout adjusts them at run time
+static uint32_t mi_timeout_ms[MI_IDLE + 1] = {
+    MI_STEPS(MI_STEP_TIMEOUT)
+};
+
+static mi_history_cb_t mi_history_cb;
+static void *mi_history_arg;
+
+static void _mi_post(uint8_t index, EventBits_t evt) {
+    mi_event_t event = {
+        .index = index,
+        .evt = evt,
+    };
+    // Never block the BTC task, a lost event ends in the state timeout
+    if (xQueueSend(mi_pool.queue, &event, 0) != pdTRUE)
+        ESP_LOGE(TAG, "[%d] event queue full, drop %x", index, evt);
+}
+
+static mi_thermometer_t *_mi_find_by_conn_id(uint16_t conn_id) {
+    for (uint8_t i = 0; i < MI_MAX_SENSORS; i++) {
+        if (mi_pool.sensors[i].assigned && mi_pool.sensors[i].conn_id == conn_id)
+            return &mi_pool.sensors[i];
     }
-    return ESP_OK;
+    return NULL;
 }
 
-static esp_err_t _mi_register_for_notify(esp_gatt_if_t gattc_if, esp_bd_addr_t bda, uint16_t handle) {
-    xEventGroupClearBits(mi_thermometer.event, EVT_REGISTER);
-    esp_ble_gattc_register_for_notify(gattc_if, bda, handle);
-    if ((xEventGroupWaitBits(mi_thermometer.event, EVT_REGISTER, false, true, 1000/portTICK_RATE_MS) & EVT_REGISTER) == 0) {
-        ESP_LOGE(TAG, "hid button register time out");
-        return ESP_FAIL;
+// Hand a sensor to the session, with the pool lock held. Handles, reads and the reading of another
+// sensor served before do not carry over
+static void _mi_assign(mi_thermometer_t *mi, const esp_bd_addr_t bda) {
+    if (memcmp(mi->bda, bda, sizeof(esp_bd_addr_t)) != 0) {
+        memcpy(mi->bda, bda, sizeof(esp_bd_addr_t));
+        mi->cached = false;
+        mi->linked = false;
+        mi->sequential = false;
+        mi->reads_pending = 0;
+        mi->lost = 0;
+        memset(&mi->model_char, 0, sizeof(mi_char_t));
+        memset(&mi->serial_char, 0, sizeof(mi_char_t));
+        memset(&mi->fw_char, 0, sizeof(mi_char_t));
+        memset(&mi->hw_char, 0, sizeof(mi_char_t));
+        memset(&mi->sw_char, 0, sizeof(mi_char_t));
+        memset(&mi->battery_char, 0, sizeof(mi_char_t));
+        memset(&mi->temp_hum_char, 0, sizeof(mi_char_t));
+        mi->handle_write = 0;
+        memset(&mi->history, 0, sizeof(mi_history_sync_t));
+        memset(&mi->reading, 0, sizeof(mi_reading_t));
+        mi->updated = 0;
     }
-    return ESP_OK;
+    mi->assigned = true;
 }
 
-static void _mi_char_data(uint8_t *data, uint16_t len) {
-    switch(mi_thermometer.state) {
-        case MI_READ_MODEL:
-            mi_thermometer.model_char.data = (char *)calloc(sizeof(char), len + 1);
-            if (mi_thermometer.model_char.data) {
-                memcpy(mi_thermometer.model_char.data, data, len);
-            }
-            break;
-        case MI_READ_SERIAL:
-            mi_thermometer.serial_char.data = (char *)calloc(sizeof(char), len + 1);
-            if (mi_thermometer.serial_char.data) {
-                memcpy(mi_thermometer.serial_char.data, data, len);
-            }
-            break;
-        case MI_READ_FW_VER:
-            mi_thermometer.fw_char.data = (char *)calloc(sizeof(char), len + 1);
-            if (mi_thermometer.fw_char.data) {
-                memcpy(mi_thermometer.fw_char.data, data, len);
-            }
-            break;
-        case MI_READ_HW_VER:
-            mi_thermometer.hw_char.data = (char *)calloc(sizeof(char), len + 1);
-            if (mi_thermometer.hw_char.data) {
-                memcpy(mi_thermometer.hw_char.data, data, len);
-            }
-            break;
-        case MI_READ_SW_VER:
-            mi_thermometer.sw_char.data = (char *)calloc(sizeof(char), len + 1);
-            if (mi_thermometer.sw_char.data) {
-                memcpy(mi_thermometer.sw_char.data, data, len);
-            }
-            break;
-        case MI_READ_BATTERY:
-            mi_thermometer.battery_char.data = (char *)calloc(sizeof(char), len + 1);
-            if (mi_thermometer.battery_char.data) {
-                memcpy(mi_thermometer.battery_char.data, data, len);
-            }
-            break;
-        case MI_IDLE:
-            mi_thermometer.temp = ((uint16_t)data[1]<<8)|data[0];
-            mi_thermometer.hum = data[2];
-            break;
-        default:
-            break;
+static mi_thermometer_t *_mi_find_by_bda(const esp_bd_addr_t bda) {
+    for (uint8_t i = 0; i < MI_MAX_SENSORS; i++) {
+        if (mi_pool.sensors[i].assigned && memcmp(mi_pool.sensors[i].bda, bda, sizeof(esp_bd_addr_t)) == 0)
+            return &mi_pool.sensors[i];
     }
+    return NULL;
 }
 
-static esp_err_t _mi_read_handle(esp_gatt_if_t gattcif, uint16_t conn_id, uint16_t handle, TickType_t tick_to_wait) {
-    xEventGroupClearBits(mi_thermometer.event, EVT_READ);
-    esp_err_t ret = esp_ble_gattc_read_char(gattcif, conn_id, handle, ESP_GATT_AUTH_REQ_NONE);
-    ERROR_CHECKE( ret != ESP_OK, "gattc read failed", return ret);
-    if ((xEventGroupWaitBits(mi_thermometer.event, EVT_READ, false, true, 1000/portTICK_RATE_MS) & EVT_READ) == 0) {
-        ESP_LOGE(TAG, "hid button read time out");
-        return ESP_FAIL;
+static uint16_t _mi_scan_duty(mi_scan_profile_t profile) {
+    return mi_scan_config[profile].window_ms * 1000 / mi_scan_config[profile].interval_ms;
+}
+
+// Credit the radio time of the schedule in force since the last call, with the pool lock held
+static void _mi_scan_account(void) {
+    int64_t now = esp_timer_get_time();
+    if (mi_pool.scanning)
+        mi_pool.radio_on_us += (now - mi_pool.scan_since) * _mi_scan_duty(mi_pool.scan_profile) / 1000;
+    mi_pool.scan_since = now;
+}
+
+static mi_scan_profile_t _mi_scan_want(void) {
+    return (xTaskGetTickCount() - mi_pool.scan_burst < pdMS_TO_TICKS(MI_SCAN_BURST_MS)) ? MI_SCAN_BURST : MI_SCAN_BACKOFF;
+}
+
+static void _mi_scan_burst(void) {
+    mi_pool.scan_burst = xTaskGetTickCount();
+}
+
+// Scanning starts once the controller has taken the parameters, see ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT
+static void _mi_scan_apply(void) {
+    portENTER_CRITICAL(&mi_pool.lock);
+    mi_scan_config_t config = mi_scan_config[mi_pool.scan_profile];
+    portEXIT_CRITICAL(&mi_pool.lock);
+    esp_ble_scan_params_t params = {
+        .scan_type              = (config.active) ? BLE_SCAN_TYPE_ACTIVE : BLE_SCAN_TYPE_PASSIVE,
+        .own_addr_type          = BLE_ADDR_TYPE_PUBLIC,
+        .scan_filter_policy     = BLE_SCAN_FILTER_ALLOW_ALL,
+        .scan_interval          = MI_SCAN_UNITS(config.interval_ms),
+        .scan_window            = MI_SCAN_UNITS(config.window_ms),
+        .scan_duplicate         = BLE_SCAN_DUPLICATE_DISABLE,
+    };
+    esp_err_t ret = esp_ble_gap_set_scan_params(&params);
+    ERROR_CHECKE( ret != ESP_OK, "set scan params failed", return);
+}
+
+// Move a running scan to the profile the schedule asks for
+static void _mi_scan_schedule(void) {
+    bool restart = false;
+    mi_scan_profile_t want = _mi_scan_want();
+    portENTER_CRITICAL(&mi_pool.lock);
+    if (mi_pool.scanning && !mi_pool.scan_switching && mi_pool.scan_profile != want) {
+        _mi_scan_account();
+        mi_pool.scan_profile = want;
+        mi_pool.scan_switching = true;
+        restart = true;
+    }
+    portEXIT_CRITICAL(&mi_pool.lock);
+    if (restart) {
+        ESP_LOGI(TAG, "Scan %s, duty %d/1000", (want == MI_SCAN_BURST) ? "burst" : "backoff", _mi_scan_duty(want));
+        esp_ble_gap_stop_scanning();
+    }
+}
+
+static void _mi_scan_start(void) {
+    bool start = false;
+    portENTER_CRITICAL(&mi_pool.lock);
+    if (!mi_pool.scanning) {
+        _mi_scan_account();
+        mi_pool.scanning = true;
+        mi_pool.scan_profile = _mi_scan_want();
+        start = true;
+    }
+    portEXIT_CRITICAL(&mi_pool.lock);
+    if (start) {
+        ESP_LOGI(TAG, "Start scan device, duty %d/1000", _mi_scan_duty(mi_pool.scan_profile));
+        _mi_scan_apply();
+    } else {
+        _mi_scan_schedule();
+    }
+}
+
+// As central the update needs no consent from the sensor, ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT reports the result
+static void _mi_conn_apply(mi_thermometer_t *mi, mi_conn_profile_t profile) {
+    portENTER_CRITICAL(&mi_pool.lock);
+    mi_conn_config_t config = mi_conn_config[profile];
+    portEXIT_CRITICAL(&mi_pool.lock);
+    esp_ble_conn_update_params_t params = {
+        .min_int = MI_CONN_UNITS(config.interval_min_ms),
+        .max_int = MI_CONN_UNITS(config.interval_max_ms),
+        .latency = config.latency,
+        .timeout = config.timeout_ms / 10,
+    };
+    memcpy(params.bda, mi->bda, sizeof(esp_bd_addr_t));
+    mi->conn_profile = profile;
+    esp_err_t ret = esp_ble_gap_update_conn_params(&params);
+    ERROR_CHECKE( ret != ESP_OK, "update conn params failed", return);
+}
+
+static void _mi_scan_stopped(void) {
+    portENTER_CRITICAL(&mi_pool.lock);
+    _mi_scan_account();
+    mi_pool.scanning = false;
+    portEXIT_CRITICAL(&mi_pool.lock);
+}
+
+static void _mi_wait(mi_thermometer_t *mi, EventBits_t wait) {
+    mi->bits = 0;
+    mi->wait = wait;
+    mi->wait_any = 0;
+    mi->start = xTaskGetTickCount();
+    mi->timeout = pdMS_TO_TICKS(mi_timeout_ms[mi->state]);
+}
+
+static esp_err_t _mi_write_char_descr(mi_thermometer_t *mi, uint16_t handle) {
+    uint8_t notify_en = 1;
+    _mi_wait(mi, EVT_WRITE);
+    return esp_ble_gattc_write_char_descr(mi_pool.gattcif, mi->conn_id, handle, sizeof(notify_en),(uint8_t *)&notify_en, ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
+}
+
+// REG_FOR_NOTIFY_EVT names the handle only and every sensor has the same ones, so one registration
+// is in flight at a time; the others start from the callback as the one before is answered
+static esp_err_t _mi_register_for_notify(mi_thermometer_t *mi, uint16_t handle) {
+    _mi_wait(mi, EVT_REGISTER);
+    portENTER_CRITICAL(&mi_pool.lock);
+    bool start = (mi_pool.registering == NULL);
+    mi->notify_pending = handle;
+    if (start)
+        mi_pool.registering = mi;
+    portEXIT_CRITICAL(&mi_pool.lock);
+    if (!start)
+        return ESP_OK;
+    esp_err_t ret = esp_ble_gattc_register_for_notify(mi_pool.gattcif, mi->bda, handle);
+    if (ret != ESP_OK) {
+        portENTER_CRITICAL(&mi_pool.lock);
+        mi_pool.registering = NULL;
+        portEXIT_CRITICAL(&mi_pool.lock);
+    }
+    return ret;
+}
+
+static esp_err_t _mi_write_char(mi_thermometer_t *mi, uint16_t handle, uint8_t *value, uint16_t len) {
+    _mi_wait(mi, EVT_WRITE);
+    return esp_ble_gattc_write_char(mi_pool.gattcif, mi->conn_id, handle, len, value, ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
+}
+
+static void _mi_char_store(mi_char_t *c, const void *data, uint16_t len) {
+    if (len > MI_CHAR_LEN)
+        len = MI_CHAR_LEN;
+    memcpy(c->data, data, len);
+    c->data[len] = '\0';
+    c->len = len;
+}
+
+// Device information characteristics in read order, MI_READ_MODEL + i reads the i-th
+static mi_char_t *_mi_dis_char(mi_thermometer_t *mi, uint8_t i) {
+    mi_char_t *chars[MI_DIS_CHARS] = {
+        &mi->model_char, &mi->serial_char, &mi->fw_char, &mi->hw_char, &mi->sw_char, &mi->battery_char,
+    };
+    return (i < MI_DIS_CHARS) ? chars[i] : NULL;
+}
+
+// Store a read by handle, true if it answers what the current state asked for
+static bool _mi_char_data(mi_thermometer_t *mi, uint16_t handle, uint8_t *data, uint16_t len) {
+    bool match = false;
+    if (handle == mi->history.clock_handle && mi->state == MI_SYNC_HISTORY) {
+        if (len < MI_CLOCK_LEN)
+            return false;
+        mi->history.clock = (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+        mi->history.clock_at = esp_timer_get_time();
+        return true;
     }
+    for (uint8_t i = 0; i < MI_DIS_CHARS; i++) {
+        mi_char_t *c = _mi_dis_char(mi, i);
+        if (c->handle != handle)
+            continue;
+        _mi_char_store(c, data, len);
+        match = (mi->state == MI_READ_DEVICE) || (mi->state == (mi_state_t)(MI_READ_MODEL + i));
+        break;
+    }
+    return match;
+}
+
+static void _mi_cache_char_restore(mi_char_t *c, const mi_cache_char_t *cc) {
+    c->handle = cc->handle;
+    _mi_char_store(c, cc->data, (cc->len < MI_CACHE_STR_LEN) ? cc->len : MI_CACHE_STR_LEN);
+}
+
+static void _mi_cache_char_backup(mi_cache_char_t *cc, const mi_char_t *c) {
+    cc->handle = c->handle;
+    cc->len = (c->len < MI_CACHE_STR_LEN) ? c->len : MI_CACHE_STR_LEN;
+    memcpy(cc->data, c->data, cc->len);
+}
+
+static bool _mi_cache_restore(mi_thermometer_t *mi) {
+    mi_cache_t cache;
+    if (mi_cache_load(mi->bda, &cache) != ESP_OK)
+        return false;
+    _mi_cache_char_restore(&mi->model_char, &cache.model_char);
+    _mi_cache_char_restore(&mi->serial_char, &cache.serial_char);
+    _mi_cache_char_restore(&mi->fw_char, &cache.fw_char);
+    _mi_cache_char_restore(&mi->hw_char, &cache.hw_char);
+    _mi_cache_char_restore(&mi->sw_char, &cache.sw_char);
+    _mi_cache_char_restore(&mi->battery_char, &cache.battery_char);
+    mi->temp_hum_char.handle = cache.temp_hum_handle;
+    mi->handle_write = cache.handle_write;
+    mi->history.handle = cache.history_handle;
+    mi->history.ccc = cache.history_ccc;
+    mi->history.index_handle = cache.history_index_handle;
+    mi->history.clock_handle = cache.history_clock_handle;
+    return true;
+}
+
+static void _mi_cache_backup(mi_thermometer_t *mi) {
+    mi_cache_t cache;
+    memset(&cache, 0, sizeof(mi_cache_t));
+    _mi_cache_char_backup(&cache.model_char, &mi->model_char);
+    _mi_cache_char_backup(&cache.serial_char, &mi->serial_char);
+    _mi_cache_char_backup(&cache.fw_char, &mi->fw_char);
+    _mi_cache_char_backup(&cache.hw_char, &mi->hw_char);
+    _mi_cache_char_backup(&cache.sw_char, &mi->sw_char);
+    _mi_cache_char_backup(&cache.battery_char, &mi->battery_char);
+    cache.temp_hum_handle = mi->temp_hum_char.handle;
+    cache.handle_write = mi->handle_write;
+    cache.history_handle = mi->history.handle;
+    cache.history_ccc = mi->history.ccc;
+    cache.history_index_handle = mi->history.index_handle;
+    cache.history_clock_handle = mi->history.clock_handle;
+    esp_err_t ret = mi_cache_save(mi->bda, &cache);
+    if (ret != ESP_OK)
+        ESP_LOGE(TAG, "[%d] save handle cache failed: %x", mi->index, ret);
+}
+
+static esp_err_t _mi_read_handle(mi_thermometer_t *mi, uint16_t handle) {
+    _mi_wait(mi, EVT_READ);
+    esp_err_t ret = esp_ble_gattc_read_char(mi_pool.gattcif, mi->conn_id, handle, ESP_GATT_AUTH_REQ_NONE);
+    ERROR_CHECKE( ret != ESP_OK, "gattc read failed", return ret);
     return ESP_OK;
 }
 
-static void _mi_read_device_services(void) {
+// Queue every device information read, the GATT client sends them back to back
+static esp_err_t _mi_read_device(mi_thermometer_t *mi) {
+    esp_err_t ret = ESP_OK;
+    _mi_wait(mi, EVT_READ);
+    mi->reads_pending = 0;
+    for (uint8_t i = 0; i < MI_DIS_CHARS && ret == ESP_OK; i++) {
+        mi_char_t *c = _mi_dis_char(mi, i);
+        if (c->handle == 0)
+            continue;
+        ret = esp_ble_gattc_read_char(mi_pool.gattcif, mi->conn_id, c->handle, ESP_GATT_AUTH_REQ_NONE);
+        if (ret == ESP_OK)
+            mi->reads_pending++;
+    }
+    return ret;
+}
+
+static void _mi_read_device_services(mi_thermometer_t *mi) {
     esp_gattc_service_elem_t service_result[10];
     uint16_t scount = 10;
-    if (esp_ble_gattc_get_service(mi_thermometer.gattcif, mi_thermometer.conn_id, NULL, service_result, &scount, 0) == ESP_OK) {
+    if (esp_ble_gattc_get_service(mi_pool.gattcif, mi->conn_id, NULL, service_result, &scount, 0) == ESP_OK) {
         for (uint16_t s = 0; s < scount; s++) {
             esp_gattc_char_elem_t char_result[20];
             uint16_t ccount = 20;
-            if (esp_ble_gattc_get_all_char(mi_thermometer.gattcif, mi_thermometer.conn_id, service_result[s].start_handle, service_result[s].end_handle, char_result, &ccount, 0) == ESP_OK) {
+            if (esp_ble_gattc_get_all_char(mi_pool.gattcif, mi->conn_id, service_result[s].start_handle, service_result[s].end_handle, char_result, &ccount, 0) == ESP_OK) {
                 for (uint16_t c = 0; c < ccount; c++) {
                     if(char_result[c].uuid.len == ESP_UUID_LEN_16) {
                         if(char_result[c].uuid.uuid.uuid16 == ESP_GATT_UUID_MODEL_NUMBER_STR) {
-                            mi_thermometer.model_char.handle = char_result[c].char_handle;
+                            mi->model_char.handle = char_result[c].char_handle;
                         }
                         else if(char_result[c].uuid.uuid.uuid16 == ESP_GATT_UUID_SERIAL_NUMBER_STR) {
-                            mi_thermometer.serial_char.handle = char_result[c].char_handle;
+                            mi->serial_char.handle = char_result[c].char_handle;
                         }
                         else if(char_result[c].uuid.uuid.uuid16 == ESP_GATT_UUID_FW_VERSION_STR) {
-                            mi_thermometer.fw_char.handle = char_result[c].char_handle;
+                            mi->fw_char.handle = char_result[c].char_handle;
                         }
                         else if(char_result[c].uuid.uuid.uuid16 == ESP_GATT_UUID_HW_VERSION_STR) {
-                            mi_thermometer.hw_char.handle = char_result[c].char_handle;
+                            mi->hw_char.handle = char_result[c].char_handle;
                         }
                         else if(char_result[c].uuid.uuid.uuid16 == ESP_GATT_UUID_SW_VERSION_STR) {
-                            mi_thermometer.sw_char.handle = char_result[c].char_handle;
+                            mi->sw_char.handle = char_result[c].char_handle;
                         }
                         else if(char_result[c].uuid.uuid.uuid16 == ESP_GATT_UUID_BATTERY_LEVEL) {
-                            mi_thermometer.battery_char.handle = char_result[c].char_handle;
+                            mi->battery_char.handle = char_result[c].char_handle;
                         }
                     }
                     else {
                         if(memcmp(char_result[c].uuid.uuid.uuid128, MI_DATA_CHAR_UUID, char_result[c].uuid.len) == 0) {
-                            mi_thermometer.temp_hum_char.handle = char_result[c].char_handle;
+                            mi->temp_hum_char.handle = char_result[c].char_handle;
                             esp_gattc_descr_elem_t descr_result[20];
                             uint16_t dcount = 20;
-                            if (esp_ble_gattc_get_all_descr(mi_thermometer.gattcif, mi_thermometer.conn_id, char_result[c].char_handle, descr_result, &dcount, 0) == ESP_OK) {
+                            if (esp_ble_gattc_get_all_descr(mi_pool.gattcif, mi->conn_id, char_result[c].char_handle, descr_result, &dcount, 0) == ESP_OK) {
                                 for (uint16_t d = 0; d < dcount; d++) {
                                     if (descr_result[d].uuid.uuid.uuid16 == ESP_GATT_UUID_CHAR_CLIENT_CONFIG) {
-                                        mi_thermometer.handle_write = descr_result[d].handle;
+                                        mi->handle_write = descr_result[d].handle;
                                     }
                                 }
                             } 
                         }
+                        else if(memcmp(char_result[c].uuid.uuid.uuid128, MI_HISTORY_CHAR_UUID, char_result[c].uuid.len) == 0) {
+                            mi->history.handle = char_result[c].char_handle;
+                            esp_gattc_descr_elem_t descr_result[20];
+                            uint16_t dcount = 20;
+                            if (esp_ble_gattc_get_all_descr(mi_pool.gattcif, mi->conn_id, char_result[c].char_handle, descr_result, &dcount, 0) == ESP_OK) {
+                                for (uint16_t d = 0; d < dcount; d++) {
+                                    if (descr_result[d].uuid.uuid.uuid16 == ESP_GATT_UUID_CHAR_CLIENT_CONFIG) {
+                                        mi->history.ccc = descr_result[d].handle;
+                                    }
+                                }
+                            }
+                        }
+                        else if(memcmp(char_result[c].uuid.uuid.uuid128, MI_HISTORY_INDEX_CHAR_UUID, char_result[c].uuid.len) == 0) {
+                            mi->history.index_handle = char_result[c].char_handle;
+                        }
+                        else if(memcmp(char_result[c].uuid.uuid.uuid128, MI_CLOCK_CHAR_UUID, char_result[c].uuid.len) == 0) {
+                            mi->history.clock_handle = char_result[c].char_handle;
+                        }
                     }
                 }
             }
@@ -185,13 +658,62 @@ static void _mi_read_device_services(void) {
     }
 }
 
+// GATTC callback side of the history download: only copy, mi_task decodes in batches
+static void _mi_history_notify(mi_thermometer_t *mi, const uint8_t *value, uint16_t len) {
+    mi_history_sync_t *h = &mi->history;
+    bool post = false;
+    if (len < MI_HISTORY_RECORD_LEN || mi->state != MI_SYNC_HISTORY)
+        return;
+    portENTER_CRITICAL(&mi_pool.lock);
+    if (h->count < MI_HISTORY_BATCH) {
+        memcpy(h->raw[h->count++], value, MI_HISTORY_RECORD_LEN);
+    } else {
+        uint32_t index = (uint32_t)value[0] | ((uint32_t)value[1] << 8) | ((uint32_t)value[2] << 16) | ((uint32_t)value[3] << 24);
+        if (!h->overflow || index < h->dropped_from)
+            h->dropped_from = index;
+        h->overflow = true;
+    }
+    if (h->count >= MI_HISTORY_BATCH / 2 && !h->posted) {
+        h->posted = true;
+        post = true;
+    }
+    portEXIT_CRITICAL(&mi_pool.lock);
+    if (post)
+        _mi_post(mi->index, EVT_HISTORY);
+}
+
+// Decode what the callback buffered and hand it on, the resume point never passes a lost record
+static void _mi_history_deliver(mi_thermometer_t *mi) {
+    static uint8_t raw[MI_HISTORY_BATCH][MI_HISTORY_RECORD_LEN];
+    static mi_history_record_t records[MI_HISTORY_BATCH];
+    mi_history_sync_t *h = &mi->history;
+    portENTER_CRITICAL(&mi_pool.lock);
+    uint8_t n = h->count;
+    memcpy(raw, h->raw, n * MI_HISTORY_RECORD_LEN);
+    h->count = 0;
+    h->posted = false;
+    portEXIT_CRITICAL(&mi_pool.lock);
+    size_t count = mi_decode_history(raw[0], n, records);
+    for (size_t i = 0; i < count; i++) {
+        if (records[i].index >= h->next && !(h->overflow && records[i].index >= h->dropped_from))
+            h->next = records[i].index + 1;
+    }
+    h->received += count;
+    uint32_t sensor_now = h->clock + (esp_timer_get_time() - h->clock_at) / 1000000;
+    if (count > 0 && mi_history_cb)
+        mi_history_cb(mi->bda, records, count, sensor_now, mi_history_arg);
+}
+
 static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param) {
+#ifdef MI_TRACE
+    mi_trace_gattc(event, gattc_if, param);
+#endif
     if (event == ESP_GATTC_REG_EVT) {
         if (param->reg.status == ESP_GATT_OK) {
             if (param->reg.app_id == MI_APPID) {
-                if(mi_thermometer.gattcif == 0)
-                    mi_thermometer.gattcif = gattc_if;
-                xEventGroupSetBits(mi_thermometer.event, EVT_READY);
+                if(mi_pool.gattcif == 0)
+                    mi_pool.gattcif = gattc_if;
+                _mi_post(MI_INDEX_ALL, EVT_READY);
             }
         } else {
             ESP_LOGE(TAG, "Reg app failed, app_id %04x, status %d", param->reg.app_id, param->reg.status);
@@ -199,19 +721,32 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp
         }
     }
 
-    if (gattc_if == ESP_GATT_IF_NONE || gattc_if == mi_thermometer.gattcif) {
+    if (gattc_if == ESP_GATT_IF_NONE || gattc_if == mi_pool.gattcif) {
         esp_ble_gattc_cb_param_t *p_data = (esp_ble_gattc_cb_param_t *)param;
+        mi_thermometer_t *mi = NULL;
         switch ((int)event) {
         case ESP_GATTC_READ_CHAR_EVT:
         case ESP_GATTC_READ_DESCR_EVT: {
-            if(p_data->read.conn_id == mi_thermometer.conn_id) {
-                _mi_char_data(p_data->read.value, p_data->read.value_len);
-                xEventGroupSetBits(mi_thermometer.event, EVT_READ);
+            mi = _mi_find_by_conn_id(p_data->read.conn_id);
+            if(mi == NULL)
+                break;
+            if (p_data->read.status != ESP_GATT_OK) {
+                ESP_LOGE(TAG, "[%d] read handle %d failed, status %x", mi->index, p_data->read.handle, p_data->read.status);
+                _mi_post(mi->index, EVT_ERROR);
+                break;
             }
+            // Answers to abandoned pipelined reads are stored but complete nothing
+            if (_mi_char_data(mi, p_data->read.handle, p_data->read.value, p_data->read.value_len))
+                _mi_post(mi->index, EVT_READ);
             break;
         }
         case ESP_GATTC_CONNECT_EVT: {
-            esp_err_t mtu_ret = esp_ble_gattc_send_mtu_req(mi_thermometer.gattcif, mi_thermometer.conn_id);
+            mi = _mi_find_by_bda(p_data->connect.remote_bda);
+            if (mi == NULL)
+                break;
+            mi->conn_id = p_data->connect.conn_id;
+            _mi_conn_apply(mi, MI_CONN_FAST);
+            esp_err_t mtu_ret = esp_ble_gattc_send_mtu_req(mi_pool.gattcif, mi->conn_id);
             if (mtu_ret) {
                 ESP_LOGE(TAG, "config MTU error, error code = %x", mtu_ret);
             }
@@ -221,29 +756,97 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp
             if (param->cfg_mtu.status != ESP_GATT_OK) {
                 ESP_LOGE(TAG,"Config mtu failed");
             }
-            xEventGroupSetBits(mi_thermometer.event, EVT_OPEN);
+            mi = _mi_find_by_conn_id(param->cfg_mtu.conn_id);
+            if (mi)
+                _mi_post(mi->index, EVT_OPEN);
             break;
+        case ESP_GATTC_WRITE_CHAR_EVT:
         case ESP_GATTC_WRITE_DESCR_EVT: {
-            if(p_data->write.conn_id == mi_thermometer.conn_id)
-                xEventGroupSetBits(mi_thermometer.event, EVT_WRITE);
+            mi = _mi_find_by_conn_id(p_data->write.conn_id);
+            if(mi)
+                _mi_post(mi->index, (p_data->write.status == ESP_GATT_OK) ? EVT_WRITE : EVT_ERROR);
             break;
         }
         case ESP_GATTC_REG_FOR_NOTIFY_EVT: {
-            xEventGroupSetBits(mi_thermometer.event, EVT_REGISTER);
+            // The event carries neither conn_id nor address, it answers the one registration in flight
+            mi_thermometer_t *next = NULL;
+            esp_bd_addr_t next_bda;
+            uint16_t next_handle = 0;
+            portENTER_CRITICAL(&mi_pool.lock);
+            mi = mi_pool.registering;
+            if (mi && mi->notify_pending == p_data->reg_for_notify.handle)
+                mi->notify_pending = 0;
+            else
+                mi = NULL;
+            mi_pool.registering = NULL;
+            for (uint8_t i = 0; i < MI_MAX_SENSORS && next == NULL; i++) {
+                if (mi_pool.sensors[i].notify_pending == 0)
+                    continue;
+                next = mi_pool.registering = &mi_pool.sensors[i];
+                memcpy(next_bda, next->bda, sizeof(esp_bd_addr_t));
+                next_handle = next->notify_pending;
+            }
+            portEXIT_CRITICAL(&mi_pool.lock);
+            if (mi)
+                _mi_post(mi->index, (p_data->reg_for_notify.status == ESP_GATT_OK) ? EVT_REGISTER : EVT_ERROR);
+            if (next && esp_ble_gattc_register_for_notify(mi_pool.gattcif, next_bda, next_handle) != ESP_OK) {
+                // Its state times out and asks again
+                portENTER_CRITICAL(&mi_pool.lock);
+                mi_pool.registering = NULL;
+                portEXIT_CRITICAL(&mi_pool.lock);
+            }
             break;
         }
         case ESP_GATTC_NOTIFY_EVT: {
-            if(p_data->notify.conn_id == mi_thermometer.conn_id) {
-                _mi_char_data(p_data->notify.value, p_data->notify.value_len);
+            mi = _mi_find_by_conn_id(p_data->notify.conn_id);
+            if (mi && mi->history.handle != 0 && p_data->notify.handle == mi->history.handle) {
+                _mi_history_notify(mi, p_data->notify.value, p_data->notify.value_len);
+                break;
             }
+            if(mi == NULL || p_data->notify.handle != mi->temp_hum_char.handle)
+                break;
+            mi_reading_t reading;
+            esp_err_t ret = mi_decode_data(p_data->notify.value, p_data->notify.value_len, &reading);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "[%d] bad notification, len %d: %x", mi->index, p_data->notify.value_len, ret);
+                break;
+            }
+            int64_t now = esp_timer_get_time();
+            portENTER_CRITICAL(&mi_pool.lock);
+            mi->reading = reading;
+            mi->updated = now;
+            portEXIT_CRITICAL(&mi_pool.lock);
+            mi_sample_t sample = {
+                .temp = reading.temp,
+                .hum = reading.hum,
+                .battery_mv = reading.battery_mv,
+                .time = now / 1000000,
+            };
+            memcpy(sample.bda, mi->bda, sizeof(esp_bd_addr_t));
+            mi_channel_publish(&sample);
+            _mi_post(mi->index, EVT_NOTIFY);
             break;
         }
         case ESP_GATTC_OPEN_EVT:
             if ((p_data->open.status == ESP_GATT_OK) || (p_data->open.status == ESP_GATT_ALREADY_OPEN)) {
-                mi_thermometer.conn_id = p_data->open.conn_id;
+                mi = _mi_find_by_bda(p_data->open.remote_bda);
+                if (mi)
+                    mi->conn_id = p_data->open.conn_id;
             }
             else {
                 ESP_LOGE(TAG, "connect device failed, status %02x", p_data->open.status);
+                mi = _mi_find_by_bda(p_data->open.remote_bda);
+                if (mi)
+                    _mi_post(mi->index, EVT_CLOSE);
+            }
+            break;
+        case ESP_GATTC_DISCONNECT_EVT:
+            mi = _mi_find_by_conn_id(p_data->disconnect.conn_id);
+            if (mi == NULL)
+                mi = _mi_find_by_bda(p_data->disconnect.remote_bda);
+            if (mi) {
+                ESP_LOGW(TAG, "[%d] disconnected, reason %x", mi->index, p_data->disconnect.reason);
+                _mi_post(mi->index, EVT_CLOSE);
             }
             break;
         case ESP_GATTC_SEARCH_CMPL_EVT:
@@ -251,10 +854,14 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp
                 ESP_LOGE(TAG, "search service failed, error status = %x", p_data->search_cmpl.status);
                 break;
             }
-            xEventGroupSetBits(mi_thermometer.event, EVT_SEARCH_SERVICE);
+            mi = _mi_find_by_conn_id(p_data->search_cmpl.conn_id);
+            if (mi)
+                _mi_post(mi->index, EVT_SEARCH_SERVICE);
             break;
         case ESP_GATTC_DIS_SRVC_CMPL_EVT:
-            xEventGroupSetBits(mi_thermometer.event, EVT_SEARCH_SERVICE);
+            mi = _mi_find_by_conn_id(p_data->dis_srvc_cmpl.conn_id);
+            if (mi)
+                _mi_post(mi->index, EVT_SEARCH_SERVICE);
             break;
         default:
             break;
@@ -262,27 +869,166 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp
     }
 }
 
+#ifdef MI_PASSIVE_MODE
+static bool _mi_adv_update(esp_ble_gap_cb_param_t *scan_result) {
+    mi_adv_data_t data;
+    if (mi_adv_decode(scan_result->scan_rst.bda, scan_result->scan_rst.ble_adv, scan_result->scan_rst.adv_data_len + scan_result->scan_rst.scan_rsp_len, &data) != ESP_OK)
+        return false;
+    int64_t now = esp_timer_get_time();
+    mi_adv_sensor_t *entry = NULL;
+    mi_adv_sensor_t *oldest = &mi_pool.adv_sensors[0];
+    bool added = false;
+    portENTER_CRITICAL(&mi_pool.lock);
+    for (uint16_t i = 0; i < MI_MAX_ADV_SENSORS; i++) {
+        mi_adv_sensor_t *s = &mi_pool.adv_sensors[i];
+        if (s->used && memcmp(s->bda, scan_result->scan_rst.bda, sizeof(esp_bd_addr_t)) == 0) {
+            entry = s;
+            break;
+        }
+        if (!s->used || (oldest->used && s->last_seen < oldest->last_seen))
+            oldest = s;
+    }
+    if (entry == NULL) {
+        // Table full, forget the sensor heard from least recently
+        entry = oldest;
+        memset(entry, 0, sizeof(mi_adv_sensor_t));
+        memcpy(entry->bda, scan_result->scan_rst.bda, sizeof(esp_bd_addr_t));
+        entry->used = true;
+        added = true;
+    }
+    uint8_t counter = entry->data.counter;
+    // MiBeacon sends one object per frame, merge instead of overwrite
+    if (data.flags & MI_ADV_HAS_TEMP)
+        entry->data.temp = data.temp;
+    if (data.flags & MI_ADV_HAS_HUM)
+        entry->data.hum = data.hum;
+    if (data.flags & MI_ADV_HAS_BATTERY)
+        entry->data.battery = data.battery;
+    if (data.flags & MI_ADV_HAS_BATTERY_MV)
+        entry->data.battery_mv = data.battery_mv;
+    entry->data.counter = data.counter;
+    entry->data.format = data.format;
+    entry->data.flags |= data.flags;
+    entry->rssi = scan_result->scan_rst.rssi;
+    entry->last_seen = now;
+    mi_sample_t sample = {
+        .temp = entry->data.temp,
+        .hum = entry->data.hum / 100,
+        .battery_mv = entry->data.battery_mv,
+        .time = now / 1000000,
+    };
+    bool complete = (entry->data.flags & (MI_ADV_HAS_TEMP | MI_ADV_HAS_HUM)) == (MI_ADV_HAS_TEMP | MI_ADV_HAS_HUM);
+    portEXIT_CRITICAL(&mi_pool.lock);
+    // Sensors repeat each frame several times, only a new counter is a new sample
+    if (complete && (added || data.counter != counter)) {
+        memcpy(sample.bda, scan_result->scan_rst.bda, sizeof(esp_bd_addr_t));
+        mi_channel_publish(&sample);
+    }
+    if (added)
+        ESP_LOGW(TAG, "Add adv device: ["MACSTR"] format: %d RSSI: %d", MAC2STR(scan_result->scan_rst.bda), data.format, scan_result->scan_rst.rssi);
+    return added;
+}
+#endif
+
 static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
     uint8_t *adv_name = NULL;
     esp_ble_gap_cb_param_t *scan_result;
     uint8_t adv_name_len = 0;
+#ifdef MI_TRACE
+    mi_trace_gap(event, param);
+#endif
     switch ((int)event) {
+    case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
+        if (mi_pool.scanning)
+            esp_ble_gap_start_scanning(0);
+        break;
+    case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT: {
+        // Stopped to switch profiles, restart with the new parameters unless scanning was called off meanwhile
+        bool apply = false;
+        portENTER_CRITICAL(&mi_pool.lock);
+        if (mi_pool.scan_switching) {
+            mi_pool.scan_switching = false;
+            apply = mi_pool.scanning;
+        }
+        portEXIT_CRITICAL(&mi_pool.lock);
+        if (apply)
+            _mi_scan_apply();
+        break;
+    }
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT: {
+        mi_thermometer_t *mi = _mi_find_by_bda(param->update_conn_params.bda);
+        if (mi == NULL)
+            break;
+        if (param->update_conn_params.status != ESP_BT_STATUS_SUCCESS) {
+            ESP_LOGW(TAG, "[%d] update conn params failed, status %x", mi->index, param->update_conn_params.status);
+            break;
+        }
+        ESP_LOGI(TAG, "[%d] conn interval %d.%02d ms, latency %d, timeout %d ms", mi->index,
+                 param->update_conn_params.conn_int * 125 / 100, param->update_conn_params.conn_int * 125 % 100,
+                 param->update_conn_params.latency, param->update_conn_params.timeout * 10);
+        break;
+    }
     case ESP_GAP_BLE_SCAN_RESULT_EVT:
         scan_result = (esp_ble_gap_cb_param_t *)param;
         switch (scan_result->scan_rst.search_evt) {
         case ESP_GAP_SEARCH_INQ_RES_EVT:
+            // Drop phones and beacons before anything walks their adv data
+            if (!mi_filter_match(scan_result->scan_rst.bda, scan_result->scan_rst.ble_adv,
+                                 scan_result->scan_rst.adv_data_len + scan_result->scan_rst.scan_rsp_len))
+                break;
+#ifdef MI_PASSIVE_MODE
+            // A new sensor may mean more are being installed nearby
+            if (_mi_adv_update(scan_result))
+                _mi_scan_burst();
+            _mi_scan_schedule();
+            break;
+#endif
             adv_name = esp_ble_resolve_adv_data(scan_result->scan_rst.ble_adv,
                                                 ESP_BLE_AD_TYPE_NAME_CMPL, &adv_name_len);
             bool is_exist = false;
+            uint16_t product;
             if (adv_name_len > 0 && strcmp((char*)"LYWSD03MMC", (char*)adv_name) == 0) {
                 is_exist = true;
+            } else if (mi_adv_product(scan_result->scan_rst.ble_adv, scan_result->scan_rst.adv_data_len + scan_result->scan_rst.scan_rsp_len, &product) == ESP_OK
+                       && product == MI_ADV_PRODUCT_LYWSD03MMC) {
+                // Passive scan, no name but the MiBeacon frame
+                is_exist = true;
             }
-            if (is_exist) {
-                ESP_LOGW(TAG, "Add device: %s ["MACSTR"] RSSI: %d", adv_name, MAC2STR(scan_result->scan_rst.bda), scan_result->scan_rst.rssi);
-                memcpy(mi_thermometer.bda, scan_result->scan_rst.bda, sizeof(esp_bd_addr_t));
-                esp_ble_gap_stop_scanning();
-                xEventGroupSetBits(mi_thermometer.event, EVT_SEARCH_DEVICE);
+            if (!is_exist || _mi_find_by_bda(scan_result->scan_rst.bda))
+                break;
+            // Hand the device to the first session waiting for one
+            mi_thermometer_t *mi = NULL;
+            bool waiting = false;
+            portENTER_CRITICAL(&mi_pool.lock);
+            for (uint8_t i = 0; i < MI_MAX_SENSORS; i++) {
+                if (mi_pool.sensors[i].assigned || mi_pool.sensors[i].state != MI_SCAN)
+                    continue;
+                if (mi == NULL) {
+                    mi = &mi_pool.sensors[i];
+                    _mi_assign(mi, scan_result->scan_rst.bda);
+                } else {
+                    waiting = true;
+                }
+            }
+            if (mi && !waiting) {
+                _mi_scan_account();
+                mi_pool.scanning = false;
             }
+            portEXIT_CRITICAL(&mi_pool.lock);
+            if (mi == NULL)
+                break;
+            _mi_scan_burst();
+            ESP_LOGW(TAG, "[%d] Add device: LYWSD03MMC ["MACSTR"] RSSI: %d", mi->index, MAC2STR(scan_result->scan_rst.bda), scan_result->scan_rst.rssi);
+            if (!waiting)
+                esp_ble_gap_stop_scanning();
+            _mi_post(mi->index, EVT_SEARCH_DEVICE);
+            break;
+        case ESP_GAP_SEARCH_INQ_CMPL_EVT:
+#ifdef MI_PASSIVE_MODE
+            esp_ble_gap_start_scanning(0);
+            break;
+#endif
+            _mi_scan_stopped();
             break;
         default:
             break;
@@ -293,105 +1039,698 @@ static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
     }
 }
 
+// Exponential in the failures so far, jittered so sensors lost together do not retry together
+static uint32_t _mi_backoff_ms(uint8_t failures) {
+    uint32_t delay = MI_RECONNECT_MAX_MS;
+    if (failures < 16 && (MI_RECONNECT_BASE_MS << failures) < MI_RECONNECT_MAX_MS)
+        delay = MI_RECONNECT_BASE_MS << failures;
+    return delay / 2 + esp_random() % (delay / 2 + 1);
+}
+
+static mi_step_t _mi_request(mi_thermometer_t *mi, esp_err_t ret) {
+    // A failed request is retried when the state times out
+    if (ret != ESP_OK)
+        ESP_LOGE(TAG, "[%d] state %d request failed: %x", mi->index, mi->state, ret);
+    return MI_STEP_WAIT;
+}
+
+static mi_step_t _mi_scan_action(mi_thermometer_t *mi, mi_state_t prev) {
+    // A session that just started looking means a sensor is missing, the retries keep the schedule
+    if (prev != MI_SCAN)
+        _mi_scan_burst();
+    _mi_scan_start();
+    return MI_STEP_WAIT;
+}
+
+static mi_step_t _mi_connect(mi_thermometer_t *mi, mi_state_t prev) {
+    if (mi->linked && prev != MI_CONNECT)
+        mi_stats_reconnect();
+    // Service discovery runs on its own after the link is up, the table waits for both
+    ESP_LOGI(TAG, "[%d] Open connect to ["ESP_BD_ADDR_STR"]", mi->index, ESP_BD_ADDR_HEX(mi->bda));
+    return _mi_request(mi, esp_ble_gattc_open(mi_pool.gattcif, mi->bda, BLE_ADDR_TYPE_PUBLIC, true));
+}
+
+static bool _mi_connected(mi_thermometer_t *mi) {
+    mi->linked = true;
+    // Known sensor, the service walk and the DIS reads skip themselves
+    mi->cached = _mi_cache_restore(mi);
+    return true;
+}
+
+#ifndef MI_POLL_MODE
+static mi_state_t _mi_connect_failed(mi_thermometer_t *mi, mi_state_t fail) {
+    // Drop a half open link, the backoff decides when to try again
+    if (mi->conn_id != MI_CONN_ID_INVALID)
+        esp_ble_gattc_close(mi_pool.gattcif, mi->conn_id);
+    mi->failures++;
+    return fail;
+}
+#endif
+
+static mi_step_t _mi_backoff(mi_thermometer_t *mi, mi_state_t prev) {
+    mi->conn_id = MI_CONN_ID_INVALID;
+    mi->notify_pending = 0;
+    if (mi->lost == 0)
+        mi->lost = mi->entered;
+    if (mi->failures >= MI_RECONNECT_ATTEMPTS) {
+        // The sensor may have moved or changed address, let any session find it again
+        ESP_LOGW(TAG, "[%d] giving up on ["ESP_BD_ADDR_STR"], scan again", mi->index, ESP_BD_ADDR_HEX(mi->bda));
+        mi_stats_scan_fallback();
+        mi->failures = 0;
+        portENTER_CRITICAL(&mi_pool.lock);
+        mi->assigned = false;
+        portEXIT_CRITICAL(&mi_pool.lock);
+        return MI_STEP_NEXT;
+    }
+    // No timeout in the table, the jittered delay is the whole wait
+    uint32_t delay = _mi_backoff_ms(mi->failures);
+    ESP_LOGW(TAG, "[%d] reconnect in %d ms, attempt %d", mi->index, delay, mi->failures + 1);
+    mi->timeout = pdMS_TO_TICKS(delay);
+    return MI_STEP_WAIT;
+}
+
+#ifdef MI_POLL_MODE
+// Close out the visit of the last polled sensor, with the pool lock held
+static void _mi_poll_finish(mi_thermometer_t *mi, int64_t now) {
+    if (mi->poll == MI_POLL_NONE)
+        return;
+    mi_poll_entry_t *e = &mi_pool.polls[mi->poll];
+    mi->poll = MI_POLL_NONE;
+    mi->assigned = false;
+    // Removed, or even replaced, while visited
+    if (!e->used || memcmp(e->bda, mi->bda, sizeof(esp_bd_addr_t)) != 0)
+        return;
+    e->busy = false;
+    if (mi->updated >= mi->poll_start) {
+        e->reading = mi->reading;
+        e->updated = mi->updated;
+        e->battery = (mi->battery_char.len) ? mi->battery_char.data[0] : 0;
+        // Keep the cadence, but a sensor served late does not get to catch up at the others' expense
+        e->due += (int64_t)e->period_ms * 1000;
+        if (e->due < now)
+            e->due = now;
+        mi_pool.poll_stats.polls++;
+    } else {
+        uint32_t retry = (e->period_ms < MI_POLL_RETRY_MS) ? e->period_ms : MI_POLL_RETRY_MS;
+        e->due = now + (int64_t)retry * 1000;
+        mi_pool.poll_stats.misses++;
+    }
+}
+#endif
+
+// Take the most overdue polled sensor, or sleep until the next one is due
+static mi_step_t _mi_poll_action(mi_thermometer_t *mi, mi_state_t prev) {
+#ifdef MI_POLL_MODE
+    int64_t now = esp_timer_get_time();
+    int64_t wake = INT64_MAX;
+    mi_poll_entry_t *pick = NULL;
+    mi->conn_id = MI_CONN_ID_INVALID;
+    mi->notify_pending = 0;
+    portENTER_CRITICAL(&mi_pool.lock);
+    _mi_poll_finish(mi, now);
+    for (uint8_t i = 0; i < MI_POLL_MAX; i++) {
+        mi_poll_entry_t *e = &mi_pool.polls[i];
+        if (!e->used || e->busy)
+            continue;
+        if (e->due > now) {
+            if (e->due < wake)
+                wake = e->due;
+        } else if (pick == NULL || e->due < pick->due) {
+            pick = e;
+        }
+    }
+    if (pick) {
+        uint32_t late_ms = (now - pick->due) / 1000;
+        if (late_ms > mi_pool.poll_stats.max_late_ms)
+            mi_pool.poll_stats.max_late_ms = late_ms;
+        pick->busy = true;
+        pick->session = mi->index;
+        _mi_assign(mi, pick->bda);
+        mi->poll = pick - mi_pool.polls;
+        mi->poll_start = now;
+    }
+    portEXIT_CRITICAL(&mi_pool.lock);
+    if (pick) {
+        ESP_LOGI(TAG, "[%d] poll ["ESP_BD_ADDR_STR"]", mi->index, ESP_BD_ADDR_HEX(mi->bda));
+        return MI_STEP_NEXT;
+    }
+    mi->timeout = (wake == INT64_MAX) ? 0 : pdMS_TO_TICKS((wake - now) / 1000) + 1;
+#endif
+    return MI_STEP_WAIT;
+}
+
+// A sensor was added while the session slept, take it now or sleep again
+static bool _mi_poll_woken(mi_thermometer_t *mi) {
+    _mi_wait(mi, EVT_POLL);
+    if (_mi_poll_action(mi, MI_POLL) == MI_STEP_WAIT)
+        return false;
+    mi->wait = 0;
+    return true;
+}
+
+static mi_step_t _mi_release(mi_thermometer_t *mi, mi_state_t prev) {
+    if (mi->conn_id == MI_CONN_ID_INVALID)
+        return MI_STEP_NEXT;
+    return _mi_request(mi, esp_ble_gattc_close(mi_pool.gattcif, mi->conn_id));
+}
+
+static mi_step_t _mi_search_service(mi_thermometer_t *mi, mi_state_t prev) {
+    if (!mi->cached)
+        _mi_read_device_services(mi);
+    return MI_STEP_NEXT;
+}
+
+static mi_step_t _mi_read_device_action(mi_thermometer_t *mi, mi_state_t prev) {
+    if (mi->cached)
+        return MI_STEP_NEXT;
+#ifdef MI_DIS_PIPELINE
+    if (mi->sequential)
+        return MI_STEP_FAIL;
+    esp_err_t ret = _mi_read_device(mi);
+    if (ret != ESP_OK) {
+        // Client queue refused, read the rest one at a time
+        ESP_LOGW(TAG, "[%d] pipelined reads refused: %x", mi->index, ret);
+        mi->sequential = true;
+        return MI_STEP_FAIL;
+    }
+    return (mi->reads_pending == 0) ? MI_STEP_NEXT : MI_STEP_WAIT;
+#else
+    return MI_STEP_FAIL;
+#endif
+}
+
+static bool _mi_read_device_done(mi_thermometer_t *mi) {
+    if (--mi->reads_pending > 0) {
+        _mi_wait(mi, EVT_READ);
+        return false;
+    }
+    ESP_LOGI(TAG, "[%d] Read model: \t%s, serial: %s", mi->index, mi->model_char.data, mi->serial_char.data);
+    ESP_LOGI(TAG, "[%d] Read fw: %s, hw: %s, sw: %s", mi->index, mi->fw_char.data, mi->hw_char.data, mi->sw_char.data);
+    ESP_LOGI(TAG, "[%d] Read battery: %d", mi->index, (mi->battery_char.len) ? mi->battery_char.data[0] : 0);
+    return true;
+}
+
+static mi_state_t _mi_read_device_failed(mi_thermometer_t *mi, mi_state_t fail) {
+    // Some sensors drop queued requests, read the rest one at a time
+    ESP_LOGW(TAG, "[%d] %d pipelined reads unanswered, read sequentially", mi->index, mi->reads_pending);
+    mi->sequential = true;
+    return fail;
+}
+
+static mi_step_t _mi_read_dis(mi_thermometer_t *mi, mi_state_t prev) {
+    return _mi_request(mi, _mi_read_handle(mi, _mi_dis_char(mi, mi->state - MI_READ_MODEL)->handle));
+}
+
+static bool _mi_read_dis_done(mi_thermometer_t *mi) {
+    static const char *names[MI_DIS_CHARS - 1] = { "model", "serial", "fw ver", "hw ver", "sw ver" };
+    uint8_t i = mi->state - MI_READ_MODEL;
+    mi_char_t *c = _mi_dis_char(mi, i);
+    if (c == &mi->battery_char)
+        ESP_LOGI(TAG, "[%d] Read battery: %d", mi->index, (c->len) ? c->data[0] : 0);
+    else
+        ESP_LOGI(TAG, "[%d] Read %s: \t%s", mi->index, names[i], c->data);
+    return true;
+}
+
+static mi_step_t _mi_notify_action(mi_thermometer_t *mi, mi_state_t prev) {
+    return _mi_request(mi, _mi_register_for_notify(mi, mi->temp_hum_char.handle));
+}
+
+static bool _mi_notify_done(mi_thermometer_t *mi) {
+    // Registered locally, now enable notifications on the sensor
+    if (mi->bits & EVT_REGISTER) {
+        _mi_request(mi, _mi_write_char_descr(mi, mi->handle_write));
+        return false;
+    }
+    if (!mi->cached)
+        _mi_cache_backup(mi);
+    if (mi->lost != 0) {
+        mi_stats_recovered(esp_timer_get_time() - mi->lost);
+        mi->lost = 0;
+    }
+    mi->failures = 0;
+    return true;
+}
+
+// Cached handles that fail are dropped and rediscovered
+static mi_state_t _mi_notify_failed(mi_thermometer_t *mi, mi_state_t fail) {
+    if (!mi->cached)
+        return fail;
+    ESP_LOGW(TAG, "[%d] cached handles rejected, discover services", mi->index);
+    mi->cached = false;
+    mi_cache_erase(mi->bda);
+    return MI_SEARCH_SERVICE;
+}
+
+static mi_step_t _mi_history_action(mi_thermometer_t *mi, mi_state_t prev) {
+    mi_history_sync_t *h = &mi->history;
+    if (h->handle == 0 || h->ccc == 0 || h->index_handle == 0 || h->clock_handle == 0 || mi_history_cb == NULL)
+        return MI_STEP_NEXT;
+    if (prev != MI_SYNC_HISTORY)
+        h->tries = 0;
+    if (mi_cache_load_index(mi->bda, &h->next) != ESP_OK)
+        h->next = 0;
+    h->count = 0;
+    h->posted = false;
+    h->overflow = false;
+    h->received = 0;
+    h->step = MI_HISTORY_CLOCK;
+    return _mi_request(mi, _mi_read_handle(mi, h->clock_handle));
+}
+
+// Read the clock, register, write the first record wanted, enable notifications, then take batches until the sensor is quiet
+static bool _mi_history_done(mi_thermometer_t *mi) {
+    mi_history_sync_t *h = &mi->history;
+    if (mi->bits & EVT_HISTORY)
+        _mi_history_deliver(mi);
+    if (h->step == MI_HISTORY_CLOCK) {
+        h->step = MI_HISTORY_REGISTER;
+        _mi_request(mi, _mi_register_for_notify(mi, h->handle));
+    } else if (h->step == MI_HISTORY_REGISTER) {
+        uint8_t index[4] = { h->next, h->next >> 8, h->next >> 16, h->next >> 24 };
+        h->step = MI_HISTORY_INDEX;
+        _mi_request(mi, _mi_write_char(mi, h->index_handle, index, sizeof(index)));
+    } else if (h->step == MI_HISTORY_INDEX) {
+        h->step = MI_HISTORY_ENABLE;
+        _mi_request(mi, _mi_write_char_descr(mi, h->ccc));
+        // The sensor may stream before the write response comes
+        mi->wait_any = EVT_HISTORY;
+    } else if (h->step == MI_HISTORY_ENABLE) {
+        ESP_LOGI(TAG, "[%d] history download from record %u", mi->index, h->next);
+        h->step = MI_HISTORY_STREAM;
+        h->start = esp_timer_get_time();
+        _mi_wait(mi, EVT_HISTORY);
+    } else {
+        _mi_wait(mi, EVT_HISTORY);
+    }
+    return false;
+}
+
+// Quiet sensor: the download is complete, or the sensor has no log to give
+static mi_state_t _mi_history_end(mi_thermometer_t *mi, mi_state_t fail) {
+    mi_history_sync_t *h = &mi->history;
+    if (h->step == MI_HISTORY_STREAM) {
+        _mi_history_deliver(mi);
+        int64_t elapsed = esp_timer_get_time() - h->start - MI_HISTORY_IDLE_MS * 1000LL;
+        ESP_LOGI(TAG, "[%d] history: %u records, %u records/s%s", mi->index, h->received,
+                 (elapsed > 0) ? (uint32_t)(h->received * 1000000LL / elapsed) : 0, (h->overflow) ? ", overflow" : "");
+        if (h->received > 0 && mi_cache_save_index(mi->bda, h->next) != ESP_OK)
+            ESP_LOGE(TAG, "[%d] save history index failed", mi->index);
+    } else if (h->step == MI_HISTORY_REGISTER && ++h->tries < MI_HISTORY_REGISTER_TRIES) {
+        // Refused while other sessions hold the table, they give their entry back when done
+        ESP_LOGI(TAG, "[%d] history register refused, retry", mi->index);
+        return MI_SYNC_HISTORY;
+    } else {
+        ESP_LOGW(TAG, "[%d] history not available", mi->index);
+    }
+    // The notification table is shared by all links, give the entry back for the next session
+    if (h->step > MI_HISTORY_REGISTER)
+        esp_ble_gattc_unregister_for_notify(mi_pool.gattcif, mi->bda, h->handle);
+    mi_stats_done(MI_SYNC_HISTORY, esp_timer_get_time() - mi->entered);
+    return fail;
+}
+
+static mi_step_t _mi_idle_action(mi_thermometer_t *mi, mi_state_t prev) {
+#ifdef MI_POLL_MODE
+    // The notification may have come while the history was checked, it is all the visit needs
+    return (mi->updated >= mi->poll_start) ? MI_STEP_NEXT : MI_STEP_WAIT;
+#else
+    // Only notifications from here on, let the link idle
+    if (mi->conn_profile != MI_CONN_SLOW)
+        _mi_conn_apply(mi, MI_CONN_SLOW);
+    return MI_STEP_WAIT;
+#endif
+}
+
+static bool _mi_idle_done(mi_thermometer_t *mi) {
+    ESP_LOGI(TAG, "[%d] Read temp: %2.1f, hum: %d, battery: %d mV", mi->index, mi->reading.temp / 100.0f, mi->reading.hum, mi->reading.battery_mv);
+    return true;
+}
+
+#ifndef MI_POLL_MODE
+static mi_state_t _mi_idle_failed(mi_thermometer_t *mi, mi_state_t fail) {
+    // Silent link, closing it ends in EVT_CLOSE and a reconnect
+    esp_ble_gattc_close(mi_pool.gattcif, mi->conn_id);
+    return fail;
+}
+#endif
+
+static const mi_step_def_t mi_steps[] = {
+    MI_STEPS(MI_STEP_DEF)
+};
+
+// "Has an action" is checked on the spelling of the column, comparing a function address to NULL is always true to -Waddress
+#define MI_STEP_CHECK(state, action, wait, timeout_ms, done, next, failed, fail, quiet) \
+    _Static_assert((int)MI_ROW_##state == (int)state, #state " out of order in MI_STEPS"); \
+    _Static_assert((next) <= MI_IDLE && (fail) <= MI_IDLE, #state " leads to an unknown state"); \
+    _Static_assert((wait) != 0 || sizeof(#action) != sizeof("NULL"), #state " has nothing to wait for and no action");
+MI_STEPS(MI_STEP_CHECK)
+_Static_assert(sizeof(mi_steps) / sizeof(mi_steps[0]) == MI_IDLE + 1, "MI_STEPS must cover every mi_state_t");
+
+// Run the action of each state until one waits, states with nothing to do chain on without recursion
+static void _mi_enter(mi_thermometer_t *mi, mi_state_t state, bool retry) {
+    mi_state_t prev = mi->state;
+    while (1) {
+        const mi_step_def_t *step = &mi_steps[state];
+#ifdef MI_STATE_DWELL_MS
+        vTaskDelay(pdMS_TO_TICKS(MI_STATE_DWELL_MS));
+#endif
+        mi->state = state;
+        mi->entered = esp_timer_get_time();
+        _mi_wait(mi, step->wait);
+        mi_step_t result = (step->action) ? step->action(mi, prev) : MI_STEP_WAIT;
+        if (result == MI_STEP_WAIT) {
+            mi_stats_enter(state, retry);
+            return;
+        }
+        mi->wait = 0;
+        prev = state;
+        state = (result == MI_STEP_NEXT) ? step->next : step->fail;
+        retry = false;
+    }
+}
+
+// The last awaited event arrived, multi-step states re-arm their wait until they are complete
+static void _mi_done(mi_thermometer_t *mi) {
+    const mi_step_def_t *step = &mi_steps[mi->state];
+    if (step->done && !step->done(mi))
+        return;
+    mi_stats_done(mi->state, esp_timer_get_time() - mi->entered);
+    _mi_enter(mi, step->next, false);
+}
+
+static void _mi_fail(mi_thermometer_t *mi) {
+    const mi_step_def_t *step = &mi_steps[mi->state];
+    mi_state_t fail = (step->failed) ? step->failed(mi, step->fail) : step->fail;
+    _mi_enter(mi, fail, fail == mi->state);
+}
+
+static void _mi_event(mi_thermometer_t *mi, EventBits_t evt) {
+    if ((evt & EVT_CLOSE) && !(mi->wait & EVT_CLOSE)) {
+        // Link lost or never came up, sessions without one ignore it
+        if (mi->state < MI_CONNECT || mi->state == MI_DISCONNECT)
+            return;
+        if (mi->state == MI_CONNECT)
+            mi->failures++;
+        else
+            mi_stats_disconnect();
+        mi->wait = 0;
+        _mi_enter(mi, MI_LINK_LOST, false);
+        return;
+    }
+    if (evt & EVT_ERROR) {
+        // Leave the retry to the state timeout, unless the cached handles are at fault
+        if (mi->wait != 0 && mi->cached && mi->state == MI_READ_TEMP_HUM) {
+            mi->wait = 0;
+            _mi_fail(mi);
+        }
+        return;
+    }
+    mi->bits |= evt;
+    if (mi->wait != 0 && ((mi->bits & mi->wait) == mi->wait || (mi->bits & mi->wait_any))) {
+        mi->wait = 0;
+        _mi_done(mi);
+    }
+}
+
+static TickType_t _mi_next_timeout(void) {
+    TickType_t next = portMAX_DELAY;
+    TickType_t now = xTaskGetTickCount();
+    for (uint8_t i = 0; i < MI_MAX_SENSORS; i++) {
+        mi_thermometer_t *mi = &mi_pool.sensors[i];
+        if (mi->wait == 0 || mi->timeout == 0)
+            continue;
+        TickType_t elapsed = now - mi->start;
+        TickType_t left = (elapsed >= mi->timeout) ? 0 : mi->timeout - elapsed;
+        if (left < next)
+            next = left;
+    }
+    return next;
+}
+
+static void _mi_check_timeouts(void) {
+    TickType_t now = xTaskGetTickCount();
+    for (uint8_t i = 0; i < MI_MAX_SENSORS; i++) {
+        mi_thermometer_t *mi = &mi_pool.sensors[i];
+        if (mi->wait == 0 || mi->timeout == 0 || now - mi->start < mi->timeout)
+            continue;
+        if (!mi_steps[mi->state].quiet)
+            ESP_LOGE(TAG, "[%d] state %d time out", mi->index, mi->state);
+        mi_stats_timeout(mi->state);
+        mi->wait = 0;
+        _mi_fail(mi);
+    }
+}
+
 void mi_task(void *pvParameters) {
+    mi_event_t event;
     ESP_LOGI(TAG, "BLE start...");
+    for (uint8_t i = 0; i < MI_MAX_SENSORS; i++) {
+        _mi_enter(&mi_pool.sensors[i], MI_INIT, false);
+    }
     while (1) {
-        switch(mi_thermometer.state) {
-            case MI_INIT:
-                if ((xEventGroupWaitBits(mi_thermometer.event, EVT_READY, false, true, 1000/portTICK_RATE_MS) & EVT_READY) == 0) { 
-                    goto _continue;
-                }
-                ESP_LOGI(TAG, "Start scan device");
-                esp_ble_gap_start_scanning(10000);
-                mi_thermometer.state = MI_SCAN;
-                break;
-            case MI_SCAN:
-                if ((xEventGroupWaitBits(mi_thermometer.event, EVT_SEARCH_DEVICE, false, true, 1000/portTICK_RATE_MS) & EVT_SEARCH_DEVICE) == 0) { 
-                    goto _continue;
+        if (xQueueReceive(mi_pool.queue, &event, _mi_next_timeout()) == pdTRUE) {
+            if (event.index == MI_INDEX_ALL) {
+                for (uint8_t i = 0; i < MI_MAX_SENSORS; i++) {
+                    _mi_event(&mi_pool.sensors[i], event.evt);
                 }
-                ESP_LOGI(TAG, "Open connect to ["ESP_BD_ADDR_STR"]", ESP_BD_ADDR_HEX(mi_thermometer.bda));
-                esp_err_t ret = esp_ble_gattc_open(mi_thermometer.gattcif, mi_thermometer.bda, BLE_ADDR_TYPE_PUBLIC, true);
-                ERROR_CHECKE(ret != ESP_OK, "gattc open failed", continue);
-                mi_thermometer.state = MI_CONNECT;
-                break;
-            case MI_CONNECT:
-                if ((xEventGroupWaitBits(mi_thermometer.event, EVT_OPEN, false, true, 1000/portTICK_RATE_MS) & EVT_OPEN) == 0) { 
-                    goto _continue;
-                }
-                mi_thermometer.state = MI_SEARCH_SERVICE;
-                break;
-            case MI_SEARCH_SERVICE:
-                _mi_read_device_services();
-                mi_thermometer.state = MI_READ_MODEL;
-                break;
-            case MI_READ_MODEL:
-                if(_mi_read_handle(mi_thermometer.gattcif, mi_thermometer.conn_id, mi_thermometer.model_char.handle, 200/portTICK_RATE_MS) != ESP_OK)
-                    goto _continue;
-                ESP_LOGI(TAG, "Read model: \t%s", mi_thermometer.model_char.data);
-                mi_thermometer.state = MI_READ_SERIAL;
-                break;
-            case MI_READ_SERIAL:
-                if(_mi_read_handle(mi_thermometer.gattcif, mi_thermometer.conn_id, mi_thermometer.serial_char.handle, 200/portTICK_RATE_MS) != ESP_OK)
-                    goto _continue;
-                ESP_LOGI(TAG, "Read serial: \t%s", mi_thermometer.serial_char.data);
-                mi_thermometer.state = MI_READ_FW_VER;
-                break;
-            case MI_READ_FW_VER:
-                if(_mi_read_handle(mi_thermometer.gattcif, mi_thermometer.conn_id, mi_thermometer.fw_char.handle, 200/portTICK_RATE_MS) != ESP_OK)
-                    goto _continue;
-                ESP_LOGI(TAG, "Read fw ver: \t%s", mi_thermometer.fw_char.data);
-                mi_thermometer.state = MI_READ_HW_VER;
-                break;
-            case MI_READ_HW_VER:
-                if(_mi_read_handle(mi_thermometer.gattcif, mi_thermometer.conn_id, mi_thermometer.hw_char.handle, 200/portTICK_RATE_MS) != ESP_OK)
-                    goto _continue;
-                ESP_LOGI(TAG, "Read hw ver: \t%s", mi_thermometer.hw_char.data);
-                mi_thermometer.state = MI_READ_SW_VER;
-                break;
-             case MI_READ_SW_VER:
-                if(_mi_read_handle(mi_thermometer.gattcif, mi_thermometer.conn_id, mi_thermometer.sw_char.handle, 200/portTICK_RATE_MS) != ESP_OK)
-                    goto _continue;
-                ESP_LOGI(TAG, "Read sw ver: \t%s", mi_thermometer.sw_char.data);
-                mi_thermometer.state = MI_READ_BATTERY;
-                break;
-            case MI_READ_BATTERY:
-                if(_mi_read_handle(mi_thermometer.gattcif, mi_thermometer.conn_id, mi_thermometer.battery_char.handle, 200/portTICK_RATE_MS) != ESP_OK)
-                    goto _continue;
-                ESP_LOGI(TAG, "Read battery: %d", mi_thermometer.battery_char.data[0]);
-                mi_thermometer.state = MI_READ_TEMP_HUM;
-                break;
-            case MI_READ_TEMP_HUM:
-                if(_mi_register_for_notify(mi_thermometer.gattcif, mi_thermometer.bda, mi_thermometer.temp_hum_char.handle) != ESP_OK)
-                    goto _continue;
-                if(_mi_write_char_descr(mi_thermometer.gattcif, mi_thermometer.conn_id, mi_thermometer.handle_write) != ESP_OK)
-                    goto _continue;
-                mi_thermometer.state = MI_IDLE;
-                break;
-            case MI_IDLE:
-                if((mi_thermometer.temp != 0) && (mi_thermometer.hum != 0))
-                    ESP_LOGI(TAG, "Read temp: %2.1f, hum: %d", mi_thermometer.temp/100, mi_thermometer.hum);
-                break;
-            default:
-                break;
+            } else if (event.index < MI_MAX_SENSORS) {
+                _mi_event(&mi_pool.sensors[event.index], event.evt);
+            }
         }
-_continue:
-        vTaskDelay(1000 / portTICK_RATE_MS);
+        _mi_check_timeouts();
     }
     vTaskDelete(NULL);
 }
 
+void mi_set_history_cb(mi_history_cb_t cb, void *arg) {
+    mi_history_arg = arg;
+    mi_history_cb = cb;
+}
+
+esp_err_t mi_set_timeout(mi_state_t state, uint32_t timeout_ms) {
+    ERROR_CHECKE( state > MI_IDLE, "invalid state", return ESP_ERR_INVALID_ARG);
+    mi_timeout_ms[state] = timeout_ms;
+    return ESP_OK;
+}
+
+esp_err_t mi_set_conn_config(mi_conn_profile_t profile, const mi_conn_config_t *config) {
+    ERROR_CHECKE( profile >= MI_CONN_PROFILES || config == NULL, "invalid conn profile", return ESP_ERR_INVALID_ARG);
+    ERROR_CHECKE( config->interval_min_ms < 8 || config->interval_min_ms > config->interval_max_ms || config->interval_max_ms > 4000
+                  || config->latency > 499 || config->timeout_ms < 100 || config->timeout_ms > 32000
+                  || config->timeout_ms <= (1 + config->latency) * config->interval_max_ms * 2,
+                  "invalid conn params", return ESP_ERR_INVALID_ARG);
+    portENTER_CRITICAL(&mi_pool.lock);
+    mi_conn_config[profile] = *config;
+    portEXIT_CRITICAL(&mi_pool.lock);
+    return ESP_OK;
+}
+
+esp_err_t mi_set_scan_config(mi_scan_profile_t profile, const mi_scan_config_t *config) {
+    bool restart = false;
+    ERROR_CHECKE( profile >= MI_SCAN_PROFILES || config == NULL, "invalid scan profile", return ESP_ERR_INVALID_ARG);
+    ERROR_CHECKE( config->window_ms < 3 || config->window_ms > config->interval_ms || config->interval_ms > 10240,
+                  "invalid scan window", return ESP_ERR_INVALID_ARG);
+    portENTER_CRITICAL(&mi_pool.lock);
+    _mi_scan_account();
+    mi_scan_config[profile] = *config;
+    if (mi_pool.scanning && !mi_pool.scan_switching && mi_pool.scan_profile == profile) {
+        mi_pool.scan_switching = true;
+        restart = true;
+    }
+    portEXIT_CRITICAL(&mi_pool.lock);
+    if (restart)
+        esp_ble_gap_stop_scanning();
+    return ESP_OK;
+}
+
+esp_err_t mi_get_scan_stats(mi_scan_stats_t *stats) {
+    ERROR_CHECKE( stats == NULL, "invalid argument", return ESP_ERR_INVALID_ARG);
+    portENTER_CRITICAL(&mi_pool.lock);
+    _mi_scan_account();
+    stats->scanning = mi_pool.scanning;
+    stats->profile = mi_pool.scan_profile;
+    stats->duty = (mi_pool.scanning) ? _mi_scan_duty(mi_pool.scan_profile) : 0;
+    stats->radio_on_ms = mi_pool.radio_on_us / 1000;
+    portEXIT_CRITICAL(&mi_pool.lock);
+    return ESP_OK;
+}
+
+#ifndef MI_POLL_MODE
+static void _mi_copy_sensor(const mi_thermometer_t *mi, mi_sensor_t *sensor) {
+    memcpy(sensor->bda, mi->bda, sizeof(esp_bd_addr_t));
+    sensor->state = mi->state;
+    sensor->temp = mi->reading.temp;
+    sensor->hum = mi->reading.hum;
+    sensor->battery_mv = mi->reading.battery_mv;
+    sensor->updated = mi->updated;
+    sensor->battery = (mi->battery_char.len) ? mi->battery_char.data[0] : 0;
+}
+#endif
+
+#ifdef MI_POLL_MODE
+static void _mi_copy_poll_sensor(const mi_poll_entry_t *e, mi_sensor_t *sensor) {
+    memcpy(sensor->bda, e->bda, sizeof(esp_bd_addr_t));
+    sensor->state = (e->busy) ? mi_pool.sensors[e->session].state : MI_POLL;
+    sensor->temp = e->reading.temp;
+    sensor->hum = e->reading.hum;
+    sensor->battery_mv = e->reading.battery_mv;
+    sensor->updated = e->updated;
+    sensor->battery = e->battery;
+}
+#endif
+
+#ifdef MI_PASSIVE_MODE
+static void _mi_copy_adv_sensor(const mi_adv_sensor_t *adv, mi_sensor_t *sensor) {
+    memcpy(sensor->bda, adv->bda, sizeof(esp_bd_addr_t));
+    sensor->state = MI_IDLE;
+    sensor->temp = adv->data.temp;
+    sensor->hum = adv->data.hum / 100;
+    sensor->battery_mv = adv->data.battery_mv;
+    sensor->updated = adv->last_seen;
+    sensor->battery = adv->data.battery;
+}
+#endif
+
+#ifdef MI_POLL_MODE
+static mi_poll_entry_t *_mi_poll_find(const esp_bd_addr_t bda) {
+    for (uint8_t i = 0; i < MI_POLL_MAX; i++) {
+        if (mi_pool.polls[i].used && memcmp(mi_pool.polls[i].bda, bda, sizeof(esp_bd_addr_t)) == 0)
+            return &mi_pool.polls[i];
+    }
+    return NULL;
+}
+#endif
+
+esp_err_t mi_poll_add(const esp_bd_addr_t bda, uint32_t period_ms) {
+#ifdef MI_POLL_MODE
+    ERROR_CHECKE( bda == NULL || period_ms == 0, "invalid argument", return ESP_ERR_INVALID_ARG);
+    esp_err_t ret = ESP_OK;
+    portENTER_CRITICAL(&mi_pool.lock);
+    mi_poll_entry_t *e = _mi_poll_find(bda);
+    for (uint8_t i = 0; i < MI_POLL_MAX && e == NULL; i++) {
+        if (mi_pool.polls[i].used)
+            continue;
+        // New sensors are due right away
+        e = &mi_pool.polls[i];
+        memset(e, 0, sizeof(mi_poll_entry_t));
+        memcpy(e->bda, bda, sizeof(esp_bd_addr_t));
+        e->due = esp_timer_get_time();
+        e->used = true;
+        mi_pool.poll_stats.sensors++;
+    }
+    if (e)
+        e->period_ms = period_ms;
+    else
+        ret = ESP_ERR_NO_MEM;
+    portEXIT_CRITICAL(&mi_pool.lock);
+    // Wake the sessions waiting for the next due sensor
+    if (ret == ESP_OK && mi_pool.queue)
+        _mi_post(MI_INDEX_ALL, EVT_POLL);
+    return ret;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t mi_poll_remove(const esp_bd_addr_t bda) {
+#ifdef MI_POLL_MODE
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    portENTER_CRITICAL(&mi_pool.lock);
+    mi_poll_entry_t *e = _mi_poll_find(bda);
+    if (e) {
+        // A visit in progress runs to its end and finds the entry gone
+        e->used = false;
+        mi_pool.poll_stats.sensors--;
+        ret = ESP_OK;
+    }
+    portEXIT_CRITICAL(&mi_pool.lock);
+    return ret;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+void mi_get_poll_stats(mi_poll_stats_t *stats) {
+    memset(stats, 0, sizeof(mi_poll_stats_t));
+#ifdef MI_POLL_MODE
+    portENTER_CRITICAL(&mi_pool.lock);
+    *stats = mi_pool.poll_stats;
+    portEXIT_CRITICAL(&mi_pool.lock);
+#endif
+}
+
+esp_err_t mi_get_sensors(mi_sensor_t *sensors, uint8_t *count) {
+    ERROR_CHECKE( sensors == NULL || count == NULL, "invalid argument", return ESP_ERR_INVALID_ARG);
+    uint8_t n = 0;
+    portENTER_CRITICAL(&mi_pool.lock);
+#ifdef MI_POLL_MODE
+    // Sessions only visit, the polled sensors are the list
+    for (uint8_t i = 0; i < MI_POLL_MAX && n < *count; i++) {
+        if (mi_pool.polls[i].used)
+            _mi_copy_poll_sensor(&mi_pool.polls[i], &sensors[n++]);
+    }
+#else
+    for (uint8_t i = 0; i < MI_MAX_SENSORS && n < *count; i++) {
+        if (mi_pool.sensors[i].assigned)
+            _mi_copy_sensor(&mi_pool.sensors[i], &sensors[n++]);
+    }
+#endif
+#ifdef MI_PASSIVE_MODE
+    for (uint16_t i = 0; i < MI_MAX_ADV_SENSORS && n < *count; i++) {
+        if (mi_pool.adv_sensors[i].used)
+            _mi_copy_adv_sensor(&mi_pool.adv_sensors[i], &sensors[n++]);
+    }
+#endif
+    portEXIT_CRITICAL(&mi_pool.lock);
+    *count = n;
+    return ESP_OK;
+}
+
+esp_err_t mi_get_sensor(const esp_bd_addr_t bda, mi_sensor_t *sensor) {
+    ERROR_CHECKE( bda == NULL || sensor == NULL, "invalid argument", return ESP_ERR_INVALID_ARG);
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    portENTER_CRITICAL(&mi_pool.lock);
+#ifdef MI_POLL_MODE
+    mi_poll_entry_t *e = _mi_poll_find(bda);
+    if (e) {
+        _mi_copy_poll_sensor(e, sensor);
+        ret = ESP_OK;
+    }
+#else
+    mi_thermometer_t *mi = _mi_find_by_bda(bda);
+    if (mi) {
+        _mi_copy_sensor(mi, sensor);
+        ret = ESP_OK;
+    }
+#endif
+#ifdef MI_PASSIVE_MODE
+    for (uint16_t i = 0; i < MI_MAX_ADV_SENSORS && ret != ESP_OK; i++) {
+        if (mi_pool.adv_sensors[i].used && memcmp(mi_pool.adv_sensors[i].bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+            _mi_copy_adv_sensor(&mi_pool.adv_sensors[i], sensor);
+            ret = ESP_OK;
+        }
+    }
+#endif
+    portEXIT_CRITICAL(&mi_pool.lock);
+    return ret;
+}
+
 esp_err_t mi_init(void) {
     esp_err_t ret = ESP_FAIL;
-    mi_thermometer.state = MI_INIT;
-    mi_thermometer.event = xEventGroupCreate();
-    xEventGroupClearBits(mi_thermometer.event, EVT_READY);
-    xEventGroupClearBits(mi_thermometer.event, EVT_SEARCH_DEVICE);
-    xEventGroupClearBits(mi_thermometer.event, EVT_OPEN);
-    xEventGroupClearBits(mi_thermometer.event, EVT_CLOSE);
-    xEventGroupClearBits(mi_thermometer.event, EVT_SEARCH_SERVICE);
-    xEventGroupClearBits(mi_thermometer.event, EVT_READ);
-    xEventGroupClearBits(mi_thermometer.event, EVT_WRITE);
-    xEventGroupClearBits(mi_thermometer.event, EVT_REGISTER);
+#ifdef MI_STATIC_ALLOC
+    mi_pool.queue = xQueueCreateStatic(MI_QUEUE_LEN, sizeof(mi_event_t), mi_queue_storage, &mi_queue);
+#else
+    mi_pool.queue = xQueueCreate(MI_QUEUE_LEN, sizeof(mi_event_t));
+#endif
+    ERROR_CHECKE( mi_pool.queue == NULL, "create event queue failed", return ESP_ERR_NO_MEM);
+    for (uint8_t i = 0; i < MI_MAX_SENSORS; i++) {
+        mi_thermometer_t *mi = &mi_pool.sensors[i];
+        mi->index = i;
+        mi->state = MI_INIT;
+        mi->conn_id = MI_CONN_ID_INVALID;
+        mi->poll = MI_POLL_NONE;
+    }
     esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
     ret = esp_bt_controller_init(&bt_cfg);
     ERROR_CHECKE( ret != ESP_OK, "initialize controller failed", return ret);
@@ -409,6 +1748,27 @@ esp_err_t mi_init(void) {
     ERROR_CHECKE( ret != ESP_OK, "gattc app register failed", return ret);
     ret = esp_ble_gatt_set_local_mtu(200);
     ERROR_CHECKE( ret != ESP_OK, "set local MTU failed", return ret);
-    xTaskCreate(&mi_task, "ble_task", 4 * 1024, NULL, 5, NULL);
+#ifdef MI_PASSIVE_MODE
+    // No sessions, everything comes from the scan results
+    if (mi_beacon_load_keys() != ESP_OK)
+        ESP_LOGW(TAG, "no bind keys, encrypted MiBeacon frames are ignored");
+    _mi_scan_burst();
+    _mi_scan_start();
+    return ESP_OK;
+#endif
+#ifdef MI_POLL_MODE
+    // Every sensor connected before has cached handles and is worth polling
+    esp_bd_addr_t bdas[MI_POLL_MAX];
+    uint8_t count = MI_POLL_MAX;
+    if (mi_cache_list(bdas, &count) == ESP_OK) {
+        for (uint8_t i = 0; i < count; i++)
+            mi_poll_add(bdas[i], MI_POLL_PERIOD_MS);
+    }
+#endif
+#ifdef MI_STATIC_ALLOC
+    xTaskCreateStatic(&mi_task, "ble_task", MI_TASK_STACK, NULL, 5, mi_task_stack, &mi_task_tcb);
+#else
+    xTaskCreate(&mi_task, "ble_task", MI_TASK_STACK, NULL, 5, NULL);
+#endif
     return ESP_OK;
-}
\ No newline at end of file
+}
@@ -1,10 +1,9 @@
 #pragma once
 
 // Libs
-#include <string.h>
-#include "freertos/FreeRTOS.h"
-#include "driver/gpio.h"
-#include "driver/i2c.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
 // Defs
 
 // SELECT FONTS
@@ -14,22 +13,19 @@
 // DISPLAY CHARS
 #define DISPLAY_WIDTH               127
 #define DISPLAY_HEIGHT              63
+#define DISPLAY_PAGES               8
+#define DISPLAY_COLUMNS             128
 
-// I2C CONFIG
-#define I2C_MASTER_SCL_IO           GPIO_NUM_4         /*!< gpio number for I2C master clock */
-#define I2C_MASTER_SDA_IO           GPIO_NUM_5         /*!< gpio number for I2C master data  */
-#define I2C_MASTER_NUM              I2C_NUM_0          /*!< I2C port number for master dev */
-#define I2C_MASTER_TX_BUF_DISABLE   0           /*!< I2C master do not need buffer */
-#define I2C_MASTER_RX_BUF_DISABLE   0           /*!< I2C master do not need buffer */
+// I2C BUS, pins and port are in ssd1306.c
 #define I2C_MASTER_FREQ_HZ          400000            /*!< I2C master clock frequency */
+#define I2C_BITS_PER_BYTE           9                 /*!< 8 data bits and the ack slot */
+#define I2C_BITS_START_STOP         2                 /*!< roughly one clock each for start and stop */
+
+// DISPLAY TASK
+#define OLED_TASK_MAX_FPS           10                /*!< refresh cap, updates in between are merged */
+#define OLED_TASK_PRIORITY          3                 /*!< below the BLE task */
 
 #define SSD1306_OLED_ADDR           0x3C                 /*!< slave address for ssd1306 oled display */
-#define WRITE_BIT                   I2C_MASTER_WRITE             /*!< I2C master write */
-#define READ_BIT                    I2C_MASTER_READ              /*!< I2C master read */
-#define ACK_CHECK_EN                0x1                      /*!< I2C master will check ack from slave*/
-#define ACK_CHECK_DIS               0x0                      /*!< I2C master will not check ack from slave */
-#define ACK_VAL                     0x0                          /*!< I2C ack value */
-#define NACK_VAL                    0x1                          /*!< I2C nack value */
 
 /* Command Table (ssd1306 datasheet) */
 
@@ -80,8 +76,39 @@
 // Charge Pump (page 60)
 #define CHARGE_PUMP_SET                 0x8D
 
+// Bus accounting since boot or the last reset, wire time is estimated from I2C_MASTER_FREQ_HZ
+typedef struct {
+    uint32_t    transactions;
+    uint32_t    bytes;              /*!< address, control, command and data bytes */
+    uint32_t    bus_us;             /*!< estimated time on the wire */
+    uint32_t    errors;             /*!< transactions that did not complete */
+    uint32_t    flushes;            /*!< calls to oled_ssd1306_flush, one per frame of the display task */
+} oled_ssd1306_stats_t;
+
 // Functions
 esp_err_t oled_ssd1306_init();
 void oled_ssd1306_clear(int page);
 void oled_ssd1306_clear_all(void);
 void oled_ssd1306_print(int page, char *text);
+// Text in one transaction at page (row of 8 px) and col (px), clipped at the right edge
+esp_err_t oled_ssd1306_print_at(int page, int col, char *text);
+// Overwrite a field of `width` chars in place, text is clipped or blank-padded to fit
+esp_err_t oled_ssd1306_print_field(int page, int col, int width, char *text);
+// Task: chess pattern, then hardware diagonal scrolling until the next command
+void oled_ssd1306_screensaver(void *ignore);
+
+// Framebuffer, drawing only touches RAM until oled_ssd1306_flush()
+void oled_ssd1306_fb_clear(int page);
+void oled_ssd1306_fb_clear_all(void);
+void oled_ssd1306_fb_print(int page, int col, char *text);
+void oled_ssd1306_fb_invalidate(void);
+esp_err_t oled_ssd1306_flush(void);
+
+// Display task, owns the bus once started; producers only touch the back buffer and never block on I2C
+esp_err_t oled_ssd1306_task_start(void);
+void oled_ssd1306_submit_clear(int page);
+void oled_ssd1306_submit_text(int page, int col, char *text);
+void oled_ssd1306_submit_field(int page, int col, int width, char *text);
+void oled_ssd1306_submit_frame(const uint8_t frame[DISPLAY_PAGES][DISPLAY_COLUMNS]);
+void oled_ssd1306_get_stats(oled_ssd1306_stats_t *stats);
+void oled_ssd1306_reset_stats(void);
@@ -1,10 +1,118 @@
 // Libs
 #include "ssd1306.h"
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "driver/i2c.h"
 #include "font8x8_basic.h"
 #include "glcdfont.h"
 
+// I2C CONFIG
+#define I2C_MASTER_SCL_IO           GPIO_NUM_4         /*!< gpio number for I2C master clock */
+#define I2C_MASTER_SDA_IO           GPIO_NUM_5         /*!< gpio number for I2C master data  */
+#define I2C_MASTER_NUM              I2C_NUM_0          /*!< I2C port number for master dev */
+#define I2C_MASTER_TX_BUF_DISABLE   0           /*!< I2C master do not need buffer */
+#define I2C_MASTER_RX_BUF_DISABLE   0           /*!< I2C master do not need buffer */
+
+#define WRITE_BIT                   I2C_MASTER_WRITE             /*!< I2C master write */
+#define READ_BIT                    I2C_MASTER_READ              /*!< I2C master read */
+#define ACK_CHECK_EN                0x1                      /*!< I2C master will check ack from slave*/
+#define ACK_CHECK_DIS               0x0                      /*!< I2C master will not check ack from slave */
+#define ACK_VAL                     0x0                          /*!< I2C ack value */
+#define NACK_VAL                    0x1                          /*!< I2C nack value */
+
 static void i2c_master_init();
 
+// Shadow of the GDDRAM, dirty_min > dirty_max marks a clean page
+typedef struct {
+    uint8_t     buf[DISPLAY_PAGES][DISPLAY_COLUMNS];
+    uint8_t     dirty_min[DISPLAY_PAGES];
+    uint8_t     dirty_max[DISPLAY_PAGES];
+} oled_fb_t;
+
+static oled_fb_t fb;
+
+// Back buffer of the display task, producers draw here under back_lock
+static uint8_t back[DISPLAY_PAGES][DISPLAY_COLUMNS];
+static portMUX_TYPE back_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t oled_task_handle;
+
+static oled_ssd1306_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Run a queued transaction and account its cost, `bytes` counts everything after the start condition
+static esp_err_t oled_ssd1306_cmd_begin(i2c_cmd_handle_t cmd, uint32_t bytes) {
+    esp_err_t ret = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_PERIOD_MS);
+    portENTER_CRITICAL(&stats_lock);
+    stats.transactions++;
+    stats.bytes += bytes;
+    stats.bus_us += ((uint64_t)bytes * I2C_BITS_PER_BYTE + I2C_BITS_START_STOP) * 1000000 / I2C_MASTER_FREQ_HZ;
+    if (ret != ESP_OK)
+        stats.errors++;
+    portEXIT_CRITICAL(&stats_lock);
+    return ret;
+}
+
+static void fb_mark_clean(int page) {
+    fb.dirty_min[page] = DISPLAY_COLUMNS - 1;
+    fb.dirty_max[page] = 0;
+}
+
+static void fb_mark_dirty(int page, int col_start, int col_end) {
+    if (fb.dirty_min[page] > fb.dirty_max[page]) {
+        fb.dirty_min[page] = col_start;
+        fb.dirty_max[page] = col_end;
+        return;
+    }
+    if (col_start < fb.dirty_min[page]) fb.dirty_min[page] = col_start;
+    if (col_end > fb.dirty_max[page]) fb.dirty_max[page] = col_end;
+}
+
+// Copy into the framebuffer, only columns that actually change become dirty
+static void fb_write(int page, int col, const uint8_t *data, int len) {
+    int first = -1, last = -1;
+    if (page < 0 || page >= DISPLAY_PAGES || col >= DISPLAY_COLUMNS)
+        return;
+    if (col + len > DISPLAY_COLUMNS)
+        len = DISPLAY_COLUMNS - col;
+    for (int i = 0; i < len; i++) {
+        if (fb.buf[page][col + i] != data[i]) {
+            fb.buf[page][col + i] = data[i];
+            if (first < 0) first = col + i;
+            last = col + i;
+        }
+    }
+    if (first >= 0)
+        fb_mark_dirty(page, first, last);
+}
+
+// Render text into one page row, clipped at `end`, blank-filled up to `end` when pad is set
+static void row_print(uint8_t *row, int col, int end, char *text, bool pad) {
+    uint16_t char_index = 0;
+    if (col < 0 || col >= DISPLAY_COLUMNS)
+        return;
+    if (end > DISPLAY_COLUMNS)
+        end = DISPLAY_COLUMNS;
+    for(; *text != '\0' && col < end; text++) {
+        char_index = (*text <= 0) ? 0 : font_width * (*text);
+        int n = (col + font_width > end) ? end - col : font_width;
+        memcpy(&row[col], &font[char_index], n);
+        col += n;
+    }
+    if (pad && col < end)
+        memset(&row[col], 0x00, end - col);
+}
+
+// Immediate calls already put these bytes on the panel, keep the shadow in sync
+static void fb_shadow(int page, int col, const uint8_t *data, int len) {
+    if (page < 0 || page >= DISPLAY_PAGES || col >= DISPLAY_COLUMNS)
+        return;
+    if (col + len > DISPLAY_COLUMNS)
+        len = DISPLAY_COLUMNS - col;
+    memcpy(&fb.buf[page][col], data, len);
+}
+
 esp_err_t oled_ssd1306_init() {
     i2c_master_init();
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
@@ -47,8 +155,10 @@ esp_err_t oled_ssd1306_init() {
     i2c_master_write_byte(cmd, DISPLAY_ON, ACK_CHECK_EN);
     // Stop bit
     i2c_master_stop(cmd);
-    esp_err_t ret = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_RATE_MS);
+    esp_err_t ret = oled_ssd1306_cmd_begin(cmd, 22);
     i2c_cmd_link_delete(cmd);
+    // GDDRAM content is undefined after power up
+    oled_ssd1306_fb_invalidate();
     return ret;
 }
 
@@ -67,8 +177,9 @@ void oled_ssd1306_test(void *ignore) {
     }
     // Stop bit
     i2c_master_stop(cmd);
-    i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_PERIOD_MS);
+    oled_ssd1306_cmd_begin(cmd, 4 + DISPLAY_COLUMNS);
     i2c_cmd_link_delete(cmd);
+    memset(fb.buf[page - 1], color, DISPLAY_COLUMNS);
     if(page == 8) page = 0;
     vTaskDelete(NULL);
 }
@@ -81,13 +192,19 @@ void oled_ssd1306_clear(int page) {
         i2c_master_write_byte(cmd, (SSD1306_OLED_ADDR << 1) | WRITE_BIT, ACK_CHECK_EN);
         i2c_master_write_byte(cmd, SINGLE_COMMAND_MODE, ACK_CHECK_EN);
         i2c_master_write_byte(cmd, (PAGE_START_ADDR | page), ACK_CHECK_EN);
+        // From column 0, not wherever the last write left the pointer
+        i2c_master_write_byte(cmd, SINGLE_COMMAND_MODE, ACK_CHECK_EN);
+        i2c_master_write_byte(cmd, LOWER_COL_START_ADDR, ACK_CHECK_EN);
+        i2c_master_write_byte(cmd, SINGLE_COMMAND_MODE, ACK_CHECK_EN);
+        i2c_master_write_byte(cmd, HIGHER_COL_START_ADDR, ACK_CHECK_EN);
         i2c_master_write_byte(cmd, DATA_MODE, ACK_CHECK_EN);
         for(uint8_t col = 0; col < 128; col++)
             i2c_master_write_byte(cmd, 0x00, ACK_CHECK_EN);
         // Stop bit
         i2c_master_stop(cmd);
-        i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_PERIOD_MS);
+        oled_ssd1306_cmd_begin(cmd, 8 + DISPLAY_COLUMNS);
         i2c_cmd_link_delete(cmd);
+        memset(fb.buf[page], 0x00, DISPLAY_COLUMNS);
     //}
 }
 
@@ -97,35 +214,55 @@ void oled_ssd1306_clear_all(void) {
     }
 }
 
-void oled_ssd1306_print(int page, char *text) {
-    uint8_t len = strlen(text);
-    uint8_t i = 0;
+// Stream a line of text in a single transaction: page/column commands, then
+// every glyph column clipped at `end`, blank-filled up to `end` when pad is set
+static esp_err_t oled_ssd1306_write_line(int page, int col, int end, char *text, bool pad) {
+    static const uint8_t blank[DISPLAY_COLUMNS] = { 0 };
     uint16_t char_index = 0;
+    int x = col;
+    if (page < 0 || page >= DISPLAY_PAGES || col < 0 || col >= DISPLAY_COLUMNS)
+        return ESP_ERR_INVALID_ARG;
+    if (end > DISPLAY_COLUMNS)
+        end = DISPLAY_COLUMNS;
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
     i2c_master_start(cmd);
     i2c_master_write_byte(cmd, (SSD1306_OLED_ADDR << 1) | WRITE_BIT, ACK_CHECK_EN);
-    i2c_master_write_byte(cmd, COMMAND_MODE, ACK_CHECK_EN);
+    i2c_master_write_byte(cmd, SINGLE_COMMAND_MODE, ACK_CHECK_EN);
     i2c_master_write_byte(cmd, (PAGE_START_ADDR | page), ACK_CHECK_EN);
-    i2c_master_write_byte(cmd, LOWER_COL_START_ADDR, ACK_CHECK_EN);
-    i2c_master_write_byte(cmd, HIGHER_COL_START_ADDR, ACK_CHECK_EN);
-    i2c_master_stop(cmd);
-    i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmd);
-    for(i = 0; i < len; i++) {
+    i2c_master_write_byte(cmd, SINGLE_COMMAND_MODE, ACK_CHECK_EN);
+    i2c_master_write_byte(cmd, (LOWER_COL_START_ADDR | (col & 0x0F)), ACK_CHECK_EN);
+    i2c_master_write_byte(cmd, SINGLE_COMMAND_MODE, ACK_CHECK_EN);
+    i2c_master_write_byte(cmd, (HIGHER_COL_START_ADDR | (col >> 4)), ACK_CHECK_EN);
+    i2c_master_write_byte(cmd, DATA_MODE, ACK_CHECK_EN);
+    for(; *text != '\0' && x < end; text++) {
         // Calculate the pos of the char in font array
-        char_index = (text[i] <= 0) ? 0 : font_width * text[i];
-        cmd = i2c_cmd_link_create();
-        i2c_master_start(cmd);
-        i2c_master_write_byte(cmd, (SSD1306_OLED_ADDR << 1) | WRITE_BIT, ACK_CHECK_EN);
-        i2c_master_write_byte(cmd, DATA_MODE, ACK_CHECK_EN);
-        for(uint8_t col = 0; col < font_width; col++) {
-            i2c_master_write_byte(cmd, font[char_index + col], ACK_CHECK_EN);
-        }
-        // Stop bit
-        i2c_master_stop(cmd);
-        i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_PERIOD_MS);
-        i2c_cmd_link_delete(cmd);
+        char_index = (*text <= 0) ? 0 : font_width * (*text);
+        int n = (x + font_width > end) ? end - x : font_width;
+        i2c_master_write(cmd, &font[char_index], n, ACK_CHECK_EN);
+        fb_shadow(page, x, &font[char_index], n);
+        x += n;
+    }
+    if (pad && x < end) {
+        i2c_master_write(cmd, blank, end - x, ACK_CHECK_EN);
+        fb_shadow(page, x, blank, end - x);
     }
+    // Stop bit
+    i2c_master_stop(cmd);
+    esp_err_t ret = oled_ssd1306_cmd_begin(cmd, 8 + ((pad && x < end) ? end : x) - col);
+    i2c_cmd_link_delete(cmd);
+    return ret;
+}
+
+void oled_ssd1306_print(int page, char *text) {
+    oled_ssd1306_write_line(page, 0, DISPLAY_COLUMNS, text, false);
+}
+
+esp_err_t oled_ssd1306_print_at(int page, int col, char *text) {
+    return oled_ssd1306_write_line(page, col, DISPLAY_COLUMNS, text, false);
+}
+
+esp_err_t oled_ssd1306_print_field(int page, int col, int width, char *text) {
+    return oled_ssd1306_write_line(page, col, col + width * font_width, text, true);
 }
 
 void oled_ssd1306_screensaver(void *ignore) {
@@ -145,7 +282,7 @@ void oled_ssd1306_screensaver(void *ignore) {
         }
         // Stop bit
         i2c_master_stop(cmd);
-        i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_PERIOD_MS);
+        oled_ssd1306_cmd_begin(cmd, 4 + DISPLAY_COLUMNS);
         i2c_cmd_link_delete(cmd);
     }
     // hor and vertical scrolling using graphic acceleration commands
@@ -162,11 +299,74 @@ void oled_ssd1306_screensaver(void *ignore) {
     i2c_master_write_byte(cmd, VERTICAL_OFFSET_ONE, ACK_CHECK_EN);
     i2c_master_write_byte(cmd, ACTIVATE_SCROLL, ACK_CHECK_EN);
     i2c_master_stop(cmd);
-    i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_PERIOD_MS);
+    oled_ssd1306_cmd_begin(cmd, 10);
     i2c_cmd_link_delete(cmd);
+    // Scrolling moves GDDRAM content, the shadow no longer matches
+    oled_ssd1306_fb_invalidate();
     vTaskDelete(NULL);
 }
 
+void oled_ssd1306_fb_clear(int page) {
+    static const uint8_t blank[DISPLAY_COLUMNS] = { 0 };
+    fb_write(page, 0, blank, DISPLAY_COLUMNS);
+}
+
+void oled_ssd1306_fb_clear_all(void) {
+    for(uint8_t page = 0; page < DISPLAY_PAGES; page++) {
+        oled_ssd1306_fb_clear(page);
+    }
+}
+
+void oled_ssd1306_fb_print(int page, int col, char *text) {
+    uint8_t row[DISPLAY_COLUMNS];
+    if (page < 0 || page >= DISPLAY_PAGES || col < 0 || col >= DISPLAY_COLUMNS)
+        return;
+    memcpy(row, fb.buf[page], DISPLAY_COLUMNS);
+    row_print(row, col, DISPLAY_COLUMNS, text, false);
+    fb_write(page, 0, row, DISPLAY_COLUMNS);
+}
+
+void oled_ssd1306_fb_invalidate(void) {
+    for(uint8_t page = 0; page < DISPLAY_PAGES; page++) {
+        fb_mark_dirty(page, 0, DISPLAY_COLUMNS - 1);
+    }
+}
+
+esp_err_t oled_ssd1306_flush(void) {
+    esp_err_t ret = ESP_OK;
+    portENTER_CRITICAL(&stats_lock);
+    stats.flushes++;
+    portEXIT_CRITICAL(&stats_lock);
+    for(uint8_t page = 0; page < DISPLAY_PAGES; page++) {
+        uint8_t start = fb.dirty_min[page];
+        uint8_t end = fb.dirty_max[page];
+        if (start > end)
+            continue;
+        // Page addressing mode: set page and start column, then stream the changed range
+        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+        i2c_master_start(cmd);
+        i2c_master_write_byte(cmd, (SSD1306_OLED_ADDR << 1) | WRITE_BIT, ACK_CHECK_EN);
+        i2c_master_write_byte(cmd, SINGLE_COMMAND_MODE, ACK_CHECK_EN);
+        i2c_master_write_byte(cmd, (PAGE_START_ADDR | page), ACK_CHECK_EN);
+        i2c_master_write_byte(cmd, SINGLE_COMMAND_MODE, ACK_CHECK_EN);
+        i2c_master_write_byte(cmd, (LOWER_COL_START_ADDR | (start & 0x0F)), ACK_CHECK_EN);
+        i2c_master_write_byte(cmd, SINGLE_COMMAND_MODE, ACK_CHECK_EN);
+        i2c_master_write_byte(cmd, (HIGHER_COL_START_ADDR | (start >> 4)), ACK_CHECK_EN);
+        i2c_master_write_byte(cmd, DATA_MODE, ACK_CHECK_EN);
+        i2c_master_write(cmd, &fb.buf[page][start], end - start + 1, ACK_CHECK_EN);
+        i2c_master_stop(cmd);
+        esp_err_t err = oled_ssd1306_cmd_begin(cmd, 8 + end - start + 1);
+        i2c_cmd_link_delete(cmd);
+        // Keep the range dirty so the next flush retries it
+        if (err != ESP_OK) {
+            ret = err;
+            continue;
+        }
+        fb_mark_clean(page);
+    }
+    return ret;
+}
+
 static void i2c_master_init() {
     int i2c_master_port = I2C_MASTER_NUM;
     i2c_config_t conf;
@@ -184,3 +384,86 @@ static void i2c_master_init() {
                        I2C_MASTER_TX_BUF_DISABLE,
                        0);
 }
+
+static void oled_ssd1306_task(void *ignore) {
+    const TickType_t period = pdMS_TO_TICKS(1000 / OLED_TASK_MAX_FPS);
+    TickType_t last = xTaskGetTickCount() - period;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // Cap the refresh rate, submissions arriving meanwhile land in the same frame
+        TickType_t elapsed = xTaskGetTickCount() - last;
+        if (elapsed < period)
+            vTaskDelay(period - elapsed);
+        ulTaskNotifyTake(pdTRUE, 0);
+        portENTER_CRITICAL(&back_lock);
+        for(uint8_t page = 0; page < DISPLAY_PAGES; page++) {
+            fb_write(page, 0, back[page], DISPLAY_COLUMNS);
+        }
+        portEXIT_CRITICAL(&back_lock);
+        oled_ssd1306_flush();
+        last = xTaskGetTickCount();
+    }
+    vTaskDelete(NULL);
+}
+
+esp_err_t oled_ssd1306_task_start(void) {
+    if (oled_task_handle)
+        return ESP_ERR_INVALID_STATE;
+    // Start from what is on the panel now
+    memcpy(back, fb.buf, sizeof(back));
+    if (xTaskCreate(&oled_ssd1306_task, "oled_task", 2 * 1024, NULL, OLED_TASK_PRIORITY, &oled_task_handle) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    xTaskNotifyGive(oled_task_handle);
+    return ESP_OK;
+}
+
+static void oled_ssd1306_submit(void) {
+    if (oled_task_handle)
+        xTaskNotifyGive(oled_task_handle);
+}
+
+void oled_ssd1306_submit_clear(int page) {
+    if (page < 0 || page >= DISPLAY_PAGES)
+        return;
+    portENTER_CRITICAL(&back_lock);
+    memset(back[page], 0x00, DISPLAY_COLUMNS);
+    portEXIT_CRITICAL(&back_lock);
+    oled_ssd1306_submit();
+}
+
+void oled_ssd1306_submit_text(int page, int col, char *text) {
+    if (page < 0 || page >= DISPLAY_PAGES)
+        return;
+    portENTER_CRITICAL(&back_lock);
+    row_print(back[page], col, DISPLAY_COLUMNS, text, false);
+    portEXIT_CRITICAL(&back_lock);
+    oled_ssd1306_submit();
+}
+
+void oled_ssd1306_submit_field(int page, int col, int width, char *text) {
+    if (page < 0 || page >= DISPLAY_PAGES)
+        return;
+    portENTER_CRITICAL(&back_lock);
+    row_print(back[page], col, col + width * font_width, text, true);
+    portEXIT_CRITICAL(&back_lock);
+    oled_ssd1306_submit();
+}
+
+void oled_ssd1306_submit_frame(const uint8_t frame[DISPLAY_PAGES][DISPLAY_COLUMNS]) {
+    portENTER_CRITICAL(&back_lock);
+    memcpy(back, frame, sizeof(back));
+    portEXIT_CRITICAL(&back_lock);
+    oled_ssd1306_submit();
+}
+
+void oled_ssd1306_get_stats(oled_ssd1306_stats_t *out) {
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void oled_ssd1306_reset_stats(void) {
+    portENTER_CRITICAL(&stats_lock);
+    memset(&stats, 0, sizeof(stats));
+    portEXIT_CRITICAL(&stats_lock);
+}
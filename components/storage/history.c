@@ -0,0 +1,408 @@
+#include "history.h"
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+
+#define MINUTE                      60
+#define HOUR                        3600
+
+#define HISTORY_NONE                0xFF        /*!< no sensor slot */
+#define HISTORY_WORDS(len)          (((len) + 31) / 32)
+
+// Open addressing over the ids, power of two and at least twice the sensors
+#if HISTORY_MAX_SENSORS > 32
+#define HISTORY_INDEX_LEN           128
+#elif HISTORY_MAX_SENSORS > 8
+#define HISTORY_INDEX_LEN           64
+#else
+#define HISTORY_INDEX_LEN           16
+#endif
+_Static_assert(HISTORY_INDEX_LEN >= 2 * HISTORY_MAX_SENSORS, "history index too small for the sensors");
+
+typedef struct __attribute__((packed)) {
+    uint32_t            time;
+    int16_t             temp;
+    uint8_t             hum;
+} history_raw_t;
+
+// Aggregate record, min/max are stored as saturated offsets from the average
+typedef struct __attribute__((packed)) {
+    int16_t             temp_avg;           /*!< 0.01 degrees Celsius */
+    uint8_t             temp_lo;            /*!< avg - min in 0.1 degrees */
+    uint8_t             temp_hi;            /*!< max - avg in 0.1 degrees */
+    uint8_t             hum_avg;
+    uint8_t             hum_lo;
+    uint8_t             hum_hi;
+    uint8_t             count;              /*!< samples */
+} history_agg_t;
+
+// Running sums of the period in progress
+typedef struct {
+    uint32_t            period;             /*!< time / period length */
+    int32_t             temp_sum;
+    uint32_t            hum_sum;
+    int16_t             temp_min;
+    int16_t             temp_max;
+    uint8_t             hum_min;
+    uint8_t             hum_max;
+    uint16_t            count;
+} history_acc_t;
+
+// Indexed by period, a period without samples is only a clear bit in valid
+typedef struct {
+    history_agg_t       *buf;               /*!< record of period p at p % len */
+    uint32_t            *valid;             /*!< a bit per record */
+    uint16_t            len;
+    uint16_t            used;               /*!< periods covered, up to last */
+    uint32_t            last;               /*!< period of the newest record */
+    uint32_t            period_len;         /*!< seconds */
+    history_acc_t       acc;
+} history_tier_ring_t;
+
+typedef struct {
+    uint8_t             id[HISTORY_ID_LEN];
+    uint8_t             older;              /*!< neighbours in the order of their last raw sample */
+    uint8_t             newer;
+    uint16_t            raw_head;
+    uint16_t            raw_used;
+    history_raw_t       raw[HISTORY_RAW_LEN];
+    history_agg_t       minute_buf[HISTORY_MINUTE_LEN];
+    history_agg_t       hour_buf[HISTORY_HOUR_LEN];
+    uint32_t            minute_valid[HISTORY_WORDS(HISTORY_MINUTE_LEN)];
+    uint32_t            hour_valid[HISTORY_WORDS(HISTORY_HOUR_LEN)];
+    history_tier_ring_t minute;
+    history_tier_ring_t hour;
+} history_sensor_t;
+
+static history_sensor_t history[HISTORY_MAX_SENSORS];
+static uint8_t history_index[HISTORY_INDEX_LEN];   /*!< slot + 1, 0 when free */
+static uint8_t history_count;              /*!< slots taken, from the first one */
+static uint8_t history_oldest = HISTORY_NONE;       /*!< the one to hand over once stale */
+static uint8_t history_latest = HISTORY_NONE;
+static uint32_t history_drops;
+static uint32_t history_newest;            /*!< newest sample time of any sensor */
+static portMUX_TYPE history_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint8_t _sat_u8(int32_t v) {
+    return (v < 0) ? 0 : (v > 255) ? 255 : v;
+}
+
+static uint32_t _history_hash(const uint8_t *id) {
+    uint32_t lo = id[0] | (id[1] << 8) | (id[2] << 16) | ((uint32_t)id[3] << 24);
+    uint32_t hi = id[4] | (id[5] << 8);
+    return ((lo ^ (hi * 0x85EBCA6B)) * 0x9E3779B1) >> 16;
+}
+
+// Linear probing, the entry holding id or the free one ending its chain
+static uint8_t _history_probe(const uint8_t *id, uint32_t hash) {
+    uint8_t i = hash & (HISTORY_INDEX_LEN - 1);
+    while (history_index[i] != 0 && memcmp(history[history_index[i] - 1].id, id, HISTORY_ID_LEN) != 0)
+        i = (i + 1) & (HISTORY_INDEX_LEN - 1);
+    return i;
+}
+
+// Shift the rest of the chain back so lookups never stop at the hole
+static void _history_unindex(uint8_t i) {
+    history_index[i] = 0;
+    uint8_t j = i;
+    while (1) {
+        j = (j + 1) & (HISTORY_INDEX_LEN - 1);
+        if (history_index[j] == 0)
+            break;
+        uint8_t home = _history_hash(history[history_index[j] - 1].id) & (HISTORY_INDEX_LEN - 1);
+        if (((j - home) & (HISTORY_INDEX_LEN - 1)) >= ((j - i) & (HISTORY_INDEX_LEN - 1))) {
+            history_index[i] = history_index[j];
+            history_index[j] = 0;
+            i = j;
+        }
+    }
+}
+
+static void _history_unlink(uint8_t slot) {
+    history_sensor_t *s = &history[slot];
+    if (s->older != HISTORY_NONE)
+        history[s->older].newer = s->newer;
+    else
+        history_oldest = s->newer;
+    if (s->newer != HISTORY_NONE)
+        history[s->newer].older = s->older;
+    else
+        history_latest = s->older;
+}
+
+static void _history_link(uint8_t slot) {
+    history_sensor_t *s = &history[slot];
+    s->older = history_latest;
+    s->newer = HISTORY_NONE;
+    if (history_latest != HISTORY_NONE)
+        history[history_latest].newer = slot;
+    else
+        history_oldest = slot;
+    history_latest = slot;
+}
+
+// Newest sample of a sensor in use, the raw tier only ever takes newer ones
+static uint32_t _history_last(const history_sensor_t *s) {
+    return s->raw[(s->raw_head + HISTORY_RAW_LEN - 1) % HISTORY_RAW_LEN].time;
+}
+
+static void _history_ring_init(history_tier_ring_t *ring, history_agg_t *buf, uint32_t *valid, uint16_t len, uint32_t period_len) {
+    memset(ring, 0, sizeof(*ring));
+    memset(valid, 0, HISTORY_WORDS(len) * sizeof(uint32_t));
+    ring->buf = buf;
+    ring->valid = valid;
+    ring->len = len;
+    ring->period_len = period_len;
+}
+
+static history_sensor_t *_history_find(const uint8_t *id, uint32_t hash, bool create) {
+    uint8_t i = _history_probe(id, hash);
+    if (history_index[i] != 0)
+        return &history[history_index[i] - 1];
+    if (!create)
+        return NULL;
+    uint8_t slot = history_count;
+    if (slot == HISTORY_MAX_SENSORS) {
+        // Full: a sensor gone quiet, one a session gave up on or out of range, makes room
+        slot = history_oldest;
+        if (_history_last(&history[slot]) + HISTORY_STALE_S >= history_newest)
+            return NULL;
+        _history_unindex(_history_probe(history[slot].id, _history_hash(history[slot].id)));
+        _history_unlink(slot);
+        i = _history_probe(id, hash);
+    } else {
+        history_count++;
+    }
+    // The buffers keep what the last owner left, raw_used and the valid bits hide it
+    history_sensor_t *s = &history[slot];
+    memcpy(s->id, id, HISTORY_ID_LEN);
+    s->raw_head = 0;
+    s->raw_used = 0;
+    _history_ring_init(&s->minute, s->minute_buf, s->minute_valid, HISTORY_MINUTE_LEN, MINUTE);
+    _history_ring_init(&s->hour, s->hour_buf, s->hour_valid, HISTORY_HOUR_LEN, HOUR);
+    history_index[i] = slot + 1;
+    _history_link(slot);
+    return s;
+}
+
+static bool _history_valid(const history_tier_ring_t *ring, uint16_t slot) {
+    return ring->valid[slot / 32] & (1U << (slot % 32));
+}
+
+// Periods from..to - 1 had no samples, a word of bits at a time
+static void _history_clear(history_tier_ring_t *ring, uint32_t from, uint32_t to) {
+    if (to - from >= ring->len) {
+        memset(ring->valid, 0, HISTORY_WORDS(ring->len) * sizeof(uint32_t));
+        return;
+    }
+    uint16_t slot = from % ring->len;
+    uint16_t n = to - from;
+    while (n > 0) {
+        uint16_t bits = 32 - slot % 32;
+        if (bits > n)
+            bits = n;
+        if (bits > ring->len - slot)
+            bits = ring->len - slot;
+        uint32_t mask = (bits == 32) ? UINT32_MAX : ((1U << bits) - 1) << (slot % 32);
+        ring->valid[slot / 32] &= ~mask;
+        slot = (slot + bits) % ring->len;
+        n -= bits;
+    }
+}
+
+static void _history_push(history_tier_ring_t *ring, const history_agg_t *rec, uint32_t period) {
+    uint16_t slot = period % ring->len;
+    if (ring->used > 0 && period > ring->last + 1)
+        _history_clear(ring, ring->last + 1, period);
+    ring->buf[slot] = *rec;
+    ring->valid[slot / 32] |= 1U << (slot % 32);
+    if (ring->used == 0)
+        ring->used = 1;
+    else
+        ring->used = (period - ring->last >= ring->len - ring->used) ? ring->len : ring->used + (period - ring->last);
+    ring->last = period;
+}
+
+static void _history_fold(const history_acc_t *acc, history_agg_t *rec) {
+    rec->temp_avg = acc->temp_sum / acc->count;
+    rec->temp_lo = _sat_u8((rec->temp_avg - acc->temp_min + 9) / 10);
+    rec->temp_hi = _sat_u8((acc->temp_max - rec->temp_avg + 9) / 10);
+    rec->hum_avg = acc->hum_sum / acc->count;
+    rec->hum_lo = rec->hum_avg - acc->hum_min;
+    rec->hum_hi = acc->hum_max - rec->hum_avg;
+    rec->count = _sat_u8(acc->count);
+}
+
+static void _history_close(history_tier_ring_t *ring) {
+    history_acc_t *acc = &ring->acc;
+    history_agg_t rec;
+    if (acc->count == 0)
+        return;
+    _history_fold(acc, &rec);
+    _history_push(ring, &rec, acc->period);
+    acc->count = 0;
+}
+
+static void _history_merge(history_agg_t *rec, int16_t temp, uint8_t hum) {
+    int16_t temp_min = rec->temp_avg - rec->temp_lo * 10;
+    int16_t temp_max = rec->temp_avg + rec->temp_hi * 10;
+    uint8_t hum_min = rec->hum_avg - rec->hum_lo;
+    uint8_t hum_max = rec->hum_avg + rec->hum_hi;
+    if (temp < temp_min) temp_min = temp;
+    if (temp > temp_max) temp_max = temp;
+    if (hum < hum_min) hum_min = hum;
+    if (hum > hum_max) hum_max = hum;
+    rec->temp_avg = ((int32_t)rec->temp_avg * rec->count + temp) / (rec->count + 1);
+    rec->hum_avg = ((uint32_t)rec->hum_avg * rec->count + hum) / (rec->count + 1);
+    rec->temp_lo = _sat_u8((rec->temp_avg - temp_min + 9) / 10);
+    rec->temp_hi = _sat_u8((temp_max - rec->temp_avg + 9) / 10);
+    rec->hum_lo = rec->hum_avg - hum_min;
+    rec->hum_hi = hum_max - rec->hum_avg;
+    rec->count = _sat_u8(rec->count + 1);
+}
+
+// A sample for a period before the one in progress lands in its record while the ring still holds it
+static void _history_late(history_tier_ring_t *ring, uint32_t period, int16_t temp, uint8_t hum) {
+    history_agg_t rec = { .temp_avg = temp, .hum_avg = hum, .count = 1 };
+    if (ring->used == 0 || period > ring->last) {
+        _history_push(ring, &rec, period);
+        return;
+    }
+    if (ring->last - period >= ring->used)
+        return;
+    uint16_t slot = period % ring->len;
+    if (_history_valid(ring, slot)) {
+        _history_merge(&ring->buf[slot], temp, hum);
+        return;
+    }
+    ring->buf[slot] = rec;
+    ring->valid[slot / 32] |= 1U << (slot % 32);
+}
+
+static void _history_accumulate(history_tier_ring_t *ring, uint32_t time, int16_t temp, uint8_t hum) {
+    history_acc_t *acc = &ring->acc;
+    uint32_t period = time / ring->period_len;
+    if (acc->count > 0 && period < acc->period) {
+        _history_late(ring, period, temp, hum);
+        return;
+    }
+    if (acc->count > 0 && period != acc->period)
+        _history_close(ring);
+    if (acc->count == 0) {
+        acc->period = period;
+        acc->temp_sum = 0;
+        acc->hum_sum = 0;
+        acc->temp_min = acc->temp_max = temp;
+        acc->hum_min = acc->hum_max = hum;
+    }
+    acc->temp_sum += temp;
+    acc->hum_sum += hum;
+    if (temp < acc->temp_min) acc->temp_min = temp;
+    if (temp > acc->temp_max) acc->temp_max = temp;
+    if (hum < acc->hum_min) acc->hum_min = hum;
+    if (hum > acc->hum_max) acc->hum_max = hum;
+    acc->count++;
+}
+
+esp_err_t history_add(const uint8_t *id, uint32_t time, int16_t temp, uint8_t hum) {
+    if (id == NULL)
+        return ESP_ERR_INVALID_ARG;
+    esp_err_t ret = ESP_OK;
+    uint32_t hash = _history_hash(id);
+    portENTER_CRITICAL(&history_lock);
+    if (time > history_newest)
+        history_newest = time;
+    history_sensor_t *s = _history_find(id, hash, true);
+    if (s == NULL) {
+        history_drops++;
+        ret = ESP_ERR_NO_MEM;
+        goto _exit;
+    }
+    // The raw tier keeps the newest samples in order, a late one only reaches the aggregates
+    if (s->raw_used == 0 || time >= _history_last(s)) {
+        history_raw_t *raw = &s->raw[s->raw_head];
+        raw->time = time;
+        raw->temp = temp;
+        raw->hum = hum;
+        s->raw_head = (s->raw_head + 1) % HISTORY_RAW_LEN;
+        if (s->raw_used < HISTORY_RAW_LEN)
+            s->raw_used++;
+        if (history_latest != s - history) {
+            _history_unlink(s - history);
+            _history_link(s - history);
+        }
+    }
+    _history_accumulate(&s->minute, time, temp, hum);
+    _history_accumulate(&s->hour, time, temp, hum);
+_exit:
+    portEXIT_CRITICAL(&history_lock);
+    return ret;
+}
+
+static void _history_point(const history_agg_t *rec, uint32_t time, history_point_t *p) {
+    p->time = time;
+    p->temp_avg = rec->temp_avg;
+    p->temp_min = rec->temp_avg - rec->temp_lo * 10;
+    p->temp_max = rec->temp_avg + rec->temp_hi * 10;
+    p->hum_avg = rec->hum_avg;
+    p->hum_min = rec->hum_avg - rec->hum_lo;
+    p->hum_max = rec->hum_avg + rec->hum_hi;
+    p->count = rec->count;
+}
+
+esp_err_t history_query(const uint8_t *id, history_tier_t tier, uint32_t from, uint32_t to, history_point_t *points, size_t *count) {
+    if (id == NULL || points == NULL || count == NULL)
+        return ESP_ERR_INVALID_ARG;
+    static const history_agg_t gap;
+    size_t n = 0;
+    esp_err_t ret = ESP_OK;
+    uint32_t hash = _history_hash(id);
+    portENTER_CRITICAL(&history_lock);
+    history_sensor_t *s = _history_find(id, hash, false);
+    if (s == NULL) {
+        ret = ESP_ERR_NOT_FOUND;
+        goto _exit;
+    }
+    if (tier == HISTORY_RAW) {
+        uint16_t start = (s->raw_head + HISTORY_RAW_LEN - s->raw_used) % HISTORY_RAW_LEN;
+        for (uint16_t i = 0; i < s->raw_used && n < *count; i++) {
+            const history_raw_t *raw = &s->raw[(start + i) % HISTORY_RAW_LEN];
+            if (raw->time < from || raw->time > to)
+                continue;
+            points[n].time = raw->time;
+            points[n].temp_min = points[n].temp_avg = points[n].temp_max = raw->temp;
+            points[n].hum_min = points[n].hum_avg = points[n].hum_max = raw->hum;
+            points[n].count = 1;
+            n++;
+        }
+        goto _exit;
+    }
+    history_tier_ring_t *ring = (tier == HISTORY_MINUTE) ? &s->minute : &s->hour;
+    // The ring covers the used periods up to the last, those without a record are gaps
+    uint32_t first = ring->last - (ring->used - 1);
+    for (uint16_t i = 0; i < ring->used && n < *count; i++) {
+        uint32_t period = first + i;
+        uint32_t time = period * ring->period_len;
+        if (time < from || time > to)
+            continue;
+        uint16_t slot = period % ring->len;
+        _history_point(_history_valid(ring, slot) ? &ring->buf[slot] : &gap, time, &points[n++]);
+    }
+    // The period in progress last, always after the ring's
+    uint32_t time = ring->acc.period * ring->period_len;
+    if (ring->acc.count > 0 && n < *count && time >= from && time <= to) {
+        history_agg_t rec;
+        _history_fold(&ring->acc, &rec);
+        _history_point(&rec, time, &points[n++]);
+    }
+_exit:
+    portEXIT_CRITICAL(&history_lock);
+    *count = n;
+    return ret;
+}
+
+uint32_t history_dropped(void) {
+    portENTER_CRITICAL(&history_lock);
+    uint32_t drops = history_drops;
+    portEXIT_CRITICAL(&history_lock);
+    return drops;
+}
@@ -0,0 +1,68 @@
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "mithermometer.h"
+
+// Per sensor DRAM: RAW_LEN * 7 + (MINUTE_LEN + HOUR_LEN) * 8 bytes and a bit each
+#define HISTORY_MAX_SENSORS         MI_SENSORS_LIMIT    /*!< every sensor the mode reports */
+#if HISTORY_MAX_SENSORS > 8
+// Tens of sensors, about 1.1 KB each, 68 KB for the 64 of passive mode
+#define HISTORY_RAW_LEN             16          /*!< last raw samples, ~1.5 min at one per 6 s */
+#define HISTORY_MINUTE_LEN          60          /*!< 1 h of 1 minute aggregates */
+#else
+// About 2.7 KB each
+#define HISTORY_RAW_LEN             64          /*!< last raw samples, ~6 min at one per 6 s */
+#define HISTORY_MINUTE_LEN          240         /*!< 4 h of 1 minute aggregates */
+#endif
+#define HISTORY_HOUR_LEN            48          /*!< 2 days of 1 hour aggregates */
+#define HISTORY_STALE_S             120         /*!< a full table hands the slot of the sensor heard from longest ago to a new one once it is this stale */
+#define HISTORY_ID_LEN              6           /*!< sensor BDA */
+
+typedef enum {
+    HISTORY_RAW,
+    HISTORY_MINUTE,
+    HISTORY_HOUR,
+} history_tier_t;
+
+/**
+ * One point of a query result. For raw samples min = avg = max and
+ * count is 1, for aggregates time is the start of the period and a
+ * count of 0 marks a period without samples.
+ */
+typedef struct {
+    uint32_t            time;               /*!< seconds */
+    int16_t             temp_min;           /*!< 0.01 degrees Celsius */
+    int16_t             temp_avg;
+    int16_t             temp_max;
+    uint8_t             hum_min;            /*!< % */
+    uint8_t             hum_avg;
+    uint8_t             hum_max;
+    uint8_t             count;
+} history_point_t;
+
+/**
+ * Add a sample in O(1), skipped periods included. time is in seconds on
+ * any clock that does not go backwards. A sample older than the newest
+ * one is merged into the aggregates of its period while the tiers still
+ * hold it, the raw tier skips it. A new sensor takes a free slot, or the
+ * one of the sensor whose newest raw sample came in first, once that is
+ * HISTORY_STALE_S behind the newest of all, its points gone;
+ * ESP_ERR_NO_MEM without either, see history_dropped().
+ */
+esp_err_t history_add(const uint8_t *id, uint32_t time, int16_t temp, uint8_t hum);
+
+// Samples refused since boot for want of a free sensor slot
+uint32_t history_dropped(void);
+
+/**
+ * Copy the points of a tier with from <= time <= to, oldest first. The
+ * period still being aggregated comes last with the samples it has so far,
+ * count saturates at 255.
+ * On entry *count is the capacity of points, on return the number written.
+ */
+esp_err_t history_query(const uint8_t *id, history_tier_t tier, uint32_t from, uint32_t to, history_point_t *points, size_t *count);
+#endif
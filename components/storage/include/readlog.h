@@ -0,0 +1,51 @@
+#ifndef _READLOG_H_
+#define _READLOG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define READLOG_PARTITION           "readlog"   /*!< data partition, see partitions.csv */
+#define READLOG_SUBTYPE             0x40
+#define READLOG_ID_LEN              6           /*!< sensor BDA */
+
+typedef struct __attribute__((packed)) {
+    uint32_t            time;               /*!< seconds */
+    uint8_t             id[READLOG_ID_LEN];
+    int16_t             temp;               /*!< 0.01 degrees Celsius */
+    uint8_t             hum;                /*!< % */
+    uint8_t             reserved;
+    uint16_t            crc;                /*!< CRC-16/CCITT of the bytes above */
+} readlog_record_t;
+
+typedef void (*readlog_cb_t)(const readlog_record_t *record, void *arg);
+
+/**
+ * Find the partition and recover the write position. The sector headers,
+ * a binary search of the newest sector, and the records of the newest two
+ * sectors for the newest time are read.
+ */
+esp_err_t readlog_init(void);
+
+/**
+ * Queue a record, it reaches flash once a 256 byte flash page worth of
+ * records is pending or on readlog_flush(). The oldest sector is erased
+ * when the log wraps. A batch that fails to write is dropped, the error
+ * returned, and the log goes on in the next sector.
+ */
+esp_err_t readlog_append(const uint8_t *id, uint32_t time, int16_t temp, uint8_t hum);
+esp_err_t readlog_flush(void);
+
+/**
+ * Call cb for every valid record with from <= time <= to, oldest first.
+ * Records with a bad CRC are skipped.
+ */
+esp_err_t readlog_read(uint32_t from, uint32_t to, readlog_cb_t cb, void *arg);
+
+/**
+ * Latest time on flash, 0 for an empty log. Records written late, older
+ * than the ones before them, do not move it back as long as they fill
+ * less than a sector.
+ */
+uint32_t readlog_last_time(void);
+#endif
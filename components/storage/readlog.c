@@ -0,0 +1,259 @@
+#include "readlog.h"
+#include <stddef.h>
+#include <string.h>
+#include "esp_partition.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define READLOG_MAGIC               0x474c4452  /*!< "RDLG" */
+#define READLOG_SECTOR_SIZE         4096
+#define READLOG_PAGE_SIZE           256         /*!< flash program page */
+#define READLOG_RECORD_SIZE         sizeof(readlog_record_t)
+#define READLOG_HEADER_SIZE         sizeof(readlog_header_t)
+#define READLOG_RECORDS_PER_SECTOR  ((READLOG_SECTOR_SIZE - READLOG_HEADER_SIZE) / READLOG_RECORD_SIZE)
+#define READLOG_BATCH               (READLOG_PAGE_SIZE / READLOG_RECORD_SIZE)
+
+static const char *TAG = "READLOG";
+
+typedef struct __attribute__((packed)) {
+    uint32_t            magic;
+    uint32_t            seq;                /*!< increases by one per sector written */
+    uint16_t            record_size;
+    uint16_t            reserved;
+    uint16_t            crc;
+    uint16_t            pad;
+} readlog_header_t;
+
+typedef struct {
+    const esp_partition_t   *part;
+    SemaphoreHandle_t       lock;
+    uint16_t                sectors;
+    uint16_t                sector;         /*!< sector being written */
+    uint32_t                seq;
+    uint16_t                slot;           /*!< next free record slot in sector */
+    uint8_t                 pending;
+    readlog_record_t        batch[READLOG_BATCH];
+    uint32_t                last_time;
+} readlog_t;
+
+static readlog_t readlog;
+
+static uint16_t _crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    while (len--) {
+        crc ^= (uint16_t)(*data++) << 8;
+        for (uint8_t i = 0; i < 8; i++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+static size_t _slot_offset(uint16_t sector, uint16_t slot) {
+    return (size_t)sector * READLOG_SECTOR_SIZE + READLOG_HEADER_SIZE + (size_t)slot * READLOG_RECORD_SIZE;
+}
+
+static bool _read_header(uint16_t sector, readlog_header_t *header) {
+    if (esp_partition_read(readlog.part, (size_t)sector * READLOG_SECTOR_SIZE, header, READLOG_HEADER_SIZE) != ESP_OK)
+        return false;
+    return header->magic == READLOG_MAGIC && header->record_size == READLOG_RECORD_SIZE &&
+           header->crc == _crc16((const uint8_t *)header, offsetof(readlog_header_t, crc));
+}
+
+static bool _slot_erased(uint16_t sector, uint16_t slot) {
+    readlog_record_t record;
+    const uint8_t *p = (const uint8_t *)&record;
+    if (esp_partition_read(readlog.part, _slot_offset(sector, slot), &record, READLOG_RECORD_SIZE) != ESP_OK)
+        return false;
+    for (size_t i = 0; i < READLOG_RECORD_SIZE; i++) {
+        if (p[i] != 0xFF)
+            return false;
+    }
+    return true;
+}
+
+static esp_err_t _start_sector(uint16_t sector, uint32_t seq) {
+    readlog_header_t header = {
+        .magic = READLOG_MAGIC,
+        .seq = seq,
+        .record_size = READLOG_RECORD_SIZE,
+        .reserved = 0xFFFF,
+        .pad = 0xFFFF,
+    };
+    header.crc = _crc16((const uint8_t *)&header, offsetof(readlog_header_t, crc));
+    esp_err_t ret = esp_partition_erase_range(readlog.part, (size_t)sector * READLOG_SECTOR_SIZE, READLOG_SECTOR_SIZE);
+    if (ret != ESP_OK)
+        return ret;
+    ret = esp_partition_write(readlog.part, (size_t)sector * READLOG_SECTOR_SIZE, &header, READLOG_HEADER_SIZE);
+    if (ret != ESP_OK)
+        return ret;
+    readlog.sector = sector;
+    readlog.seq = seq;
+    readlog.slot = 0;
+    return ESP_OK;
+}
+
+// The sector after the one being written holds the oldest data and is recycled
+static esp_err_t _next_sector(void) {
+    return _start_sector((readlog.sector + 1) % readlog.sectors, readlog.seq + 1);
+}
+
+// Latest time of the records before slot with a good CRC, a write cut short may have left bad ones
+static void _newest_time(uint16_t sector, uint16_t slots, uint32_t *time) {
+    readlog_record_t records[READLOG_BATCH];
+    for (uint16_t slot = 0; slot < slots; slot += READLOG_BATCH) {
+        uint16_t n = (slots - slot < READLOG_BATCH) ? slots - slot : READLOG_BATCH;
+        if (esp_partition_read(readlog.part, _slot_offset(sector, slot), records, n * READLOG_RECORD_SIZE) != ESP_OK)
+            return;
+        for (uint16_t r = 0; r < n; r++) {
+            if (records[r].crc == _crc16((const uint8_t *)&records[r], offsetof(readlog_record_t, crc)) && records[r].time > *time)
+                *time = records[r].time;
+        }
+    }
+}
+
+esp_err_t readlog_init(void) {
+    readlog_header_t header;
+    bool found = false;
+    readlog.part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, READLOG_SUBTYPE, READLOG_PARTITION);
+    if (readlog.part == NULL) {
+        ESP_LOGE(TAG, "partition %s not found", READLOG_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+    readlog.lock = xSemaphoreCreateMutex();
+    if (readlog.lock == NULL)
+        return ESP_ERR_NO_MEM;
+    readlog.sectors = readlog.part->size / READLOG_SECTOR_SIZE;
+    // The newest sector has the highest sequence number
+    for (uint16_t s = 0; s < readlog.sectors; s++) {
+        if (!_read_header(s, &header))
+            continue;
+        if (!found || (int32_t)(header.seq - readlog.seq) > 0) {
+            readlog.sector = s;
+            readlog.seq = header.seq;
+            found = true;
+        }
+    }
+    if (!found) {
+        ESP_LOGI(TAG, "empty log, %d sectors", readlog.sectors);
+        return _start_sector(0, 0);
+    }
+    // Records are written in order, binary search the first erased slot
+    uint16_t lo = 0, hi = READLOG_RECORDS_PER_SECTOR;
+    while (lo < hi) {
+        uint16_t mid = (lo + hi) / 2;
+        if (_slot_erased(readlog.sector, mid))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    readlog.slot = lo;
+    // Records may come late, the newest time is the largest of the sector and the one before,
+    // which also covers a sector just started
+    uint16_t prev = (readlog.sector + readlog.sectors - 1) % readlog.sectors;
+    _newest_time(readlog.sector, lo, &readlog.last_time);
+    if (prev != readlog.sector && _read_header(prev, &header) && header.seq == readlog.seq - 1)
+        _newest_time(prev, READLOG_RECORDS_PER_SECTOR, &readlog.last_time);
+    ESP_LOGI(TAG, "sector %d seq %u slot %d", readlog.sector, readlog.seq, readlog.slot);
+    // Full, writing on would run into the next sector
+    if (readlog.slot >= READLOG_RECORDS_PER_SECTOR)
+        return _next_sector();
+    return ESP_OK;
+}
+
+static esp_err_t _flush(void) {
+    if (readlog.pending == 0)
+        return ESP_OK;
+    esp_err_t ret = esp_partition_write(readlog.part, _slot_offset(readlog.sector, readlog.slot), readlog.batch, readlog.pending * READLOG_RECORD_SIZE);
+    if (ret == ESP_OK) {
+        for (uint8_t i = 0; i < readlog.pending; i++) {
+            if (readlog.batch[i].time > readlog.last_time)
+                readlog.last_time = readlog.batch[i].time;
+        }
+        readlog.slot += readlog.pending;
+    } else {
+        // The slots may be partly programmed, and a hole would mislead the search in readlog_init: drop the batch and leave the sector
+        ESP_LOGW(TAG, "write failed, %d records dropped", readlog.pending);
+        readlog.slot = READLOG_RECORDS_PER_SECTOR;
+    }
+    readlog.pending = 0;
+    if (readlog.slot >= READLOG_RECORDS_PER_SECTOR) {
+        esp_err_t err = _next_sector();
+        if (ret == ESP_OK)
+            ret = err;
+    }
+    return ret;
+}
+
+esp_err_t readlog_append(const uint8_t *id, uint32_t time, int16_t temp, uint8_t hum) {
+    if (readlog.part == NULL)
+        return ESP_ERR_INVALID_STATE;
+    xSemaphoreTake(readlog.lock, portMAX_DELAY);
+    // The sector could not be recycled after the last write, nowhere to put the record until it is
+    if (readlog.slot >= READLOG_RECORDS_PER_SECTOR) {
+        esp_err_t err = _next_sector();
+        if (err != ESP_OK) {
+            xSemaphoreGive(readlog.lock);
+            return err;
+        }
+    }
+    readlog_record_t *record = &readlog.batch[readlog.pending++];
+    record->time = time;
+    memcpy(record->id, id, READLOG_ID_LEN);
+    record->temp = temp;
+    record->hum = hum;
+    record->reserved = 0xFF;
+    record->crc = _crc16((const uint8_t *)record, offsetof(readlog_record_t, crc));
+    // Write whole flash pages, or what is left of the sector
+    esp_err_t ret = ESP_OK;
+    size_t end = _slot_offset(readlog.sector, readlog.slot + readlog.pending);
+    if (end % READLOG_PAGE_SIZE == 0 || readlog.pending >= READLOG_BATCH || readlog.slot + readlog.pending >= READLOG_RECORDS_PER_SECTOR)
+        ret = _flush();
+    xSemaphoreGive(readlog.lock);
+    return ret;
+}
+
+esp_err_t readlog_flush(void) {
+    if (readlog.part == NULL)
+        return ESP_ERR_INVALID_STATE;
+    xSemaphoreTake(readlog.lock, portMAX_DELAY);
+    esp_err_t ret = _flush();
+    xSemaphoreGive(readlog.lock);
+    return ret;
+}
+
+esp_err_t readlog_read(uint32_t from, uint32_t to, readlog_cb_t cb, void *arg) {
+    readlog_header_t header;
+    readlog_record_t records[READLOG_BATCH];
+    if (readlog.part == NULL)
+        return ESP_ERR_INVALID_STATE;
+    if (cb == NULL)
+        return ESP_ERR_INVALID_ARG;
+    xSemaphoreTake(readlog.lock, portMAX_DELAY);
+    // Oldest sector follows the one being written
+    for (uint16_t i = 1; i <= readlog.sectors; i++) {
+        uint16_t sector = (readlog.sector + i) % readlog.sectors;
+        if (!_read_header(sector, &header))
+            continue;
+        uint16_t slots = (sector == readlog.sector) ? readlog.slot : READLOG_RECORDS_PER_SECTOR;
+        for (uint16_t slot = 0; slot < slots; slot += READLOG_BATCH) {
+            uint16_t n = slots - slot;
+            if (n > READLOG_BATCH)
+                n = READLOG_BATCH;
+            if (esp_partition_read(readlog.part, _slot_offset(sector, slot), records, n * READLOG_RECORD_SIZE) != ESP_OK)
+                break;
+            for (uint16_t r = 0; r < n; r++) {
+                if (records[r].crc != _crc16((const uint8_t *)&records[r], offsetof(readlog_record_t, crc)))
+                    continue;
+                if (records[r].time >= from && records[r].time <= to)
+                    cb(&records[r], arg);
+            }
+        }
+    }
+    xSemaphoreGive(readlog.lock);
+    return ESP_OK;
+}
+
+uint32_t readlog_last_time(void) {
+    return readlog.last_time;
+}
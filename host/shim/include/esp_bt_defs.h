@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define ESP_BD_ADDR_LEN             6
+typedef uint8_t esp_bd_addr_t[ESP_BD_ADDR_LEN];
+
+#define ESP_BD_ADDR_STR             "%02x:%02x:%02x:%02x:%02x:%02x"
+#define ESP_BD_ADDR_HEX(addr)       addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]
+
+typedef enum {
+    ESP_BT_STATUS_SUCCESS = 0,
+    ESP_BT_STATUS_FAIL,
+    ESP_BT_STATUS_NOT_READY,
+    ESP_BT_STATUS_NOMEM,
+    ESP_BT_STATUS_BUSY,
+} esp_bt_status_t;
+
+typedef enum {
+    BLE_ADDR_TYPE_PUBLIC        = 0x00,
+    BLE_ADDR_TYPE_RANDOM        = 0x01,
+    BLE_ADDR_TYPE_RPA_PUBLIC    = 0x02,
+    BLE_ADDR_TYPE_RPA_RANDOM    = 0x03,
+} esp_ble_addr_type_t;
+
+typedef enum {
+    ESP_BT_DEVICE_TYPE_BREDR    = 0x01,
+    ESP_BT_DEVICE_TYPE_BLE      = 0x02,
+    ESP_BT_DEVICE_TYPE_DUMO     = 0x03,
+} esp_bt_dev_type_t;
+
+#define ESP_UUID_LEN_16             2
+#define ESP_UUID_LEN_32             4
+#define ESP_UUID_LEN_128            16
+
+typedef struct {
+    uint16_t                len;
+    union {
+        uint16_t            uuid16;
+        uint32_t            uuid32;
+        uint8_t             uuid128[ESP_UUID_LEN_128];
+    } uuid;
+} __attribute__((packed)) esp_bt_uuid_t;
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_bt_defs.h"
+
+#define ESP_BLE_ADV_DATA_LEN_MAX        31
+#define ESP_BLE_SCAN_RSP_DATA_LEN_MAX   31
+
+#define ESP_BLE_AD_TYPE_FLAG            0x01
+#define ESP_BLE_AD_TYPE_16SRV_PART      0x02
+#define ESP_BLE_AD_TYPE_16SRV_CMPL      0x03
+#define ESP_BLE_AD_TYPE_NAME_SHORT      0x08
+#define ESP_BLE_AD_TYPE_NAME_CMPL       0x09
+#define ESP_BLE_AD_TYPE_SERVICE_DATA    0x16
+
+// Values as in ESP-IDF v4.3, traces recorded on target replay unchanged
+typedef enum {
+    ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT       = 0,
+    ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT  = 1,
+    ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT     = 2,
+    ESP_GAP_BLE_SCAN_RESULT_EVT                 = 3,
+    ESP_GAP_BLE_SCAN_START_COMPLETE_EVT         = 7,
+    ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT          = 18,
+    ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT          = 20,
+} esp_gap_ble_cb_event_t;
+
+typedef enum {
+    ESP_GAP_SEARCH_INQ_RES_EVT             = 0,
+    ESP_GAP_SEARCH_INQ_CMPL_EVT            = 1,
+} esp_gap_search_evt_t;
+
+typedef enum {
+    ESP_BLE_EVT_CONN_ADV         = 0x00,
+    ESP_BLE_EVT_CONN_DIR_ADV     = 0x01,
+    ESP_BLE_EVT_DISC_ADV         = 0x02,
+    ESP_BLE_EVT_NON_CONN_ADV     = 0x03,
+    ESP_BLE_EVT_SCAN_RSP         = 0x04,
+} esp_ble_evt_type_t;
+
+typedef enum {
+    BLE_SCAN_TYPE_PASSIVE   = 0x0,
+    BLE_SCAN_TYPE_ACTIVE    = 0x1,
+} esp_ble_scan_type_t;
+
+typedef enum {
+    BLE_SCAN_FILTER_ALLOW_ALL = 0x0,
+} esp_ble_scan_filter_t;
+
+typedef enum {
+    BLE_SCAN_DUPLICATE_DISABLE = 0x0,
+    BLE_SCAN_DUPLICATE_ENABLE  = 0x1,
+} esp_ble_scan_duplicate_t;
+
+typedef struct {
+    esp_ble_scan_type_t     scan_type;
+    esp_ble_addr_type_t     own_addr_type;
+    esp_ble_scan_filter_t   scan_filter_policy;
+    uint16_t                scan_interval;          /*!< 0.625 ms units */
+    uint16_t                scan_window;
+    esp_ble_scan_duplicate_t scan_duplicate;
+} esp_ble_scan_params_t;
+
+typedef struct {
+    esp_bd_addr_t           bda;
+    uint16_t                min_int;                /*!< 1.25 ms units */
+    uint16_t                max_int;
+    uint16_t                latency;
+    uint16_t                timeout;                /*!< 10 ms units */
+} esp_ble_conn_update_params_t;
+
+typedef union {
+    struct ble_scan_result_evt_param {
+        esp_gap_search_evt_t    search_evt;
+        esp_bd_addr_t           bda;
+        esp_bt_dev_type_t       dev_type;
+        esp_ble_addr_type_t     ble_addr_type;
+        esp_ble_evt_type_t      ble_evt_type;
+        int                     rssi;
+        uint8_t                 ble_adv[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+        int                     flag;
+        int                     num_resps;
+        uint8_t                 adv_data_len;
+        uint8_t                 scan_rsp_len;
+        uint32_t                num_dis;
+    } scan_rst;
+    struct ble_scan_param_cmpl_evt_param {
+        esp_bt_status_t         status;
+    } scan_param_cmpl;
+    struct ble_scan_start_cmpl_evt_param {
+        esp_bt_status_t         status;
+    } scan_start_cmpl;
+    struct ble_scan_stop_cmpl_evt_param {
+        esp_bt_status_t         status;
+    } scan_stop_cmpl;
+    struct ble_update_conn_params_evt_param {
+        esp_bt_status_t         status;
+        esp_bd_addr_t           bda;
+        uint16_t                min_int;
+        uint16_t                max_int;
+        uint16_t                latency;
+        uint16_t                conn_int;
+        uint16_t                timeout;
+    } update_conn_params;
+} esp_ble_gap_cb_param_t;
+
+typedef void (*esp_gap_ble_cb_t)(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback);
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *scan_params);
+esp_err_t esp_ble_gap_start_scanning(uint32_t duration);
+esp_err_t esp_ble_gap_stop_scanning(void);
+esp_err_t esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t *params);
+uint8_t *esp_ble_resolve_adv_data(uint8_t *adv_data, uint8_t type, uint8_t *length);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_bt_defs.h"
+
+#define ESP_GATT_UUID_CHAR_CLIENT_CONFIG    0x2902
+#define ESP_GATT_UUID_BATTERY_LEVEL         0x2A19
+#define ESP_GATT_UUID_MODEL_NUMBER_STR      0x2A24
+#define ESP_GATT_UUID_SERIAL_NUMBER_STR     0x2A25
+#define ESP_GATT_UUID_FW_VERSION_STR        0x2A26
+#define ESP_GATT_UUID_HW_VERSION_STR        0x2A27
+#define ESP_GATT_UUID_SW_VERSION_STR        0x2A28
+
+#define ESP_GATT_IF_NONE                    0xff
+typedef uint8_t esp_gatt_if_t;
+
+typedef enum {
+    ESP_GATT_OK                     = 0x0,
+    ESP_GATT_INVALID_HANDLE         = 0x01,
+    ESP_GATT_READ_NOT_PERMIT        = 0x02,
+    ESP_GATT_WRITE_NOT_PERMIT       = 0x03,
+    ESP_GATT_REQ_NOT_SUPPORTED      = 0x06,
+    ESP_GATT_NOT_FOUND              = 0x0a,
+    ESP_GATT_NO_RESOURCES           = 0x80,
+    ESP_GATT_INTERNAL_ERROR         = 0x81,
+    ESP_GATT_WRONG_STATE            = 0x82,
+    ESP_GATT_BUSY                   = 0x84,
+    ESP_GATT_ERROR                  = 0x85,
+    ESP_GATT_CONGESTED              = 0x8f,
+    ESP_GATT_ALREADY_OPEN           = 0x91,
+    ESP_GATT_CANCEL                 = 0x92,
+} esp_gatt_status_t;
+
+typedef enum {
+    ESP_GATT_CONN_UNKNOWN                   = 0,
+    ESP_GATT_CONN_L2C_FAILURE               = 1,
+    ESP_GATT_CONN_TIMEOUT                   = 0x08,
+    ESP_GATT_CONN_TERMINATE_PEER_USER       = 0x13,
+    ESP_GATT_CONN_TERMINATE_LOCAL_HOST      = 0x16,
+    ESP_GATT_CONN_FAIL_ESTABLISH            = 0x3e,
+    ESP_GATT_CONN_NONE                      = 0x0101,
+} esp_gatt_conn_reason_t;
+
+typedef enum {
+    ESP_GATT_AUTH_REQ_NONE                  = 0,
+} esp_gatt_auth_req_t;
+
+typedef enum {
+    ESP_GATT_WRITE_TYPE_NO_RSP  = 1,
+    ESP_GATT_WRITE_TYPE_RSP,
+} esp_gatt_write_type_t;
+
+typedef struct {
+    bool                is_primary;
+    uint16_t            start_handle;
+    uint16_t            end_handle;
+    esp_bt_uuid_t       uuid;
+} esp_gattc_service_elem_t;
+
+typedef struct {
+    uint16_t            char_handle;
+    uint8_t             properties;
+    esp_bt_uuid_t       uuid;
+} esp_gattc_char_elem_t;
+
+typedef struct {
+    uint16_t            handle;
+    esp_bt_uuid_t       uuid;
+} esp_gattc_descr_elem_t;
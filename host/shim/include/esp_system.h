@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// Deterministic, see shim_set_seed()
+uint32_t esp_random(void);
+
+// Heap model of the shim, see shim_heap_get_stats()
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+void esp_restart(void) __attribute__((noreturn));
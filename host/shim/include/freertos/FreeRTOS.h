@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "esp_bit_defs.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint8_t StackType_t;
+
+#define pdFALSE                     ((BaseType_t)0)
+#define pdTRUE                      ((BaseType_t)1)
+#define pdPASS                      (pdTRUE)
+#define pdFAIL                      (pdFALSE)
+#define errQUEUE_EMPTY              ((BaseType_t)0)
+#define errQUEUE_FULL               ((BaseType_t)0)
+
+#define configTICK_RATE_HZ          CONFIG_FREERTOS_HZ
+#define configMAX_PRIORITIES        25
+#define configMAX_TASK_NAME_LEN     16
+#define configSUPPORT_STATIC_ALLOCATION     CONFIG_FREERTOS_SUPPORT_STATIC_ALLOCATION
+#define configSUPPORT_DYNAMIC_ALLOCATION    1
+
+#define portMAX_DELAY               ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS          ((TickType_t)1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS            portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(xTimeInMs)    ((TickType_t)(((TickType_t)(xTimeInMs) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000U))
+#define tskNO_AFFINITY              0x7FFFFFFF
+
+// Tasks run one at a time on the host, a critical section only holds off preemption
+typedef struct {
+    uint32_t                owner;
+    uint32_t                count;
+} portMUX_TYPE;
+
+#define portMUX_FREE_VAL            0xB33FFFFF
+#define portMUX_INITIALIZER_UNLOCKED    { .owner = portMUX_FREE_VAL, .count = 0 }
+
+void vPortEnterCritical(portMUX_TYPE *mux);
+void vPortExitCritical(portMUX_TYPE *mux);
+void vPortCPUInitializeMutex(portMUX_TYPE *mux);
+
+#define portENTER_CRITICAL(mux)         vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux)          vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux)     vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux)      vPortExitCritical(mux)
+#define portENTER_CRITICAL_SAFE(mux)    vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_SAFE(mux)     vPortExitCritical(mux)
+#define portYIELD_FROM_ISR()            do { } while (0)
+
+// Placeholders of the kernel objects, the host keeps its own pools
+typedef struct {
+    uint8_t                 dummy[360];
+} StaticTask_t;
+
+typedef struct {
+    uint8_t                 dummy[80];
+} StaticQueue_t;
+
+typedef StaticQueue_t StaticSemaphore_t;
+
+typedef struct {
+    uint8_t                 dummy[32];
+} StaticEventGroup_t;
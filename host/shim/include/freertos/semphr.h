@@ -0,0 +1,24 @@
+#pragma once
+
+#include "queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+// Semaphores are queues of empty items, a mutex starts with one, no priority inheritance
+QueueHandle_t xQueueCreateMutex(const uint8_t ucQueueType);
+QueueHandle_t xQueueCreateMutexStatic(const uint8_t ucQueueType, StaticQueue_t *pxStaticQueue);
+QueueHandle_t xQueueCreateCountingSemaphore(const UBaseType_t uxMaxCount, const UBaseType_t uxInitialCount);
+BaseType_t xQueueSemaphoreTake(QueueHandle_t xQueue, TickType_t xTicksToWait);
+
+#define xSemaphoreCreateMutex()             xQueueCreateMutex(queueQUEUE_TYPE_MUTEX)
+#define xSemaphoreCreateMutexStatic(pxMutexBuffer)  xQueueCreateMutexStatic(queueQUEUE_TYPE_MUTEX, (pxMutexBuffer))
+#define xSemaphoreCreateBinary()            xQueueGenericCreate((UBaseType_t)1, 0, queueQUEUE_TYPE_BINARY_SEMAPHORE)
+#define xSemaphoreCreateBinaryStatic(pxStaticSemaphore) \
+    xQueueGenericCreateStatic((UBaseType_t)1, 0, NULL, (pxStaticSemaphore), queueQUEUE_TYPE_BINARY_SEMAPHORE)
+#define xSemaphoreCreateCounting(uxMaxCount, uxInitialCount)    xQueueCreateCountingSemaphore((uxMaxCount), (uxInitialCount))
+#define xSemaphoreTake(xSemaphore, xBlockTime)  xQueueSemaphoreTake((xSemaphore), (xBlockTime))
+#define xSemaphoreGive(xSemaphore)          xQueueGenericSend((QueueHandle_t)(xSemaphore), NULL, 0, queueSEND_TO_BACK)
+#define xSemaphoreGiveFromISR(xSemaphore, pxHigherPriorityTaskWoken) \
+    xQueueGenericSendFromISR((QueueHandle_t)(xSemaphore), NULL, (pxHigherPriorityTaskWoken), queueSEND_TO_BACK)
+#define vSemaphoreDelete(xSemaphore)        vQueueDelete((QueueHandle_t)(xSemaphore))
+#define uxSemaphoreGetCount(xSemaphore)     uxQueueMessagesWaiting((QueueHandle_t)(xSemaphore))
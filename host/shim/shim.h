@@ -0,0 +1,101 @@
+#pragma once
+
+// Host side of the ESP-IDF shim. The firmware sees FreeRTOS, esp_timer, NVS, the
+// partition API, I2C and Bluedroid; the harness drives them through this header.
+//
+// Time is virtual: tasks run one at a time on their own threads and take no time
+// while running, the clock only moves when every task is blocked, straight to the
+// next timer or timeout. A run with the same seed gives the same trace every time.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_log.h"
+
+#define SHIM_HEAP_SIZE              (160 * 1024)    /*!< free heap of the target once Bluedroid is up */
+#define SHIM_PAYLOAD_MAX            320             /*!< bytes copied with a deferred call */
+
+// Reset the kernel, the clock and the heap accounting, the flash and NVS keep their content
+void shim_init(void);
+
+// Clock
+int64_t shim_now_us(void);
+void shim_set_seed(uint32_t seed);
+void shim_set_realtime(bool realtime);          /*!< pace the virtual clock to the wall clock */
+
+/**
+ * Run tasks and timers until cond returns true or max_ms of virtual time have
+ * passed. cond is checked between every two steps, NULL runs the full time.
+ */
+bool shim_run_until(bool (*cond)(void *arg), void *arg, uint32_t max_ms);
+void shim_run_for(uint32_t ms);
+
+// Run app_main in the "main" task at priority 1, like the IDF startup code
+void shim_start_app(void (*app)(void));
+
+/**
+ * Call fn at at_us with a copy of payload, in a context named after the
+ * task the target would run it in ("btc" for the Bluetooth stack). Returns
+ * an id for shim_cancel, 0 if the pool is full.
+ */
+typedef void (*shim_call_t)(void *payload, size_t len);
+uint32_t shim_post(int64_t at_us, const char *context, shim_call_t fn, const void *payload, size_t len);
+bool shim_cancel(uint32_t id);
+
+// The calling task blocks for us of virtual time, hardware waits like a bus transfer
+void shim_busy_us(uint32_t us);
+
+// Task, or deferred call context, running right now; "host" for the harness itself
+const char *shim_context(void);
+
+/**
+ * Run boot(arg) in a forked child as one power cycle: statics and the heap
+ * start over, the flash and NVS carry over. Returns the exit status, a
+ * crash or failed check returns non-zero. Call before any task is started.
+ */
+int shim_reboot_run(int (*boot)(void *arg), void *arg);
+
+// Heap, every malloc of the firmware and the kernel objects it creates
+typedef struct {
+    size_t      free;
+    size_t      minimum_free;
+    uint32_t    allocations;
+    uint32_t    frees;
+    uint32_t    failed;                         /*!< allocations refused past SHIM_HEAP_SIZE */
+} shim_heap_stats_t;
+
+void shim_heap_get_stats(shim_heap_stats_t *stats);
+uint32_t shim_heap_allocations(const char *context);   /*!< allocations made by a task or context since shim_init */
+
+// Log, ESP_LOGx prints up to the level of SHIM_LOG in the environment (E, W, I, D or V, default W)
+void shim_log_set_level(esp_log_level_t level);
+uint32_t shim_log_errors(void);                 /*!< ESP_LOGE calls since shim_init, printed or not */
+
+// Flash and NVS, kept in shared memory so they survive shim_reboot_run
+typedef struct {
+    uint32_t    reads;
+    uint32_t    writes;
+    uint32_t    erases;
+    uint64_t    bytes_read;
+    uint64_t    bytes_written;
+    uint32_t    nvs_writes;                     /*!< nvs_set_* that changed a value */
+} shim_flash_stats_t;
+
+void shim_flash_get_stats(shim_flash_stats_t *stats);
+void shim_flash_reset_stats(void);
+void shim_flash_fail_writes(uint32_t count);    /*!< the next count partition writes fail with ESP_FAIL */
+void shim_storage_erase(void);                  /*!< factory state, erased flash and empty NVS */
+
+// I2C, a device gets the bytes after the address of every write transaction
+typedef void (*shim_i2c_write_t)(void *ctx, const uint8_t *data, size_t len);
+
+typedef struct {
+    uint32_t    transactions;
+    uint32_t    bytes;                          /*!< address byte included */
+    uint32_t    nacks;
+    uint64_t    bus_us;
+} shim_i2c_stats_t;
+
+void shim_i2c_attach(int port, uint8_t addr, shim_i2c_write_t write, void *ctx);
+void shim_i2c_get_stats(int port, shim_i2c_stats_t *stats);
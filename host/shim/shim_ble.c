@@ -0,0 +1,1355 @@
+// Bluedroid GAP/GATTC over a population of mock sensors, see shim_ble.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "shim_internal.h"
+#include "shim_ble.h"
+#include "esp_bt.h"
+#include "esp_bt_main.h"
+#include "esp_gatt_common_api.h"
+
+#define SHIM_BLE_CONTEXT            "btc"
+#define SHIM_BLE_BTC_US             100         /*!< API call to callback, no air time */
+#define SHIM_BLE_HCI_US             1000        /*!< controller command to completion event */
+#define SHIM_BLE_ADV_DELAY_US       10000       /*!< advDelay, 0 to 10 ms added to every advertising interval */
+#define SHIM_BLE_OPEN_TIMEOUT_US    30000000LL  /*!< CONFIG_BT_BLE_ESTAB_LINK_CONN_TOUT */
+#define SHIM_BLE_INIT_INTERVAL      24          /*!< 30 ms, the Bluedroid default of a new link */
+#define SHIM_BLE_INIT_TIMEOUT       500
+#define SHIM_BLE_UPDATE_EVENTS      6           /*!< connection events up to the instant of a parameter update */
+#define SHIM_BLE_DISCOVERY_OPS      24          /*!< ATT round trips of a full service discovery */
+#define SHIM_BLE_MTU_DEFAULT        23
+#define SHIM_BLE_VALUE_MAX          247
+#define SHIM_BLE_HOUR_US            3600000000LL
+#define SHIM_BLE_LINK_NONE          0xFF
+
+#define SHIM_CHAR_READ              0x02
+#define SHIM_CHAR_WRITE             0x08
+#define SHIM_CHAR_NOTIFY            0x10
+#define SHIM_CHAR_INDICATE          0x20
+
+typedef enum {
+    SHIM_LINK_FREE,
+    SHIM_LINK_PENDING,                      /*!< open called, waiting for the sensor to advertise */
+    SHIM_LINK_UP,
+    SHIM_LINK_CLOSING,                      /*!< disconnect events posted */
+} shim_link_state_t;
+
+typedef struct {
+    shim_link_state_t   state;
+    uint32_t            gen;                /*!< bumped when the link goes away, events of an older one are dropped */
+    esp_bd_addr_t       bda;
+    int                 sensor;
+    uint16_t            interval;           /*!< 1.25 ms units */
+    uint16_t            latency;
+    uint16_t            timeout;            /*!< 10 ms units */
+    uint16_t            mtu;
+    int64_t             att_busy;           /*!< the ATT bearer answers one request at a time */
+    bool                discovered;
+    bool                data_notify;
+    bool                history_notify;
+    bool                history_streaming;
+    uint32_t            history_next;
+    uint32_t            open_timeout;       /*!< shim_post id while pending */
+} shim_link_t;
+
+typedef struct {
+    shim_sensor_config_t config;
+    bool                used;
+    bool                powered;
+    int                 link;
+    uint32_t            counter;            /*!< one per reading, MiBeacon frame counter and extended counter */
+    uint8_t             object;             /*!< next MiBeacon object */
+    uint32_t            rng;
+    int64_t             added;
+    shim_sensor_stats_t stats;
+} shim_sensor_t;
+
+typedef struct {
+    bool                used;
+    esp_bd_addr_t       bda;
+    uint16_t            handle;
+} shim_notif_reg_t;
+
+typedef enum {
+    SHIM_ATT_READ,
+    SHIM_ATT_WRITE,
+    SHIM_ATT_WRITE_DESCR,
+    SHIM_ATT_MTU,
+} shim_att_op_t;
+
+typedef struct {
+    uint8_t             link;
+    uint32_t            gen;
+    shim_att_op_t       op;
+    uint16_t            handle;
+    int64_t             respond;
+    uint16_t            len;
+    uint8_t             value[SHIM_BLE_VALUE_MAX];
+} shim_att_req_t;
+
+typedef struct {
+    uint8_t             link;
+    uint32_t            gen;
+    esp_gattc_cb_event_t event;
+    esp_gatt_if_t       gattc_if;
+    esp_ble_gattc_cb_param_t param;
+    uint16_t            len;
+    uint8_t             value[SHIM_BLE_VALUE_MAX];
+} shim_gattc_evt_t;
+
+typedef struct {
+    esp_gap_ble_cb_event_t event;
+    esp_ble_gap_cb_param_t param;
+} shim_gap_evt_t;
+
+typedef struct {
+    uint8_t             link;
+    uint32_t            gen;
+    uint32_t            left;
+} shim_link_call_t;
+
+typedef struct {
+    uint8_t             link;
+    uint32_t            gen;
+    esp_ble_conn_update_params_t params;
+} shim_update_call_t;
+
+_Static_assert(sizeof(shim_att_req_t) <= SHIM_PAYLOAD_MAX, "ATT request too large for shim_post");
+_Static_assert(sizeof(shim_gattc_evt_t) <= SHIM_PAYLOAD_MAX, "GATTC event too large for shim_post");
+_Static_assert(sizeof(shim_gap_evt_t) <= SHIM_PAYLOAD_MAX, "GAP event too large for shim_post");
+
+// Attribute table of the LYWSD03MMC
+typedef enum {
+    SHIM_ATTR_SERVICE,
+    SHIM_ATTR_CHAR,
+    SHIM_ATTR_DESCR,
+} shim_attr_kind_t;
+
+typedef struct {
+    shim_attr_kind_t    kind;
+    uint16_t            handle;             /*!< first handle of a service, value handle of a characteristic */
+    uint16_t            end;                /*!< last handle of a service */
+    uint16_t            uuid16;
+    uint8_t             uuid128;            /*!< last but two byte of the custom UUID, 0 for 16-bit UUIDs */
+    uint8_t             properties;
+} shim_attr_t;
+
+static const uint8_t shim_uuid128_base[ESP_UUID_LEN_128] = {
+    0xa6, 0xa3, 0x7d, 0x99, 0xf2, 0x6f, 0x1a, 0x8a, 0x0c, 0x4b, 0x0a, 0x7a, 0x00, 0xcc, 0xe0, 0xeb,
+};
+
+static const shim_attr_t shim_attrs[] = {
+    { SHIM_ATTR_SERVICE, 0x0001, 0x0007, 0x1800, 0, 0 },
+    { SHIM_ATTR_CHAR,    0x0003, 0,      0x2A00, 0, SHIM_CHAR_READ },
+    { SHIM_ATTR_CHAR,    0x0005, 0,      0x2A01, 0, SHIM_CHAR_READ },
+    { SHIM_ATTR_CHAR,    0x0007, 0,      0x2A04, 0, SHIM_CHAR_READ },
+    { SHIM_ATTR_SERVICE, 0x0008, 0x000B, 0x1801, 0, 0 },
+    { SHIM_ATTR_CHAR,    0x000A, 0,      0x2A05, 0, SHIM_CHAR_INDICATE },
+    { SHIM_ATTR_DESCR,   0x000B, 0,      ESP_GATT_UUID_CHAR_CLIENT_CONFIG, 0, 0 },
+    { SHIM_ATTR_SERVICE, 0x000C, 0x001A, 0x180A, 0, 0 },
+    { SHIM_ATTR_CHAR,    SHIM_HANDLE_MODEL,  0, ESP_GATT_UUID_MODEL_NUMBER_STR,  0, SHIM_CHAR_READ },
+    { SHIM_ATTR_CHAR,    SHIM_HANDLE_SERIAL, 0, ESP_GATT_UUID_SERIAL_NUMBER_STR, 0, SHIM_CHAR_READ },
+    { SHIM_ATTR_CHAR,    SHIM_HANDLE_FW,     0, ESP_GATT_UUID_FW_VERSION_STR,    0, SHIM_CHAR_READ },
+    { SHIM_ATTR_CHAR,    SHIM_HANDLE_HW,     0, ESP_GATT_UUID_HW_VERSION_STR,    0, SHIM_CHAR_READ },
+    { SHIM_ATTR_CHAR,    SHIM_HANDLE_SW,     0, ESP_GATT_UUID_SW_VERSION_STR,    0, SHIM_CHAR_READ },
+    { SHIM_ATTR_CHAR,    0x0018, 0,      0x2A29, 0, SHIM_CHAR_READ },
+    { SHIM_ATTR_CHAR,    0x001A, 0,      0x2A50, 0, SHIM_CHAR_READ },
+    { SHIM_ATTR_SERVICE, 0x001B, 0x001E, 0x180F, 0, 0 },
+    { SHIM_ATTR_CHAR,    SHIM_HANDLE_BATTERY, 0, ESP_GATT_UUID_BATTERY_LEVEL, 0, SHIM_CHAR_READ | SHIM_CHAR_NOTIFY },
+    { SHIM_ATTR_DESCR,   0x001E, 0,      ESP_GATT_UUID_CHAR_CLIENT_CONFIG, 0, 0 },
+    { SHIM_ATTR_SERVICE, 0x0030, 0x0050, 0,      0xb0, 0 },
+    { SHIM_ATTR_CHAR,    SHIM_HANDLE_CLOCK, 0, 0, 0xb7, SHIM_CHAR_READ | SHIM_CHAR_WRITE },
+    { SHIM_ATTR_CHAR,    SHIM_HANDLE_DATA, 0, 0, 0xc1, SHIM_CHAR_READ | SHIM_CHAR_NOTIFY },
+    { SHIM_ATTR_DESCR,   0x0037, 0,      0x2901, 0, 0 },
+    { SHIM_ATTR_DESCR,   SHIM_HANDLE_DATA_CCC, 0, ESP_GATT_UUID_CHAR_CLIENT_CONFIG, 0, 0 },
+    { SHIM_ATTR_CHAR,    SHIM_HANDLE_HISTORY_INDEX, 0, 0, 0xba, SHIM_CHAR_READ | SHIM_CHAR_WRITE },
+    { SHIM_ATTR_CHAR,    SHIM_HANDLE_HISTORY, 0, 0, 0xbc, SHIM_CHAR_NOTIFY },
+    { SHIM_ATTR_DESCR,   SHIM_HANDLE_HISTORY_CCC, 0, ESP_GATT_UUID_CHAR_CLIENT_CONFIG, 0, 0 },
+};
+
+#define SHIM_ATTRS                  (sizeof(shim_attrs) / sizeof(shim_attrs[0]))
+
+static struct {
+    bool                controller;
+    bool                bluedroid;
+    bool                replay;
+    esp_gap_ble_cb_t    gap_cb;
+    esp_gattc_cb_t      gattc_cb;
+    bool                app_registered;
+    uint16_t            local_mtu;
+    esp_ble_scan_params_t scan_params;
+    bool                scanning;
+    int64_t             scan_start;
+    uint32_t            scan_gen;
+    shim_link_t         links[SHIM_BLE_LINKS];
+    shim_notif_reg_t    regs[SHIM_BLE_NOTIF_REG_MAX];
+    uint32_t            reg_delay_us;
+    int64_t             reg_answered;       /*!< REG_FOR_NOTIFY_EVT of the last registration comes then */
+    shim_sensor_t       sensors[SHIM_SENSORS_MAX];
+    shim_ble_stats_t    stats;
+} ble;
+
+void shim_ble_reset(void) {
+    memset(&ble, 0, sizeof(ble));
+    ble.local_mtu = SHIM_BLE_MTU_DEFAULT;
+    ble.reg_delay_us = SHIM_BLE_BTC_US;
+    for (int i = 0; i < SHIM_BLE_LINKS; i++)
+        ble.links[i].gen = 1;
+}
+
+/* Helpers */
+
+static uint32_t _shim_ble_rand(shim_sensor_t *s) {
+    s->rng ^= s->rng << 13;
+    s->rng ^= s->rng >> 17;
+    s->rng ^= s->rng << 5;
+    return s->rng;
+}
+
+static int64_t _shim_ble_interval_us(const shim_link_t *link) {
+    return (int64_t)link->interval * 1250;
+}
+
+static int _shim_ble_sensor_find(const esp_bd_addr_t bda) {
+    for (int i = 0; i < SHIM_SENSORS_MAX; i++) {
+        if (ble.sensors[i].used && memcmp(ble.sensors[i].config.bda, bda, sizeof(esp_bd_addr_t)) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static shim_link_t *_shim_ble_link(uint16_t conn_id) {
+    if (conn_id >= SHIM_BLE_LINKS || ble.links[conn_id].state != SHIM_LINK_UP)
+        return NULL;
+    return &ble.links[conn_id];
+}
+
+static bool _shim_ble_registered(const esp_bd_addr_t bda, uint16_t handle) {
+    for (int i = 0; i < SHIM_BLE_NOTIF_REG_MAX; i++) {
+        if (ble.regs[i].used && ble.regs[i].handle == handle && memcmp(ble.regs[i].bda, bda, sizeof(esp_bd_addr_t)) == 0)
+            return true;
+    }
+    return false;
+}
+
+static void _shim_ble_emit_gap(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+    if (ble.gap_cb)
+        ble.gap_cb(event, param);
+}
+
+static void _shim_ble_emit_gattc(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param) {
+    if (ble.gattc_cb)
+        ble.gattc_cb(event, gattc_if, param);
+}
+
+static void _shim_ble_gap_call(void *payload, size_t len) {
+    shim_gap_evt_t *e = payload;
+    _shim_ble_emit_gap(e->event, &e->param);
+}
+
+static void _shim_ble_post_gap(int64_t at, esp_gap_ble_cb_event_t event, const esp_ble_gap_cb_param_t *param) {
+    shim_gap_evt_t e = { .event = event, .param = *param };
+    shim_post(at, SHIM_BLE_CONTEXT, _shim_ble_gap_call, &e, sizeof(e));
+}
+
+// The value travels in the payload, the pointers in param are set again at delivery
+static void _shim_ble_gattc_call(void *payload, size_t len) {
+    shim_gattc_evt_t *e = payload;
+    if (e->link != SHIM_BLE_LINK_NONE && ble.links[e->link].gen != e->gen)
+        return;
+    if (e->event == ESP_GATTC_READ_CHAR_EVT || e->event == ESP_GATTC_READ_DESCR_EVT)
+        e->param.read.value = e->value;
+    else if (e->event == ESP_GATTC_NOTIFY_EVT)
+        e->param.notify.value = e->value;
+    _shim_ble_emit_gattc(e->event, e->gattc_if, &e->param);
+}
+
+static void _shim_ble_post_gattc(int64_t at, uint8_t link, esp_gattc_cb_event_t event, const esp_ble_gattc_cb_param_t *param,
+                                 const uint8_t *value, uint16_t len) {
+    shim_gattc_evt_t e = {
+        .link = link,
+        .gen = (link != SHIM_BLE_LINK_NONE) ? ble.links[link].gen : 0,
+        .event = event,
+        .gattc_if = SHIM_BLE_GATTC_IF,
+        .param = *param,
+        .len = (len > SHIM_BLE_VALUE_MAX) ? SHIM_BLE_VALUE_MAX : len,
+    };
+    if (e.len)
+        memcpy(e.value, value, e.len);
+    shim_post(at, SHIM_BLE_CONTEXT, _shim_ble_gattc_call, &e, offsetof(shim_gattc_evt_t, value) + e.len);
+}
+
+/* Advertising */
+
+static uint8_t _shim_ble_ad(uint8_t *p, uint8_t type, const uint8_t *data, uint8_t len) {
+    p[0] = len + 1;
+    p[1] = type;
+    memcpy(&p[2], data, len);
+    return len + 2;
+}
+
+static uint8_t _shim_ble_flags(uint8_t *p) {
+    const uint8_t flags = 0x06;
+    return _shim_ble_ad(p, ESP_BLE_AD_TYPE_FLAG, &flags, 1);
+}
+
+static uint8_t _shim_ble_name(uint8_t *p, const shim_sensor_t *s) {
+    char name[16];
+    if (s->config.format == SHIM_SENSOR_ATC || s->config.format == SHIM_SENSOR_PVVX)
+        snprintf(name, sizeof(name), "ATC_%02X%02X%02X", s->config.bda[3], s->config.bda[4], s->config.bda[5]);
+    else
+        snprintf(name, sizeof(name), "LYWSD03MMC");
+    return _shim_ble_ad(p, ESP_BLE_AD_TYPE_NAME_CMPL, (const uint8_t *)name, strlen(name));
+}
+
+// Service data: 16-bit UUID, then the frame
+static uint8_t _shim_ble_service_data(uint8_t *p, uint16_t uuid, const uint8_t *frame, uint8_t len) {
+    uint8_t data[ESP_BLE_ADV_DATA_LEN_MAX];
+    data[0] = uuid & 0xFF;
+    data[1] = uuid >> 8;
+    memcpy(&data[2], frame, len);
+    return _shim_ble_ad(p, ESP_BLE_AD_TYPE_SERVICE_DATA, data, len + 2);
+}
+
+static uint8_t _shim_ble_mibeacon(uint8_t *p, shim_sensor_t *s) {
+    const shim_sensor_config_t *c = &s->config;
+    uint8_t frame[ESP_BLE_ADV_DATA_LEN_MAX];
+    uint8_t pos = 0;
+    bool encrypted = (c->format == SHIM_SENSOR_MIBEACON);
+    // Frame control: version 5, MAC, capability or encrypted object
+    uint16_t frctrl = (encrypted) ? 0x5858 : 0x5030;
+    frame[pos++] = frctrl & 0xFF;
+    frame[pos++] = frctrl >> 8;
+    frame[pos++] = 0x5B;
+    frame[pos++] = 0x05;
+    frame[pos++] = s->counter & 0xFF;
+    for (int i = 0; i < 6; i++)
+        frame[pos++] = c->bda[5 - i];
+    if (!encrypted) {
+        frame[pos++] = 0x08;
+        return _shim_ble_service_data(p, 0xFE95, frame, pos);
+    }
+    // One object per frame, in turn
+    uint8_t obj[6];
+    uint8_t obj_len;
+    switch (s->object) {
+    case 0:
+        obj[0] = 0x04; obj[1] = 0x10; obj[2] = 2;
+        obj[3] = (c->temp / 10) & 0xFF; obj[4] = (uint16_t)(c->temp / 10) >> 8;
+        obj_len = 5;
+        break;
+    case 1:
+        obj[0] = 0x06; obj[1] = 0x10; obj[2] = 2;
+        obj[3] = (c->hum * 10) & 0xFF; obj[4] = (c->hum * 10) >> 8;
+        obj_len = 5;
+        break;
+    default:
+        obj[0] = 0x0A; obj[1] = 0x10; obj[2] = 1;
+        obj[3] = c->battery;
+        obj_len = 4;
+        break;
+    }
+    uint8_t ext[3] = { s->counter >> 8, s->counter >> 16, s->counter >> 24 };
+    uint8_t nonce[12];
+    const uint8_t aad = 0x11;
+    for (int i = 0; i < 6; i++)
+        nonce[i] = c->bda[5 - i];
+    memcpy(&nonce[6], &frame[2], 3);
+    memcpy(&nonce[9], ext, 3);
+    shim_ccm_seal(c->bind_key, nonce, sizeof(nonce), &aad, 1, obj, &frame[pos], obj_len, &frame[pos + obj_len + 3], 4);
+    memcpy(&frame[pos + obj_len], ext, 3);
+    pos += obj_len + 3 + 4;
+    return _shim_ble_service_data(p, 0xFE95, frame, pos);
+}
+
+static uint8_t _shim_ble_atc(uint8_t *p, const shim_sensor_t *s) {
+    const shim_sensor_config_t *c = &s->config;
+    uint8_t frame[15];
+    if (c->format == SHIM_SENSOR_ATC) {
+        int16_t temp = c->temp / 10;
+        memcpy(frame, c->bda, 6);
+        frame[6] = (uint16_t)temp >> 8;
+        frame[7] = temp & 0xFF;
+        frame[8] = c->hum;
+        frame[9] = c->battery;
+        frame[10] = c->battery_mv >> 8;
+        frame[11] = c->battery_mv & 0xFF;
+        frame[12] = s->counter & 0xFF;
+        return _shim_ble_service_data(p, 0x181A, frame, 13);
+    }
+    uint16_t hum = c->hum * 100;
+    for (int i = 0; i < 6; i++)
+        frame[i] = c->bda[5 - i];
+    frame[6] = c->temp & 0xFF;
+    frame[7] = (uint16_t)c->temp >> 8;
+    frame[8] = hum & 0xFF;
+    frame[9] = hum >> 8;
+    frame[10] = c->battery_mv & 0xFF;
+    frame[11] = c->battery_mv >> 8;
+    frame[12] = c->battery;
+    frame[13] = s->counter & 0xFF;
+    frame[14] = 0;
+    return _shim_ble_service_data(p, 0x181A, frame, 15);
+}
+
+// Advertising data and scan response of the current reading, scan_rsp_len 0 if the sensor gives none
+static void _shim_ble_adv_data(shim_sensor_t *s, struct ble_scan_result_evt_param *r, bool active) {
+    uint8_t *p = r->ble_adv;
+    uint8_t len = 0;
+    switch (s->config.format) {
+    case SHIM_SENSOR_STOCK:
+    case SHIM_SENSOR_MIBEACON:
+        len += _shim_ble_flags(p);
+        len += _shim_ble_mibeacon(p + len, s);
+        break;
+    case SHIM_SENSOR_ATC:
+    case SHIM_SENSOR_PVVX:
+        len += _shim_ble_flags(p);
+        len += _shim_ble_atc(p + len, s);
+        break;
+    case SHIM_SENSOR_PHONE: {
+        const uint8_t flags = 0x1A;
+        uint8_t apple[8] = { 0x4C, 0x00, 0x10, 0x05, 0x01, 0x1C, s->counter, s->counter >> 8 };
+        len += _shim_ble_ad(p, ESP_BLE_AD_TYPE_FLAG, &flags, 1);
+        len += _shim_ble_ad(p + len, 0xFF, apple, sizeof(apple));
+        break;
+    }
+    }
+    r->adv_data_len = len;
+    r->scan_rsp_len = 0;
+    // Bluedroid reports advertisement and scan response together, the name last and zero padded
+    if (active && s->config.format != SHIM_SENSOR_PHONE)
+        r->scan_rsp_len = _shim_ble_name(p + len, s);
+}
+
+static void _shim_ble_connect(shim_sensor_t *s, int id, shim_link_t *link);
+
+static bool _shim_ble_hears(int64_t now) {
+    if (!ble.scanning || ble.replay)
+        return false;
+    int64_t interval = (int64_t)ble.scan_params.scan_interval * 625;
+    int64_t window = (int64_t)ble.scan_params.scan_window * 625;
+    return (now - ble.scan_start) % interval < window;
+}
+
+// One advertising event, a pending connection to the sensor is made on it
+static void _shim_ble_adv_call(void *payload, size_t len) {
+    int id = *(int *)payload;
+    shim_sensor_t *s = &ble.sensors[id];
+    int64_t now = shim_now_us();
+    int64_t next = now + (int64_t)s->config.adv_interval_ms * 1000 + _shim_ble_rand(s) % SHIM_BLE_ADV_DELAY_US;
+    shim_post(next, SHIM_BLE_CONTEXT, _shim_ble_adv_call, &id, sizeof(id));
+    if (!s->powered || s->link >= 0)
+        return;
+    s->stats.adv_sent++;
+    if (s->config.format != SHIM_SENSOR_PHONE) {
+        for (int i = 0; i < SHIM_BLE_LINKS; i++) {
+            shim_link_t *link = &ble.links[i];
+            if (link->state == SHIM_LINK_PENDING && memcmp(link->bda, s->config.bda, sizeof(esp_bd_addr_t)) == 0) {
+                _shim_ble_connect(s, id, link);
+                return;
+            }
+        }
+    }
+    if (!_shim_ble_hears(now))
+        return;
+    esp_ble_gap_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    struct ble_scan_result_evt_param *r = &param.scan_rst;
+    r->search_evt = ESP_GAP_SEARCH_INQ_RES_EVT;
+    memcpy(r->bda, s->config.bda, sizeof(esp_bd_addr_t));
+    r->dev_type = ESP_BT_DEVICE_TYPE_BLE;
+    r->ble_addr_type = (s->config.format == SHIM_SENSOR_PHONE) ? BLE_ADDR_TYPE_RANDOM : BLE_ADDR_TYPE_PUBLIC;
+    r->ble_evt_type = (s->config.format == SHIM_SENSOR_STOCK || s->config.format == SHIM_SENSOR_MIBEACON) ? ESP_BLE_EVT_CONN_ADV : ESP_BLE_EVT_NON_CONN_ADV;
+    r->rssi = s->config.rssi;
+    r->num_resps = 1;
+    _shim_ble_adv_data(s, r, ble.scan_params.scan_type == BLE_SCAN_TYPE_ACTIVE);
+    s->stats.adv_heard++;
+    ble.stats.scan_reports++;
+    if (r->scan_rsp_len > 0)
+        ble.stats.scan_requests++;
+    _shim_ble_emit_gap(ESP_GAP_BLE_SCAN_RESULT_EVT, &param);
+}
+
+/* Links */
+
+static void _shim_ble_free(shim_link_t *link) {
+    if (link->sensor >= 0 && ble.sensors[link->sensor].link == link - ble.links)
+        ble.sensors[link->sensor].link = -1;
+    if (link->state == SHIM_LINK_UP || link->state == SHIM_LINK_CLOSING)
+        ble.stats.links--;
+    shim_cancel(link->open_timeout);
+    uint32_t gen = link->gen + 1;
+    memset(link, 0, sizeof(shim_link_t));
+    link->gen = gen;
+    link->sensor = -1;
+}
+
+// ATT requests queue on the bearer: the sensor hears one at its next listened event, answers one event later
+static int64_t _shim_ble_att_slot(shim_link_t *link, uint8_t delay_events, int64_t *arrive) {
+    int64_t now = shim_now_us();
+    int64_t start = (link->att_busy > now) ? link->att_busy : now;
+    int64_t interval = _shim_ble_interval_us(link);
+    *arrive = start + interval * (1 + link->latency);
+    link->att_busy = *arrive + interval * (1 + delay_events);
+    ble.stats.att_ops++;
+    return link->att_busy;
+}
+
+static void _shim_ble_discovery_call(void *payload, size_t len) {
+    shim_link_call_t *c = payload;
+    shim_link_t *link = &ble.links[c->link];
+    if (link->gen != c->gen || link->state != SHIM_LINK_UP)
+        return;
+    if (c->left > 0) {
+        int64_t arrive;
+        c->left--;
+        shim_post(_shim_ble_att_slot(link, 0, &arrive), SHIM_BLE_CONTEXT, _shim_ble_discovery_call, c, sizeof(*c));
+        return;
+    }
+    link->discovered = true;
+    shim_gattc_cache_add(link->bda);
+    esp_ble_gattc_cb_param_t param = {
+        .dis_srvc_cmpl = { .status = ESP_GATT_OK, .conn_id = c->link },
+    };
+    _shim_ble_emit_gattc(ESP_GATTC_DIS_SRVC_CMPL_EVT, SHIM_BLE_GATTC_IF, &param);
+}
+
+static void _shim_ble_connect(shim_sensor_t *s, int id, shim_link_t *link) {
+    uint8_t conn_id = link - ble.links;
+    shim_cancel(link->open_timeout);
+    link->open_timeout = 0;
+    link->state = SHIM_LINK_UP;
+    link->sensor = id;
+    link->interval = SHIM_BLE_INIT_INTERVAL;
+    link->latency = 0;
+    link->timeout = SHIM_BLE_INIT_TIMEOUT;
+    link->mtu = SHIM_BLE_MTU_DEFAULT;
+    link->att_busy = shim_now_us();
+    s->link = conn_id;
+    s->stats.connections++;
+    if (++ble.stats.links > ble.stats.links_max)
+        ble.stats.links_max = ble.stats.links;
+
+    esp_ble_gattc_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.connect.conn_id = conn_id;
+    memcpy(param.connect.remote_bda, link->bda, sizeof(esp_bd_addr_t));
+    param.connect.conn_params.interval = link->interval;
+    param.connect.conn_params.latency = link->latency;
+    param.connect.conn_params.timeout = link->timeout;
+    _shim_ble_emit_gattc(ESP_GATTC_CONNECT_EVT, SHIM_BLE_GATTC_IF, &param);
+    if (link->state != SHIM_LINK_UP)
+        return;
+    memset(&param, 0, sizeof(param));
+    param.open.status = ESP_GATT_OK;
+    param.open.conn_id = conn_id;
+    memcpy(param.open.remote_bda, link->bda, sizeof(esp_bd_addr_t));
+    param.open.mtu = SHIM_BLE_MTU_DEFAULT;
+    _shim_ble_emit_gattc(ESP_GATTC_OPEN_EVT, SHIM_BLE_GATTC_IF, &param);
+    // Discovery runs by itself after the open, from the GATT cache of a sensor seen before, this boot or an earlier one
+    shim_link_call_t c = { .link = conn_id, .gen = link->gen, .left = shim_gattc_cache_find(link->bda) ? 0 : SHIM_BLE_DISCOVERY_OPS };
+    shim_post(shim_now_us() + SHIM_BLE_BTC_US, SHIM_BLE_CONTEXT, _shim_ble_discovery_call, &c, sizeof(c));
+}
+
+static void _shim_ble_open_timeout_call(void *payload, size_t len) {
+    shim_link_call_t *c = payload;
+    shim_link_t *link = &ble.links[c->link];
+    if (link->gen != c->gen || link->state != SHIM_LINK_PENDING)
+        return;
+    esp_ble_gattc_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.open.status = ESP_GATT_ERROR;
+    param.open.conn_id = c->link;
+    memcpy(param.open.remote_bda, link->bda, sizeof(esp_bd_addr_t));
+    link->open_timeout = 0;
+    _shim_ble_free(link);
+    _shim_ble_emit_gattc(ESP_GATTC_OPEN_EVT, SHIM_BLE_GATTC_IF, &param);
+}
+
+static void _shim_ble_disconnect_call(void *payload, size_t len) {
+    shim_link_call_t *c = payload;
+    shim_link_t *link = &ble.links[c->link];
+    if (link->gen != c->gen || link->state != SHIM_LINK_CLOSING)
+        return;
+    esp_bd_addr_t bda;
+    memcpy(bda, link->bda, sizeof(esp_bd_addr_t));
+    // Bluedroid forgets the notification registrations of a device once it has no link left
+    for (int i = 0; i < SHIM_BLE_NOTIF_REG_MAX; i++) {
+        if (ble.regs[i].used && memcmp(ble.regs[i].bda, bda, sizeof(esp_bd_addr_t)) == 0)
+            ble.regs[i].used = false;
+    }
+    _shim_ble_free(link);
+    esp_ble_gattc_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.disconnect.reason = c->left;
+    param.disconnect.conn_id = c->link;
+    memcpy(param.disconnect.remote_bda, bda, sizeof(esp_bd_addr_t));
+    _shim_ble_emit_gattc(ESP_GATTC_DISCONNECT_EVT, SHIM_BLE_GATTC_IF, &param);
+    memset(&param, 0, sizeof(param));
+    param.close.status = ESP_GATT_OK;
+    param.close.conn_id = c->link;
+    memcpy(param.close.remote_bda, bda, sizeof(esp_bd_addr_t));
+    param.close.reason = c->left;
+    _shim_ble_emit_gattc(ESP_GATTC_CLOSE_EVT, SHIM_BLE_GATTC_IF, &param);
+}
+
+// Everything queued for the link is dropped, the disconnect comes after delay_us
+static void _shim_ble_drop(shim_link_t *link, int64_t delay_us, esp_gatt_conn_reason_t reason) {
+    link->state = SHIM_LINK_CLOSING;
+    link->gen++;
+    shim_link_call_t c = { .link = link - ble.links, .gen = link->gen, .left = reason };
+    shim_post(shim_now_us() + delay_us, SHIM_BLE_CONTEXT, _shim_ble_disconnect_call, &c, sizeof(c));
+}
+
+/* Sensor side of the GATT server */
+
+static uint16_t _shim_ble_read_value(const shim_sensor_t *s, uint16_t handle, uint8_t *value) {
+    const shim_sensor_config_t *c = &s->config;
+    const char *str = NULL;
+    switch (handle) {
+    case 0x0003:
+    case SHIM_HANDLE_MODEL:     str = "LYWSD03MMC"; break;
+    case SHIM_HANDLE_SERIAL:    str = "F1.0-CFMK-LB-ZCXTJ--"; break;
+    case SHIM_HANDLE_FW:        str = "1.0.0_0109"; break;
+    case SHIM_HANDLE_HW:        str = "B1.5"; break;
+    case SHIM_HANDLE_SW:        str = "0109"; break;
+    case 0x0018:                str = "miaomiaoce.com"; break;
+    case SHIM_HANDLE_BATTERY:
+        value[0] = c->battery;
+        return 1;
+    case SHIM_HANDLE_CLOCK: {
+        // The hour of the newest record has just ended, seconds and a time zone byte
+        uint32_t now = c->history_time + c->history_count * 3600 + (shim_now_us() - s->added) / 1000000;
+        value[0] = now & 0xFF;
+        value[1] = (now >> 8) & 0xFF;
+        value[2] = (now >> 16) & 0xFF;
+        value[3] = now >> 24;
+        value[4] = 0;
+        return 5;
+    }
+    case SHIM_HANDLE_DATA:
+        value[0] = c->temp & 0xFF;
+        value[1] = (uint16_t)c->temp >> 8;
+        value[2] = c->hum;
+        value[3] = c->battery_mv & 0xFF;
+        value[4] = c->battery_mv >> 8;
+        return 5;
+    default:
+        return 0;
+    }
+    memcpy(value, str, strlen(str));
+    return strlen(str);
+}
+
+static uint32_t _shim_ble_history_count(const shim_sensor_t *s) {
+    return s->config.history_count + (shim_now_us() - s->added) / SHIM_BLE_HOUR_US;
+}
+
+static void _shim_ble_history_record(const shim_sensor_t *s, uint32_t index, uint8_t *r) {
+    uint32_t time = s->config.history_time + index * 3600;
+    int16_t temp = s->config.temp / 10;
+    int16_t temp_max = temp + 5 + index % 7;
+    int16_t temp_min = temp - 5 - index % 5;
+    r[0] = index; r[1] = index >> 8; r[2] = index >> 16; r[3] = index >> 24;
+    r[4] = time; r[5] = time >> 8; r[6] = time >> 16; r[7] = time >> 24;
+    r[8] = temp_max & 0xFF; r[9] = (uint16_t)temp_max >> 8;
+    r[10] = (s->config.hum < 98) ? s->config.hum + 2 : 100;
+    r[11] = temp_min & 0xFF; r[12] = (uint16_t)temp_min >> 8;
+    r[13] = (s->config.hum > 2) ? s->config.hum - 2 : 0;
+}
+
+static void _shim_ble_notify(shim_link_t *link, uint16_t handle, uint8_t *value, uint16_t len) {
+    esp_ble_gattc_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.notify.conn_id = link - ble.links;
+    memcpy(param.notify.remote_bda, link->bda, sizeof(esp_bd_addr_t));
+    param.notify.handle = handle;
+    param.notify.value_len = len;
+    param.notify.value = value;
+    param.notify.is_notify = true;
+    _shim_ble_emit_gattc(ESP_GATTC_NOTIFY_EVT, SHIM_BLE_GATTC_IF, &param);
+}
+
+// The log goes out a few records per connection event until the sensor has no more
+static void _shim_ble_history_call(void *payload, size_t len) {
+    shim_link_call_t *c = payload;
+    shim_link_t *link = &ble.links[c->link];
+    if (link->gen != c->gen || link->state != SHIM_LINK_UP)
+        return;
+    shim_sensor_t *s = &ble.sensors[link->sensor];
+    uint32_t count = _shim_ble_history_count(s);
+    if (!link->history_notify || link->history_next >= count) {
+        link->history_streaming = false;
+        return;
+    }
+    for (uint8_t i = 0; i < s->config.history_per_event && link->history_next < count; i++) {
+        uint8_t record[14];
+        _shim_ble_history_record(s, link->history_next++, record);
+        s->stats.history_sent++;
+        if (_shim_ble_registered(link->bda, SHIM_HANDLE_HISTORY))
+            _shim_ble_notify(link, SHIM_HANDLE_HISTORY, record, sizeof(record));
+        if (link->gen != c->gen)
+            return;
+    }
+    shim_post(shim_now_us() + _shim_ble_interval_us(link), SHIM_BLE_CONTEXT, _shim_ble_history_call, c, sizeof(*c));
+}
+
+static esp_gatt_status_t _shim_ble_write(shim_link_t *link, shim_att_op_t op, uint16_t handle, const uint8_t *value, uint16_t len) {
+    shim_sensor_t *s = &ble.sensors[link->sensor];
+    if (op == SHIM_ATT_WRITE) {
+        if (handle == SHIM_HANDLE_HISTORY_INDEX) {
+            if (len < 4)
+                return ESP_GATT_ERROR;
+            link->history_next = value[0] | (value[1] << 8) | (value[2] << 16) | ((uint32_t)value[3] << 24);
+            s->stats.history_from = link->history_next;
+            return ESP_GATT_OK;
+        }
+        return (handle == 0x0032) ? ESP_GATT_OK : ESP_GATT_WRITE_NOT_PERMIT;
+    }
+    if (len < 1)
+        return ESP_GATT_ERROR;
+    switch (handle) {
+    case SHIM_HANDLE_DATA_CCC:
+        link->data_notify = value[0] & 1;
+        return ESP_GATT_OK;
+    case SHIM_HANDLE_HISTORY_CCC:
+        link->history_notify = value[0] & 1;
+        // The log starts right away, the write response may well come after the first records
+        if (link->history_notify && !link->history_streaming) {
+            shim_link_call_t c = { .link = link - ble.links, .gen = link->gen };
+            link->history_streaming = true;
+            shim_post(shim_now_us() + _shim_ble_interval_us(link), SHIM_BLE_CONTEXT, _shim_ble_history_call, &c, sizeof(c));
+        }
+        return ESP_GATT_OK;
+    case 0x000B:
+    case 0x001E:
+        return ESP_GATT_OK;
+    default:
+        return ESP_GATT_WRITE_NOT_PERMIT;
+    }
+}
+
+// The request reached the sensor: act on it and send the response
+static void _shim_ble_att_call(void *payload, size_t len) {
+    shim_att_req_t *r = payload;
+    shim_link_t *link = &ble.links[r->link];
+    if (link->gen != r->gen || link->state != SHIM_LINK_UP)
+        return;
+    shim_sensor_t *s = &ble.sensors[link->sensor];
+    esp_ble_gattc_cb_param_t param;
+    uint8_t value[SHIM_BLE_VALUE_MAX];
+    uint16_t value_len = 0;
+    memset(&param, 0, sizeof(param));
+    switch (r->op) {
+    case SHIM_ATT_READ:
+        value_len = _shim_ble_read_value(s, r->handle, value);
+        if (value_len > link->mtu - 1)
+            value_len = link->mtu - 1;
+        param.read.status = (value_len) ? ESP_GATT_OK : ESP_GATT_INVALID_HANDLE;
+        param.read.conn_id = r->link;
+        param.read.handle = r->handle;
+        param.read.value_len = value_len;
+        _shim_ble_post_gattc(r->respond, r->link, ESP_GATTC_READ_CHAR_EVT, &param, value, value_len);
+        break;
+    case SHIM_ATT_WRITE:
+    case SHIM_ATT_WRITE_DESCR:
+        param.write.status = _shim_ble_write(link, r->op, r->handle, r->value, r->len);
+        param.write.conn_id = r->link;
+        param.write.handle = r->handle;
+        _shim_ble_post_gattc(r->respond, r->link, (r->op == SHIM_ATT_WRITE) ? ESP_GATTC_WRITE_CHAR_EVT : ESP_GATTC_WRITE_DESCR_EVT,
+                             &param, NULL, 0);
+        break;
+    case SHIM_ATT_MTU:
+        link->mtu = (ble.local_mtu < s->config.mtu) ? ble.local_mtu : s->config.mtu;
+        param.cfg_mtu.status = ESP_GATT_OK;
+        param.cfg_mtu.conn_id = r->link;
+        param.cfg_mtu.mtu = link->mtu;
+        _shim_ble_post_gattc(r->respond, r->link, ESP_GATTC_CFG_MTU_EVT, &param, NULL, 0);
+        break;
+    }
+}
+
+static esp_err_t _shim_ble_att(uint16_t conn_id, shim_att_op_t op, uint16_t handle, const uint8_t *value, uint16_t len) {
+    if (ble.replay)
+        return ESP_OK;
+    // Like Bluedroid, a request on a link that is gone is dropped without an answer
+    shim_link_t *link = _shim_ble_link(conn_id);
+    if (link == NULL)
+        return ESP_OK;
+    if (len > SHIM_BLE_VALUE_MAX)
+        return ESP_ERR_INVALID_ARG;
+    shim_sensor_t *s = &ble.sensors[link->sensor];
+    uint8_t delay = (op == SHIM_ATT_WRITE || op == SHIM_ATT_WRITE_DESCR) ? s->config.write_delay_events : 0;
+    int64_t arrive;
+    shim_att_req_t r = {
+        .link = conn_id,
+        .gen = link->gen,
+        .op = op,
+        .handle = handle,
+        .len = len,
+    };
+    r.respond = _shim_ble_att_slot(link, delay, &arrive);
+    if (len)
+        memcpy(r.value, value, len);
+    shim_post(arrive, SHIM_BLE_CONTEXT, _shim_ble_att_call, &r, offsetof(shim_att_req_t, value) + len);
+    return ESP_OK;
+}
+
+// A new reading: advertised from now on, notified to a subscribed link at its next event
+static void _shim_ble_measure_call(void *payload, size_t len) {
+    int id = *(int *)payload;
+    shim_sensor_t *s = &ble.sensors[id];
+    shim_post(shim_now_us() + (int64_t)s->config.measure_ms * 1000, SHIM_BLE_CONTEXT, _shim_ble_measure_call, &id, sizeof(id));
+    if (!s->powered)
+        return;
+    s->counter++;
+    s->object = (s->object + 1) % 3;
+    if (s->link < 0)
+        return;
+    shim_link_t *link = &ble.links[s->link];
+    if (link->state != SHIM_LINK_UP || !link->data_notify)
+        return;
+    s->stats.notifications++;
+    if (!_shim_ble_registered(link->bda, SHIM_HANDLE_DATA))
+        return;
+    uint8_t value[5];
+    esp_ble_gattc_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.notify.conn_id = s->link;
+    memcpy(param.notify.remote_bda, link->bda, sizeof(esp_bd_addr_t));
+    param.notify.handle = SHIM_HANDLE_DATA;
+    param.notify.value_len = _shim_ble_read_value(s, SHIM_HANDLE_DATA, value);
+    param.notify.is_notify = true;
+    _shim_ble_post_gattc(shim_now_us() + _shim_ble_interval_us(link), s->link, ESP_GATTC_NOTIFY_EVT, &param, value, sizeof(value));
+}
+
+static void _shim_ble_update_call(void *payload, size_t len) {
+    shim_update_call_t *c = payload;
+    shim_link_t *link = &ble.links[c->link];
+    if (link->gen != c->gen || link->state != SHIM_LINK_UP)
+        return;
+    link->interval = c->params.max_int;
+    link->latency = c->params.latency;
+    link->timeout = c->params.timeout;
+    esp_ble_gap_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.update_conn_params.status = ESP_BT_STATUS_SUCCESS;
+    memcpy(param.update_conn_params.bda, link->bda, sizeof(esp_bd_addr_t));
+    param.update_conn_params.min_int = c->params.min_int;
+    param.update_conn_params.max_int = c->params.max_int;
+    param.update_conn_params.latency = c->params.latency;
+    param.update_conn_params.conn_int = link->interval;
+    param.update_conn_params.timeout = c->params.timeout;
+    _shim_ble_emit_gap(ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT, &param);
+}
+
+/* Harness API */
+
+void shim_sensor_config_default(shim_sensor_config_t *config, shim_sensor_format_t format, uint16_t n) {
+    memset(config, 0, sizeof(*config));
+    const uint8_t oui[3] = { 0xA4, 0xC1, 0x38 };
+    const uint8_t random[3] = { 0x5A, 0x3C, 0x71 };
+    memcpy(config->bda, (format == SHIM_SENSOR_PHONE) ? random : oui, 3);
+    config->bda[4] = n >> 8;
+    config->bda[5] = n & 0xFF;
+    config->format = format;
+    for (int i = 0; i < 16; i++)
+        config->bind_key[i] = 0x10 * (i + 1) + n;
+    config->adv_interval_ms = 1000;
+    config->measure_ms = 6000;
+    config->rssi = -50 - n % 40;
+    config->temp = 2150 + (n % 10) * 10;
+    config->hum = 45;
+    config->battery = 90;
+    config->battery_mv = 2950;
+    config->mtu = SHIM_BLE_VALUE_MAX;
+    config->history_count = 48;
+    config->history_time = 1700000000;
+    config->history_per_event = 2;
+}
+
+uint8_t shim_sensor_adv(const shim_sensor_config_t *config, uint32_t counter, uint8_t object, bool active, uint8_t *adv) {
+    shim_sensor_t s = { .config = *config, .counter = counter, .object = object };
+    struct ble_scan_result_evt_param r;
+    memset(&r, 0, sizeof(r));
+    _shim_ble_adv_data(&s, &r, active);
+    memcpy(adv, r.ble_adv, r.adv_data_len + r.scan_rsp_len);
+    return r.adv_data_len + r.scan_rsp_len;
+}
+
+int shim_sensor_add(const shim_sensor_config_t *config) {
+    for (int id = 0; id < SHIM_SENSORS_MAX; id++) {
+        shim_sensor_t *s = &ble.sensors[id];
+        if (s->used)
+            continue;
+        memset(s, 0, sizeof(*s));
+        s->config = *config;
+        s->used = true;
+        s->powered = true;
+        s->link = -1;
+        s->added = shim_now_us();
+        s->rng = 0x9E3779B9u ^ (config->bda[3] << 16 | config->bda[4] << 8 | config->bda[5]) ^ (id * 7919);
+        if (s->rng == 0)
+            s->rng = 1;
+        // Sensors powered up at different times, their events do not line up
+        int64_t adv = s->added + _shim_ble_rand(s) % ((int64_t)config->adv_interval_ms * 1000);
+        int64_t measure = s->added + _shim_ble_rand(s) % ((int64_t)config->measure_ms * 1000);
+        shim_post(adv, SHIM_BLE_CONTEXT, _shim_ble_adv_call, &id, sizeof(id));
+        shim_post(measure, SHIM_BLE_CONTEXT, _shim_ble_measure_call, &id, sizeof(id));
+        return id;
+    }
+    return -1;
+}
+
+void shim_sensor_set_reading(int id, int16_t temp, uint8_t hum, uint16_t battery_mv) {
+    shim_sensor_config_t *c = &ble.sensors[id].config;
+    c->temp = temp;
+    c->hum = hum;
+    c->battery_mv = battery_mv;
+}
+
+void shim_sensor_set_power(int id, bool on) {
+    shim_sensor_t *s = &ble.sensors[id];
+    if (s->powered == on)
+        return;
+    s->powered = on;
+    if (!on && s->link >= 0 && ble.links[s->link].state == SHIM_LINK_UP) {
+        shim_link_t *link = &ble.links[s->link];
+        _shim_ble_drop(link, (int64_t)link->timeout * 10000, ESP_GATT_CONN_TIMEOUT);
+    }
+}
+
+void shim_sensor_get_stats(int id, shim_sensor_stats_t *stats) {
+    *stats = ble.sensors[id].stats;
+}
+
+void shim_ble_get_stats(shim_ble_stats_t *stats) {
+    *stats = ble.stats;
+    if (ble.scanning)
+        stats->scan_on_us += shim_now_us() - ble.scan_start;
+}
+
+bool shim_ble_scanning(void) {
+    return ble.scanning;
+}
+
+bool shim_ble_registered(const esp_bd_addr_t bda, uint16_t handle) {
+    return _shim_ble_registered(bda, handle);
+}
+
+void shim_ble_set_reg_delay(uint32_t us) {
+    ble.reg_delay_us = (us) ? us : SHIM_BLE_BTC_US;
+}
+
+void shim_ble_set_replay(bool replay) {
+    ble.replay = replay;
+}
+
+void shim_ble_inject_gap(int64_t at_us, esp_gap_ble_cb_event_t event, const esp_ble_gap_cb_param_t *param) {
+    _shim_ble_post_gap(at_us, event, param);
+}
+
+void shim_ble_inject_gattc(int64_t at_us, esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, const esp_ble_gattc_cb_param_t *param) {
+    shim_gattc_evt_t e = {
+        .link = SHIM_BLE_LINK_NONE,
+        .event = event,
+        .gattc_if = gattc_if,
+        .param = *param,
+    };
+    if (event == ESP_GATTC_READ_CHAR_EVT || event == ESP_GATTC_READ_DESCR_EVT) {
+        e.len = (param->read.value_len < SHIM_BLE_VALUE_MAX) ? param->read.value_len : SHIM_BLE_VALUE_MAX;
+        if (e.len)
+            memcpy(e.value, param->read.value, e.len);
+    } else if (event == ESP_GATTC_NOTIFY_EVT) {
+        e.len = (param->notify.value_len < SHIM_BLE_VALUE_MAX) ? param->notify.value_len : SHIM_BLE_VALUE_MAX;
+        if (e.len)
+            memcpy(e.value, param->notify.value, e.len);
+    }
+    shim_post(at_us, SHIM_BLE_CONTEXT, _shim_ble_gattc_call, &e, offsetof(shim_gattc_evt_t, value) + e.len);
+}
+
+/* Controller and Bluedroid */
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg) {
+    if (cfg == NULL || cfg->ble_max_conn > SHIM_BLE_LINKS)
+        return ESP_ERR_INVALID_ARG;
+    if (ble.controller)
+        return ESP_ERR_INVALID_STATE;
+    ble.controller = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode) {
+    if (!ble.controller || !(mode & ESP_BT_MODE_BLE))
+        return ESP_ERR_INVALID_STATE;
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_init(void) {
+    if (!ble.controller || ble.bluedroid)
+        return ESP_ERR_INVALID_STATE;
+    ble.bluedroid = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_enable(void) {
+    return (ble.bluedroid) ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_ble_gatt_set_local_mtu(uint16_t mtu) {
+    if (mtu < SHIM_BLE_MTU_DEFAULT || mtu > 517)
+        return ESP_ERR_INVALID_ARG;
+    ble.local_mtu = mtu;
+    return ESP_OK;
+}
+
+/* GAP */
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback) {
+    if (!ble.bluedroid)
+        return ESP_ERR_INVALID_STATE;
+    ble.gap_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *scan_params) {
+    if (!ble.bluedroid)
+        return ESP_ERR_INVALID_STATE;
+    if (scan_params == NULL || scan_params->scan_interval < 4 || scan_params->scan_interval > 0x4000
+        || scan_params->scan_window < 4 || scan_params->scan_window > scan_params->scan_interval)
+        return ESP_ERR_INVALID_ARG;
+    esp_ble_gap_cb_param_t param = { .scan_param_cmpl = { .status = ESP_BT_STATUS_SUCCESS } };
+    // The controller refuses new parameters while it scans
+    if (ble.scanning)
+        param.scan_param_cmpl.status = ESP_BT_STATUS_FAIL;
+    else
+        ble.scan_params = *scan_params;
+    if (!ble.replay)
+        _shim_ble_post_gap(shim_now_us() + SHIM_BLE_HCI_US, ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT, &param);
+    return ESP_OK;
+}
+
+static void _shim_ble_scan_end_call(void *payload, size_t len) {
+    if (*(uint32_t *)payload != ble.scan_gen || !ble.scanning)
+        return;
+    ble.scanning = false;
+    ble.stats.scan_on_us += shim_now_us() - ble.scan_start;
+    esp_ble_gap_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.scan_rst.search_evt = ESP_GAP_SEARCH_INQ_CMPL_EVT;
+    _shim_ble_emit_gap(ESP_GAP_BLE_SCAN_RESULT_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_start_scanning(uint32_t duration) {
+    if (!ble.bluedroid)
+        return ESP_ERR_INVALID_STATE;
+    if (ble.replay)
+        return ESP_OK;
+    esp_ble_gap_cb_param_t param = { .scan_start_cmpl = { .status = ESP_BT_STATUS_SUCCESS } };
+    int64_t now = shim_now_us();
+    if (ble.scanning || ble.scan_params.scan_interval == 0) {
+        param.scan_start_cmpl.status = ESP_BT_STATUS_FAIL;
+    } else {
+        ble.scanning = true;
+        ble.scan_start = now;
+        ble.scan_gen++;
+        ble.stats.scan_starts++;
+        if (duration)
+            shim_post(now + (int64_t)duration * 1000000, SHIM_BLE_CONTEXT, _shim_ble_scan_end_call, &ble.scan_gen, sizeof(ble.scan_gen));
+    }
+    _shim_ble_post_gap(now + SHIM_BLE_HCI_US, ESP_GAP_BLE_SCAN_START_COMPLETE_EVT, &param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_stop_scanning(void) {
+    if (!ble.bluedroid)
+        return ESP_ERR_INVALID_STATE;
+    if (ble.replay)
+        return ESP_OK;
+    if (ble.scanning) {
+        ble.scanning = false;
+        ble.scan_gen++;
+        ble.stats.scan_on_us += shim_now_us() - ble.scan_start;
+    }
+    esp_ble_gap_cb_param_t param = { .scan_stop_cmpl = { .status = ESP_BT_STATUS_SUCCESS } };
+    _shim_ble_post_gap(shim_now_us() + SHIM_BLE_HCI_US, ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT, &param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t *params) {
+    if (!ble.bluedroid)
+        return ESP_ERR_INVALID_STATE;
+    if (params == NULL || params->min_int < 6 || params->max_int > 3200 || params->min_int > params->max_int
+        || params->latency > 499 || params->timeout < 10 || params->timeout > 3200)
+        return ESP_ERR_INVALID_ARG;
+    if (ble.replay)
+        return ESP_OK;
+    for (int i = 0; i < SHIM_BLE_LINKS; i++) {
+        shim_link_t *link = &ble.links[i];
+        if (link->state != SHIM_LINK_UP || memcmp(link->bda, params->bda, sizeof(esp_bd_addr_t)) != 0)
+            continue;
+        // The new parameters take effect at the instant, a few events on
+        shim_update_call_t c = { .link = i, .gen = link->gen, .params = *params };
+        shim_post(shim_now_us() + _shim_ble_interval_us(link) * SHIM_BLE_UPDATE_EVENTS, SHIM_BLE_CONTEXT, _shim_ble_update_call, &c, sizeof(c));
+        return ESP_OK;
+    }
+    esp_ble_gap_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.update_conn_params.status = ESP_BT_STATUS_FAIL;
+    memcpy(param.update_conn_params.bda, params->bda, sizeof(esp_bd_addr_t));
+    _shim_ble_post_gap(shim_now_us() + SHIM_BLE_HCI_US, ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT, &param);
+    return ESP_OK;
+}
+
+uint8_t *esp_ble_resolve_adv_data(uint8_t *adv_data, uint8_t type, uint8_t *length) {
+    uint8_t pos = 0;
+    *length = 0;
+    if (adv_data == NULL)
+        return NULL;
+    while (pos < ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX) {
+        uint8_t ad_len = adv_data[pos];
+        if (ad_len == 0 || pos + 1 + ad_len > ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX)
+            break;
+        if (adv_data[pos + 1] == type) {
+            *length = ad_len - 1;
+            return &adv_data[pos + 2];
+        }
+        pos += ad_len + 1;
+    }
+    return NULL;
+}
+
+/* GATTC */
+
+esp_err_t esp_ble_gattc_register_callback(esp_gattc_cb_t callback) {
+    if (!ble.bluedroid)
+        return ESP_ERR_INVALID_STATE;
+    ble.gattc_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_app_register(uint16_t app_id) {
+    if (!ble.bluedroid)
+        return ESP_ERR_INVALID_STATE;
+    esp_ble_gattc_cb_param_t param = { .reg = { .status = (ble.app_registered) ? ESP_GATT_ERROR : ESP_GATT_OK, .app_id = app_id } };
+    ble.app_registered = true;
+    if (!ble.replay)
+        _shim_ble_post_gattc(shim_now_us() + SHIM_BLE_BTC_US, SHIM_BLE_LINK_NONE, ESP_GATTC_REG_EVT, &param, NULL, 0);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_open(esp_gatt_if_t gattc_if, esp_bd_addr_t remote_bda, esp_ble_addr_type_t remote_addr_type, bool is_direct) {
+    if (!ble.app_registered || gattc_if != SHIM_BLE_GATTC_IF)
+        return ESP_ERR_INVALID_STATE;
+    if (ble.replay)
+        return ESP_OK;
+    esp_ble_gattc_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    memcpy(param.open.remote_bda, remote_bda, sizeof(esp_bd_addr_t));
+    shim_link_t *free = NULL;
+    for (int i = 0; i < SHIM_BLE_LINKS; i++) {
+        shim_link_t *link = &ble.links[i];
+        if (link->state == SHIM_LINK_FREE) {
+            if (free == NULL)
+                free = link;
+            continue;
+        }
+        if (memcmp(link->bda, remote_bda, sizeof(esp_bd_addr_t)) != 0)
+            continue;
+        if (link->state == SHIM_LINK_UP) {
+            param.open.status = ESP_GATT_ALREADY_OPEN;
+            param.open.conn_id = i;
+            param.open.mtu = link->mtu;
+            _shim_ble_post_gattc(shim_now_us() + SHIM_BLE_BTC_US, i, ESP_GATTC_OPEN_EVT, &param, NULL, 0);
+        } else if (link->state == SHIM_LINK_PENDING) {
+            // Asked again while waiting, the establishment timeout starts over
+            shim_link_call_t c = { .link = i, .gen = link->gen };
+            shim_cancel(link->open_timeout);
+            link->open_timeout = shim_post(shim_now_us() + SHIM_BLE_OPEN_TIMEOUT_US, SHIM_BLE_CONTEXT, _shim_ble_open_timeout_call, &c, sizeof(c));
+        }
+        return ESP_OK;
+    }
+    if (free == NULL) {
+        param.open.status = ESP_GATT_NO_RESOURCES;
+        _shim_ble_post_gattc(shim_now_us() + SHIM_BLE_BTC_US, SHIM_BLE_LINK_NONE, ESP_GATTC_OPEN_EVT, &param, NULL, 0);
+        return ESP_OK;
+    }
+    free->state = SHIM_LINK_PENDING;
+    memcpy(free->bda, remote_bda, sizeof(esp_bd_addr_t));
+    free->sensor = _shim_ble_sensor_find(remote_bda);
+    shim_link_call_t c = { .link = free - ble.links, .gen = free->gen };
+    free->open_timeout = shim_post(shim_now_us() + SHIM_BLE_OPEN_TIMEOUT_US, SHIM_BLE_CONTEXT, _shim_ble_open_timeout_call, &c, sizeof(c));
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_close(esp_gatt_if_t gattc_if, uint16_t conn_id) {
+    if (!ble.app_registered || gattc_if != SHIM_BLE_GATTC_IF)
+        return ESP_ERR_INVALID_STATE;
+    if (ble.replay || conn_id >= SHIM_BLE_LINKS)
+        return ESP_OK;
+    shim_link_t *link = &ble.links[conn_id];
+    if (link->state == SHIM_LINK_PENDING)
+        _shim_ble_free(link);
+    else if (link->state == SHIM_LINK_UP)
+        _shim_ble_drop(link, _shim_ble_interval_us(link) * (1 + link->latency), ESP_GATT_CONN_TERMINATE_LOCAL_HOST);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_send_mtu_req(esp_gatt_if_t gattc_if, uint16_t conn_id) {
+    if (gattc_if != SHIM_BLE_GATTC_IF)
+        return ESP_ERR_INVALID_STATE;
+    return _shim_ble_att(conn_id, SHIM_ATT_MTU, 0, NULL, 0);
+}
+
+static esp_err_t _shim_ble_db(uint16_t conn_id) {
+    shim_link_t *link = _shim_ble_link(conn_id);
+    return (link && link->discovered) ? ESP_OK : ESP_FAIL;
+}
+
+static void _shim_ble_uuid(const shim_attr_t *a, esp_bt_uuid_t *uuid) {
+    memset(uuid, 0, sizeof(*uuid));
+    if (a->uuid128) {
+        uuid->len = ESP_UUID_LEN_128;
+        memcpy(uuid->uuid.uuid128, shim_uuid128_base, ESP_UUID_LEN_128);
+        uuid->uuid.uuid128[12] = a->uuid128;
+    } else {
+        uuid->len = ESP_UUID_LEN_16;
+        uuid->uuid.uuid16 = a->uuid16;
+    }
+}
+
+esp_err_t esp_ble_gattc_get_service(esp_gatt_if_t gattc_if, uint16_t conn_id, esp_bt_uuid_t *svc_uuid,
+                                    esp_gattc_service_elem_t *result, uint16_t *count, uint16_t offset) {
+    if (result == NULL || count == NULL || _shim_ble_db(conn_id) != ESP_OK)
+        return ESP_FAIL;
+    uint16_t found = 0, n = 0;
+    for (size_t i = 0; i < SHIM_ATTRS; i++) {
+        if (shim_attrs[i].kind != SHIM_ATTR_SERVICE)
+            continue;
+        esp_bt_uuid_t uuid;
+        _shim_ble_uuid(&shim_attrs[i], &uuid);
+        if (svc_uuid && (svc_uuid->len != uuid.len || memcmp(&svc_uuid->uuid, &uuid.uuid, uuid.len) != 0))
+            continue;
+        if (found++ < offset || n >= *count)
+            continue;
+        result[n].is_primary = true;
+        result[n].start_handle = shim_attrs[i].handle;
+        result[n].end_handle = shim_attrs[i].end;
+        result[n].uuid = uuid;
+        n++;
+    }
+    *count = n;
+    return (n) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_ble_gattc_get_all_char(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t start_handle, uint16_t end_handle,
+                                     esp_gattc_char_elem_t *result, uint16_t *count, uint16_t offset) {
+    if (result == NULL || count == NULL || _shim_ble_db(conn_id) != ESP_OK)
+        return ESP_FAIL;
+    uint16_t found = 0, n = 0;
+    for (size_t i = 0; i < SHIM_ATTRS; i++) {
+        const shim_attr_t *a = &shim_attrs[i];
+        if (a->kind != SHIM_ATTR_CHAR || a->handle < start_handle || a->handle > end_handle)
+            continue;
+        if (found++ < offset || n >= *count)
+            continue;
+        result[n].char_handle = a->handle;
+        result[n].properties = a->properties;
+        _shim_ble_uuid(a, &result[n].uuid);
+        n++;
+    }
+    *count = n;
+    return (n) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_ble_gattc_get_all_descr(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t char_handle,
+                                      esp_gattc_descr_elem_t *result, uint16_t *count, uint16_t offset) {
+    if (result == NULL || count == NULL || _shim_ble_db(conn_id) != ESP_OK)
+        return ESP_FAIL;
+    uint16_t found = 0, n = 0;
+    size_t i = 0;
+    while (i < SHIM_ATTRS && !(shim_attrs[i].kind == SHIM_ATTR_CHAR && shim_attrs[i].handle == char_handle))
+        i++;
+    if (i == SHIM_ATTRS)
+        return ESP_FAIL;
+    for (i++; i < SHIM_ATTRS && shim_attrs[i].kind == SHIM_ATTR_DESCR; i++) {
+        if (found++ < offset || n >= *count)
+            continue;
+        result[n].handle = shim_attrs[i].handle;
+        _shim_ble_uuid(&shim_attrs[i], &result[n].uuid);
+        n++;
+    }
+    *count = n;
+    return (n) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_ble_gattc_read_char(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle, esp_gatt_auth_req_t auth_req) {
+    if (gattc_if != SHIM_BLE_GATTC_IF)
+        return ESP_ERR_INVALID_STATE;
+    return _shim_ble_att(conn_id, SHIM_ATT_READ, handle, NULL, 0);
+}
+
+esp_err_t esp_ble_gattc_write_char(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle, uint16_t value_len, uint8_t *value,
+                                   esp_gatt_write_type_t write_type, esp_gatt_auth_req_t auth_req) {
+    if (gattc_if != SHIM_BLE_GATTC_IF || value == NULL)
+        return ESP_ERR_INVALID_ARG;
+    return _shim_ble_att(conn_id, SHIM_ATT_WRITE, handle, value, value_len);
+}
+
+esp_err_t esp_ble_gattc_write_char_descr(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle, uint16_t value_len, uint8_t *value,
+                                         esp_gatt_write_type_t write_type, esp_gatt_auth_req_t auth_req) {
+    if (gattc_if != SHIM_BLE_GATTC_IF || value == NULL)
+        return ESP_ERR_INVALID_ARG;
+    return _shim_ble_att(conn_id, SHIM_ATT_WRITE_DESCR, handle, value, value_len);
+}
+
+// Local to Bluedroid, the event carries the handle but not the device
+esp_err_t esp_ble_gattc_register_for_notify(esp_gatt_if_t gattc_if, esp_bd_addr_t server_bda, uint16_t handle) {
+    if (gattc_if != SHIM_BLE_GATTC_IF || server_bda == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (ble.replay)
+        return ESP_OK;
+    esp_ble_gattc_cb_param_t param = { .reg_for_notify = { .status = ESP_GATT_NO_RESOURCES, .handle = handle } };
+    ble.stats.reg_for_notify++;
+    // Answered in order, but the event names the handle only
+    if (shim_now_us() < ble.reg_answered)
+        ble.stats.reg_overlapped++;
+    ble.reg_answered = shim_now_us() + ble.reg_delay_us;
+    if (_shim_ble_registered(server_bda, handle)) {
+        param.reg_for_notify.status = ESP_GATT_OK;
+    } else {
+        for (int i = 0; i < SHIM_BLE_NOTIF_REG_MAX; i++) {
+            if (ble.regs[i].used)
+                continue;
+            ble.regs[i].used = true;
+            memcpy(ble.regs[i].bda, server_bda, sizeof(esp_bd_addr_t));
+            ble.regs[i].handle = handle;
+            param.reg_for_notify.status = ESP_GATT_OK;
+            break;
+        }
+    }
+    if (param.reg_for_notify.status != ESP_GATT_OK)
+        ble.stats.reg_refused++;
+    _shim_ble_post_gattc(ble.reg_answered, SHIM_BLE_LINK_NONE, ESP_GATTC_REG_FOR_NOTIFY_EVT, &param, NULL, 0);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_unregister_for_notify(esp_gatt_if_t gattc_if, esp_bd_addr_t server_bda, uint16_t handle) {
+    if (gattc_if != SHIM_BLE_GATTC_IF || server_bda == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (ble.replay)
+        return ESP_OK;
+    esp_ble_gattc_cb_param_t param = { .unreg_for_notify = { .status = ESP_GATT_ERROR, .handle = handle } };
+    for (int i = 0; i < SHIM_BLE_NOTIF_REG_MAX; i++) {
+        if (ble.regs[i].used && ble.regs[i].handle == handle && memcmp(ble.regs[i].bda, server_bda, sizeof(esp_bd_addr_t)) == 0) {
+            ble.regs[i].used = false;
+            param.unreg_for_notify.status = ESP_GATT_OK;
+            break;
+        }
+    }
+    _shim_ble_post_gattc(shim_now_us() + SHIM_BLE_BTC_US, SHIM_BLE_LINK_NONE, ESP_GATTC_UNREG_FOR_NOTIFY_EVT, &param, NULL, 0);
+    return ESP_OK;
+}
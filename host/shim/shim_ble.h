@@ -0,0 +1,116 @@
+#pragma once
+
+// Mock sensors on the air and the Bluedroid GAP/GATTC they talk through.
+//
+// Every sensor advertises on its own schedule, answers the GATT client with
+// the attribute table of a LYWSD03MMC, notifies its readings and streams its
+// hourly log. Link timing follows the connection parameters: a request waits
+// for the next connection event the sensor listens to, the answer comes one
+// event later. Callbacks run in the "btc" context.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_bt_defs.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gattc_api.h"
+
+#define SHIM_SENSORS_MAX            160
+#define SHIM_BLE_LINKS              3           /*!< CONFIG_BTDM_CTRL_BLE_MAX_CONN */
+#define SHIM_BLE_NOTIF_REG_MAX      5           /*!< BTA_GATTC_NOTIF_REG_MAX, shared by every link */
+#define SHIM_BLE_GATTC_IF           3
+
+// Value handles, the same on every sensor
+#define SHIM_HANDLE_MODEL           0x000E
+#define SHIM_HANDLE_SERIAL          0x0010
+#define SHIM_HANDLE_FW              0x0012
+#define SHIM_HANDLE_HW              0x0014
+#define SHIM_HANDLE_SW              0x0016
+#define SHIM_HANDLE_BATTERY         0x001D
+#define SHIM_HANDLE_CLOCK           0x0032
+#define SHIM_HANDLE_DATA            0x0036
+#define SHIM_HANDLE_DATA_CCC        0x0038
+#define SHIM_HANDLE_HISTORY_INDEX   0x0040
+#define SHIM_HANDLE_HISTORY         0x0043
+#define SHIM_HANDLE_HISTORY_CCC     0x0044
+
+typedef enum {
+    SHIM_SENSOR_STOCK,                      /*!< stock firmware: connectable, MiBeacon without objects, name in the scan response */
+    SHIM_SENSOR_ATC,                        /*!< custom firmware, 13 byte 0x181A service data */
+    SHIM_SENSOR_PVVX,                       /*!< custom firmware, 15 byte 0x181A service data */
+    SHIM_SENSOR_MIBEACON,                   /*!< encrypted MiBeacon v5, one object per frame */
+    SHIM_SENSOR_PHONE,                      /*!< anything else on the air, random address and manufacturer data */
+} shim_sensor_format_t;
+
+typedef struct {
+    esp_bd_addr_t       bda;
+    shim_sensor_format_t format;
+    uint8_t             bind_key[16];       /*!< SHIM_SENSOR_MIBEACON */
+    uint32_t            adv_interval_ms;
+    uint32_t            measure_ms;         /*!< new reading: notification, adv counter */
+    int8_t              rssi;
+    int16_t             temp;               /*!< 0.01 degrees Celsius */
+    uint8_t             hum;
+    uint8_t             battery;
+    uint16_t            battery_mv;
+    uint16_t            mtu;
+    uint32_t            history_count;      /*!< hourly records logged at shim_sensor_add, one more every hour */
+    uint32_t            history_time;       /*!< sensor clock of record 0 */
+    uint8_t             history_per_event;  /*!< records notified per connection event */
+    uint8_t             write_delay_events; /*!< write responses come this many events late, the log may start first */
+} shim_sensor_config_t;
+
+typedef struct {
+    uint32_t            adv_sent;
+    uint32_t            adv_heard;          /*!< reports given to the GAP callback */
+    uint32_t            connections;
+    uint32_t            notifications;
+    uint32_t            history_sent;
+    uint32_t            history_from;       /*!< last index written to the history index characteristic */
+} shim_sensor_stats_t;
+
+typedef struct {
+    uint32_t            scan_reports;
+    uint32_t            scan_requests;      /*!< reports that came with a scan response, active scans only */
+    uint32_t            scan_starts;
+    uint32_t            att_ops;
+    uint32_t            links;              /*!< open right now */
+    uint32_t            links_max;
+    uint32_t            reg_for_notify;
+    uint32_t            reg_refused;        /*!< registration table full */
+    uint32_t            reg_overlapped;     /*!< registrations made while an earlier one was unanswered */
+    uint64_t            scan_on_us;         /*!< time with the scanner started */
+} shim_ble_stats_t;
+
+/**
+ * Defaults of a LYWSD03MMC numbered n: address A4:C1:38:00:n, 21.50 C,
+ * 45 %, advertising every 1 s, a reading every 6 s and two days of log.
+ */
+void shim_sensor_config_default(shim_sensor_config_t *config, shim_sensor_format_t format, uint16_t n);
+
+/**
+ * Advertising data the sensor sends for a reading numbered counter, the
+ * MiBeacon object of that frame and the scan response when active. Returns
+ * the length written to adv, ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX at most.
+ */
+uint8_t shim_sensor_adv(const shim_sensor_config_t *config, uint32_t counter, uint8_t object, bool active, uint8_t *adv);
+
+// Returns the sensor id, -1 once SHIM_SENSORS_MAX are on the air
+int shim_sensor_add(const shim_sensor_config_t *config);
+void shim_sensor_set_reading(int id, int16_t temp, uint8_t hum, uint16_t battery_mv);
+void shim_sensor_set_power(int id, bool on);        /*!< off drops its link at the supervision timeout */
+void shim_sensor_get_stats(int id, shim_sensor_stats_t *stats);
+
+void shim_ble_get_stats(shim_ble_stats_t *stats);
+bool shim_ble_scanning(void);
+bool shim_ble_registered(const esp_bd_addr_t bda, uint16_t handle);  /*!< in the notification table */
+// REG_FOR_NOTIFY_EVT comes us after the call, a BTC task behind on other work; 0 for the default
+void shim_ble_set_reg_delay(uint32_t us);
+
+/**
+ * Replay: the mock stack stops generating events, API calls still succeed,
+ * and the harness feeds recorded callbacks instead. Pointers in param are
+ * followed and their bytes copied, value_len of them.
+ */
+void shim_ble_set_replay(bool replay);
+void shim_ble_inject_gap(int64_t at_us, esp_gap_ble_cb_event_t event, const esp_ble_gap_cb_param_t *param);
+void shim_ble_inject_gattc(int64_t at_us, esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, const esp_ble_gattc_cb_param_t *param);
@@ -0,0 +1,126 @@
+// mbedtls CCM (RFC 3610) over the AES block cipher of OpenSSL
+
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/aes.h>
+#include "shim_internal.h"
+#include "mbedtls/ccm.h"
+
+static void _shim_ccm_counter(uint8_t ctr[16], size_t q, size_t index) {
+    for (size_t i = 0; i < q; i++)
+        ctr[15 - i] = (index >> (8 * i)) & 0xFF;
+}
+
+static void _shim_ccm(const AES_KEY *aes, bool decrypt, const uint8_t *nonce, size_t nonce_len, const uint8_t *add, size_t add_len,
+                      const uint8_t *input, uint8_t *output, size_t length, uint8_t *tag, size_t tag_len) {
+    size_t q = 15 - nonce_len;
+    uint8_t block[16], mac[16], ctr[16], stream[16];
+
+    // CBC-MAC over B0, the additional data and the plaintext
+    block[0] = ((add_len) ? 0x40 : 0) | ((tag_len - 2) / 2) << 3 | (q - 1);
+    memcpy(block + 1, nonce, nonce_len);
+    _shim_ccm_counter(block, q, length);
+    AES_encrypt(block, mac, aes);
+    if (add_len) {
+        size_t off = 0;
+        memset(block, 0, sizeof(block));
+        block[0] = add_len >> 8;
+        block[1] = add_len & 0xFF;
+        size_t use = (add_len < 14) ? add_len : 14;
+        memcpy(block + 2, add, use);
+        off = use;
+        while (1) {
+            for (int i = 0; i < 16; i++)
+                mac[i] ^= block[i];
+            AES_encrypt(mac, mac, aes);
+            if (off >= add_len)
+                break;
+            memset(block, 0, sizeof(block));
+            use = (add_len - off < 16) ? add_len - off : 16;
+            memcpy(block, add + off, use);
+            off += use;
+        }
+    }
+
+    ctr[0] = q - 1;
+    memcpy(ctr + 1, nonce, nonce_len);
+    for (size_t off = 0, index = 1; off < length; off += 16, index++) {
+        size_t use = (length - off < 16) ? length - off : 16;
+        uint8_t plain[16];
+        _shim_ccm_counter(ctr, q, index);
+        AES_encrypt(ctr, stream, aes);
+        for (size_t i = 0; i < use; i++) {
+            uint8_t in = input[off + i];
+            output[off + i] = in ^ stream[i];
+            plain[i] = (decrypt) ? output[off + i] : in;
+        }
+        for (size_t i = 0; i < use; i++)
+            mac[i] ^= plain[i];
+        AES_encrypt(mac, mac, aes);
+    }
+
+    _shim_ccm_counter(ctr, q, 0);
+    AES_encrypt(ctr, stream, aes);
+    for (size_t i = 0; i < tag_len; i++)
+        tag[i] = mac[i] ^ stream[i];
+}
+
+static bool _shim_ccm_valid(size_t nonce_len, size_t add_len, size_t tag_len) {
+    return nonce_len >= 7 && nonce_len <= 13 && add_len < 0xFF00 && tag_len >= 4 && tag_len <= 16 && tag_len % 2 == 0;
+}
+
+void shim_ccm_seal(const uint8_t key[16], const uint8_t *nonce, size_t nonce_len, const uint8_t *add, size_t add_len,
+                   const uint8_t *input, uint8_t *output, size_t length, uint8_t *tag, size_t tag_len) {
+    AES_KEY aes;
+    AES_set_encrypt_key(key, 128, &aes);
+    _shim_ccm(&aes, false, nonce, nonce_len, add, add_len, input, output, length, tag, tag_len);
+}
+
+void mbedtls_ccm_init(mbedtls_ccm_context *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+// Like mbedtls 2.x, the cipher context is freed and allocated again on every call
+int mbedtls_ccm_setkey(mbedtls_ccm_context *ctx, mbedtls_cipher_id_t cipher, const unsigned char *key, unsigned int keybits) {
+    if (cipher != MBEDTLS_CIPHER_ID_AES || (keybits != 128 && keybits != 192 && keybits != 256))
+        return MBEDTLS_ERR_CCM_BAD_INPUT;
+    free(ctx->cipher_ctx);
+    ctx->cipher_ctx = calloc(1, sizeof(AES_KEY));
+    if (ctx->cipher_ctx == NULL)
+        return MBEDTLS_ERR_CIPHER_ALLOC_FAILED;
+    AES_set_encrypt_key(key, keybits, ctx->cipher_ctx);
+    return 0;
+}
+
+void mbedtls_ccm_free(mbedtls_ccm_context *ctx) {
+    free(ctx->cipher_ctx);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+int mbedtls_ccm_encrypt_and_tag(mbedtls_ccm_context *ctx, size_t length, const unsigned char *iv, size_t iv_len,
+                                const unsigned char *add, size_t add_len, const unsigned char *input,
+                                unsigned char *output, unsigned char *tag, size_t tag_len) {
+    if (ctx->cipher_ctx == NULL || !_shim_ccm_valid(iv_len, add_len, tag_len))
+        return MBEDTLS_ERR_CCM_BAD_INPUT;
+    _shim_ccm(ctx->cipher_ctx, false, iv, iv_len, add, add_len, input, output, length, tag, tag_len);
+    return 0;
+}
+
+int mbedtls_ccm_auth_decrypt(mbedtls_ccm_context *ctx, size_t length, const unsigned char *iv, size_t iv_len,
+                             const unsigned char *add, size_t add_len, const unsigned char *input,
+                             unsigned char *output, const unsigned char *tag, size_t tag_len) {
+    if (ctx->cipher_ctx == NULL || !_shim_ccm_valid(iv_len, add_len, tag_len))
+        return MBEDTLS_ERR_CCM_BAD_INPUT;
+    uint8_t check[16];
+    _shim_ccm(ctx->cipher_ctx, true, iv, iv_len, add, add_len, input, output, length, check, tag_len);
+    uint8_t diff = 0;
+    for (size_t i = 0; i < tag_len; i++)
+        diff |= check[i] ^ tag[i];
+    if (diff) {
+        memset(output, 0, length);
+        return MBEDTLS_ERR_CCM_AUTH_FAILED;
+    }
+    return 0;
+}
@@ -0,0 +1,630 @@
+// Heap accounting, log, random, the partition API and NVS
+
+#define _GNU_SOURCE
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "shim_internal.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_partition.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "sdkconfig.h"
+
+#define SHIM_HEAP_CONTEXTS          32
+#define SHIM_LOG_TAGS               32
+#define SHIM_NVS_ENTRIES            256
+#define SHIM_NVS_NAMESPACES         32
+#define SHIM_NVS_HANDLES            16
+#define SHIM_NVS_VALUE_MAX          512
+#define SHIM_READLOG_SIZE           0x40000     /*!< see partitions.csv */
+#define SHIM_GATTC_CACHE_MAX        50          /*!< MAX_DEVICE_IN_CACHE of bta_gattc_cache.c, the oldest goes first */
+
+/* Heap, the firmware is linked with --wrap for malloc, calloc, realloc and free */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static struct {
+    size_t          live;
+    size_t          peak;
+    uint32_t        allocations;
+    uint32_t        frees;
+    uint32_t        failed;
+    struct {
+        char        name[16];
+        uint32_t    allocations;
+    } contexts[SHIM_HEAP_CONTEXTS];
+} heap;
+
+static bool _shim_heap_fits(size_t size) {
+    if (size > SHIM_HEAP_SIZE - heap.live) {
+        heap.failed++;
+        return false;
+    }
+    return true;
+}
+
+static void _shim_heap_taken(void *ptr) {
+    heap.live += malloc_usable_size(ptr);
+    if (heap.live > heap.peak)
+        heap.peak = heap.live;
+    heap.allocations++;
+    const char *context = shim_context();
+    for (int i = 0; i < SHIM_HEAP_CONTEXTS; i++) {
+        if (heap.contexts[i].name[0] == '\0')
+            strncpy(heap.contexts[i].name, context, sizeof(heap.contexts[i].name) - 1);
+        else if (strncmp(heap.contexts[i].name, context, sizeof(heap.contexts[i].name) - 1) != 0)
+            continue;
+        heap.contexts[i].allocations++;
+        break;
+    }
+}
+
+static void _shim_heap_given(void *ptr) {
+    size_t size = malloc_usable_size(ptr);
+    heap.live -= (size < heap.live) ? size : heap.live;
+    heap.frees++;
+}
+
+void *__wrap_malloc(size_t size) {
+    if (!_shim_heap_fits(size))
+        return NULL;
+    void *ptr = __real_malloc(size);
+    if (ptr)
+        _shim_heap_taken(ptr);
+    return ptr;
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    if (size && nmemb > SIZE_MAX / size)
+        return NULL;
+    if (!_shim_heap_fits(nmemb * size))
+        return NULL;
+    void *ptr = __real_calloc(nmemb, size);
+    if (ptr)
+        _shim_heap_taken(ptr);
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    if (ptr == NULL)
+        return __wrap_malloc(size);
+    size_t old = malloc_usable_size(ptr);
+    if (size > old && !_shim_heap_fits(size - old))
+        return NULL;
+    _shim_heap_given(ptr);
+    void *moved = __real_realloc(ptr, size);
+    _shim_heap_taken((moved) ? moved : ptr);
+    return moved;
+}
+
+void __wrap_free(void *ptr) {
+    if (ptr == NULL)
+        return;
+    _shim_heap_given(ptr);
+    __real_free(ptr);
+}
+
+void shim_heap_reset(void) {
+    memset(&heap, 0, sizeof(heap));
+}
+
+void shim_heap_get_stats(shim_heap_stats_t *stats) {
+    stats->free = SHIM_HEAP_SIZE - heap.live;
+    stats->minimum_free = SHIM_HEAP_SIZE - heap.peak;
+    stats->allocations = heap.allocations;
+    stats->frees = heap.frees;
+    stats->failed = heap.failed;
+}
+
+uint32_t shim_heap_allocations(const char *context) {
+    for (int i = 0; i < SHIM_HEAP_CONTEXTS; i++) {
+        if (strncmp(heap.contexts[i].name, context, sizeof(heap.contexts[i].name) - 1) == 0)
+            return heap.contexts[i].allocations;
+    }
+    return 0;
+}
+
+uint32_t esp_get_free_heap_size(void) {
+    return SHIM_HEAP_SIZE - heap.live;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void) {
+    return SHIM_HEAP_SIZE - heap.peak;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    return SHIM_HEAP_SIZE - heap.live;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    return SHIM_HEAP_SIZE - heap.peak;
+}
+
+/* Log */
+
+static struct {
+    esp_log_level_t default_level;
+    esp_log_level_t cap;                    /*!< SHIM_LOG, applied on top of the tag levels */
+    uint32_t        errors;
+    struct {
+        char            tag[24];
+        esp_log_level_t level;
+    } tags[SHIM_LOG_TAGS];
+} log_state;
+
+static esp_log_level_t _shim_log_parse(const char *level) {
+    switch ((level) ? level[0] : 'W') {
+    case 'N': case 'n': case '0': return ESP_LOG_NONE;
+    case 'E': case 'e': case '1': return ESP_LOG_ERROR;
+    case 'I': case 'i': case '3': return ESP_LOG_INFO;
+    case 'D': case 'd': case '4': return ESP_LOG_DEBUG;
+    case 'V': case 'v': case '5': return ESP_LOG_VERBOSE;
+    default: return ESP_LOG_WARN;
+    }
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    if (strcmp(tag, "*") == 0) {
+        log_state.default_level = level;
+        for (int i = 0; i < SHIM_LOG_TAGS; i++)
+            log_state.tags[i].level = level;
+        return;
+    }
+    for (int i = 0; i < SHIM_LOG_TAGS; i++) {
+        if (log_state.tags[i].tag[0] == '\0')
+            strncpy(log_state.tags[i].tag, tag, sizeof(log_state.tags[i].tag) - 1);
+        else if (strcmp(log_state.tags[i].tag, tag) != 0)
+            continue;
+        log_state.tags[i].level = level;
+        return;
+    }
+}
+
+static esp_log_level_t _shim_log_level(const char *tag) {
+    for (int i = 0; i < SHIM_LOG_TAGS && log_state.tags[i].tag[0]; i++) {
+        if (strcmp(log_state.tags[i].tag, tag) == 0)
+            return log_state.tags[i].level;
+    }
+    return log_state.default_level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    if (level == ESP_LOG_ERROR)
+        log_state.errors++;
+    if (level > log_state.cap || level > _shim_log_level(tag))
+        return;
+    static const char letters[] = "NEWIDV";
+    va_list args;
+    va_start(args, format);
+    printf("%c (%lld) %s: ", letters[level], (long long)(shim_now_us() / 1000), tag);
+    vprintf(format, args);
+    putchar('\n');
+    va_end(args);
+}
+
+void shim_log_set_level(esp_log_level_t level) {
+    log_state.cap = level;
+}
+
+uint32_t shim_log_errors(void) {
+    return log_state.errors;
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_INVALID_MAC: return "ESP_ERR_INVALID_MAC";
+    case ESP_ERR_NVS_NOT_INITIALIZED: return "ESP_ERR_NVS_NOT_INITIALIZED";
+    case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_TYPE_MISMATCH: return "ESP_ERR_NVS_TYPE_MISMATCH";
+    case ESP_ERR_NVS_READ_ONLY: return "ESP_ERR_NVS_READ_ONLY";
+    case ESP_ERR_NVS_NOT_ENOUGH_SPACE: return "ESP_ERR_NVS_NOT_ENOUGH_SPACE";
+    case ESP_ERR_NVS_INVALID_NAME: return "ESP_ERR_NVS_INVALID_NAME";
+    case ESP_ERR_NVS_INVALID_HANDLE: return "ESP_ERR_NVS_INVALID_HANDLE";
+    case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+    case ESP_ERR_NVS_NO_FREE_PAGES: return "ESP_ERR_NVS_NO_FREE_PAGES";
+    case ESP_ERR_NVS_NEW_VERSION_FOUND: return "ESP_ERR_NVS_NEW_VERSION_FOUND";
+    default: return "UNKNOWN ERROR";
+    }
+}
+
+/* Random, xorshift so every run with the same seed repeats */
+
+static uint32_t shim_random = 1;
+
+void shim_set_seed(uint32_t seed) {
+    shim_random = (seed) ? seed : 1;
+}
+
+uint32_t esp_random(void) {
+    shim_random ^= shim_random << 13;
+    shim_random ^= shim_random >> 17;
+    shim_random ^= shim_random << 5;
+    return shim_random;
+}
+
+void esp_restart(void) {
+    printf("shim: esp_restart, the boot ends here\n");
+    fflush(stdout);
+    _exit(0);
+}
+
+/* Flash and NVS, shared between the harness and the boots it forks */
+
+typedef struct {
+    bool            used;
+    char            ns[16];
+    char            key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_type_t      type;
+    uint32_t        u32;
+    uint16_t        len;
+    uint8_t         blob[SHIM_NVS_VALUE_MAX];
+} shim_nvs_entry_t;
+
+typedef struct {
+    bool                formatted;
+    uint8_t             readlog[SHIM_READLOG_SIZE];
+    char                namespaces[SHIM_NVS_NAMESPACES][16];
+    shim_nvs_entry_t    nvs[SHIM_NVS_ENTRIES];
+    uint8_t             gattc_cache[SHIM_GATTC_CACHE_MAX][6];  /*!< CONFIG_BT_GATTC_CACHE_NVS_FLASH, in the nvs partition */
+    uint8_t             gattc_cached;
+    uint8_t             gattc_next;
+    shim_flash_stats_t  stats;
+    uint32_t            fail_writes;
+} shim_storage_t;
+
+static shim_storage_t *storage;
+
+// As in partitions.csv, only readlog has content behind it
+static const esp_partition_t shim_partitions[] = {
+    { .type = ESP_PARTITION_TYPE_DATA, .subtype = ESP_PARTITION_SUBTYPE_DATA_NVS, .address = 0x9000, .size = 0x6000, .label = "nvs" },
+    { .type = ESP_PARTITION_TYPE_DATA, .subtype = 0x40, .address = 0x190000, .size = SHIM_READLOG_SIZE, .label = "readlog" },
+};
+
+static struct {
+    bool            initialized;
+    struct {
+        bool        used;
+        bool        writable;
+        char        ns[16];
+    } handles[SHIM_NVS_HANDLES];
+} nvs_state;
+
+struct nvs_opaque_iterator_t {
+    char            ns[16];
+    nvs_type_t      type;
+    int             index;
+};
+
+void shim_storage_erase(void) {
+    memset(storage, 0, sizeof(*storage));
+    memset(storage->readlog, 0xFF, sizeof(storage->readlog));
+    storage->formatted = true;
+}
+
+void shim_esp_reset(void) {
+    memset(&log_state, 0, sizeof(log_state));
+    log_state.default_level = CONFIG_LOG_DEFAULT_LEVEL;
+    log_state.cap = _shim_log_parse(getenv("SHIM_LOG"));
+    shim_random = 1;
+    memset(&nvs_state, 0, sizeof(nvs_state));
+    if (storage == NULL) {
+        storage = mmap(NULL, sizeof(*storage), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (storage == MAP_FAILED) {
+            perror("shim: mmap");
+            abort();
+        }
+    }
+    if (!storage->formatted)
+        shim_storage_erase();
+}
+
+void shim_flash_get_stats(shim_flash_stats_t *stats) {
+    *stats = storage->stats;
+}
+
+void shim_flash_reset_stats(void) {
+    memset(&storage->stats, 0, sizeof(storage->stats));
+}
+
+void shim_flash_fail_writes(uint32_t count) {
+    storage->fail_writes = count;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label) {
+    for (size_t i = 0; i < sizeof(shim_partitions) / sizeof(shim_partitions[0]); i++) {
+        const esp_partition_t *part = &shim_partitions[i];
+        if (part->type != type || (subtype != ESP_PARTITION_SUBTYPE_ANY && part->subtype != subtype))
+            continue;
+        if (label && strcmp(part->label, label) != 0)
+            continue;
+        return part;
+    }
+    return NULL;
+}
+
+static uint8_t *_shim_partition_data(const esp_partition_t *partition, size_t offset, size_t size) {
+    if (partition == NULL || partition->size != SHIM_READLOG_SIZE || strcmp(partition->label, "readlog") != 0)
+        return NULL;
+    if (offset > partition->size || size > partition->size - offset)
+        return NULL;
+    return storage->readlog + offset;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+    uint8_t *data = _shim_partition_data(partition, src_offset, size);
+    if (data == NULL || dst == NULL)
+        return ESP_ERR_INVALID_ARG;
+    memcpy(dst, data, size);
+    storage->stats.reads++;
+    storage->stats.bytes_read += size;
+    return ESP_OK;
+}
+
+// NOR flash: programming only clears bits
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size) {
+    uint8_t *data = _shim_partition_data(partition, dst_offset, size);
+    if (data == NULL || src == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (storage->fail_writes) {
+        storage->fail_writes--;
+        return ESP_FAIL;
+    }
+    for (size_t i = 0; i < size; i++)
+        data[i] &= ((const uint8_t *)src)[i];
+    storage->stats.writes++;
+    storage->stats.bytes_written += size;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    if (offset % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE)
+        return ESP_ERR_INVALID_SIZE;
+    uint8_t *data = _shim_partition_data(partition, offset, size);
+    if (data == NULL)
+        return ESP_ERR_INVALID_ARG;
+    memset(data, 0xFF, size);
+    storage->stats.erases += size / SPI_FLASH_SEC_SIZE;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_init(void) {
+    nvs_state.initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    memset(storage->namespaces, 0, sizeof(storage->namespaces));
+    memset(storage->nvs, 0, sizeof(storage->nvs));
+    memset(storage->gattc_cache, 0, sizeof(storage->gattc_cache));
+    storage->gattc_cached = 0;
+    storage->gattc_next = 0;
+    return ESP_OK;
+}
+
+bool shim_gattc_cache_find(const uint8_t *bda) {
+    for (int i = 0; i < storage->gattc_cached; i++) {
+        if (memcmp(storage->gattc_cache[i], bda, 6) == 0)
+            return true;
+    }
+    return false;
+}
+
+void shim_gattc_cache_add(const uint8_t *bda) {
+    if (shim_gattc_cache_find(bda))
+        return;
+    memcpy(storage->gattc_cache[storage->gattc_next], bda, 6);
+    storage->gattc_next = (storage->gattc_next + 1) % SHIM_GATTC_CACHE_MAX;
+    if (storage->gattc_cached < SHIM_GATTC_CACHE_MAX)
+        storage->gattc_cached++;
+}
+
+static int _shim_nvs_namespace(const char *name, bool create) {
+    for (int i = 0; i < SHIM_NVS_NAMESPACES; i++) {
+        if (strcmp(storage->namespaces[i], name) == 0)
+            return i;
+    }
+    if (!create)
+        return -1;
+    for (int i = 0; i < SHIM_NVS_NAMESPACES; i++) {
+        if (storage->namespaces[i][0] == '\0') {
+            strcpy(storage->namespaces[i], name);
+            return i;
+        }
+    }
+    return -1;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle) {
+    if (!nvs_state.initialized)
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    if (name == NULL || strlen(name) >= sizeof(storage->namespaces[0]))
+        return ESP_ERR_NVS_INVALID_NAME;
+    if (_shim_nvs_namespace(name, open_mode == NVS_READWRITE) < 0)
+        return (open_mode == NVS_READWRITE) ? ESP_ERR_NVS_NOT_ENOUGH_SPACE : ESP_ERR_NVS_NOT_FOUND;
+    for (int i = 0; i < SHIM_NVS_HANDLES; i++) {
+        if (nvs_state.handles[i].used)
+            continue;
+        nvs_state.handles[i].used = true;
+        nvs_state.handles[i].writable = open_mode == NVS_READWRITE;
+        strcpy(nvs_state.handles[i].ns, name);
+        *out_handle = i + 1;
+        return ESP_OK;
+    }
+    return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+}
+
+void nvs_close(nvs_handle_t handle) {
+    if (handle >= 1 && handle <= SHIM_NVS_HANDLES)
+        nvs_state.handles[handle - 1].used = false;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    if (handle < 1 || handle > SHIM_NVS_HANDLES || !nvs_state.handles[handle - 1].used)
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    return ESP_OK;
+}
+
+static esp_err_t _shim_nvs_find(nvs_handle_t handle, const char *key, nvs_type_t type, bool write, shim_nvs_entry_t **entry) {
+    if (handle < 1 || handle > SHIM_NVS_HANDLES || !nvs_state.handles[handle - 1].used)
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    if (write && !nvs_state.handles[handle - 1].writable)
+        return ESP_ERR_NVS_READ_ONLY;
+    if (key == NULL || strlen(key) >= NVS_KEY_NAME_MAX_SIZE)
+        return ESP_ERR_NVS_INVALID_NAME;
+    const char *ns = nvs_state.handles[handle - 1].ns;
+    shim_nvs_entry_t *unused = NULL;
+    for (int i = 0; i < SHIM_NVS_ENTRIES; i++) {
+        shim_nvs_entry_t *e = &storage->nvs[i];
+        if (!e->used) {
+            if (unused == NULL)
+                unused = e;
+            continue;
+        }
+        if (strcmp(e->ns, ns) == 0 && strcmp(e->key, key) == 0 && (type == NVS_TYPE_ANY || e->type == type)) {
+            *entry = e;
+            return ESP_OK;
+        }
+    }
+    if (!write)
+        return ESP_ERR_NVS_NOT_FOUND;
+    if (unused == NULL)
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    memset(unused, 0, sizeof(*unused));
+    strcpy(unused->ns, ns);
+    strcpy(unused->key, key);
+    unused->type = type;
+    *entry = unused;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value) {
+    shim_nvs_entry_t *entry;
+    esp_err_t ret = _shim_nvs_find(handle, key, NVS_TYPE_U32, false, &entry);
+    if (ret == ESP_OK)
+        *out_value = entry->u32;
+    return ret;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value) {
+    shim_nvs_entry_t *entry;
+    esp_err_t ret = _shim_nvs_find(handle, key, NVS_TYPE_U32, true, &entry);
+    if (ret != ESP_OK)
+        return ret;
+    // Like NVS, writing the value already stored costs nothing
+    if (entry->used && entry->u32 == value)
+        return ESP_OK;
+    entry->used = true;
+    entry->u32 = value;
+    storage->stats.nvs_writes++;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length) {
+    shim_nvs_entry_t *entry;
+    esp_err_t ret = _shim_nvs_find(handle, key, NVS_TYPE_BLOB, false, &entry);
+    if (ret != ESP_OK)
+        return ret;
+    if (out_value == NULL) {
+        *length = entry->len;
+        return ESP_OK;
+    }
+    if (*length < entry->len) {
+        *length = entry->len;
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out_value, entry->blob, entry->len);
+    *length = entry->len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length) {
+    if (length > SHIM_NVS_VALUE_MAX)
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    shim_nvs_entry_t *entry;
+    esp_err_t ret = _shim_nvs_find(handle, key, NVS_TYPE_BLOB, true, &entry);
+    if (ret != ESP_OK)
+        return ret;
+    if (entry->used && entry->len == length && memcmp(entry->blob, value, length) == 0)
+        return ESP_OK;
+    entry->used = true;
+    entry->len = length;
+    memcpy(entry->blob, value, length);
+    storage->stats.nvs_writes++;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+    shim_nvs_entry_t *entry;
+    if (handle >= 1 && handle <= SHIM_NVS_HANDLES && nvs_state.handles[handle - 1].used && !nvs_state.handles[handle - 1].writable)
+        return ESP_ERR_NVS_READ_ONLY;
+    esp_err_t ret = _shim_nvs_find(handle, key, NVS_TYPE_ANY, false, &entry);
+    if (ret != ESP_OK)
+        return ret;
+    entry->used = false;
+    storage->stats.nvs_writes++;
+    return ESP_OK;
+}
+
+// The iterator sits on a matching entry, at the end it is freed and NULL returned
+static nvs_iterator_t _shim_nvs_seek(nvs_iterator_t it, int from) {
+    for (int i = from; i < SHIM_NVS_ENTRIES; i++) {
+        shim_nvs_entry_t *e = &storage->nvs[i];
+        if (!e->used || strcmp(e->ns, it->ns) != 0 || (it->type != NVS_TYPE_ANY && e->type != it->type))
+            continue;
+        it->index = i;
+        return it;
+    }
+    free(it);
+    return NULL;
+}
+
+nvs_iterator_t nvs_entry_find(const char *part_name, const char *namespace_name, nvs_type_t type) {
+    if (!nvs_state.initialized || namespace_name == NULL || strlen(namespace_name) >= sizeof(((nvs_iterator_t)0)->ns))
+        return NULL;
+    nvs_iterator_t it = calloc(1, sizeof(*it));
+    if (it == NULL)
+        return NULL;
+    strcpy(it->ns, namespace_name);
+    it->type = type;
+    return _shim_nvs_seek(it, 0);
+}
+
+nvs_iterator_t nvs_entry_next(nvs_iterator_t iterator) {
+    if (iterator == NULL)
+        return NULL;
+    return _shim_nvs_seek(iterator, iterator->index + 1);
+}
+
+void nvs_entry_info(nvs_iterator_t iterator, nvs_entry_info_t *out_info) {
+    shim_nvs_entry_t *e = &storage->nvs[iterator->index];
+    memset(out_info, 0, sizeof(*out_info));
+    strcpy(out_info->namespace_name, e->ns);
+    strcpy(out_info->key, e->key);
+    out_info->type = e->type;
+}
+
+void nvs_release_iterator(nvs_iterator_t iterator) {
+    free(iterator);
+}
@@ -0,0 +1,198 @@
+// I2C master, write transactions go to the devices attached with shim_i2c_attach()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shim_internal.h"
+#include "driver/i2c.h"
+
+#define SHIM_I2C_DEVICES            4
+#define SHIM_I2C_BITS_PER_BYTE      9
+#define SHIM_I2C_BITS_START_STOP    2
+#define SHIM_I2C_TRANSFER_MAX       4096
+
+typedef enum {
+    SHIM_I2C_START,
+    SHIM_I2C_WRITE,
+    SHIM_I2C_STOP,
+} shim_i2c_op_t;
+
+// Like the IDF 4.3 driver: one allocation per command, write() keeps the caller's pointer
+typedef struct shim_i2c_cmd {
+    shim_i2c_op_t       op;
+    uint8_t             byte;
+    const uint8_t       *data;
+    size_t              len;
+    struct shim_i2c_cmd *next;
+} shim_i2c_cmd_t;
+
+typedef struct {
+    shim_i2c_cmd_t      *head;
+    shim_i2c_cmd_t      *tail;
+} shim_i2c_link_t;
+
+static struct {
+    bool                installed;
+    uint32_t            clk_speed;
+    struct {
+        uint8_t             addr;
+        shim_i2c_write_t    write;
+        void                *ctx;
+    } devices[SHIM_I2C_DEVICES];
+    shim_i2c_stats_t    stats;
+} ports[I2C_NUM_MAX];
+
+void shim_i2c_reset(void) {
+    memset(ports, 0, sizeof(ports));
+}
+
+void shim_i2c_attach(int port, uint8_t addr, shim_i2c_write_t write, void *ctx) {
+    for (int i = 0; i < SHIM_I2C_DEVICES; i++) {
+        if (ports[port].devices[i].write && ports[port].devices[i].addr != addr)
+            continue;
+        ports[port].devices[i].addr = addr;
+        ports[port].devices[i].write = write;
+        ports[port].devices[i].ctx = ctx;
+        return;
+    }
+    fprintf(stderr, "shim: no room for i2c device 0x%02x\n", addr);
+    abort();
+}
+
+void shim_i2c_get_stats(int port, shim_i2c_stats_t *stats) {
+    *stats = ports[port].stats;
+}
+
+esp_err_t i2c_param_config(i2c_port_t i2c_num, const i2c_config_t *i2c_conf) {
+    if (i2c_num < 0 || i2c_num >= I2C_NUM_MAX || i2c_conf == NULL || i2c_conf->mode != I2C_MODE_MASTER)
+        return ESP_ERR_INVALID_ARG;
+    if (i2c_conf->master.clk_speed == 0 || i2c_conf->master.clk_speed > 1000000)
+        return ESP_ERR_INVALID_ARG;
+    ports[i2c_num].clk_speed = i2c_conf->master.clk_speed;
+    return ESP_OK;
+}
+
+esp_err_t i2c_driver_install(i2c_port_t i2c_num, i2c_mode_t mode, size_t slv_rx_buf_len, size_t slv_tx_buf_len, int intr_alloc_flags) {
+    if (i2c_num < 0 || i2c_num >= I2C_NUM_MAX || mode != I2C_MODE_MASTER || ports[i2c_num].clk_speed == 0)
+        return ESP_ERR_INVALID_ARG;
+    if (ports[i2c_num].installed)
+        return ESP_FAIL;
+    ports[i2c_num].installed = true;
+    return ESP_OK;
+}
+
+esp_err_t i2c_driver_delete(i2c_port_t i2c_num) {
+    if (i2c_num < 0 || i2c_num >= I2C_NUM_MAX || !ports[i2c_num].installed)
+        return ESP_ERR_INVALID_ARG;
+    ports[i2c_num].installed = false;
+    return ESP_OK;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create(void) {
+    return calloc(1, sizeof(shim_i2c_link_t));
+}
+
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd_handle) {
+    shim_i2c_link_t *link = cmd_handle;
+    if (link == NULL)
+        return;
+    while (link->head) {
+        shim_i2c_cmd_t *cmd = link->head;
+        link->head = cmd->next;
+        free(cmd);
+    }
+    free(link);
+}
+
+static esp_err_t _shim_i2c_append(i2c_cmd_handle_t cmd_handle, shim_i2c_op_t op, uint8_t byte, const uint8_t *data, size_t len) {
+    shim_i2c_link_t *link = cmd_handle;
+    if (link == NULL)
+        return ESP_ERR_INVALID_ARG;
+    shim_i2c_cmd_t *cmd = calloc(1, sizeof(shim_i2c_cmd_t));
+    if (cmd == NULL)
+        return ESP_ERR_NO_MEM;
+    cmd->op = op;
+    cmd->byte = byte;
+    cmd->data = data;
+    cmd->len = len;
+    if (link->tail)
+        link->tail->next = cmd;
+    else
+        link->head = cmd;
+    link->tail = cmd;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd_handle) {
+    return _shim_i2c_append(cmd_handle, SHIM_I2C_START, 0, NULL, 0);
+}
+
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data, bool ack_en) {
+    return _shim_i2c_append(cmd_handle, SHIM_I2C_WRITE, data, NULL, 1);
+}
+
+esp_err_t i2c_master_write(i2c_cmd_handle_t cmd_handle, const uint8_t *data, size_t data_len, bool ack_en) {
+    if (data == NULL)
+        return ESP_ERR_INVALID_ARG;
+    return _shim_i2c_append(cmd_handle, SHIM_I2C_WRITE, 0, data, data_len);
+}
+
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd_handle) {
+    return _shim_i2c_append(cmd_handle, SHIM_I2C_STOP, 0, NULL, 0);
+}
+
+static uint32_t _shim_i2c_wire_us(i2c_port_t port, size_t bytes) {
+    uint64_t bits = (uint64_t)bytes * SHIM_I2C_BITS_PER_BYTE + SHIM_I2C_BITS_START_STOP;
+    return (bits * 1000000 + ports[port].clk_speed - 1) / ports[port].clk_speed;
+}
+
+// Delivers the bytes between start and stop, the caller waits out the wire time
+esp_err_t i2c_master_cmd_begin(i2c_port_t i2c_num, i2c_cmd_handle_t cmd_handle, TickType_t ticks_to_wait) {
+    static uint8_t transfer[SHIM_I2C_TRANSFER_MAX];
+    shim_i2c_link_t *link = cmd_handle;
+    if (i2c_num < 0 || i2c_num >= I2C_NUM_MAX || link == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (!ports[i2c_num].installed)
+        return ESP_ERR_INVALID_STATE;
+
+    size_t len = 0;
+    bool started = false;
+    for (shim_i2c_cmd_t *cmd = link->head; cmd; cmd = cmd->next) {
+        if (cmd->op == SHIM_I2C_START)
+            started = true;
+        if (cmd->op != SHIM_I2C_WRITE)
+            continue;
+        if (!started || len + cmd->len > sizeof(transfer)) {
+            fprintf(stderr, "shim: i2c write without start or longer than %d bytes\n", SHIM_I2C_TRANSFER_MAX);
+            abort();
+        }
+        if (cmd->data)
+            memcpy(transfer + len, cmd->data, cmd->len);
+        else
+            transfer[len] = cmd->byte;
+        len += cmd->len;
+    }
+    if (len == 0)
+        return ESP_OK;
+
+    shim_i2c_stats_t *stats = &ports[i2c_num].stats;
+    stats->transactions++;
+    uint8_t addr = transfer[0] >> 1;
+    for (int i = 0; i < SHIM_I2C_DEVICES; i++) {
+        if (ports[i2c_num].devices[i].write == NULL || ports[i2c_num].devices[i].addr != addr || (transfer[0] & 1))
+            continue;
+        uint32_t us = _shim_i2c_wire_us(i2c_num, len);
+        stats->bytes += len;
+        stats->bus_us += us;
+        ports[i2c_num].devices[i].write(ports[i2c_num].devices[i].ctx, transfer + 1, len - 1);
+        shim_busy_us(us);
+        return ESP_OK;
+    }
+    // Nobody acknowledged the address, the master stops after it
+    uint32_t us = _shim_i2c_wire_us(i2c_num, 1);
+    stats->bytes++;
+    stats->bus_us += us;
+    stats->nacks++;
+    shim_busy_us(us);
+    return ESP_FAIL;
+}
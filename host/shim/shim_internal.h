@@ -0,0 +1,22 @@
+#pragma once
+
+// Between the shim modules only, the harness uses shim.h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "shim.h"
+
+void shim_rtos_reset(void);
+void shim_heap_reset(void);
+void shim_esp_reset(void);
+void shim_i2c_reset(void);
+void shim_ble_reset(void);
+
+// Bluedroid's GATT cache of the addresses discovered before, kept with NVS across shim_reboot_run
+bool shim_gattc_cache_find(const uint8_t *bda);
+void shim_gattc_cache_add(const uint8_t *bda);
+
+// AES-128-CCM without touching the heap, for the mock sensors
+void shim_ccm_seal(const uint8_t key[16], const uint8_t *nonce, size_t nonce_len, const uint8_t *add, size_t add_len,
+                   const uint8_t *input, uint8_t *output, size_t length, uint8_t *tag, size_t tag_len);
@@ -0,0 +1,973 @@
+// FreeRTOS and esp_timer on virtual time
+//
+// Every task is a thread, but only the thread holding the baton runs: the harness
+// loop in shim_run_until() hands it to the highest priority ready task and gets it
+// back when that task blocks. The kernel state needs no locking, shim.lock only
+// guards the handoff itself.
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "shim_internal.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+
+#define SHIM_MAX_TASKS              32
+#define SHIM_MAX_QUEUES             64
+#define SHIM_MAX_GROUPS             16
+#define SHIM_CALL_BITS              13
+#define SHIM_MAX_CALLS              (1 << SHIM_CALL_BITS)
+#define SHIM_CALL_NONE              0xFFFF
+#define SHIM_TICK_US                (1000000 / configTICK_RATE_HZ)
+#define SHIM_THREAD_STACK           (1024 * 1024)
+
+typedef enum {
+    SHIM_TASK_FREE,
+    SHIM_TASK_READY,
+    SHIM_TASK_BLOCKED,
+    SHIM_TASK_DELETED,                      /*!< deleted by another task, its thread stays parked */
+} shim_task_state_t;
+
+struct tskTaskControlBlock {
+    shim_task_state_t   state;
+    char                name[configMAX_TASK_NAME_LEN];
+    TaskFunction_t      fn;
+    void                *arg;
+    UBaseType_t         prio;
+    uint32_t            stack;
+    void                *heap;              /*!< TCB and stack of a dynamic task, for the heap accounting */
+    uint64_t            seq;                /*!< equal priorities run, and waiters wake, in this order */
+    const void          *wait_obj;
+    int64_t             wake_us;
+    bool                timed_out;
+    uint32_t            notify;
+    bool                notified;
+    pthread_t           thread;
+    pthread_cond_t      cond;
+};
+
+struct QueueDefinition {
+    bool                used;
+    uint8_t             type;
+    UBaseType_t         length;
+    UBaseType_t         item_size;          /*!< 0 for semaphores and mutexes */
+    UBaseType_t         count;
+    UBaseType_t         head;
+    uint8_t             *storage;
+    void                *heap;
+};
+
+struct EventGroupDef_t {
+    bool                used;
+    EventBits_t         bits;
+    void                *heap;
+};
+
+typedef struct {
+    int64_t             at;
+    uint64_t            seq;
+    uint32_t            id;
+    const char          *context;
+    shim_call_t         fn;
+    size_t              len;
+    _Alignas(16) uint8_t payload[SHIM_PAYLOAD_MAX];
+} shim_call_slot_t;
+
+struct esp_timer {
+    esp_timer_cb_t      callback;
+    void                *arg;
+    const char          *name;
+    uint64_t            period;
+    uint32_t            call;               /*!< pending shim_post, 0 if not armed */
+};
+
+static struct {
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;               /*!< the harness waits here for the baton */
+    TaskHandle_t        current;            /*!< NULL while the harness or a deferred call runs */
+    const char          *context;
+    int64_t             now;
+    uint64_t            seq;
+    uint32_t            critical;
+    bool                yield_pending;
+    bool                realtime;
+    struct timespec     wall_start;
+    int64_t             virt_start;
+    uint32_t            call_gen;
+    uint32_t            call_count;
+    uint32_t            call_free_count;
+} shim = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static struct tskTaskControlBlock tasks[SHIM_MAX_TASKS];
+static struct QueueDefinition queues[SHIM_MAX_QUEUES];
+static struct EventGroupDef_t groups[SHIM_MAX_GROUPS];
+static shim_call_slot_t calls[SHIM_MAX_CALLS];
+static uint16_t call_heap[SHIM_MAX_CALLS];
+static uint16_t call_pos[SHIM_MAX_CALLS];
+static uint16_t call_free[SHIM_MAX_CALLS];
+
+static void (*shim_app)(void);
+
+/* Scheduler */
+
+// Give the baton to `to` (NULL is the harness) and sleep until it comes back
+static void _shim_switch(TaskHandle_t to) {
+    TaskHandle_t self = shim.current;
+    pthread_mutex_lock(&shim.lock);
+    shim.current = to;
+    pthread_cond_signal((to) ? &to->cond : &shim.cond);
+    while (shim.current != self)
+        pthread_cond_wait((self) ? &self->cond : &shim.cond, &shim.lock);
+    pthread_mutex_unlock(&shim.lock);
+}
+
+static int64_t _shim_deadline(TickType_t ticks) {
+    if (ticks == portMAX_DELAY)
+        return INT64_MAX;
+    return (shim.now / SHIM_TICK_US + ticks) * SHIM_TICK_US;
+}
+
+static void _shim_yield(void) {
+    TaskHandle_t self = shim.current;
+    if (self == NULL)
+        return;
+    if (shim.critical) {
+        shim.yield_pending = true;
+        return;
+    }
+    self->state = SHIM_TASK_READY;
+    self->seq = ++shim.seq;
+    _shim_switch(NULL);
+}
+
+// Block the running task on obj until woken or wake_us, false on timeout
+static bool _shim_block(const void *obj, int64_t wake_us) {
+    TaskHandle_t self = shim.current;
+    // The harness and deferred calls stand for ISRs and the Bluetooth stack, they never wait
+    if (self == NULL)
+        return false;
+    if (shim.critical) {
+        fprintf(stderr, "shim: task %s blocks inside a critical section\n", self->name);
+        abort();
+    }
+    self->state = SHIM_TASK_BLOCKED;
+    self->wait_obj = obj;
+    self->wake_us = wake_us;
+    self->timed_out = false;
+    self->seq = ++shim.seq;
+    _shim_switch(NULL);
+    return !self->timed_out;
+}
+
+// Make the first (or every) waiter on obj ready, preempting a lower priority caller
+static void _shim_wake(const void *obj, bool all) {
+    bool preempt = false;
+    while (1) {
+        TaskHandle_t best = NULL;
+        for (int i = 0; i < SHIM_MAX_TASKS; i++) {
+            TaskHandle_t t = &tasks[i];
+            if (t->state != SHIM_TASK_BLOCKED || t->wait_obj != obj)
+                continue;
+            if (best == NULL || t->prio > best->prio || (t->prio == best->prio && t->seq < best->seq))
+                best = t;
+        }
+        if (best == NULL)
+            break;
+        best->state = SHIM_TASK_READY;
+        best->wait_obj = NULL;
+        best->seq = ++shim.seq;
+        if (shim.current && best->prio > shim.current->prio)
+            preempt = true;
+        if (!all)
+            break;
+    }
+    if (preempt)
+        _shim_yield();
+}
+
+static TaskHandle_t _shim_pick(void) {
+    TaskHandle_t best = NULL;
+    for (int i = 0; i < SHIM_MAX_TASKS; i++) {
+        TaskHandle_t t = &tasks[i];
+        if (t->state != SHIM_TASK_READY)
+            continue;
+        if (best == NULL || t->prio > best->prio || (t->prio == best->prio && t->seq < best->seq))
+            best = t;
+    }
+    return best;
+}
+
+static void *_shim_task_main(void *arg) {
+    TaskHandle_t self = arg;
+    pthread_mutex_lock(&shim.lock);
+    while (shim.current != self)
+        pthread_cond_wait(&self->cond, &shim.lock);
+    pthread_mutex_unlock(&shim.lock);
+    self->fn(self->arg);
+    fprintf(stderr, "shim: task %s returned from its function\n", self->name);
+    abort();
+}
+
+static TaskHandle_t _shim_task_new(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, void *heap) {
+    TaskHandle_t t = NULL;
+    for (int i = 0; i < SHIM_MAX_TASKS; i++) {
+        if (tasks[i].state == SHIM_TASK_FREE) {
+            t = &tasks[i];
+            break;
+        }
+    }
+    if (t == NULL)
+        return NULL;
+    memset(t, 0, sizeof(*t));
+    strncpy(t->name, (name) ? name : "", sizeof(t->name) - 1);
+    t->fn = fn;
+    t->arg = arg;
+    t->prio = (prio < configMAX_PRIORITIES) ? prio : configMAX_PRIORITIES - 1;
+    t->stack = stack;
+    t->heap = heap;
+    t->state = SHIM_TASK_READY;
+    t->seq = ++shim.seq;
+    t->wake_us = INT64_MAX;
+    pthread_cond_init(&t->cond, NULL);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, SHIM_THREAD_STACK);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&t->thread, &attr, _shim_task_main, t) != 0) {
+        perror("shim: pthread_create");
+        abort();
+    }
+    pthread_attr_destroy(&attr);
+    if (shim.current && t->prio > shim.current->prio)
+        _shim_yield();
+    return t;
+}
+
+/* Deferred calls, a binary heap on (at, seq) */
+
+static bool _shim_call_before(uint16_t a, uint16_t b) {
+    if (calls[a].at != calls[b].at)
+        return calls[a].at < calls[b].at;
+    return calls[a].seq < calls[b].seq;
+}
+
+static void _shim_call_set(uint32_t pos, uint16_t slot) {
+    call_heap[pos] = slot;
+    call_pos[slot] = pos;
+}
+
+static void _shim_call_up(uint32_t pos) {
+    uint16_t slot = call_heap[pos];
+    while (pos > 0) {
+        uint32_t parent = (pos - 1) / 2;
+        if (!_shim_call_before(slot, call_heap[parent]))
+            break;
+        _shim_call_set(pos, call_heap[parent]);
+        pos = parent;
+    }
+    _shim_call_set(pos, slot);
+}
+
+static void _shim_call_down(uint32_t pos) {
+    uint16_t slot = call_heap[pos];
+    while (1) {
+        uint32_t child = pos * 2 + 1;
+        if (child >= shim.call_count)
+            break;
+        if (child + 1 < shim.call_count && _shim_call_before(call_heap[child + 1], call_heap[child]))
+            child++;
+        if (!_shim_call_before(call_heap[child], slot))
+            break;
+        _shim_call_set(pos, call_heap[child]);
+        pos = child;
+    }
+    _shim_call_set(pos, slot);
+}
+
+static void _shim_call_remove(uint16_t slot) {
+    uint32_t pos = call_pos[slot];
+    call_pos[slot] = SHIM_CALL_NONE;
+    call_free[shim.call_free_count++] = slot;
+    if (--shim.call_count == pos)
+        return;
+    uint16_t moved = call_heap[shim.call_count];
+    _shim_call_set(pos, moved);
+    _shim_call_up(pos);
+    _shim_call_down(call_pos[moved]);
+}
+
+uint32_t shim_post(int64_t at_us, const char *context, shim_call_t fn, const void *payload, size_t len) {
+    if (shim.call_free_count == 0 || len > SHIM_PAYLOAD_MAX) {
+        fprintf(stderr, "shim: deferred call dropped, %u pending\n", shim.call_count);
+        return 0;
+    }
+    if (++shim.call_gen >= (1u << (32 - SHIM_CALL_BITS)))
+        shim.call_gen = 1;
+    uint16_t slot = call_free[--shim.call_free_count];
+    shim_call_slot_t *call = &calls[slot];
+    call->at = (at_us > shim.now) ? at_us : shim.now;
+    call->seq = ++shim.seq;
+    call->id = (shim.call_gen << SHIM_CALL_BITS) | slot;
+    call->context = context;
+    call->fn = fn;
+    call->len = len;
+    if (len)
+        memcpy(call->payload, payload, len);
+    _shim_call_set(shim.call_count++, slot);
+    _shim_call_up(call_pos[slot]);
+    return call->id;
+}
+
+bool shim_cancel(uint32_t id) {
+    uint16_t slot = id & (SHIM_MAX_CALLS - 1);
+    if (id == 0 || call_pos[slot] == SHIM_CALL_NONE || calls[slot].id != id)
+        return false;
+    _shim_call_remove(slot);
+    return true;
+}
+
+static bool _shim_fire_one(void) {
+    if (shim.call_count == 0 || calls[call_heap[0]].at > shim.now)
+        return false;
+    uint16_t slot = call_heap[0];
+    shim_call_slot_t *call = &calls[slot];
+    _Alignas(16) uint8_t payload[SHIM_PAYLOAD_MAX];
+    size_t len = call->len;
+    shim_call_t fn = call->fn;
+    const char *context = call->context;
+    memcpy(payload, call->payload, len);
+    _shim_call_remove(slot);
+    shim.context = context;
+    fn(payload, len);
+    shim.context = NULL;
+    return true;
+}
+
+/* Clock */
+
+static void _shim_advance(int64_t to) {
+    if (to <= shim.now)
+        return;
+    if (shim.realtime) {
+        int64_t wall_us = to - shim.virt_start;
+        struct timespec at = shim.wall_start;
+        at.tv_sec += wall_us / 1000000;
+        at.tv_nsec += (wall_us % 1000000) * 1000;
+        if (at.tv_nsec >= 1000000000) {
+            at.tv_sec++;
+            at.tv_nsec -= 1000000000;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL) != 0)
+            ;
+    }
+    shim.now = to;
+}
+
+static int64_t _shim_next_event(void) {
+    int64_t next = (shim.call_count) ? calls[call_heap[0]].at : INT64_MAX;
+    for (int i = 0; i < SHIM_MAX_TASKS; i++) {
+        if (tasks[i].state == SHIM_TASK_BLOCKED && tasks[i].wake_us < next)
+            next = tasks[i].wake_us;
+    }
+    return next;
+}
+
+static void _shim_expire(void) {
+    for (int i = 0; i < SHIM_MAX_TASKS; i++) {
+        TaskHandle_t t = &tasks[i];
+        if (t->state != SHIM_TASK_BLOCKED || t->wake_us > shim.now)
+            continue;
+        t->state = SHIM_TASK_READY;
+        t->wait_obj = NULL;
+        t->timed_out = true;
+        t->seq = ++shim.seq;
+    }
+}
+
+int64_t shim_now_us(void) {
+    return shim.now;
+}
+
+void shim_set_realtime(bool realtime) {
+    shim.realtime = realtime;
+    clock_gettime(CLOCK_MONOTONIC, &shim.wall_start);
+    shim.virt_start = shim.now;
+}
+
+bool shim_run_until(bool (*cond)(void *arg), void *arg, uint32_t max_ms) {
+    if (shim.current) {
+        fprintf(stderr, "shim: shim_run_until called from task %s\n", shim.current->name);
+        abort();
+    }
+    int64_t deadline = shim.now + (int64_t)max_ms * 1000;
+    while (1) {
+        if (cond && cond(arg))
+            return true;
+        TaskHandle_t t = _shim_pick();
+        if (t) {
+            _shim_switch(t);
+            continue;
+        }
+        if (_shim_fire_one())
+            continue;
+        int64_t next = _shim_next_event();
+        if (next > deadline) {
+            _shim_advance(deadline);
+            return cond && cond(arg);
+        }
+        _shim_advance(next);
+        _shim_expire();
+    }
+}
+
+void shim_run_for(uint32_t ms) {
+    shim_run_until(NULL, NULL, ms);
+}
+
+void shim_busy_us(uint32_t us) {
+    if (shim.current)
+        _shim_block(NULL, shim.now + us);
+}
+
+const char *shim_context(void) {
+    if (shim.current)
+        return shim.current->name;
+    return (shim.context) ? shim.context : "host";
+}
+
+static void _shim_app_main(void *arg) {
+    shim_app();
+    vTaskDelete(NULL);
+}
+
+void shim_start_app(void (*app)(void)) {
+    static StaticTask_t tcb;
+    static StackType_t stack[CONFIG_ESP_MAIN_TASK_STACK_SIZE];
+    shim_app = app;
+    xTaskCreateStatic(&_shim_app_main, "main", sizeof(stack), NULL, 1, stack, &tcb);
+}
+
+void shim_rtos_reset(void) {
+    for (int i = 0; i < SHIM_MAX_TASKS; i++) {
+        if (tasks[i].state != SHIM_TASK_FREE) {
+            fprintf(stderr, "shim: reset with task %s alive, use shim_reboot_run\n", tasks[i].name);
+            abort();
+        }
+    }
+    memset(queues, 0, sizeof(queues));
+    memset(groups, 0, sizeof(groups));
+    shim.current = NULL;
+    shim.context = NULL;
+    shim.now = 0;
+    shim.seq = 0;
+    shim.critical = 0;
+    shim.yield_pending = false;
+    shim.realtime = false;
+    shim.call_gen = 0;
+    shim.call_count = 0;
+    shim.call_free_count = 0;
+    for (int i = SHIM_MAX_CALLS - 1; i >= 0; i--) {
+        call_pos[i] = SHIM_CALL_NONE;
+        call_free[shim.call_free_count++] = i;
+    }
+}
+
+void shim_init(void) {
+    shim_rtos_reset();
+    shim_heap_reset();
+    shim_esp_reset();
+    shim_i2c_reset();
+    shim_ble_reset();
+}
+
+int shim_reboot_run(int (*boot)(void *arg), void *arg) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("shim: fork");
+        return -1;
+    }
+    if (pid == 0) {
+        shim_init();
+        int ret = boot(arg);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(ret);
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+        ;
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    return 128 + WTERMSIG(status);
+}
+
+/* Tasks */
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, const uint32_t usStackDepth,
+                                   void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pvCreatedTask, const BaseType_t xCoreID) {
+    void *heap = malloc(sizeof(StaticTask_t) + usStackDepth);
+    if (heap == NULL)
+        return pdFAIL;
+    TaskHandle_t t = _shim_task_new(pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, heap);
+    if (t == NULL) {
+        free(heap);
+        return pdFAIL;
+    }
+    if (pvCreatedTask)
+        *pvCreatedTask = t;
+    return pdPASS;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, const uint32_t ulStackDepth,
+                                           void *pvParameters, UBaseType_t uxPriority, StackType_t *pxStackBuffer,
+                                           StaticTask_t *pxTaskBuffer, const BaseType_t xCoreID) {
+    if (pxStackBuffer == NULL || pxTaskBuffer == NULL)
+        return NULL;
+    return _shim_task_new(pvTaskCode, pcName, ulStackDepth, pvParameters, uxPriority, NULL);
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete) {
+    TaskHandle_t t = (xTaskToDelete) ? xTaskToDelete : shim.current;
+    if (t == NULL)
+        return;
+    free(t->heap);
+    t->heap = NULL;
+    if (t != shim.current) {
+        t->state = SHIM_TASK_DELETED;
+        return;
+    }
+    t->state = SHIM_TASK_FREE;
+    pthread_mutex_lock(&shim.lock);
+    shim.current = NULL;
+    pthread_cond_signal(&shim.cond);
+    pthread_mutex_unlock(&shim.lock);
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay) {
+    if (xTicksToDelay == 0) {
+        _shim_yield();
+        return;
+    }
+    _shim_block(NULL, _shim_deadline(xTicksToDelay));
+}
+
+void vTaskDelayUntil(TickType_t *pxPreviousWakeTime, const TickType_t xTimeIncrement) {
+    *pxPreviousWakeTime += xTimeIncrement;
+    int64_t wake_us = (int64_t)*pxPreviousWakeTime * SHIM_TICK_US;
+    if (wake_us > shim.now)
+        _shim_block(NULL, wake_us);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(shim.now / SHIM_TICK_US);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return shim.current;
+}
+
+char *pcTaskGetTaskName(TaskHandle_t xTaskToQuery) {
+    TaskHandle_t t = (xTaskToQuery) ? xTaskToQuery : shim.current;
+    return (t) ? t->name : NULL;
+}
+
+// Stack use is not measured on the host, the whole stack is reported free
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask) {
+    TaskHandle_t t = (xTask) ? xTask : shim.current;
+    return (t) ? t->stack : 0;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t xTask) {
+    TaskHandle_t t = (xTask) ? xTask : shim.current;
+    return (t) ? t->prio : 0;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait) {
+    TaskHandle_t self = shim.current;
+    if (self == NULL)
+        return 0;
+    int64_t wake_us = _shim_deadline(xTicksToWait);
+    while (self->notify == 0) {
+        if (xTicksToWait == 0 || !_shim_block(&self->notify, wake_us))
+            break;
+    }
+    uint32_t value = self->notify;
+    if (value)
+        self->notify = (xClearCountOnExit) ? 0 : value - 1;
+    self->notified = false;
+    return value;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction) {
+    TaskHandle_t t = xTaskToNotify;
+    switch (eAction) {
+    case eSetBits:
+        t->notify |= ulValue;
+        break;
+    case eIncrement:
+        t->notify++;
+        break;
+    case eSetValueWithOverwrite:
+        t->notify = ulValue;
+        break;
+    case eSetValueWithoutOverwrite:
+        if (t->notified)
+            return pdFAIL;
+        t->notify = ulValue;
+        break;
+    case eNoAction:
+        break;
+    }
+    t->notified = true;
+    _shim_wake(&t->notify, false);
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit, uint32_t *pulNotificationValue, TickType_t xTicksToWait) {
+    TaskHandle_t self = shim.current;
+    if (self == NULL)
+        return pdFALSE;
+    int64_t wake_us = _shim_deadline(xTicksToWait);
+    if (!self->notified)
+        self->notify &= ~ulBitsToClearOnEntry;
+    while (!self->notified) {
+        if (xTicksToWait == 0 || !_shim_block(&self->notify, wake_us))
+            break;
+    }
+    if (pulNotificationValue)
+        *pulNotificationValue = self->notify;
+    if (!self->notified)
+        return pdFALSE;
+    self->notify &= ~ulBitsToClearOnExit;
+    self->notified = false;
+    return pdTRUE;
+}
+
+/* Critical sections, a single runner only has to hold off preemption */
+
+void vPortCPUInitializeMutex(portMUX_TYPE *mux) {
+    mux->owner = portMUX_FREE_VAL;
+    mux->count = 0;
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux) {
+    mux->count++;
+    shim.critical++;
+}
+
+void vPortExitCritical(portMUX_TYPE *mux) {
+    if (mux->count == 0 || shim.critical == 0) {
+        fprintf(stderr, "shim: unbalanced portEXIT_CRITICAL in %s\n", shim_context());
+        abort();
+    }
+    mux->count--;
+    if (--shim.critical == 0 && shim.yield_pending) {
+        shim.yield_pending = false;
+        _shim_yield();
+    }
+}
+
+/* Queues, semaphores and mutexes */
+
+static QueueHandle_t _shim_queue_new(UBaseType_t length, UBaseType_t item_size, uint8_t type, uint8_t *storage, void *heap) {
+    for (int i = 0; i < SHIM_MAX_QUEUES; i++) {
+        QueueHandle_t q = &queues[i];
+        if (q->used)
+            continue;
+        memset(q, 0, sizeof(*q));
+        q->used = true;
+        q->type = type;
+        q->length = length;
+        q->item_size = item_size;
+        q->storage = storage;
+        q->heap = heap;
+        return q;
+    }
+    fprintf(stderr, "shim: out of queues\n");
+    return NULL;
+}
+
+// Senders wait on the byte after the queue, receivers on the queue itself
+static const void *_shim_senders(QueueHandle_t q) {
+    return (const uint8_t *)q + 1;
+}
+
+static bool _shim_queue_put(QueueHandle_t q, const void *item, BaseType_t position) {
+    if (position == queueOVERWRITE && q->count == q->length) {
+        if (q->item_size)
+            memcpy(q->storage + q->head * q->item_size, item, q->item_size);
+        return true;
+    }
+    if (q->count >= q->length)
+        return false;
+    if (q->item_size) {
+        UBaseType_t index;
+        if (position == queueSEND_TO_FRONT) {
+            q->head = (q->head + q->length - 1) % q->length;
+            index = q->head;
+        } else {
+            index = (q->head + q->count) % q->length;
+        }
+        memcpy(q->storage + index * q->item_size, item, q->item_size);
+    }
+    q->count++;
+    return true;
+}
+
+static void _shim_queue_get(QueueHandle_t q, void *buffer, bool peek) {
+    if (q->item_size && buffer)
+        memcpy(buffer, q->storage + q->head * q->item_size, q->item_size);
+    if (peek)
+        return;
+    q->head = (q->length) ? (q->head + 1) % q->length : 0;
+    q->count--;
+}
+
+QueueHandle_t xQueueGenericCreate(const UBaseType_t uxQueueLength, const UBaseType_t uxItemSize, const uint8_t ucQueueType) {
+    uint8_t *heap = malloc(sizeof(StaticQueue_t) + uxQueueLength * uxItemSize);
+    if (heap == NULL)
+        return NULL;
+    QueueHandle_t q = _shim_queue_new(uxQueueLength, uxItemSize, ucQueueType, heap + sizeof(StaticQueue_t), heap);
+    if (q == NULL)
+        free(heap);
+    return q;
+}
+
+QueueHandle_t xQueueGenericCreateStatic(const UBaseType_t uxQueueLength, const UBaseType_t uxItemSize, uint8_t *pucQueueStorage,
+                                        StaticQueue_t *pxStaticQueue, const uint8_t ucQueueType) {
+    if (pxStaticQueue == NULL || (uxItemSize && pucQueueStorage == NULL))
+        return NULL;
+    return _shim_queue_new(uxQueueLength, uxItemSize, ucQueueType, pucQueueStorage, NULL);
+}
+
+QueueHandle_t xQueueCreateMutex(const uint8_t ucQueueType) {
+    QueueHandle_t q = xQueueGenericCreate(1, 0, ucQueueType);
+    if (q)
+        q->count = 1;
+    return q;
+}
+
+QueueHandle_t xQueueCreateMutexStatic(const uint8_t ucQueueType, StaticQueue_t *pxStaticQueue) {
+    QueueHandle_t q = xQueueGenericCreateStatic(1, 0, NULL, pxStaticQueue, ucQueueType);
+    if (q)
+        q->count = 1;
+    return q;
+}
+
+QueueHandle_t xQueueCreateCountingSemaphore(const UBaseType_t uxMaxCount, const UBaseType_t uxInitialCount) {
+    QueueHandle_t q = xQueueGenericCreate(uxMaxCount, 0, queueQUEUE_TYPE_COUNTING_SEMAPHORE);
+    if (q)
+        q->count = uxInitialCount;
+    return q;
+}
+
+BaseType_t xQueueGenericSend(QueueHandle_t xQueue, const void *const pvItemToQueue, TickType_t xTicksToWait, const BaseType_t xCopyPosition) {
+    int64_t wake_us = _shim_deadline(xTicksToWait);
+    while (!_shim_queue_put(xQueue, pvItemToQueue, xCopyPosition)) {
+        if (xTicksToWait == 0 || !_shim_block(_shim_senders(xQueue), wake_us))
+            return errQUEUE_FULL;
+    }
+    _shim_wake(xQueue, false);
+    return pdPASS;
+}
+
+BaseType_t xQueueGenericSendFromISR(QueueHandle_t xQueue, const void *const pvItemToQueue, BaseType_t *const pxHigherPriorityTaskWoken,
+                                    const BaseType_t xCopyPosition) {
+    if (!_shim_queue_put(xQueue, pvItemToQueue, xCopyPosition))
+        return errQUEUE_FULL;
+    _shim_wake(xQueue, false);
+    if (pxHigherPriorityTaskWoken)
+        *pxHigherPriorityTaskWoken = pdFALSE;
+    return pdPASS;
+}
+
+static BaseType_t _shim_queue_receive(QueueHandle_t q, void *buffer, TickType_t ticks, bool peek) {
+    int64_t wake_us = _shim_deadline(ticks);
+    while (q->count == 0) {
+        if (ticks == 0 || !_shim_block(q, wake_us))
+            return pdFALSE;
+    }
+    _shim_queue_get(q, buffer, peek);
+    if (!peek)
+        _shim_wake(_shim_senders(q), false);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *const pvBuffer, TickType_t xTicksToWait) {
+    return _shim_queue_receive(xQueue, pvBuffer, xTicksToWait, false);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t xQueue, void *const pvBuffer, TickType_t xTicksToWait) {
+    return _shim_queue_receive(xQueue, pvBuffer, xTicksToWait, true);
+}
+
+BaseType_t xQueueSemaphoreTake(QueueHandle_t xQueue, TickType_t xTicksToWait) {
+    return _shim_queue_receive(xQueue, NULL, xTicksToWait, false);
+}
+
+BaseType_t xQueueGenericReset(QueueHandle_t xQueue, BaseType_t xNewQueue) {
+    xQueue->count = 0;
+    xQueue->head = 0;
+    _shim_wake(_shim_senders(xQueue), true);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t xQueue) {
+    return xQueue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(const QueueHandle_t xQueue) {
+    return xQueue->length - xQueue->count;
+}
+
+void vQueueDelete(QueueHandle_t xQueue) {
+    free(xQueue->heap);
+    xQueue->used = false;
+}
+
+/* Event groups */
+
+static EventGroupHandle_t _shim_group_new(void *heap) {
+    for (int i = 0; i < SHIM_MAX_GROUPS; i++) {
+        if (groups[i].used)
+            continue;
+        groups[i].used = true;
+        groups[i].bits = 0;
+        groups[i].heap = heap;
+        return &groups[i];
+    }
+    fprintf(stderr, "shim: out of event groups\n");
+    return NULL;
+}
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    void *heap = malloc(sizeof(StaticEventGroup_t));
+    if (heap == NULL)
+        return NULL;
+    EventGroupHandle_t group = _shim_group_new(heap);
+    if (group == NULL)
+        free(heap);
+    return group;
+}
+
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *pxEventGroupBuffer) {
+    return (pxEventGroupBuffer) ? _shim_group_new(NULL) : NULL;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToWaitFor, const BaseType_t xClearOnExit,
+                                const BaseType_t xWaitForAllBits, TickType_t xTicksToWait) {
+    int64_t wake_us = _shim_deadline(xTicksToWait);
+    while (1) {
+        EventBits_t bits = xEventGroup->bits;
+        bool met = (xWaitForAllBits) ? (bits & uxBitsToWaitFor) == uxBitsToWaitFor : (bits & uxBitsToWaitFor) != 0;
+        if (met) {
+            if (xClearOnExit)
+                xEventGroup->bits &= ~uxBitsToWaitFor;
+            return bits;
+        }
+        if (xTicksToWait == 0 || !_shim_block(xEventGroup, wake_us))
+            return xEventGroup->bits;
+    }
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToSet) {
+    xEventGroup->bits |= uxBitsToSet;
+    EventBits_t bits = xEventGroup->bits;
+    _shim_wake(xEventGroup, true);
+    return bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToClear) {
+    EventBits_t bits = xEventGroup->bits;
+    xEventGroup->bits &= ~uxBitsToClear;
+    return bits;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t xEventGroup) {
+    return xEventGroup->bits;
+}
+
+void vEventGroupDelete(EventGroupHandle_t xEventGroup) {
+    _shim_wake(xEventGroup, true);
+    free(xEventGroup->heap);
+    xEventGroup->used = false;
+}
+
+/* esp_timer, callbacks run as deferred calls of the "esp_timer" context */
+
+int64_t esp_timer_get_time(void) {
+    return shim.now;
+}
+
+static void _esp_timer_fire(void *payload, size_t len) {
+    esp_timer_handle_t timer = *(esp_timer_handle_t *)payload;
+    timer->call = 0;
+    if (timer->period)
+        timer->call = shim_post(shim.now + timer->period, "esp_timer", _esp_timer_fire, &timer, sizeof(timer));
+    timer->callback(timer->arg);
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out) {
+    if (args == NULL || args->callback == NULL || out == NULL)
+        return ESP_ERR_INVALID_ARG;
+    esp_timer_handle_t timer = calloc(1, sizeof(struct esp_timer));
+    if (timer == NULL)
+        return ESP_ERR_NO_MEM;
+    timer->callback = args->callback;
+    timer->arg = args->arg;
+    timer->name = args->name;
+    *out = timer;
+    return ESP_OK;
+}
+
+static esp_err_t _esp_timer_start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us) {
+    if (timer == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (timer->call)
+        return ESP_ERR_INVALID_STATE;
+    timer->period = period_us;
+    timer->call = shim_post(shim.now + timeout_us, "esp_timer", _esp_timer_fire, &timer, sizeof(timer));
+    return (timer->call) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return _esp_timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    return _esp_timer_start(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (timer == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (!shim_cancel(timer->call))
+        return ESP_ERR_INVALID_STATE;
+    timer->call = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    if (timer == NULL)
+        return ESP_ERR_INVALID_ARG;
+    if (timer->call)
+        return ESP_ERR_INVALID_STATE;
+    free(timer);
+    return ESP_OK;
+}
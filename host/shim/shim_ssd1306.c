@@ -0,0 +1,209 @@
+// SSD1306 model, the command set of the datasheet chapters 9 and 10
+
+#include <string.h>
+#include "shim.h"
+#include "shim_ssd1306.h"
+
+#define SHIM_SSD1306_CO             0x80        /*!< control byte: one byte follows, then another control byte */
+#define SHIM_SSD1306_DC             0x40        /*!< control byte: data, otherwise commands */
+
+// Parameters following a command byte
+static uint8_t _shim_ssd1306_params(uint8_t cmd) {
+    switch (cmd) {
+    case 0x26: case 0x27:
+        return 6;
+    case 0x29: case 0x2A:
+        return 5;
+    case 0x21: case 0x22: case 0xA3:
+        return 2;
+    case 0x20: case 0x81: case 0x8D: case 0xA8: case 0xD3: case 0xD5: case 0xD9: case 0xDA: case 0xDB:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+void shim_ssd1306_init(shim_ssd1306_t *oled) {
+    memset(oled, 0, sizeof(*oled));
+    oled->addressing = SHIM_SSD1306_PAGE;
+    oled->col_end = DISPLAY_COLUMNS - 1;
+    oled->page_end = DISPLAY_PAGES - 1;
+    oled->contrast = 0x7F;
+    oled->mux = 63;
+    oled->scroll.area_rows = 64;
+}
+
+void shim_ssd1306_attach(shim_ssd1306_t *oled, int port, uint8_t addr) {
+    shim_i2c_attach(port, addr, shim_ssd1306_write, oled);
+}
+
+static void _shim_ssd1306_command(shim_ssd1306_t *oled) {
+    const uint8_t *c = oled->cmd;
+    oled->stats.commands++;
+    oled->wrapped = false;
+    if (c[0] <= 0x0F) {
+        oled->col = (oled->col & 0xF0) | c[0];
+    } else if (c[0] <= 0x1F) {
+        oled->col = ((c[0] & 0x07) << 4) | (oled->col & 0x0F);
+    } else if (c[0] >= 0x40 && c[0] <= 0x7F) {
+        oled->start_line = c[0] & 0x3F;
+    } else if (c[0] >= 0xB0 && c[0] <= 0xB7) {
+        oled->page = c[0] & 0x07;
+    } else {
+        switch (c[0]) {
+        case 0x20:
+            if ((c[1] & 0x03) == 0x03)
+                oled->stats.errors++;
+            else
+                oled->addressing = c[1] & 0x03;
+            break;
+        case 0x21:
+            oled->col_start = oled->col = c[1] & 0x7F;
+            oled->col_end = c[2] & 0x7F;
+            break;
+        case 0x22:
+            oled->page_start = oled->page = c[1] & 0x07;
+            oled->page_end = c[2] & 0x07;
+            break;
+        case 0x26: case 0x27: case 0x29: case 0x2A:
+            // Setup is only taken while scrolling is off
+            if (oled->scroll.active) {
+                oled->stats.errors++;
+                break;
+            }
+            oled->scroll.setup = c[0];
+            oled->scroll.start_page = c[2] & 0x07;
+            oled->scroll.interval = c[3] & 0x07;
+            oled->scroll.end_page = c[4] & 0x07;
+            oled->scroll.vertical_offset = (c[0] >= 0x29) ? c[5] & 0x3F : 0;
+            break;
+        case 0x2E:
+            oled->scroll.active = false;
+            break;
+        case 0x2F:
+            if (oled->scroll.setup == 0 || oled->scroll.end_page < oled->scroll.start_page)
+                oled->stats.errors++;
+            else
+                oled->scroll.active = true;
+            break;
+        case 0xA3:
+            oled->scroll.area_top = c[1] & 0x3F;
+            oled->scroll.area_rows = c[2] & 0x7F;
+            break;
+        case 0x81: oled->contrast = c[1]; break;
+        case 0x8D: oled->charge_pump = (c[1] & 0x04) != 0; break;
+        case 0xA0: case 0xA1: oled->segment_remap = c[0] & 1; break;
+        case 0xA4: case 0xA5: oled->entire_on = c[0] & 1; break;
+        case 0xA6: case 0xA7: oled->inverse = c[0] & 1; break;
+        case 0xA8:
+            if ((c[1] & 0x3F) < 15)
+                oled->stats.errors++;
+            else
+                oled->mux = c[1] & 0x3F;
+            break;
+        case 0xAE: case 0xAF: oled->display_on = c[0] & 1; break;
+        case 0xC0: case 0xC8: oled->com_remap = (c[0] & 0x08) != 0; break;
+        case 0xD3: oled->offset = c[1] & 0x3F; break;
+        case 0xD5: case 0xD9: case 0xDA: case 0xDB: case 0xE3:
+            break;
+        default:
+            oled->stats.errors++;
+            break;
+        }
+    }
+}
+
+static void _shim_ssd1306_command_byte(shim_ssd1306_t *oled, uint8_t byte) {
+    oled->cmd[oled->cmd_len++] = byte;
+    if (oled->cmd_len <= _shim_ssd1306_params(oled->cmd[0]))
+        return;
+    _shim_ssd1306_command(oled);
+    oled->cmd_len = 0;
+}
+
+// Write at the pointers and move them on the way the addressing mode does
+static void _shim_ssd1306_data(shim_ssd1306_t *oled, uint8_t byte) {
+    oled->stats.data_bytes++;
+    if (oled->scroll.active)
+        oled->stats.scroll_writes++;
+    if (oled->wrapped)
+        oled->stats.page_wraps++;
+    oled->wrapped = false;
+    oled->gddram[oled->page][oled->col] = byte;
+    switch (oled->addressing) {
+    case SHIM_SSD1306_PAGE:
+        if (oled->col == DISPLAY_COLUMNS - 1) {
+            oled->col = 0;
+            oled->wrapped = true;
+        } else {
+            oled->col++;
+        }
+        break;
+    case SHIM_SSD1306_HORIZONTAL:
+        if (oled->col < oled->col_end) {
+            oled->col++;
+            break;
+        }
+        oled->col = oled->col_start;
+        oled->page = (oled->page < oled->page_end) ? oled->page + 1 : oled->page_start;
+        break;
+    case SHIM_SSD1306_VERTICAL:
+        if (oled->page < oled->page_end) {
+            oled->page++;
+            break;
+        }
+        oled->page = oled->page_start;
+        oled->col = (oled->col < oled->col_end) ? oled->col + 1 : oled->col_start;
+        break;
+    }
+}
+
+void shim_ssd1306_write(void *ctx, const uint8_t *data, size_t len) {
+    shim_ssd1306_t *oled = ctx;
+    // Bytes after the start condition, the address included
+    uint32_t bytes = len + 1;
+    oled->stats.transactions++;
+    oled->stats.bytes += bytes;
+    oled->stats.bus_us += ((uint64_t)bytes * I2C_BITS_PER_BYTE + I2C_BITS_START_STOP) * 1000000 / I2C_MASTER_FREQ_HZ;
+
+    size_t i = 0;
+    while (i < len) {
+        uint8_t control = data[i++];
+        if (control & ~(SHIM_SSD1306_CO | SHIM_SSD1306_DC))
+            oled->stats.errors++;
+        bool is_data = (control & SHIM_SSD1306_DC) != 0;
+        // Co clear: every byte up to the stop condition is of this kind
+        size_t end = (control & SHIM_SSD1306_CO) ? i + 1 : len;
+        if (end > len) {
+            oled->stats.errors++;
+            break;
+        }
+        for (; i < end; i++) {
+            if (is_data)
+                _shim_ssd1306_data(oled, data[i]);
+            else
+                _shim_ssd1306_command_byte(oled, data[i]);
+        }
+    }
+}
+
+bool shim_ssd1306_pixel(const shim_ssd1306_t *oled, int x, int y) {
+    if (x < 0 || x >= DISPLAY_COLUMNS || y < 0 || y >= DISPLAY_PAGES * 8)
+        return false;
+    return (oled->gddram[y / 8][x] >> (y % 8)) & 1;
+}
+
+bool shim_ssd1306_dump_pbm(const shim_ssd1306_t *oled, FILE *file) {
+    uint8_t row[DISPLAY_COLUMNS / 8];
+    if (fprintf(file, "P4\n%d %d\n", DISPLAY_COLUMNS, DISPLAY_PAGES * 8) < 0)
+        return false;
+    for (int y = 0; y < DISPLAY_PAGES * 8; y++) {
+        memset(row, 0, sizeof(row));
+        for (int x = 0; x < DISPLAY_COLUMNS; x++)
+            if (shim_ssd1306_pixel(oled, x, y))
+                row[x / 8] |= 0x80 >> (x % 8);
+        if (fwrite(row, sizeof(row), 1, file) != 1)
+            return false;
+    }
+    return true;
+}
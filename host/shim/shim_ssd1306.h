@@ -0,0 +1,78 @@
+#pragma once
+
+// SSD1306 on the I2C bus, fed the byte stream of every write transaction.
+//
+// Control bytes, page, horizontal and vertical addressing, the hardware
+// configuration and the scroll commands are decoded like the controller
+// does; data lands in a 128x64 GDDRAM image. Bus cost is estimated per
+// transaction at I2C_MASTER_FREQ_HZ, the same way the driver estimates its own.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "ssd1306.h"
+
+#define SHIM_SSD1306_CMD_MAX        7           /*!< longest command, 0x26 with its six parameters */
+
+typedef enum {
+    SHIM_SSD1306_HORIZONTAL,
+    SHIM_SSD1306_VERTICAL,
+    SHIM_SSD1306_PAGE,                          /*!< power-on default */
+} shim_ssd1306_addressing_t;
+
+typedef struct {
+    uint32_t    transactions;
+    uint32_t    bytes;                          /*!< address byte included, like oled_ssd1306_stats_t */
+    uint64_t    bus_us;
+    uint32_t    commands;
+    uint32_t    data_bytes;
+    uint32_t    page_wraps;                     /*!< page mode data written past column 127, it lands in column 0 */
+    uint32_t    scroll_writes;                  /*!< GDDRAM written while scrolling, undefined on the panel */
+    uint32_t    errors;                         /*!< unknown commands, reserved control bits, control bytes without payload */
+} shim_ssd1306_stats_t;
+
+typedef struct {
+    uint8_t                     gddram[DISPLAY_PAGES][DISPLAY_COLUMNS];
+    shim_ssd1306_addressing_t   addressing;
+    uint8_t                     page;
+    uint8_t                     col;
+    bool                        wrapped;        /*!< page mode pointer went past column 127 */
+    uint8_t                     col_start;      /*!< 0x21 and 0x22 windows, horizontal and vertical modes */
+    uint8_t                     col_end;
+    uint8_t                     page_start;
+    uint8_t                     page_end;
+    uint8_t                     start_line;
+    uint8_t                     contrast;
+    uint8_t                     mux;
+    uint8_t                     offset;
+    bool                        display_on;
+    bool                        inverse;
+    bool                        entire_on;
+    bool                        charge_pump;
+    bool                        segment_remap;
+    bool                        com_remap;
+    struct {
+        bool        active;
+        uint8_t     setup;                      /*!< 0x26, 0x27, 0x29 or 0x2A, 0 before any setup */
+        uint8_t     start_page;
+        uint8_t     end_page;
+        uint8_t     interval;
+        uint8_t     vertical_offset;
+        uint8_t     area_top;                   /*!< 0xA3 */
+        uint8_t     area_rows;
+    } scroll;
+    // Decoder, a command and its parameters may spread over several control bytes
+    uint8_t                     cmd[SHIM_SSD1306_CMD_MAX];
+    uint8_t                     cmd_len;
+    shim_ssd1306_stats_t        stats;
+} shim_ssd1306_t;
+
+// Power-on reset, GDDRAM cleared (it is random on a real panel)
+void shim_ssd1306_init(shim_ssd1306_t *oled);
+void shim_ssd1306_attach(shim_ssd1306_t *oled, int port, uint8_t addr);
+// A shim_i2c_write_t, ctx is the shim_ssd1306_t
+void shim_ssd1306_write(void *ctx, const uint8_t *data, size_t len);
+
+bool shim_ssd1306_pixel(const shim_ssd1306_t *oled, int x, int y);
+// P4 bitmap of GDDRAM, a lit pixel is black
+bool shim_ssd1306_dump_pbm(const shim_ssd1306_t *oled, FILE *file);
@@ -0,0 +1,188 @@
+// Trace records back into esp_ble_gap_cb_param_t and esp_ble_gattc_cb_param_t
+
+#include <string.h>
+#include "shim.h"
+#include "shim_ble.h"
+#include "shim_trace.h"
+#include "mi_trace.h"
+
+#define SHIM_TRACE_RECORD_MAX       (sizeof(mi_trace_hdr_t) + 255)
+
+static int _shim_trace_nibble(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Bytes decoded, up to the first character that is not a hex digit pair
+static size_t _shim_trace_unhex(const char *hex, uint8_t *out, size_t max) {
+    size_t n = 0;
+    while (n < max) {
+        int hi = _shim_trace_nibble(hex[2 * n]);
+        int lo = (hi < 0) ? -1 : _shim_trace_nibble(hex[2 * n + 1]);
+        if (lo < 0)
+            break;
+        out[n++] = (hi << 4) | lo;
+    }
+    return n;
+}
+
+static bool _shim_trace_gap(int64_t at, uint8_t event, const uint8_t *payload, uint8_t len) {
+    esp_ble_gap_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    if (event == ESP_GAP_BLE_SCAN_RESULT_EVT) {
+        mi_trace_scan_t scan;
+        if (len < sizeof(scan))
+            return false;
+        memcpy(&scan, payload, sizeof(scan));
+        if (sizeof(scan) + scan.adv_len + scan.rsp_len > len)
+            return false;
+        param.scan_rst.search_evt = scan.search_evt;
+        memcpy(param.scan_rst.bda, scan.bda, sizeof(scan.bda));
+        param.scan_rst.ble_addr_type = scan.addr_type;
+        param.scan_rst.rssi = scan.rssi;
+        param.scan_rst.adv_data_len = scan.adv_len;
+        param.scan_rst.scan_rsp_len = scan.rsp_len;
+        memcpy(param.scan_rst.ble_adv, payload + sizeof(scan), scan.adv_len + scan.rsp_len);
+    }
+    shim_ble_inject_gap(at, event, &param);
+    return true;
+}
+
+// The inverse of mi_trace_gattc(), fields it does not keep stay zero
+static bool _shim_trace_gattc(int64_t at, uint8_t event, const uint8_t *payload, uint8_t len) {
+    esp_ble_gattc_cb_param_t param;
+    mi_trace_gattc_t rec;
+    if (len < sizeof(rec))
+        return false;
+    memcpy(&rec, payload, sizeof(rec));
+    const uint8_t *value = payload + sizeof(rec);
+    uint16_t value_len = len - sizeof(rec);
+    memset(&param, 0, sizeof(param));
+    switch (event) {
+    case ESP_GATTC_REG_EVT:
+        param.reg.status = rec.status;
+        param.reg.app_id = rec.handle;
+        break;
+    case ESP_GATTC_OPEN_EVT:
+        param.open.status = rec.status;
+        param.open.conn_id = rec.conn_id;
+        memcpy(param.open.remote_bda, rec.bda, sizeof(rec.bda));
+        break;
+    case ESP_GATTC_CONNECT_EVT:
+        param.connect.conn_id = rec.conn_id;
+        memcpy(param.connect.remote_bda, rec.bda, sizeof(rec.bda));
+        break;
+    case ESP_GATTC_DISCONNECT_EVT:
+        param.disconnect.reason = rec.status;
+        param.disconnect.conn_id = rec.conn_id;
+        memcpy(param.disconnect.remote_bda, rec.bda, sizeof(rec.bda));
+        break;
+    case ESP_GATTC_CLOSE_EVT:
+        param.close.status = rec.status;
+        param.close.conn_id = rec.conn_id;
+        memcpy(param.close.remote_bda, rec.bda, sizeof(rec.bda));
+        break;
+    case ESP_GATTC_CFG_MTU_EVT:
+        param.cfg_mtu.status = rec.status;
+        param.cfg_mtu.conn_id = rec.conn_id;
+        param.cfg_mtu.mtu = rec.handle;
+        break;
+    case ESP_GATTC_SEARCH_CMPL_EVT:
+        param.search_cmpl.status = rec.status;
+        param.search_cmpl.conn_id = rec.conn_id;
+        break;
+    case ESP_GATTC_DIS_SRVC_CMPL_EVT:
+        param.dis_srvc_cmpl.status = rec.status;
+        param.dis_srvc_cmpl.conn_id = rec.conn_id;
+        break;
+    case ESP_GATTC_READ_CHAR_EVT:
+    case ESP_GATTC_READ_DESCR_EVT:
+        param.read.status = rec.status;
+        param.read.conn_id = rec.conn_id;
+        param.read.handle = rec.handle;
+        param.read.value = (uint8_t *)value;
+        param.read.value_len = value_len;
+        break;
+    case ESP_GATTC_WRITE_CHAR_EVT:
+    case ESP_GATTC_WRITE_DESCR_EVT:
+        param.write.status = rec.status;
+        param.write.conn_id = rec.conn_id;
+        param.write.handle = rec.handle;
+        break;
+    case ESP_GATTC_REG_FOR_NOTIFY_EVT:
+        param.reg_for_notify.status = rec.status;
+        param.reg_for_notify.handle = rec.handle;
+        break;
+    case ESP_GATTC_NOTIFY_EVT:
+        param.notify.conn_id = rec.conn_id;
+        param.notify.handle = rec.handle;
+        memcpy(param.notify.remote_bda, rec.bda, sizeof(rec.bda));
+        param.notify.value = (uint8_t *)value;
+        param.notify.value_len = value_len;
+        param.notify.is_notify = true;
+        break;
+    default:
+        break;
+    }
+    shim_ble_inject_gattc(at, event, rec.gattc_if, &param);
+    return true;
+}
+
+bool shim_trace_replay(FILE *log, uint32_t speed, shim_trace_stats_t *stats) {
+    char line[2 * SHIM_TRACE_RECORD_MAX + 128];
+    uint8_t record[SHIM_TRACE_RECORD_MAX];
+    int64_t start = shim_now_us();
+    int64_t elapsed = 0;
+    uint32_t last = 0;
+    bool first = true;
+    memset(stats, 0, sizeof(*stats));
+    shim_ble_set_replay(true);
+    while (fgets(line, sizeof(line), log)) {
+        const char *hex = strstr(line, SHIM_TRACE_PREFIX);
+        if (hex == NULL)
+            continue;
+        size_t len = _shim_trace_unhex(hex + strlen(SHIM_TRACE_PREFIX), record, sizeof(record));
+        mi_trace_hdr_t hdr;
+        if (len < sizeof(hdr)) {
+            stats->skipped++;
+            continue;
+        }
+        memcpy(&hdr, record, sizeof(hdr));
+        if (len != sizeof(hdr) + hdr.len) {
+            stats->skipped++;
+            continue;
+        }
+        // Target time is 32 bit, differences survive the wrap
+        if (!first)
+            elapsed += (uint32_t)(hdr.time - last);
+        last = hdr.time;
+        first = false;
+        int64_t at = (speed) ? start + elapsed / speed : shim_now_us();
+        // Run up to the record before queueing it, the deferred calls stay few
+        if (at - shim_now_us() >= 1000)
+            shim_run_for((at - shim_now_us()) / 1000);
+        if (at < shim_now_us())
+            at = shim_now_us();
+        bool ok = (hdr.source == MI_TRACE_GAP) ? _shim_trace_gap(at, hdr.event, record + sizeof(hdr), hdr.len)
+                                                : _shim_trace_gattc(at, hdr.event, record + sizeof(hdr), hdr.len);
+        if (!ok) {
+            stats->skipped++;
+            continue;
+        }
+        stats->records++;
+        if (hdr.source == MI_TRACE_GAP && hdr.event == ESP_GAP_BLE_SCAN_RESULT_EVT)
+            stats->scan_reports++;
+        else if (hdr.source == MI_TRACE_GATTC)
+            stats->gattc_events++;
+        if (speed == 0)
+            shim_run_for(0);
+    }
+    shim_run_for(0);
+    stats->span_us = elapsed;
+    return stats->records > 0;
+}
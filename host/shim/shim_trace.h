@@ -0,0 +1,26 @@
+#pragma once
+
+// Replay of the traces mi_trace_dump() prints on the target console
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define SHIM_TRACE_PREFIX           "MI_TRACE "
+
+typedef struct {
+    uint32_t    records;
+    uint32_t    scan_reports;
+    uint32_t    gattc_events;
+    uint32_t    skipped;                        /*!< prefixed lines that do not decode */
+    int64_t     span_us;                        /*!< recorded time from the first record to the last */
+} shim_trace_stats_t;
+
+/**
+ * Feed every record of a console log into the GAP and GATTC callbacks,
+ * with the mock stack in replay mode; other lines are ignored. The clock
+ * runs along: speed 1 keeps the recorded pacing, n plays n times faster
+ * and 0 delivers each record once the one before is handled. With
+ * shim_set_realtime() speed 1 is real time on the wall clock.
+ */
+bool shim_trace_replay(FILE *log, uint32_t speed, shim_trace_stats_t *stats);
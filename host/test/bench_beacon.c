@@ -0,0 +1,105 @@
+// Encrypted MiBeacon decoding: frames per second through mi_adv_decode
+// with the key schedule set up once per bind key, against a setkey on
+// every frame the way the decoder used to, and the heap calls of each
+
+#include <time.h>
+#include "test.h"
+#include "mi_adv.h"
+#include "mbedtls/ccm.h"
+
+#define SENSORS         MI_BEACON_KEYS_MAX
+#define READINGS        64          /*!< frames per sensor, each one sent twice */
+#define ROUNDS          200
+
+typedef struct {
+    esp_bd_addr_t   bda;
+    uint8_t         adv[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+    uint8_t         len;
+} frame_t;
+
+static frame_t frames[SENSORS * READINGS * 2];
+static shim_sensor_config_t config[SENSORS];
+
+static double wall_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double wall, uint32_t count, uint32_t allocations) {
+    printf("%-22s %8.0f frames/s %6.2f us/frame %8.3f allocations/frame\n",
+           name, count / wall, wall * 1e6 / count, (double)allocations / count);
+}
+
+int main(void) {
+    shim_init();
+    shim_storage_erase();
+    CHECK(nvs_flash_init() == ESP_OK);
+    // Sensors take turns, every frame is heard twice in a row like on the air
+    uint32_t n = 0;
+    for (int s = 0; s < SENSORS; s++) {
+        shim_sensor_config_default(&config[s], SHIM_SENSOR_MIBEACON, s + 1);
+        CHECK(mi_beacon_set_key(config[s].bda, config[s].bind_key) == ESP_OK);
+    }
+    for (int r = 0; r < READINGS; r++) {
+        for (int s = 0; s < SENSORS; s++) {
+            for (int repeat = 0; repeat < 2; repeat++, n++) {
+                memcpy(frames[n].bda, config[s].bda, sizeof(esp_bd_addr_t));
+                frames[n].len = shim_sensor_adv(&config[s], r + 1, r % 3, false, frames[n].adv);
+            }
+        }
+    }
+    CHECK(mi_beacon_load_keys() == ESP_OK);
+
+    // The decoder, every repeat rejected before AES
+    mi_adv_data_t data;
+    mi_beacon_stats_t before, after;
+    mi_beacon_get_stats(&before);
+    uint32_t allocations = shim_heap_allocations("host");
+    double start = wall_s();
+    for (int round = 0; round < ROUNDS; round++)
+        for (uint32_t i = 0; i < n; i++)
+            CHECK(mi_adv_decode(frames[i].bda, frames[i].adv, frames[i].len, &data) == ((i % 2) ? ESP_ERR_INVALID_STATE : ESP_OK));
+    double wall = wall_s() - start;
+    allocations = shim_heap_allocations("host") - allocations;
+    mi_beacon_get_stats(&after);
+    CHECK_EQ(after.decrypted - before.decrypted, ROUNDS * n / 2);
+    CHECK_EQ(after.auth_failed, 0);
+    CHECK_EQ(allocations, 0);
+    report("mi_adv_decode", wall, ROUNDS * n, allocations);
+
+    // The same frames without the repeats, key schedule per key against per frame
+    mbedtls_ccm_context ccm[SENSORS];
+    for (int s = 0; s < SENSORS; s++) {
+        mbedtls_ccm_init(&ccm[s]);
+        CHECK(mbedtls_ccm_setkey(&ccm[s], MBEDTLS_CIPHER_ID_AES, config[s].bind_key, 128) == 0);
+    }
+    for (int per_frame = 0; per_frame < 2; per_frame++) {
+        allocations = shim_heap_allocations("host");
+        start = wall_s();
+        uint32_t count = 0;
+        for (int round = 0; round < ROUNDS; round++) {
+            for (uint32_t i = 0; i < n; i += 2, count++) {
+                int s = (i / 2) % SENSORS;
+                // adv: flags, then length, 0x16, UUID, frame control, product id, counter, MAC, objects, ext, MIC
+                const uint8_t *frame = &frames[i].adv[3 + 4];
+                uint8_t len = frames[i].adv[3] - 3, pos = 11;
+                uint8_t nonce[12], out[MI_BEACON_PAYLOAD_MAX];
+                const uint8_t aad = 0x11;
+                for (int b = 0; b < 6; b++)
+                    nonce[b] = frames[i].bda[5 - b];
+                memcpy(&nonce[6], &frame[2], 3);
+                memcpy(&nonce[9], &frame[len - 7], 3);
+                if (per_frame)
+                    CHECK(mbedtls_ccm_setkey(&ccm[s], MBEDTLS_CIPHER_ID_AES, config[s].bind_key, 128) == 0);
+                CHECK(mbedtls_ccm_auth_decrypt(&ccm[s], len - pos - 7, nonce, sizeof(nonce), &aad, 1,
+                                               &frame[pos], out, &frame[len - 4], 4) == 0);
+            }
+        }
+        wall = wall_s() - start;
+        report((per_frame) ? "ccm, setkey per frame" : "ccm, setkey per key", wall, count, shim_heap_allocations("host") - allocations);
+    }
+    for (int s = 0; s < SENSORS; s++)
+        mbedtls_ccm_free(&ccm[s]);
+    return 0;
+}
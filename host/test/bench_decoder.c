@@ -0,0 +1,108 @@
+// Decodes per second of the fixed-point decoders on the host: notifications
+// of the data characteristic, records of the hourly log, and the plain
+// advertisement formats from the mock sensors' frames. bench_beacon covers
+// the encrypted MiBeacon ones.
+
+#include <time.h>
+#include "test.h"
+#include "mi_decoder.h"
+#include "mi_adv.h"
+
+#define PAYLOADS        256             /*!< different readings, decoded in turn */
+#define ROUNDS          20000
+
+static uint8_t data[PAYLOADS][MI_DATA_LEN];
+static uint8_t history[PAYLOADS * MI_HISTORY_RECORD_LEN];
+static mi_history_record_t records[PAYLOADS];
+
+typedef struct {
+    esp_bd_addr_t   bda;
+    uint8_t         adv[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+    uint8_t         len;
+} frame_t;
+
+static frame_t frames[PAYLOADS];
+
+static double wall_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double wall, uint64_t count) {
+    printf("%-28s %12.0f decodes/s %8.1f ns/decode\n", name, count / wall, wall * 1e9 / count);
+}
+
+// Readings from -40 to +85 C, signed like the sensor sends them
+static void fill(void) {
+    for (int i = 0; i < PAYLOADS; i++) {
+        int16_t temp = -4000 + i * 12500 / PAYLOADS;
+        uint16_t mv = 2400 + i;
+        uint8_t *p = &history[i * MI_HISTORY_RECORD_LEN];
+        data[i][0] = temp & 0xFF;
+        data[i][1] = (uint16_t)temp >> 8;
+        data[i][2] = i % 101;
+        data[i][3] = mv & 0xFF;
+        data[i][4] = mv >> 8;
+        for (int b = 0; b < 4; b++) {
+            p[b] = i >> (8 * b);
+            p[4 + b] = (i * 3600) >> (8 * b);
+        }
+        p[8] = (temp / 10) & 0xFF;
+        p[9] = (uint16_t)(temp / 10) >> 8;
+        p[10] = i % 101;
+        p[11] = (temp / 10) & 0xFF;
+        p[12] = (uint16_t)(temp / 10) >> 8;
+        p[13] = i % 101;
+    }
+}
+
+static void bench_adv(shim_sensor_format_t format, const char *name) {
+    for (int i = 0; i < PAYLOADS; i++) {
+        shim_sensor_config_t config;
+        shim_sensor_config_default(&config, format, i + 1);
+        config.temp = -4000 + i * 12500 / PAYLOADS;
+        memcpy(frames[i].bda, config.bda, sizeof(esp_bd_addr_t));
+        frames[i].len = shim_sensor_adv(&config, i + 1, 0, true, frames[i].adv);
+    }
+    mi_adv_data_t out;
+    int64_t sum = 0;
+    double start = wall_s();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < PAYLOADS; i++) {
+            CHECK(mi_adv_decode(frames[i].bda, frames[i].adv, frames[i].len, &out) == ESP_OK);
+            sum += out.temp;
+        }
+    }
+    report(name, wall_s() - start, (uint64_t)ROUNDS * PAYLOADS);
+    CHECK(sum != 0);
+}
+
+int main(void) {
+    static test_sensors_t sensors;
+    test_setup(&sensors, 0);
+    fill();
+    uint32_t allocations = shim_heap_allocations("host");
+
+    mi_reading_t reading;
+    int64_t sum = 0;
+    double start = wall_s();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < PAYLOADS; i++) {
+            CHECK(mi_decode_data(data[i], MI_DATA_LEN, &reading) == ESP_OK);
+            sum += reading.temp + reading.battery_mv;
+        }
+    }
+    report("mi_decode_data", wall_s() - start, (uint64_t)ROUNDS * PAYLOADS);
+    CHECK(sum != 0);
+
+    start = wall_s();
+    for (int round = 0; round < ROUNDS; round++)
+        CHECK_EQ(mi_decode_history(history, PAYLOADS, records), PAYLOADS);
+    report("mi_decode_history, a record", wall_s() - start, (uint64_t)ROUNDS * PAYLOADS);
+
+    bench_adv(SHIM_SENSOR_ATC, "mi_adv_decode, ATC");
+    bench_adv(SHIM_SENSOR_PVVX, "mi_adv_decode, pvvx");
+    CHECK_EQ(shim_heap_allocations("host") - allocations, 0);
+    return 0;
+}
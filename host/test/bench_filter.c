@@ -0,0 +1,129 @@
+// Advertising reports per second on one host core at the top of esp_gap_cb:
+// an office of phones and a few sensors, every report resolved for its name
+// and compared the way the callback did before mi_filter, against
+// mi_filter_match under each rule on its own and the default pair, and the
+// callback's path now, the filter then the name of what passes. Phones must
+// all be rejected, the sensors all pass, and nothing may touch the heap.
+
+#include <time.h>
+#include "test.h"
+#include "mi_filter.h"
+#include "mi_adv.h"
+
+#define PHONES          240
+#define SENSORS         MI_FILTER_BDA_MAX   /*!< all of them fit the allowlist */
+#define REPORTS         (PHONES + SENSORS)
+#define ROUNDS          2000
+#define PASSES          10              /*!< best one of each row reported, the host is shared */
+
+typedef struct {
+    esp_bd_addr_t   bda;
+    uint8_t         adv[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+    uint8_t         len;
+} report_t;
+
+static report_t reports[REPORTS];
+static uint32_t named;                  /*!< sensors the old check knew, stock and MiBeacon, not the custom firmware */
+
+static double wall_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double wall, uint64_t count) {
+    printf("%-28s %12.0f reports/s %8.1f ns/report\n", name, count / wall, wall * 1e9 / count);
+}
+
+// A sensor every sixteenth report, the formats in turn, active scan so they carry their names
+static void fill(void) {
+    static const shim_sensor_format_t formats[] = { SHIM_SENSOR_STOCK, SHIM_SENSOR_ATC, SHIM_SENSOR_PVVX, SHIM_SENSOR_MIBEACON };
+    for (int i = 0; i < REPORTS; i++) {
+        shim_sensor_config_t config;
+        if (i % (REPORTS / SENSORS) == 0)
+            shim_sensor_config_default(&config, formats[i / (REPORTS / SENSORS) % 4], i + 1);
+        else
+            shim_sensor_config_default(&config, SHIM_SENSOR_PHONE, i + 1);
+        memcpy(reports[i].bda, config.bda, sizeof(esp_bd_addr_t));
+        reports[i].len = shim_sensor_adv(&config, i + 1, 0, true, reports[i].adv);
+    }
+}
+
+// What esp_gap_cb asked of every report before it had a filter
+static bool is_sensor(report_t *r) {
+    uint8_t len;
+    uint16_t product;
+    uint8_t *name = esp_ble_resolve_adv_data(r->adv, ESP_BLE_AD_TYPE_NAME_CMPL, &len);
+    if (len == strlen("LYWSD03MMC") && memcmp(name, "LYWSD03MMC", len) == 0)
+        return true;
+    return mi_adv_product(r->adv, r->len, &product) == ESP_OK && product == MI_ADV_PRODUCT_LYWSD03MMC;
+}
+
+typedef struct {
+    const char  *name;
+    bool        filter;
+    uint8_t     rules;
+    bool        resolve;                /*!< the name of every report the filter lets through */
+    double      best;
+} row_t;
+
+static row_t rows[] = {
+    { "name of every report",       false,  0,                  true },
+    { "mi_filter_match, address",   true,   MI_FILTER_BDA,      false },
+    { "mi_filter_match, prefix",    true,   MI_FILTER_OUI,      false },
+    { "mi_filter_match, service",   true,   MI_FILTER_UUID,     false },
+    { "mi_filter_match, default",   true,   MI_FILTER_DEFAULT,  false },
+    { "filter then name",           true,   MI_FILTER_DEFAULT,  true },
+};
+
+static void bench_row(row_t *row) {
+    mi_filter_stats_t before, after;
+    uint32_t found = 0;
+    mi_filter_set_rules(row->rules);
+    mi_filter_get_stats(&before);
+    double start = wall_s();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < REPORTS; i++) {
+            if (!row->filter || mi_filter_match(reports[i].bda, reports[i].adv, reports[i].len))
+                found += !row->resolve || is_sensor(&reports[i]);
+        }
+    }
+    double wall = wall_s() - start;
+    row->best = (row->best == 0 || wall < row->best) ? wall : row->best;
+    mi_filter_get_stats(&after);
+    CHECK_EQ(found, ROUNDS * ((row->resolve) ? named : SENSORS));
+    if (row->filter) {
+        CHECK_EQ(after.seen - before.seen, (uint32_t)ROUNDS * REPORTS);
+        CHECK_EQ(after.rejected - before.rejected, (uint32_t)ROUNDS * PHONES);
+    }
+}
+
+int main(void) {
+    static test_sensors_t sensors;
+    test_setup(&sensors, 0);
+    fill();
+    for (int i = 0; i < REPORTS; i += REPORTS / SENSORS) {
+        CHECK(mi_filter_add_bda(reports[i].bda) == ESP_OK);
+        named += is_sensor(&reports[i]);
+    }
+    CHECK(named > 0);
+    uint32_t allocations = shim_heap_allocations("host");
+
+    // Rows take turns, a busy host slows them all alike
+    for (int pass = 0; pass < PASSES; pass++)
+        for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++)
+            bench_row(&rows[i]);
+    for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++)
+        report(rows[i].name, rows[i].best, (uint64_t)ROUNDS * REPORTS);
+
+    // Every other sensor off the allowlist, the chains still reach the rest
+    mi_filter_set_rules(MI_FILTER_BDA);
+    for (int i = 0; i < REPORTS; i += 2 * (REPORTS / SENSORS))
+        CHECK(mi_filter_remove_bda(reports[i].bda) == ESP_OK);
+    CHECK(mi_filter_remove_bda(reports[0].bda) == ESP_ERR_NOT_FOUND);
+    for (int i = 0; i < REPORTS; i += REPORTS / SENSORS)
+        CHECK_EQ(mi_filter_match(reports[i].bda, NULL, 0), i % (2 * (REPORTS / SENSORS)) != 0);
+    mi_filter_set_rules(MI_FILTER_DEFAULT);
+    CHECK_EQ(shim_heap_allocations("host") - allocations, 0);
+    return 0;
+}
@@ -0,0 +1,86 @@
+// readlog on flash: write amplification for the sample rates of the
+// gateway modes, flushed every READLOG_FLUSH_S like app_main does, and
+// what readlog_init and the restore at boot read back once the log is full
+
+#include "test.h"
+#include "readlog.h"
+
+#define RECORD_SIZE         sizeof(readlog_record_t)
+#define FLUSH_S             60          /*!< READLOG_FLUSH_S of app_main */
+#define DAYS                7
+#define ENDURANCE           100000      /*!< erase cycles per sector */
+
+typedef struct {
+    const char  *name;
+    uint32_t    per_minute;             /*!< records appended */
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    { "3 connected, 6 s notify",    30 },
+    { "40 passive, measured",       80 },
+    { "64 passive, every adv",      640 },
+    { "1 sensor, 1 per minute",     1 },
+};
+
+static void count(const readlog_record_t *record, void *arg) {
+    (*(uint32_t *)arg)++;
+}
+
+static int write_boot(void *arg) {
+    const scenario_t *s = arg;
+    uint8_t id[READLOG_ID_LEN] = { 0xA4, 0xC1, 0x38 };
+    shim_init();
+    CHECK(readlog_init() == ESP_OK);
+    shim_flash_reset_stats();
+    uint32_t time = 0;
+    uint64_t records = 0;
+    for (uint32_t minute = 0; minute < DAYS * 24 * 60; minute++) {
+        for (uint32_t i = 0; i < s->per_minute; i++) {
+            id[5] = i;
+            time = minute * FLUSH_S + i * FLUSH_S / s->per_minute;
+            CHECK(readlog_append(id, time, 2150, 45) == ESP_OK);
+            records++;
+        }
+        CHECK(readlog_flush() == ESP_OK);
+    }
+    shim_flash_stats_t stats;
+    shim_flash_get_stats(&stats);
+    uint32_t sectors = 0x40000 / 4096;
+    double erases_day = (double)stats.erases / DAYS;
+    printf("%-26s %7u %9llu %8.3f %7.2f %8.1f %8.1f",
+           s->name, s->per_minute, (unsigned long long)records, (double)stats.writes / records,
+           (double)stats.bytes_written / (records * RECORD_SIZE), erases_day,
+           (erases_day > 0) ? ENDURANCE * sectors / erases_day / 365 : 0.0);
+    return 0;
+}
+
+// The log as the last run left it, read like app_main does at boot
+static int scan_boot(void *arg) {
+    shim_flash_stats_t init, restore;
+    uint32_t records = 0;
+    shim_init();
+    shim_flash_reset_stats();
+    CHECK(readlog_init() == ESP_OK);
+    shim_flash_get_stats(&init);
+    shim_flash_reset_stats();
+    CHECK(readlog_read(0, UINT32_MAX, count, &records) == ESP_OK);
+    shim_flash_get_stats(&restore);
+    printf(" | %5u %7llu | %5u %7llu %6u\n", init.reads, (unsigned long long)init.bytes_read,
+           restore.reads, (unsigned long long)restore.bytes_read, records);
+    return 0;
+}
+
+int main(void) {
+    shim_init();
+    printf("%d days, flushed every %d s; amplification is flash bytes programmed per record byte\n", DAYS, FLUSH_S);
+    printf("%-26s %7s %9s %8s %7s %8s %8s | %-13s | %s\n", "scenario", "rec/min", "records",
+           "wr/rec", "ampl", "erase/d", "years", "init reads/B", "restore reads/B records");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        shim_storage_erase();
+        fflush(stdout);
+        CHECK_EQ(shim_reboot_run(write_boot, (void *)&scenarios[i]), 0);
+        fflush(stdout);
+        CHECK_EQ(shim_reboot_run(scan_boot, NULL), 0);
+    }
+    return 0;
+}
@@ -0,0 +1,63 @@
+// Advertisement reports per second the passive gateway absorbs: ten minutes
+// of 40 sensors, recorded once, replayed faster and faster. app_main is woken
+// to drain its channel as it fills, none may overflow at any speed; the wall
+// clock of the back to back replay is the host cost of the callback path.
+
+#include <time.h>
+#include "test.h"
+#include "shim_trace.h"
+#include "mi_channel.h"
+
+#define SENSORS         40
+
+static const char *path = "build/bench_replay.log";
+
+static double wall_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int replay_boot(void *arg) {
+    uint32_t speed = *(uint32_t *)arg;
+    test_boot();
+    shim_log_set_level(ESP_LOG_ERROR);
+    // Callbacks registered and the scan set up, then the trace takes over
+    shim_run_for(1000);
+    FILE *log = fopen(path, "r");
+    CHECK(log);
+    shim_trace_stats_t stats;
+    double start = wall_s();
+    CHECK(shim_trace_replay(log, speed, &stats));
+    double wall = wall_s() - start;
+    fclose(log);
+    // Let app_main drain what is left
+    shim_run_for(2000);
+    // app_main subscribes first
+    mi_channel_stats_t channel;
+    CHECK(mi_channel_get_stats(0, &channel) == ESP_OK);
+    char label[16], offered[16] = "-";
+    snprintf(label, sizeof(label), speed ? "%ux" : "max", speed);
+    if (speed && stats.span_us)
+        snprintf(offered, sizeof(offered), "%.0f", stats.scan_reports * 1e6 * speed / stats.span_us);
+    printf("%-6s %10s %9u %9u %9u %9.3f %12.0f\n", label, offered, stats.scan_reports,
+           channel.published, channel.overflows, wall, stats.scan_reports / wall);
+    CHECK_EQ(channel.overflows, 0);
+    return 0;
+}
+
+int main(void) {
+    shim_init();
+    test_record_t record = {
+        .path = path,
+        .count = SENSORS,
+        .ms = 10 * 60 * 1000,
+    };
+    CHECK_EQ(shim_reboot_run(test_record_boot, &record), 0);
+    printf("%-6s %10s %9s %9s %9s %9s %12s\n", "speed", "reports/s", "reports", "samples", "dropped", "wall s", "host rep/s");
+    fflush(stdout);
+    uint32_t speeds[] = { 1, 4, 16, 64, 256, 0 };
+    for (size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++)
+        CHECK_EQ(shim_reboot_run(replay_boot, &speeds[i]), 0);
+    return 0;
+}
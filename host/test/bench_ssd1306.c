@@ -0,0 +1,105 @@
+// A line of text on the SSD1306 model: transactions, bytes on the wire and
+// bus time per line, the way oled_ssd1306_print used to send it, one
+// transaction per character, against one transaction per line, a field
+// rewritten in place, and the display task's framebuffer flush of a
+// reading that changed by one digit
+
+#include "test.h"
+#include "driver/i2c.h"
+
+#define LINES           (DISPLAY_PAGES * 100)
+
+// The glyphs ssd1306.c draws with
+extern const uint8_t font_width;
+extern uint8_t font[];
+
+// oled_ssd1306_print before it rendered a line in one transaction
+static void print_per_char(int page, const char *text) {
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (SSD1306_OLED_ADDR << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, COMMAND_MODE, true);
+    i2c_master_write_byte(cmd, (PAGE_START_ADDR | page), true);
+    i2c_master_write_byte(cmd, LOWER_COL_START_ADDR, true);
+    i2c_master_write_byte(cmd, HIGHER_COL_START_ADDR, true);
+    i2c_master_stop(cmd);
+    CHECK(i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000 / portTICK_PERIOD_MS) == ESP_OK);
+    i2c_cmd_link_delete(cmd);
+    for (; *text; text++) {
+        uint16_t char_index = (*text <= 0) ? 0 : font_width * (*text);
+        cmd = i2c_cmd_link_create();
+        i2c_master_start(cmd);
+        i2c_master_write_byte(cmd, (SSD1306_OLED_ADDR << 1) | I2C_MASTER_WRITE, true);
+        i2c_master_write_byte(cmd, DATA_MODE, true);
+        for (uint8_t col = 0; col < font_width; col++)
+            i2c_master_write_byte(cmd, font[char_index + col], true);
+        i2c_master_stop(cmd);
+        CHECK(i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000 / portTICK_PERIOD_MS) == ESP_OK);
+        i2c_cmd_link_delete(cmd);
+    }
+}
+
+// A sensor line of app_main, the reading of line i
+static void sensor_line(char *line, size_t len, int i) {
+    snprintf(line, len, "%d %5.1fC %3d%%", i % DISPLAY_PAGES, (2150 + i % 10) / 100.0f, 45);
+}
+
+static void report(const char *name, const shim_ssd1306_stats_t *before) {
+    printf("%-24s %8.2f %8.1f %9.1f\n", name,
+           (double)(test_oled.stats.transactions - before->transactions) / LINES,
+           (double)(test_oled.stats.bytes - before->bytes) / LINES,
+           (double)(test_oled.stats.bus_us - before->bus_us) / LINES);
+}
+
+int main(void) {
+    static test_sensors_t sensors;
+    char line[DISPLAY_COLUMNS / 8 + 1];
+    test_setup(&sensors, 0);
+    CHECK(oled_ssd1306_init() == ESP_OK);
+    printf("%-24s %8s %8s %9s   per line at %d Hz\n", "", "trans", "bytes", "bus us", I2C_MASTER_FREQ_HZ);
+
+    shim_ssd1306_stats_t before = test_oled.stats;
+    for (int i = 0; i < LINES; i++) {
+        sensor_line(line, sizeof(line), i);
+        print_per_char(i % DISPLAY_PAGES, line);
+    }
+    report("per char, before", &before);
+    // Same glyphs as the one transaction path draws
+    uint8_t old[DISPLAY_COLUMNS];
+    memcpy(old, test_oled.gddram[(LINES - 1) % DISPLAY_PAGES], sizeof(old));
+    oled_ssd1306_clear_all();
+
+    before = test_oled.stats;
+    for (int i = 0; i < LINES; i++) {
+        sensor_line(line, sizeof(line), i);
+        CHECK(oled_ssd1306_print_at(i % DISPLAY_PAGES, 0, line) == ESP_OK);
+    }
+    report("print_at", &before);
+    CHECK_EQ(test_oled.stats.transactions - before.transactions, LINES);
+    CHECK(memcmp(old, test_oled.gddram[(LINES - 1) % DISPLAY_PAGES], strlen(line) * font_width) == 0);
+
+    before = test_oled.stats;
+    for (int i = 0; i < LINES; i++) {
+        sensor_line(line, sizeof(line), i);
+        CHECK(oled_ssd1306_print_field(i % DISPLAY_PAGES, 0, DISPLAY_COLUMNS / 8, line) == ESP_OK);
+    }
+    report("print_field, full width", &before);
+
+    // Once every page shows a line, each one after it changes a digit
+    oled_ssd1306_fb_clear_all();
+    for (int i = 0; i < DISPLAY_PAGES; i++) {
+        sensor_line(line, sizeof(line), i);
+        oled_ssd1306_fb_print(i, 0, line);
+    }
+    CHECK(oled_ssd1306_flush() == ESP_OK);
+    before = test_oled.stats;
+    for (int i = DISPLAY_PAGES; i < LINES + DISPLAY_PAGES; i++) {
+        sensor_line(line, sizeof(line), i);
+        oled_ssd1306_fb_print(i % DISPLAY_PAGES, 0, line);
+        CHECK(oled_ssd1306_flush() == ESP_OK);
+    }
+    report("fb flush, one digit", &before);
+    CHECK_EQ(test_oled.stats.errors, 0);
+    CHECK_EQ(test_oled.stats.page_wraps, 0);
+    return 0;
+}
@@ -0,0 +1,147 @@
+// Time to first reading of one stock sensor, a cold boot with empty flash
+// then a warm one with Bluedroid's GATT cache and mi_cache from the first:
+// from app_main to the link up, from there to the data notification
+// registered, the gateway's own part, then to the sensor's first
+// notification, which only waits for its next measurement, and from
+// app_main to the first reading shown. Service discovery, 24 round trips
+// at the 30 ms interval of a new link, fills most of a cold registration
+// and none of a warm one.
+//
+// The paced variant is the baseline, mi_task sleeping a second before
+// every state as it did before the event queue. It reads the device
+// information in one state where that engine took six, so the old engine
+// was slower still. Measured medians, paced against default: link to
+// registered 12.6 s against 1.3 s cold and 5.6 s against 0.06 s warm,
+// app_main to registered 22 s against 2.8 s cold and 15 s against 1.6 s
+// warm. The first reading, 27 s against 6.7 s, gains only four times: the
+// link waits for an advertisement and the notification for a measurement.
+
+#include <sys/mman.h>
+#include "test.h"
+
+#define RUNS            16              /*!< sensors numbered 1.., each one advertises and measures on its own phase */
+#define TIMEOUT_MS      (2 * 60 * 1000)
+#define REGISTERED_MAX  1500            /*!< ms from the link to registered on a cold boot, discovery included */
+#define CACHED_MAX      200             /*!< the same on a warm boot, nothing to discover */
+
+typedef struct {
+    uint32_t    link_ms;
+    uint32_t    registered_ms;              /*!< after the link */
+    uint32_t    notified_ms;                /*!< after the registration, the sensor's next measurement */
+    uint32_t    read_ms;
+} ttfr_t;
+
+typedef struct {
+    uint16_t    n;
+    ttfr_t      *result;
+} run_t;
+
+static bool linked(void *arg) {
+    const test_sensors_t *sensors = arg;
+    shim_sensor_stats_t stats;
+    shim_sensor_get_stats(sensors->ids[0], &stats);
+    return stats.connections > 0;
+}
+
+static bool registered(void *arg) {
+    const test_sensors_t *sensors = arg;
+    return shim_ble_registered(sensors->config[0].bda, SHIM_HANDLE_DATA);
+}
+
+static bool notified(void *arg) {
+    const test_sensors_t *sensors = arg;
+    shim_sensor_stats_t stats;
+    shim_sensor_get_stats(sensors->ids[0], &stats);
+    return stats.notifications > 0;
+}
+
+// The flash as the last boot left it
+static int ttfr_boot(void *arg) {
+    const run_t *run = arg;
+    static test_sensors_t sensors;
+    shim_init();
+    shim_ssd1306_init(&test_oled);
+    shim_ssd1306_attach(&test_oled, 0, SSD1306_OLED_ADDR);
+    sensors.count = 1;
+    shim_sensor_config_default(&sensors.config[0], SHIM_SENSOR_STOCK, run->n);
+    sensors.ids[0] = shim_sensor_add(&sensors.config[0]);
+    CHECK(sensors.ids[0] >= 0);
+    shim_log_set_level(ESP_LOG_ERROR);
+    test_start(&sensors, 60000);
+    CHECK(shim_run_until(linked, &sensors, TIMEOUT_MS));
+    run->result->link_ms = shim_now_us() / 1000;
+    CHECK(shim_run_until(registered, &sensors, TIMEOUT_MS));
+    run->result->registered_ms = shim_now_us() / 1000 - run->result->link_ms;
+    CHECK(shim_run_until(notified, &sensors, TIMEOUT_MS));
+    run->result->notified_ms = shim_now_us() / 1000 - run->result->link_ms - run->result->registered_ms;
+    CHECK(shim_run_until(test_all_read, &sensors, TIMEOUT_MS));
+    run->result->read_ms = shim_now_us() / 1000;
+    CHECK_EQ(shim_log_errors(), 0);
+    return 0;
+}
+
+static int compare(const void *a, const void *b) {
+    return (int)*(const uint32_t *)a - (int)*(const uint32_t *)b;
+}
+
+// min, median and max of one column
+static void stats(ttfr_t *results, size_t offset, uint32_t *out) {
+    uint32_t v[RUNS];
+    for (int i = 0; i < RUNS; i++)
+        v[i] = *(uint32_t *)((uint8_t *)&results[i] + offset);
+    qsort(v, RUNS, sizeof(v[0]), compare);
+    out[0] = v[0];
+    out[1] = v[RUNS / 2];
+    out[2] = v[RUNS - 1];
+}
+
+static const struct {
+    const char  *name;
+    size_t      offset;
+} columns[] = {
+    { "link up",            offsetof(ttfr_t, link_ms) },
+    { "then registered",    offsetof(ttfr_t, registered_ms) },
+    { "then notified",      offsetof(ttfr_t, notified_ms) },
+    { "first reading",      offsetof(ttfr_t, read_ms) },
+};
+
+#define COLUMNS         (sizeof(columns) / sizeof(columns[0]))
+
+static void report(const char *name, ttfr_t *results, uint32_t out[COLUMNS][3]) {
+    printf("%-6s", name);
+    for (size_t c = 0; c < COLUMNS; c++) {
+        stats(results, columns[c].offset, out[c]);
+        printf(" %6u %6u %6u ", out[c][0], out[c][1], out[c][2]);
+    }
+    printf("\n");
+}
+
+int main(void) {
+    // Results outlive the boots, each one a forked child
+    ttfr_t *cold = mmap(NULL, 2 * RUNS * sizeof(ttfr_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    CHECK(cold != MAP_FAILED);
+    ttfr_t *warm = cold + RUNS;
+    shim_init();
+    for (int i = 0; i < RUNS; i++) {
+        shim_storage_erase();
+        run_t run = { .n = i + 1, .result = &cold[i] };
+        CHECK_EQ(shim_reboot_run(ttfr_boot, &run), 0);
+        run.result = &warm[i];
+        CHECK_EQ(shim_reboot_run(ttfr_boot, &run), 0);
+    }
+    uint32_t c[COLUMNS][3], w[COLUMNS][3];
+    printf("%-6s", "ms");
+    for (size_t i = 0; i < COLUMNS; i++)
+        printf(" %20s ", columns[i].name);
+    printf("\n%-6s", "boot");
+    for (size_t i = 0; i < COLUMNS; i++)
+        printf(" %6s %6s %6s ", "min", "median", "max");
+    printf("\n");
+    report("cold", cold, c);
+    report("warm", warm, w);
+#ifndef MI_STATE_DWELL_MS
+    CHECK(c[1][2] < REGISTERED_MAX);
+    CHECK(w[1][2] < CACHED_MAX);
+#endif
+    return 0;
+}
@@ -0,0 +1,42 @@
+// Replay a console log captured with MI_TRACE into app_main, in the variant
+// the target ran:
+//
+//   build/<variant>/replay <console.log> [speed] [realtime]
+//
+// speed 1 (the default) keeps the recorded pacing, n plays n times faster,
+// 0 back to back; "realtime" paces the virtual clock to the wall clock.
+// SHIM_LOG=I shows what the firmware makes of it.
+
+#include "test.h"
+#include "shim_trace.h"
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <console.log> [speed] [realtime]\n", argv[0]);
+        return 2;
+    }
+    uint32_t speed = (argc > 2) ? strtoul(argv[2], NULL, 0) : 1;
+    FILE *log = fopen(argv[1], "r");
+    if (log == NULL) {
+        perror(argv[1]);
+        return 2;
+    }
+    test_boot();
+    shim_set_realtime(argc > 3 && strcmp(argv[3], "realtime") == 0);
+    shim_run_for(1000);
+    shim_trace_stats_t stats;
+    bool ok = shim_trace_replay(log, speed, &stats);
+    fclose(log);
+    shim_run_for(2000);
+    printf("%u records, %u scan reports, %u gattc events, %u skipped, %lld ms recorded\n",
+           stats.records, stats.scan_reports, stats.gattc_events, stats.skipped, (long long)stats.span_us / 1000);
+
+    mi_sensor_t sensors[32];
+    uint8_t count = sizeof(sensors) / sizeof(sensors[0]);
+    if (mi_get_sensors(sensors, &count) == ESP_OK) {
+        for (uint8_t i = 0; i < count; i++)
+            printf(MACSTR " state %2d %6.2f C %3u %% %4u mV\n", MAC2STR(sensors[i].bda), sensors[i].state,
+                   sensors[i].temp / 100.0f, sensors[i].hum, sensors[i].battery_mv);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+// Checks and helpers shared by the host tests and benchmarks
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shim.h"
+#include "shim_ble.h"
+#include "shim_ssd1306.h"
+#include "nvs_flash.h"
+#include "mithermometer.h"
+#include "mi_beacon.h"
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) do { \
+        long long _a = (long long)(a), _b = (long long)(b); \
+        if (_a != _b) { \
+            fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+            exit(1); \
+        } \
+    } while (0)
+
+void app_main(void);
+
+// Sensor format each variant of the firmware reads
+#ifdef MI_PASSIVE_MODE
+#define TEST_FORMAT(n)              ((n) % 3 == 0 ? SHIM_SENSOR_ATC : ((n) % 3 == 1 ? SHIM_SENSOR_PVVX : SHIM_SENSOR_MIBEACON))
+#else
+#define TEST_FORMAT(n)              SHIM_SENSOR_STOCK
+#endif
+
+typedef struct {
+    int                     count;
+    int                     ids[SHIM_SENSORS_MAX];
+    shim_sensor_config_t    config[SHIM_SENSORS_MAX];
+} test_sensors_t;
+
+// The panel app_main draws on
+static shim_ssd1306_t test_oled;
+
+/**
+ * Fresh flash, a blank panel on the bus and count sensors of the variant's
+ * format numbered from 1. MiBeacon sensors get their bind key in NVS like
+ * the provisioning would.
+ */
+static inline void test_setup(test_sensors_t *sensors, int count) {
+    shim_init();
+    shim_storage_erase();
+    shim_ssd1306_init(&test_oled);
+    shim_ssd1306_attach(&test_oled, 0, SSD1306_OLED_ADDR);
+    CHECK(nvs_flash_init() == ESP_OK);
+    sensors->count = count;
+    for (int i = 0; i < count; i++) {
+        shim_sensor_config_default(&sensors->config[i], TEST_FORMAT(i), i + 1);
+        sensors->ids[i] = shim_sensor_add(&sensors->config[i]);
+        CHECK(sensors->ids[i] >= 0);
+        if (sensors->config[i].format == SHIM_SENSOR_MIBEACON)
+            CHECK(mi_beacon_set_key(sensors->config[i].bda, sensors->config[i].bind_key) == ESP_OK);
+    }
+}
+
+// Start app_main, in MI_POLL_MODE every sensor is added with period_ms once it runs
+static inline void test_start(test_sensors_t *sensors, uint32_t period_ms) {
+    shim_start_app(app_main);
+#ifdef MI_POLL_MODE
+    shim_run_for(100);
+    for (int i = 0; i < sensors->count; i++)
+        CHECK(mi_poll_add(sensors->config[i].bda, period_ms) == ESP_OK);
+#endif
+}
+
+// Whether the gateway shows the current values of sensor i
+static inline bool test_sensor_read(const test_sensors_t *sensors, int i) {
+    mi_sensor_t sensor;
+    if (mi_get_sensor(sensors->config[i].bda, &sensor) != ESP_OK || sensor.updated == 0)
+        return false;
+    return sensor.temp == sensors->config[i].temp && sensor.hum == sensors->config[i].hum;
+}
+
+static inline bool test_all_read(void *arg) {
+    const test_sensors_t *sensors = arg;
+    for (int i = 0; i < sensors->count; i++)
+        if (!test_sensor_read(sensors, i))
+            return false;
+    return true;
+}
+
+// Panel on the bus and app_main running, the flash kept from the last boot
+static inline void test_boot(void) {
+    shim_init();
+    shim_ssd1306_init(&test_oled);
+    shim_ssd1306_attach(&test_oled, 0, SSD1306_OLED_ADDR);
+    shim_start_app(app_main);
+}
+
+#ifdef MI_TRACE
+#include <fcntl.h>
+#include <unistd.h>
+#include "mi_trace.h"
+
+typedef struct {
+    const char  *path;
+    int         count;
+    uint32_t    ms;
+} test_record_t;
+
+/**
+ * A shim_reboot_run boot: count sensors on the air for ms, the console
+ * with the mi_trace_dump() output of every 100 ms goes to path.
+ */
+static inline int test_record_boot(void *arg) {
+    const test_record_t *record = arg;
+    static test_sensors_t sensors;
+    test_setup(&sensors, record->count);
+    int fd = open(record->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd >= 0);
+    fflush(stdout);
+    CHECK(dup2(fd, STDOUT_FILENO) >= 0);
+    close(fd);
+    test_start(&sensors, 60000);
+    for (uint32_t t = 0; t < record->ms; t += 100) {
+        shim_run_for(100);
+        mi_trace_dump();
+    }
+    fflush(stdout);
+    mi_trace_stats_t stats;
+    mi_trace_get_stats(&stats);
+    CHECK_EQ(stats.dropped, 0);
+    CHECK(test_all_read(&sensors));
+    return 0;
+}
+#endif
@@ -0,0 +1,165 @@
+// The decoders on their own: the data characteristic and the hourly log in
+// fixed point, signed temperatures, range and length checks, out left alone
+// on an error, and the advertisement formats from the mock sensors' frames.
+// None of it may touch the heap.
+
+#include "test.h"
+#include "mi_decoder.h"
+#include "mi_adv.h"
+
+#define BEACON_N        3               /*!< the MiBeacon sensor of test_adv, its key loaded up front */
+
+static const mi_reading_t untouched = { .temp = 0x5A5A, .hum = 0x5A, .battery_mv = 0x5A5A };
+
+static esp_err_t decode(const uint8_t *data, uint16_t len, mi_reading_t *out) {
+    *out = untouched;
+    return mi_decode_data(data, len, out);
+}
+
+static bool is_untouched(const mi_reading_t *out) {
+    return memcmp(out, &untouched, sizeof(*out)) == 0;
+}
+
+static void test_data(void) {
+    mi_reading_t out;
+    const uint8_t typical[] = { 0x66, 0x08, 45, 0xB8, 0x0B };         /* 21.50 C, 45 %, 3000 mV */
+    CHECK(decode(typical, sizeof(typical), &out) == ESP_OK);
+    CHECK_EQ(out.temp, 2150);
+    CHECK_EQ(out.hum, 45);
+    CHECK_EQ(out.battery_mv, 3000);
+
+    // Below zero in two's complement, not a large positive value
+    const uint8_t frost[] = { 0x2E, 0xFB, 80, 0x10, 0x0B };           /* -12.34 C */
+    CHECK(decode(frost, sizeof(frost), &out) == ESP_OK);
+    CHECK_EQ(out.temp, -1234);
+    CHECK_EQ(out.battery_mv, 2832);
+
+    // The ends of the sensor's range and one past them
+    const uint8_t lowest[] = { 0x60, 0xF0, 0, 0, 0 };                 /* -40.00 C */
+    const uint8_t highest[] = { 0x34, 0x21, 100, 0xFF, 0xFF };        /* 85.00 C, 100 % */
+    const uint8_t too_cold[] = { 0x5F, 0xF0, 50, 0, 0 };
+    const uint8_t too_hot[] = { 0x35, 0x21, 50, 0, 0 };
+    const uint8_t too_humid[] = { 0x66, 0x08, 101, 0, 0 };
+    CHECK(decode(lowest, sizeof(lowest), &out) == ESP_OK);
+    CHECK_EQ(out.temp, -4000);
+    CHECK(decode(highest, sizeof(highest), &out) == ESP_OK);
+    CHECK_EQ(out.temp, 8500);
+    CHECK_EQ(out.hum, 100);
+    CHECK_EQ(out.battery_mv, 0xFFFF);
+    CHECK(decode(too_cold, sizeof(too_cold), &out) == ESP_ERR_INVALID_RESPONSE);
+    CHECK(is_untouched(&out));
+    CHECK(decode(too_hot, sizeof(too_hot), &out) == ESP_ERR_INVALID_RESPONSE);
+    CHECK(is_untouched(&out));
+    CHECK(decode(too_humid, sizeof(too_humid), &out) == ESP_ERR_INVALID_RESPONSE);
+    CHECK(is_untouched(&out));
+
+    // Short payloads, battery bytes included, and trailing bytes ignored
+    for (uint16_t len = 0; len < MI_DATA_LEN; len++) {
+        CHECK(decode(typical, len, &out) == ESP_ERR_INVALID_SIZE);
+        CHECK(is_untouched(&out));
+    }
+    const uint8_t longer[] = { 0x66, 0x08, 45, 0xB8, 0x0B, 0xEE, 0xEE };
+    CHECK(decode(longer, sizeof(longer), &out) == ESP_OK);
+    CHECK_EQ(out.battery_mv, 3000);
+    CHECK(mi_decode_data(NULL, MI_DATA_LEN, &out) == ESP_ERR_INVALID_ARG);
+    CHECK(mi_decode_data(typical, sizeof(typical), NULL) == ESP_ERR_INVALID_ARG);
+}
+
+static void history_record(uint8_t *p, uint32_t index, uint32_t time, int16_t max, uint8_t hum_max, int16_t min, uint8_t hum_min) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = index >> (8 * i);
+        p[4 + i] = time >> (8 * i);
+    }
+    p[8] = max & 0xFF;
+    p[9] = (uint16_t)max >> 8;
+    p[10] = hum_max;
+    p[11] = min & 0xFF;
+    p[12] = (uint16_t)min >> 8;
+    p[13] = hum_min;
+}
+
+static void test_history(void) {
+    uint8_t data[4 * MI_HISTORY_RECORD_LEN];
+    mi_history_record_t out[4];
+    history_record(&data[0], 7, 0x12345678, 235, 60, -52, 41);
+    history_record(&data[MI_HISTORY_RECORD_LEN], 8, 0x12345678 + 3600, 851, 50, 100, 50);    /* 85.1 C, out of range */
+    history_record(&data[2 * MI_HISTORY_RECORD_LEN], 9, 0x12345678 + 7200, 300, 101, 200, 40); /* 101 % */
+    history_record(&data[3 * MI_HISTORY_RECORD_LEN], 10, 0x12345678 + 10800, 850, 100, -400, 0);
+    CHECK_EQ(mi_decode_history(data, 4, out), 2);
+    CHECK_EQ(out[0].index, 7);
+    CHECK_EQ(out[0].time, 0x12345678);
+    CHECK_EQ(out[0].temp_max, 2350);
+    CHECK_EQ(out[0].hum_max, 60);
+    CHECK_EQ(out[0].temp_min, -520);
+    CHECK_EQ(out[0].hum_min, 41);
+    CHECK_EQ(out[1].index, 10);
+    CHECK_EQ(out[1].temp_max, 8500);
+    CHECK_EQ(out[1].temp_min, -4000);
+    CHECK_EQ(mi_decode_history(data, 0, out), 0);
+    CHECK_EQ(mi_decode_history(NULL, 4, out), 0);
+}
+
+// What the mock sensors send, in 0.1 C for the formats that carry no more
+static void test_adv(void) {
+    static const struct {
+        shim_sensor_format_t    format;
+        mi_adv_format_t         decoded;
+        int16_t                 temp;
+    } cases[] = {
+        { SHIM_SENSOR_ATC,      MI_ADV_FORMAT_ATC,      -1230 },
+        { SHIM_SENSOR_PVVX,     MI_ADV_FORMAT_PVVX,     -1234 },
+        { SHIM_SENSOR_MIBEACON, MI_ADV_FORMAT_MIBEACON, -1230 },     /* BEACON_N */
+    };
+    uint8_t adv[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+    mi_adv_data_t out;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        shim_sensor_config_t config;
+        shim_sensor_config_default(&config, cases[i].format, i + 1);
+        config.temp = -1234;
+        config.hum = 67;
+        // MiBeacon sends one object per frame, temperature then humidity
+        uint8_t len = shim_sensor_adv(&config, 1, 0, false, adv);
+        CHECK(mi_adv_decode(config.bda, adv, len, &out) == ESP_OK);
+        CHECK_EQ(out.format, cases[i].decoded);
+        CHECK(out.flags & MI_ADV_HAS_TEMP);
+        CHECK_EQ(out.temp, cases[i].temp);
+        if (config.format == SHIM_SENSOR_MIBEACON) {
+            len = shim_sensor_adv(&config, 2, 1, false, adv);
+            CHECK(mi_adv_decode(config.bda, adv, len, &out) == ESP_OK);
+        }
+        CHECK(out.flags & MI_ADV_HAS_HUM);
+        CHECK_EQ(out.hum, 6700);
+        // Cut anywhere inside the service data, nothing is read past len
+        for (uint8_t cut = 0; cut < len; cut++)
+            CHECK(mi_adv_decode(config.bda, adv, cut, &out) != ESP_OK);
+    }
+
+    // The stock firmware's frame names the product and carries no reading, a phone carries neither
+    shim_sensor_config_t config;
+    uint16_t product;
+    shim_sensor_config_default(&config, SHIM_SENSOR_STOCK, 10);
+    uint8_t len = shim_sensor_adv(&config, 1, 0, false, adv);
+    CHECK(mi_adv_product(adv, len, &product) == ESP_OK);
+    CHECK_EQ(product, MI_ADV_PRODUCT_LYWSD03MMC);
+    CHECK(mi_adv_decode(config.bda, adv, len, &out) != ESP_OK);
+    shim_sensor_config_default(&config, SHIM_SENSOR_PHONE, 11);
+    len = shim_sensor_adv(&config, 1, 0, true, adv);
+    CHECK(mi_adv_decode(config.bda, adv, len, &out) == ESP_ERR_NOT_FOUND);
+    CHECK(mi_adv_product(adv, len, &product) == ESP_ERR_NOT_FOUND);
+}
+
+int main(void) {
+    static test_sensors_t sensors;
+    test_setup(&sensors, 0);
+    // Loading a key sets up its cipher context, that allocates once
+    shim_sensor_config_t beacon;
+    shim_sensor_config_default(&beacon, SHIM_SENSOR_MIBEACON, BEACON_N);
+    CHECK(mi_beacon_set_key(beacon.bda, beacon.bind_key) == ESP_OK);
+    CHECK(mi_beacon_load_keys() == ESP_OK);
+    uint32_t allocations = shim_heap_allocations("host");
+    test_data();
+    test_history();
+    test_adv();
+    CHECK_EQ(shim_heap_allocations("host") - allocations, 0);
+    return 0;
+}
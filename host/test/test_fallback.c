@@ -0,0 +1,79 @@
+// A sensor that stays off: its session gives up reconnecting, scans, and
+// takes a sensor it never served. Nothing of the old one may show through,
+// not its reading, its resume point in the history, or the reconnect and
+// recovery stats, and its slot in the history goes to the new one
+
+#include "test.h"
+#include "mi_stats.h"
+#include "history.h"
+
+#define SENSORS         MI_MAX_SENSORS
+#define GIVE_UP_MS      (10 * 60 * 1000)
+
+typedef struct {
+    const shim_sensor_config_t  *config;
+    bool                        listed;     /*!< a session has the sensor */
+    bool                        stale;      /*!< it showed a reading that is not its own */
+} watch_t;
+
+static void check(watch_t *w) {
+    mi_sensor_t sensor;
+    if (mi_get_sensor(w->config->bda, &sensor) != ESP_OK)
+        return;
+    w->listed = true;
+    if (sensor.updated != 0 && (sensor.temp != w->config->temp || sensor.hum != w->config->hum))
+        w->stale = true;
+}
+
+static bool fallen_back(void *arg) {
+    mi_stats_t stats;
+    mi_stats_get(&stats);
+    return stats.scan_fallbacks > 0;
+}
+
+int main(void) {
+    static test_sensors_t sensors;
+    test_setup(&sensors, SENSORS);
+    test_start(&sensors, 60000);
+    CHECK(shim_run_until(test_all_read, &sensors, 60 * 1000));
+    // Let the first one log its history index, the new sensor must not resume from it
+    shim_run_for(60 * 1000);
+
+    shim_sensor_set_power(sensors.ids[0], false);
+    CHECK(shim_run_until(fallen_back, NULL, GIVE_UP_MS));
+    // The dead sensor's connection attempts log errors up to the last one closed, none after
+    shim_run_for(1000);
+    mi_stats_t before, after;
+    mi_stats_get(&before);
+    uint32_t errors = shim_log_errors();
+
+    // Reading far from the one of the sensor gone
+    static shim_sensor_config_t config;
+    shim_sensor_config_default(&config, TEST_FORMAT(SENSORS), SENSORS + 1);
+    config.temp = sensors.config[0].temp + 350;
+    config.hum = sensors.config[0].hum + 10;
+    int id = shim_sensor_add(&config);
+    CHECK(id >= 0);
+    sensors.config[0] = config;
+    sensors.ids[0] = id;
+    watch_t w = { .config = &config };
+    for (uint32_t ms = 0; ms < 60 * 1000 && !test_all_read(&sensors); ms += 10) {
+        shim_run_for(10);
+        check(&w);
+    }
+    CHECK(w.listed);
+    CHECK(!w.stale);
+    CHECK(test_all_read(&sensors));
+    shim_run_for(60 * 1000);
+
+    mi_stats_get(&after);
+    CHECK_EQ(after.reconnects, before.reconnects);
+    CHECK_EQ(after.recovered, before.recovered);
+    shim_sensor_stats_t stats;
+    shim_sensor_get_stats(id, &stats);
+    CHECK_EQ(stats.history_from, 0);
+    CHECK_EQ(stats.history_sent, config.history_count);
+    CHECK_EQ(history_dropped(), 0);
+    CHECK_EQ(shim_log_errors(), errors);
+    return 0;
+}
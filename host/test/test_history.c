@@ -0,0 +1,264 @@
+// The tiers on their own, gaps and late samples and a full table, then the
+// sensors' own hourly logs: every record downloaded once, moved from the
+// sensor clock onto the gateway's, written to the hour tier and readlog, and
+// the download picking up after the last record on the next boot. Last, a
+// log record for an hour the gateway heard live and never closed is left out
+
+#include "test.h"
+#include "history.h"
+#include "readlog.h"
+#include "mi_cache.h"
+
+#define SENSORS         MI_MAX_SENSORS
+#define LOGGED          48              /*!< records on the sensors at the first boot */
+#define HOURS_OFF       3               /*!< power off between the boots, the sensors log on */
+#define SYNC_MS         60000
+#define MIN_RATE        50              /*!< records per second a download must reach */
+
+// Before the first live sample, only the downloaded log lands here
+#define BACKFILL_END    (HISTORY_HOUR_LEN * 3600)
+#define LIVE_HOUR       (HISTORY_HOUR_LEN + 10)     /*!< hour the last boot heard sensor 0 in */
+#define LIVE_SAMPLES    3
+
+typedef struct {
+    const test_sensors_t    *sensors;
+    uint32_t                count[SENSORS];
+    bool                    ok;
+} collect_t;
+
+// A record of hour i of the log: its min and max, i hours after the gateway's clock start
+static void collect(const readlog_record_t *record, void *arg) {
+    collect_t *c = arg;
+    if (record->time >= BACKFILL_END)
+        return;
+    for (int s = 0; s < c->sensors->count; s++) {
+        const shim_sensor_config_t *config = &c->sensors->config[s];
+        if (memcmp(record->id, config->bda, READLOG_ID_LEN) != 0)
+            continue;
+        uint32_t i = (record->time + 1800) / 3600;
+        int16_t min = (config->temp / 10 - 5 - i % 5) * 10;
+        int16_t max = (config->temp / 10 + 5 + i % 7) * 10;
+        if (record->time + 2 < i * 3600 || record->time > i * 3600 + 2 || (record->temp != min && record->temp != max)) {
+            fprintf(stderr, "sensor %d: record at %u, %d\n", s, record->time, record->temp);
+            c->ok = false;
+        }
+        c->count[s]++;
+    }
+}
+
+// The minute tier and the minute in progress after it
+static size_t query_minutes(const uint8_t *id, history_point_t *points) {
+    size_t n = HISTORY_MINUTE_LEN + 1;
+    CHECK(history_query(id, HISTORY_MINUTE, 0, UINT32_MAX, points, &n) == ESP_OK);
+    return n;
+}
+
+// Skipped minutes read back as count 0 without a record written for them
+static int tiers(void *arg) {
+    static history_point_t points[HISTORY_MINUTE_LEN + 1];
+    uint8_t id[HISTORY_ID_LEN] = { 0xA4, 0xC1, 0x38, 0, 0, 1 };
+    CHECK(history_add(id, 0, 2000, 40) == ESP_OK);
+    CHECK(history_add(id, 5 * 60, 2100, 41) == ESP_OK);
+    CHECK(history_add(id, 6 * 60, 2200, 42) == ESP_OK);
+    CHECK_EQ(query_minutes(id, points), 7);
+    for (int i = 0; i < 7; i++) {
+        CHECK_EQ(points[i].time, i * 60);
+        CHECK_EQ(points[i].count, (i == 0 || i >= 5) ? 1 : 0);
+    }
+
+    // A late sample fills its gap, a second one merges into it
+    CHECK(history_add(id, 2 * 60 + 10, 1900, 39) == ESP_OK);
+    CHECK(history_add(id, 2 * 60 + 20, 1700, 37) == ESP_OK);
+    query_minutes(id, points);
+    CHECK_EQ(points[2].count, 2);
+    CHECK_EQ(points[2].temp_min, 1700);
+    CHECK_EQ(points[2].temp_max, 1900);
+
+    // A gap longer than the ring leaves nothing of what came before
+    uint32_t later = (6 + HISTORY_MINUTE_LEN + 10) * 60;
+    CHECK(history_add(id, later, 2300, 43) == ESP_OK);
+    CHECK(history_add(id, later + 60, 2300, 43) == ESP_OK);
+    CHECK_EQ(query_minutes(id, points), HISTORY_MINUTE_LEN + 1);
+    for (int i = 0; i < HISTORY_MINUTE_LEN + 1; i++)
+        CHECK_EQ(points[i].count, (i >= HISTORY_MINUTE_LEN - 1) ? 1 : 0);
+    CHECK_EQ(points[HISTORY_MINUTE_LEN - 1].time, later);
+
+    // A full table refuses a newcomer until the sensor heard from first is stale, then hands over its slot
+    for (uint8_t i = 2; i <= HISTORY_MAX_SENSORS; i++) {
+        id[5] = i;
+        CHECK(history_add(id, later + 60, 2000, 40) == ESP_OK);
+    }
+    id[5] = HISTORY_MAX_SENSORS + 1;
+    CHECK(history_add(id, later + 60 + HISTORY_STALE_S, 2000, 40) == ESP_ERR_NO_MEM);
+    CHECK_EQ(history_dropped(), 1);
+    CHECK(history_add(id, later + 61 + HISTORY_STALE_S, 2000, 40) == ESP_OK);
+    CHECK_EQ(history_dropped(), 1);
+    size_t n = 1;
+    id[5] = 1;
+    CHECK(history_query(id, HISTORY_RAW, 0, UINT32_MAX, points, &n) == ESP_ERR_NOT_FOUND);
+    for (uint8_t i = 2; i <= HISTORY_MAX_SENSORS + 1; i++) {
+        id[5] = i;
+        n = 1;
+        CHECK(history_query(id, HISTORY_RAW, 0, UINT32_MAX, points, &n) == ESP_OK);
+        CHECK_EQ(n, 1);
+    }
+    return 0;
+}
+
+static void collect_any(const readlog_record_t *record, void *arg) {
+    collect_t *c = arg;
+    for (int s = 0; s < c->sensors->count; s++)
+        c->count[s] += memcmp(record->id, c->sensors->config[s].bda, READLOG_ID_LEN) == 0;
+}
+
+// Flash kept from the last boot, the sensors on the air before app_main starts
+static void boot(test_sensors_t *sensors, uint32_t logged) {
+    shim_init();
+    shim_ssd1306_init(&test_oled);
+    shim_ssd1306_attach(&test_oled, 0, SSD1306_OLED_ADDR);
+    sensors->count = SENSORS;
+    for (int i = 0; i < SENSORS; i++) {
+        shim_sensor_config_default(&sensors->config[i], TEST_FORMAT(i), i + 1);
+        sensors->config[i].history_count = logged;
+        // Records may come ahead of the response to the write that asked for them
+        sensors->config[i].write_delay_events = 2 * i;
+        sensors->ids[i] = shim_sensor_add(&sensors->config[i]);
+        CHECK(sensors->ids[i] >= 0);
+    }
+    shim_start_app(app_main);
+}
+
+static bool all_synced(const test_sensors_t *sensors, uint32_t index) {
+    for (int i = 0; i < sensors->count; i++) {
+        uint32_t saved;
+        if (mi_cache_load_index(sensors->config[i].bda, &saved) != ESP_OK || saved != index)
+            return false;
+    }
+    return true;
+}
+
+static int first_boot(void *arg) {
+    static test_sensors_t sensors;
+    int64_t started[SENSORS] = { 0 }, finished[SENSORS] = { 0 };
+    boot(&sensors, LOGGED);
+
+    // Sample the download progress every 10 ms for the rate
+    uint32_t ms = 0;
+    while (!all_synced(&sensors, LOGGED) && ms < SYNC_MS) {
+        shim_run_for(10);
+        ms += 10;
+        for (int i = 0; i < SENSORS; i++) {
+            shim_sensor_stats_t stats;
+            shim_sensor_get_stats(sensors.ids[i], &stats);
+            if (stats.history_sent > 0 && started[i] == 0)
+                started[i] = shim_now_us();
+            if (stats.history_sent >= LOGGED && finished[i] == 0)
+                finished[i] = shim_now_us();
+        }
+    }
+    CHECK(all_synced(&sensors, LOGGED));
+    CHECK(shim_run_until(test_all_read, &sensors, SYNC_MS));
+
+    for (int i = 0; i < SENSORS; i++) {
+        shim_sensor_stats_t stats;
+        shim_sensor_get_stats(sensors.ids[i], &stats);
+        CHECK_EQ(stats.history_from, 0);
+        CHECK_EQ(stats.history_sent, LOGGED);
+        CHECK(finished[i] > started[i]);
+        uint32_t rate = (uint64_t)LOGGED * 1000000 / (finished[i] - started[i]);
+        printf("sensor %d: %u records in %lld ms, %u records/s\n", i, LOGGED, (long long)(finished[i] - started[i]) / 1000, rate);
+        CHECK(rate >= MIN_RATE);
+    }
+
+    // The oldest record is older than the hour tier, the others fill one hour each with their min and max
+    collect_t c = { .sensors = &sensors, .ok = true };
+    CHECK(readlog_flush() == ESP_OK);
+    CHECK(readlog_read(0, UINT32_MAX, collect, &c) == ESP_OK);
+    CHECK(c.ok);
+    for (int i = 0; i < SENSORS; i++) {
+        static history_point_t points[HISTORY_HOUR_LEN];
+        size_t n = HISTORY_HOUR_LEN, filled = 0;
+        CHECK_EQ(c.count[i], 2 * (LOGGED - 1));
+        CHECK(history_query(sensors.config[i].bda, HISTORY_HOUR, 0, BACKFILL_END - 1, points, &n) == ESP_OK);
+        for (size_t p = 0; p < n; p++) {
+            if (points[p].count == 0)
+                continue;
+            CHECK_EQ(points[p].count, 2);
+            filled++;
+        }
+        CHECK_EQ(filled, LOGGED - 1);
+    }
+    CHECK_EQ(shim_log_errors(), 0);
+    return 0;
+}
+
+// The index saved at the first boot: only the hours logged while off come down
+static int second_boot(void *arg) {
+    static test_sensors_t sensors;
+    boot(&sensors, LOGGED + HOURS_OFF);
+    CHECK(shim_run_until(test_all_read, &sensors, SYNC_MS));
+    uint32_t ms = 0;
+    while (!all_synced(&sensors, LOGGED + HOURS_OFF) && ms < SYNC_MS) {
+        shim_run_for(100);
+        ms += 100;
+    }
+    CHECK(all_synced(&sensors, LOGGED + HOURS_OFF));
+    for (int i = 0; i < SENSORS; i++) {
+        shim_sensor_stats_t stats;
+        shim_sensor_get_stats(sensors.ids[i], &stats);
+        CHECK_EQ(stats.history_from, LOGGED);
+        CHECK_EQ(stats.history_sent, HOURS_OFF);
+    }
+    CHECK_EQ(shim_log_errors(), 0);
+    return 0;
+}
+
+// Sensor 0 heard in LIVE_HOUR, then only another one until half past the next: the clock starts there and sensor 0's hour stays open
+static int seed(void *arg) {
+    static const uint8_t other[HISTORY_ID_LEN] = { 0xA4, 0xC1, 0x38, 0xFF, 0xFF, 0xFF };
+    shim_sensor_config_t config;
+    shim_init();
+    shim_sensor_config_default(&config, TEST_FORMAT(0), 1);
+    CHECK(readlog_init() == ESP_OK);
+    for (int i = 0; i < LIVE_SAMPLES; i++)
+        CHECK(readlog_append(config.bda, LIVE_HOUR * 3600 + 600 + i * 300, config.temp + i * 10, config.hum) == ESP_OK);
+    CHECK(readlog_append(other, (LIVE_HOUR + 1) * 3600 + 1800, 2000, 40) == ESP_OK);
+    CHECK(readlog_flush() == ESP_OK);
+    return 0;
+}
+
+// The newest log record falls half an hour into LIVE_HOUR, the samples already there stay the only ones
+static int live_hour(void *arg) {
+    static test_sensors_t sensors;
+    static history_point_t points[2];
+    boot(&sensors, LOGGED);
+    uint32_t ms = 0;
+    while (!all_synced(&sensors, LOGGED) && ms < SYNC_MS) {
+        shim_run_for(100);
+        ms += 100;
+    }
+    CHECK(all_synced(&sensors, LOGGED));
+    collect_t c = { .sensors = &sensors, .ok = true };
+    CHECK(readlog_flush() == ESP_OK);
+    CHECK(readlog_read(LIVE_HOUR * 3600, LIVE_HOUR * 3600 + 3599, collect_any, &c) == ESP_OK);
+    CHECK_EQ(c.count[0], LIVE_SAMPLES);
+    size_t n = 2;
+    CHECK(history_query(sensors.config[0].bda, HISTORY_HOUR, (LIVE_HOUR - 1) * 3600, LIVE_HOUR * 3600, points, &n) == ESP_OK);
+    CHECK_EQ(n, 2);
+    CHECK_EQ(points[0].count, 2);
+    CHECK_EQ(points[1].count, LIVE_SAMPLES);
+    CHECK_EQ(shim_log_errors(), 0);
+    return 0;
+}
+
+int main(void) {
+    shim_init();
+    shim_storage_erase();
+    CHECK_EQ(shim_reboot_run(tiers, NULL), 0);
+    CHECK_EQ(shim_reboot_run(first_boot, NULL), 0);
+    CHECK_EQ(shim_reboot_run(second_boot, NULL), 0);
+    shim_storage_erase();
+    CHECK_EQ(shim_reboot_run(seed, NULL), 0);
+    CHECK_EQ(shim_reboot_run(live_hour, NULL), 0);
+    return 0;
+}
@@ -0,0 +1,88 @@
+// readlog across power cycles: a newest sector left full, one started but
+// still empty, and batches whose write fails
+
+#include "test.h"
+#include "readlog.h"
+#include "esp_partition.h"
+
+#define RECORDS_PER_SECTOR  255
+
+static const uint8_t id[READLOG_ID_LEN] = { 0xA4, 0xC1, 0x38, 0x00, 0x00, 0x01 };
+
+typedef struct {
+    uint32_t    count;
+    uint32_t    last;
+    bool        ordered;
+} collect_t;
+
+static void collect(const readlog_record_t *record, void *arg) {
+    collect_t *c = arg;
+    if (c->count && record->time <= c->last)
+        c->ordered = false;
+    c->last = record->time;
+    c->count++;
+}
+
+typedef struct {
+    uint32_t    append;             /*!< records to add after the last one on flash */
+    uint32_t    fail_after;         /*!< fail writes once this many are added, 0 never */
+    uint32_t    fail_writes;
+    uint32_t    expect_count;       /*!< records on flash at the end, 0 to skip the check */
+    uint32_t    expect_last_time;   /*!< readlog_last_time() right after init */
+} boot_t;
+
+static int boot(void *arg) {
+    const boot_t *b = arg;
+    shim_init();
+    CHECK(readlog_init() == ESP_OK);
+    CHECK_EQ(readlog_last_time(), b->expect_last_time);
+    uint32_t time = readlog_last_time();
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < b->append; i++) {
+        if (b->fail_writes && i == b->fail_after)
+            shim_flash_fail_writes(b->fail_writes);
+        if (readlog_append(id, ++time, 2150, 45) != ESP_OK)
+            failed++;
+    }
+    if (readlog_flush() != ESP_OK)
+        failed++;
+    // A failed sector header fails the same call as the batch, or the next append
+    CHECK(failed <= b->fail_writes && (failed > 0) == (b->fail_writes > 0));
+    collect_t c = { .ordered = true };
+    CHECK(readlog_read(0, UINT32_MAX, collect, &c) == ESP_OK);
+    CHECK(c.ordered);
+    if (b->expect_count)
+        CHECK_EQ(c.count, b->expect_count);
+    if (b->append)
+        CHECK_EQ(c.last, time);
+    return 0;
+}
+
+static void run(boot_t b) {
+    CHECK_EQ(shim_reboot_run(boot, &b), 0);
+}
+
+int main(void) {
+    shim_init();
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, READLOG_SUBTYPE, READLOG_PARTITION);
+    CHECK(part);
+
+    // A full sector, then power lost between erasing the next one and writing its header
+    shim_storage_erase();
+    run((boot_t){ .append = RECORDS_PER_SECTOR, .expect_count = RECORDS_PER_SECTOR });
+    CHECK(esp_partition_erase_range(part, 4096, 4096) == ESP_OK);
+    run((boot_t){ .append = 10, .expect_last_time = RECORDS_PER_SECTOR, .expect_count = RECORDS_PER_SECTOR + 10 });
+    run((boot_t){ .expect_last_time = RECORDS_PER_SECTOR + 10, .expect_count = RECORDS_PER_SECTOR + 10 });
+
+    // The newest sector holds only its header
+    shim_storage_erase();
+    run((boot_t){ .append = 2 * RECORDS_PER_SECTOR, .expect_count = 2 * RECORDS_PER_SECTOR });
+    run((boot_t){ .expect_last_time = 2 * RECORDS_PER_SECTOR, .expect_count = 2 * RECORDS_PER_SECTOR });
+
+    // Failed batches are dropped, pending never grows past one batch
+    shim_storage_erase();
+    // the first page holds 15 records after the sector header
+    run((boot_t){ .append = 100, .fail_after = 5, .fail_writes = 1, .expect_count = 100 - 15 });
+    run((boot_t){ .append = 1000, .fail_after = 300, .fail_writes = 3, .expect_last_time = 100 });
+    return 0;
+}
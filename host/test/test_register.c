@@ -0,0 +1,33 @@
+// Notification registrations of three sensors while the BTC task answers
+// late: REG_FOR_NOTIFY_EVT names the handle only, the same on every sensor,
+// so no registration may start before the one ahead of it is answered, and
+// every session ends up registered for its own sensor
+
+#include "test.h"
+
+#define SENSORS         3
+#define REG_DELAY_US    200000          /*!< longer than the sessions' registrations are apart */
+
+int main(void) {
+    static test_sensors_t sensors;
+    test_setup(&sensors, SENSORS);
+    shim_ble_set_reg_delay(REG_DELAY_US);
+    test_start(&sensors, 60000);
+    CHECK(shim_run_until(test_all_read, &sensors, 5 * 60 * 1000));
+    printf("all read after %lld ms\n", (long long)(shim_now_us() / 1000));
+    shim_run_for(10 * 60 * 1000);
+
+    shim_ble_stats_t stats;
+    shim_ble_get_stats(&stats);
+    printf("%u registrations, %u refused\n", stats.reg_for_notify, stats.reg_refused);
+    CHECK(stats.reg_for_notify >= SENSORS);
+    CHECK_EQ(stats.reg_overlapped, 0);
+    CHECK(test_all_read(&sensors));
+#ifndef MI_POLL_MODE
+    // Links held for good, and with them the registrations
+    for (int i = 0; i < SENSORS; i++)
+        CHECK(shim_ble_registered(sensors.config[i].bda, SHIM_HANDLE_DATA));
+#endif
+    CHECK_EQ(shim_log_errors(), 0);
+    return 0;
+}
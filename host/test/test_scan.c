@@ -0,0 +1,43 @@
+// Scan scheduler in connected mode: the burst ends, the backoff listens
+// passively at a tenth of the time, and a stock sensor switched on then is
+// still found from its MiBeacon frame alone
+
+#include "test.h"
+
+#define FIND_MS         (2 * 60 * 1000)
+
+static bool third_read(void *arg) {
+    return test_sensor_read(arg, 2);
+}
+
+int main(void) {
+    static test_sensors_t sensors;
+    test_setup(&sensors, 2);
+    test_start(&sensors, 60000);
+    CHECK(shim_run_until(test_all_read, &sensors, 60 * 1000));
+    shim_run_for(MI_SCAN_BURST_MS + 10 * 1000);
+
+    // The third session still looks for a sensor
+    mi_scan_stats_t scan;
+    shim_ble_stats_t before, after;
+    mi_get_scan_stats(&scan);
+    CHECK(scan.scanning);
+    CHECK_EQ(scan.profile, MI_SCAN_BACKOFF);
+    CHECK_EQ(scan.duty, 100);
+    shim_ble_get_stats(&before);
+
+    shim_sensor_config_default(&sensors.config[2], TEST_FORMAT(2), 3);
+    sensors.ids[2] = shim_sensor_add(&sensors.config[2]);
+    CHECK(sensors.ids[2] >= 0);
+    sensors.count = 3;
+    int64_t added = shim_now_us();
+    CHECK(shim_run_until(third_read, &sensors, FIND_MS));
+    shim_ble_get_stats(&after);
+    printf("found and read after %lld ms of backoff, %u reports\n", (long long)(shim_now_us() - added) / 1000, after.scan_reports - before.scan_reports);
+
+    CHECK(after.scan_reports > before.scan_reports);
+    CHECK_EQ(after.scan_requests, before.scan_requests);
+    CHECK(test_all_read(&sensors));
+    CHECK_EQ(shim_log_errors(), 0);
+    return 0;
+}
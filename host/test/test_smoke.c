@@ -0,0 +1,31 @@
+// app_main against three mock sensors: every variant boots, shows their
+// readings and runs an hour without an error logged. SHIM_PBM=file keeps
+// the last screen
+
+#include "test.h"
+
+int main(void) {
+    static test_sensors_t sensors;
+    test_setup(&sensors, 3);
+    test_start(&sensors, 60000);
+
+    CHECK(shim_run_until(test_all_read, &sensors, 5 * 60 * 1000));
+    printf("all read after %lld ms\n", (long long)(shim_now_us() / 1000));
+
+    shim_run_for(60 * 60 * 1000);
+    CHECK(test_all_read(&sensors));
+    CHECK_EQ(shim_log_errors(), 0);
+    CHECK_EQ(test_oled.stats.errors, 0);
+    CHECK_EQ(test_oled.stats.page_wraps, 0);
+    const char *pbm = getenv("SHIM_PBM");
+    if (pbm) {
+        FILE *file = fopen(pbm, "wb");
+        CHECK(file && shim_ssd1306_dump_pbm(&test_oled, file));
+        fclose(file);
+    }
+    shim_heap_stats_t heap;
+    shim_heap_get_stats(&heap);
+    CHECK_EQ(heap.failed, 0);
+    printf("heap: %zu free, %zu lowest\n", heap.free, heap.minimum_free);
+    return 0;
+}
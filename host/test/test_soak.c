@@ -0,0 +1,59 @@
+// Hours of readings against a heap that must stay where it was once the
+// gateway settled: no allocation per reading in the BT callbacks or the
+// session task, free heap and its low-water mark flat, and every sensor
+// kept in the history
+
+#include "test.h"
+#include "history.h"
+
+#ifdef MI_PASSIVE_MODE
+#define SENSORS         6
+#else
+#define SENSORS         MI_MAX_SENSORS  /*!< one session each, held for good */
+#endif
+#define WARMUP_MS       (10 * 60 * 1000)
+#define SOAK_MS         (6 * 60 * 60 * 1000)
+
+// The first two are the ones MI_STATIC_ALLOC and the MiBeacon decoder keep off the heap
+static const char *contexts[] = { "btc", "ble_task", "main", "oled_task" };
+#define CONTEXTS        (sizeof(contexts) / sizeof(contexts[0]))
+#define CONTEXTS_NONE   2
+
+int main(void) {
+    static test_sensors_t sensors;
+    test_setup(&sensors, SENSORS);
+    test_start(&sensors, 60000);
+    CHECK(shim_run_until(test_all_read, &sensors, 5 * 60 * 1000));
+    shim_run_for(WARMUP_MS);
+
+    shim_heap_stats_t settled, soaked;
+    uint32_t allocations[CONTEXTS];
+    shim_heap_get_stats(&settled);
+    for (size_t i = 0; i < CONTEXTS; i++)
+        allocations[i] = shim_heap_allocations(contexts[i]);
+    shim_run_for(SOAK_MS);
+    shim_heap_get_stats(&soaked);
+
+    printf("heap after %d min: %zu free, %zu lowest; after %d h more: %zu free, %zu lowest\n",
+           WARMUP_MS / 60000, settled.free, settled.minimum_free, SOAK_MS / 3600000, soaked.free, soaked.minimum_free);
+    for (size_t i = 0; i < CONTEXTS; i++) {
+        uint32_t n = shim_heap_allocations(contexts[i]) - allocations[i];
+        printf("%-10s %u allocations while soaking\n", contexts[i], n);
+        // A free for every allocation keeps the free heap level, the count does not
+        if (i < CONTEXTS_NONE)
+            CHECK_EQ(n, 0);
+    }
+    CHECK(test_all_read(&sensors));
+    for (int i = 0; i < SENSORS; i++) {
+        history_point_t point;
+        size_t n = 1;
+        CHECK(history_query(sensors.config[i].bda, HISTORY_HOUR, 0, UINT32_MAX, &point, &n) == ESP_OK);
+        CHECK_EQ(n, 1);
+    }
+    CHECK_EQ(history_dropped(), 0);
+    CHECK_EQ(shim_log_errors(), 0);
+    CHECK_EQ(soaked.failed, 0);
+    CHECK(soaked.free >= settled.free);
+    CHECK_EQ(soaked.minimum_free, settled.minimum_free);
+    return 0;
+}
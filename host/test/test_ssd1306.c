@@ -0,0 +1,97 @@
+// The display driver against the SSD1306 model: what each call leaves in
+// GDDRAM, the driver's own bus accounting, and the cost of a frame
+
+#include "test.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static void check_bus_stats(void) {
+    oled_ssd1306_stats_t driver;
+    oled_ssd1306_get_stats(&driver);
+    CHECK_EQ(driver.transactions, test_oled.stats.transactions);
+    CHECK_EQ(driver.bytes, test_oled.stats.bytes);
+    CHECK_EQ(driver.bus_us, test_oled.stats.bus_us);
+    CHECK_EQ(driver.errors, 0);
+    CHECK_EQ(test_oled.stats.errors, 0);
+    CHECK_EQ(test_oled.stats.page_wraps, 0);
+}
+
+static bool page_blank(int page, int from, int to) {
+    for (int col = from; col < to; col++)
+        if (test_oled.gddram[page][col])
+            return false;
+    return true;
+}
+
+int main(void) {
+    static test_sensors_t sensors;
+    test_setup(&sensors, 0);
+
+    CHECK(oled_ssd1306_init() == ESP_OK);
+    CHECK(test_oled.display_on);
+    CHECK(test_oled.charge_pump);
+    CHECK_EQ(test_oled.mux, 63);
+    CHECK_EQ(test_oled.addressing, SHIM_SSD1306_PAGE);
+    check_bus_stats();
+
+    // Framebuffer and immediate text render the same glyphs
+    oled_ssd1306_fb_clear_all();
+    oled_ssd1306_fb_print(0, 0, "Hello");
+    CHECK(oled_ssd1306_flush() == ESP_OK);
+    CHECK(oled_ssd1306_print_at(1, 0, "Hello") == ESP_OK);
+    CHECK(!page_blank(0, 0, 40));
+    CHECK(memcmp(test_oled.gddram[0], test_oled.gddram[1], DISPLAY_COLUMNS) == 0);
+    CHECK(page_blank(2, 0, DISPLAY_COLUMNS));
+    check_bus_stats();
+
+    // Clipped at the right edge, nothing wraps into column 0
+    CHECK(oled_ssd1306_print_at(2, 100, "Hello") == ESP_OK);
+    CHECK(memcmp(&test_oled.gddram[2][100], test_oled.gddram[0], DISPLAY_COLUMNS - 100) == 0);
+    CHECK(page_blank(2, 0, 100));
+
+    // A field blanks what it does not use
+    memset(test_oled.gddram[3], 0xFF, DISPLAY_COLUMNS);
+    CHECK(oled_ssd1306_print_field(3, 8, 4, "He") == ESP_OK);
+    CHECK(memcmp(&test_oled.gddram[3][8], test_oled.gddram[0], 16) == 0);
+    CHECK(page_blank(3, 24, 40));
+    CHECK_EQ(test_oled.gddram[3][40], 0xFF);
+    check_bus_stats();
+
+    // Only the changed columns go out again
+    shim_ssd1306_stats_t before = test_oled.stats;
+    oled_ssd1306_fb_print(0, 0, "Jello");
+    CHECK(oled_ssd1306_flush() == ESP_OK);
+    CHECK_EQ(test_oled.stats.transactions - before.transactions, 1);
+    CHECK(test_oled.stats.data_bytes - before.data_bytes <= 8);
+    CHECK(memcmp(&test_oled.gddram[0][8], &test_oled.gddram[1][8], 32) == 0);
+
+    // Cost of a full frame, the upper bound of one display task refresh
+    before = test_oled.stats;
+    oled_ssd1306_fb_invalidate();
+    CHECK(oled_ssd1306_flush() == ESP_OK);
+    printf("full frame: %u transactions %u bytes %llu us on the bus at %d Hz\n",
+           test_oled.stats.transactions - before.transactions, test_oled.stats.bytes - before.bytes,
+           (unsigned long long)(test_oled.stats.bus_us - before.bus_us), I2C_MASTER_FREQ_HZ);
+    CHECK_EQ(test_oled.stats.data_bytes - before.data_bytes, DISPLAY_PAGES * DISPLAY_COLUMNS);
+    check_bus_stats();
+
+    // Screensaver: chess pattern on every page, then diagonal scrolling over all of them
+    xTaskCreate(oled_ssd1306_screensaver, "screensaver", 2048, NULL, 1, NULL);
+    shim_run_for(1000);
+    CHECK_EQ(test_oled.gddram[0][0], 0x00);
+    CHECK_EQ(test_oled.gddram[0][7], 0xFF);
+    CHECK(test_oled.scroll.active);
+    CHECK_EQ(test_oled.scroll.setup, VERTICAL_AND_RIGHT_HOR_SCROLL);
+    CHECK_EQ(test_oled.scroll.start_page, 0);
+    CHECK_EQ(test_oled.scroll.end_page, 7);
+    CHECK_EQ(test_oled.scroll.vertical_offset, 1);
+    CHECK_EQ(test_oled.stats.scroll_writes, 0);
+    check_bus_stats();
+
+    const char *pbm = getenv("SHIM_PBM");
+    FILE *file = (pbm) ? fopen(pbm, "wb") : tmpfile();
+    CHECK(file && shim_ssd1306_dump_pbm(&test_oled, file));
+    CHECK_EQ(ftell(file), strlen("P4\n128 64\n") + DISPLAY_COLUMNS * DISPLAY_PAGES);
+    fclose(file);
+    return 0;
+}
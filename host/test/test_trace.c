@@ -0,0 +1,50 @@
+// A trace recorded from the mock sensors, replayed into a fresh boot without
+// them, gives the gateway the same sensors and readings
+
+#include "test.h"
+#include "shim_trace.h"
+
+#define SENSORS         6
+
+static const char *path = "build/test_trace.log";
+
+static int replay_boot(void *arg) {
+    static test_sensors_t sensors;
+    uint32_t speed = *(uint32_t *)arg;
+    test_boot();
+    // Same addresses and values as recorded, none of them on the air
+    sensors.count = SENSORS;
+    for (int i = 0; i < SENSORS; i++)
+        shim_sensor_config_default(&sensors.config[i], TEST_FORMAT(i), i + 1);
+    // Callbacks registered and the scan set up, then the trace takes over
+    shim_run_for(1000);
+    FILE *log = fopen(path, "r");
+    CHECK(log);
+    shim_trace_stats_t stats;
+    CHECK(shim_trace_replay(log, speed, &stats));
+    fclose(log);
+    printf("speed %u: %u records, %u scan reports, %lld ms recorded, replayed in %lld ms\n", speed,
+           stats.records, stats.scan_reports, (long long)stats.span_us / 1000, (long long)shim_now_us() / 1000);
+    CHECK_EQ(stats.skipped, 0);
+    CHECK(stats.scan_reports > 0);
+    CHECK(test_all_read(&sensors));
+    shim_ble_stats_t ble;
+    shim_ble_get_stats(&ble);
+    CHECK_EQ(ble.scan_reports, 0);
+    CHECK_EQ(shim_log_errors(), 0);
+    return 0;
+}
+
+int main(void) {
+    shim_init();
+    test_record_t record = {
+        .path = path,
+        .count = SENSORS,
+        .ms = 60 * 1000,
+    };
+    CHECK_EQ(shim_reboot_run(test_record_boot, &record), 0);
+    uint32_t speeds[] = { 1, 10, 0 };
+    for (size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++)
+        CHECK_EQ(shim_reboot_run(replay_boot, &speeds[i]), 0);
+    return 0;
+}
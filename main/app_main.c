@@ -15,10 +15,55 @@
 #include "esp_sleep.h"
 #include "ssd1306.h"
 #include "mithermometer.h"
+#include "mi_beacon.h"
+#include "mi_channel.h"
+#include "history.h"
+#include "readlog.h"
 #include "sdkconfig.h"
 
 static const char *TAG = "main";
 
+#define READLOG_FLUSH_S             60          /*!< bound on readings lost at power off */
+#define TIME_BASE_EMPTY             (HISTORY_HOUR_LEN * 3600)   /*!< clock of an empty log, the sensor logs downloaded first fit before it */
+
+static uint32_t time_base;
+
+static void history_restore(const readlog_record_t *record, void *arg) {
+    history_add(record->id, record->time, record->temp, record->hum);
+}
+
+// The sensor's own hourly log fills the hours the gateway has no samples for, as two samples: its min and max
+static void history_download(const uint8_t *bda, const mi_history_record_t *records, size_t count, uint32_t sensor_now, void *arg) {
+    uint32_t now = time_base + esp_timer_get_time() / 1000000;
+    for (size_t i = 0; i < count; i++) {
+        const mi_history_record_t *r = &records[i];
+        uint32_t age = sensor_now - r->time;
+        // Older than the hour tier keeps, or than the clock itself
+        if (age > HISTORY_HOUR_LEN * 3600 || age >= now)
+            continue;
+        uint32_t time = now - age;
+        // The hour in progress is the live samples', some may still wait in the channel
+        if (time / 3600 >= now / 3600)
+            continue;
+        history_point_t point;
+        size_t n = 1;
+        if (history_query(bda, HISTORY_HOUR, time - time % 3600, time - time % 3600, &point, &n) == ESP_OK && n == 1 && point.count > 0)
+            continue;
+        history_add(bda, time, r->temp_min, r->hum_min);
+        history_add(bda, time, r->temp_max, r->hum_max);
+        readlog_append(bda, time, r->temp_min, r->hum_min);
+        readlog_append(bda, time, r->temp_max, r->hum_max);
+    }
+}
+
+static void store_samples(mi_channel_t channel) {
+    mi_sample_t sample;
+    while (mi_channel_read(channel, &sample) == ESP_OK) {
+        history_add(sample.bda, time_base + sample.time, sample.temp, sample.hum);
+        readlog_append(sample.bda, time_base + sample.time, sample.temp, sample.hum);
+    }
+}
+
 void app_main(void) {
     esp_log_level_set("*", ESP_LOG_ERROR);
     esp_log_level_set("main", ESP_LOG_INFO);
@@ -31,14 +76,79 @@ void app_main(void) {
     }
     ESP_ERROR_CHECK(ret);
 
+    // No wall clock, keep log time monotonic across reboots by starting after its last record
+    if (readlog_init() == ESP_OK) {
+        time_base = readlog_last_time() + 1;
+        readlog_read(0, UINT32_MAX, history_restore, NULL);
+    }
+    if (time_base < TIME_BASE_EMPTY)
+        time_base = TIME_BASE_EMPTY;
+
     ESP_LOGI(TAG, " IDF:                 %s", IDF_VER);
     oled_ssd1306_init();
-    oled_ssd1306_clear_all();
-    oled_ssd1306_print(0, "Hello");
+    oled_ssd1306_fb_print(0, 0, "Hello");
+    oled_ssd1306_flush();
+    // From here on only the display task talks to the OLED
+    oled_ssd1306_task_start();
+    // Storage gets every sample, the display only needs the latest
+    mi_channel_t samples;
+    ESP_ERROR_CHECK(mi_subscribe(&samples));
+    // Sensor clock to ours, in the BLE task
+    mi_set_history_cb(history_download, NULL);
     mi_init();
 
+    uint32_t flushed = 0;
     while (1) {
-        //ESP_LOGI(TAG, "Run....");
-        vTaskDelay(1000 / portTICK_RATE_MS);
+        uint32_t now = time_base + esp_timer_get_time() / 1000000;
+        mi_sensor_t sensors[DISPLAY_PAGES - 1];
+        uint8_t count = DISPLAY_PAGES - 1;
+        if (mi_get_sensors(sensors, &count) == ESP_OK) {
+            for (uint8_t i = 0; i < count; i++) {
+                char line[DISPLAY_COLUMNS / 8 + 1];
+                snprintf(line, sizeof(line), "%d %5.1fC %3d%%", i, sensors[i].temp / 100.0f, sensors[i].hum);
+                oled_ssd1306_submit_field(i + 1, 0, sizeof(line) - 1, line);
+            }
+        }
+        store_samples(samples);
+        if (now - flushed >= READLOG_FLUSH_S) {
+            readlog_flush();
+            flushed = now;
+            oled_ssd1306_stats_t stats;
+            oled_ssd1306_get_stats(&stats);
+            ESP_LOGI(TAG, "display: %u frames %u transactions %u bytes %u us on the bus %u errors",
+                     stats.flushes, stats.transactions, stats.bytes, stats.bus_us, stats.errors);
+            mi_channel_stats_t channel;
+            mi_channel_get_stats(samples, &channel);
+            ESP_LOGI(TAG, "samples: %u published %u overflows", channel.published, channel.overflows);
+            // Restored, downloaded and live samples of sensors beyond the table alike
+            uint32_t dropped = history_dropped();
+            if (dropped > 0)
+                ESP_LOGW(TAG, "history: %u samples dropped, all %u sensor slots taken", dropped, HISTORY_MAX_SENSORS);
+            // Steady once running, a falling low-water mark means something still allocates per reading
+            ESP_LOGI(TAG, "heap: %u free, %u lowest", esp_get_free_heap_size(), esp_get_minimum_free_heap_size());
+            mi_scan_stats_t scan;
+            mi_get_scan_stats(&scan);
+            ESP_LOGI(TAG, "scan: %s duty %u/1000, radio on %llu ms of %u s",
+                     (scan.scanning) ? ((scan.profile == MI_SCAN_BURST) ? "burst" : "backoff") : "off",
+                     scan.duty, (unsigned long long)scan.radio_on_ms, (uint32_t)(esp_timer_get_time() / 1000000));
+#ifdef MI_PASSIVE_MODE
+            mi_beacon_stats_t beacon;
+            mi_beacon_get_stats(&beacon);
+            ESP_LOGI(TAG, "mibeacon: %u encrypted %u decrypted %u duplicates %u without key %u failed",
+                     beacon.frames, beacon.decrypted, beacon.duplicates, beacon.no_key, beacon.auth_failed);
+#endif
+#ifdef MI_POLL_MODE
+            mi_poll_stats_t poll;
+            mi_get_poll_stats(&poll);
+            ESP_LOGI(TAG, "poll: %u sensors %u polls %u misses, late up to %u ms",
+                     poll.sensors, poll.polls, poll.misses, poll.max_late_ms);
+#endif
+        }
+        // A second to the next pass, woken early to drain a channel filling faster than that
+        TickType_t wake = xTaskGetTickCount() + 1000 / portTICK_RATE_MS;
+        for (TickType_t left = wake - xTaskGetTickCount(); (int32_t)left > 0; left = wake - xTaskGetTickCount()) {
+            ulTaskNotifyTake(pdTRUE, left);
+            store_samples(samples);
+        }
     }
 }